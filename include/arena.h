@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <Arduino.h>
+
+// Bump allocator for one operation (a sync, a records export). The owner
+// claims it with arenaBegin(), carves buffers with arenaAlloc() and drops
+// them all at once with arenaEnd(). Backed by PSRAM when the board has it
+// so large temporary buffers stay out of the internal heap WiFi/BLE need.
+struct Arena
+{
+    uint8_t *base;
+    size_t capacity;
+    size_t used;
+    size_t highWater;    // Most bytes in use by any one operation
+    const char *owner;   // Operation holding the arena, nullptr when free
+    bool inPsram;
+    uint32_t operations; // Completed begin/end pairs
+    uint32_t failures;   // Allocations that didn't fit, or begins while busy
+};
+
+// Globals
+extern Arena opArena;
+
+// Function prototypes
+bool initArena(Arena &arena, size_t psramBytes, size_t internalBytes);
+bool arenaBegin(Arena &arena, const char *owner);
+void *arenaAlloc(Arena &arena, size_t size);
+size_t arenaAvailable(const Arena &arena);
+void arenaEnd(Arena &arena);
+void showArenaStats(const Arena &arena);
+
+#endif // ARENA_H
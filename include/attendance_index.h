@@ -0,0 +1,21 @@
+#ifndef ATTENDANCE_INDEX_H
+#define ATTENDANCE_INDEX_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "record_log.h"
+
+// Who was present on which date, keyed by sensor slot: one presence bitmap
+// per date plus days-present per slot, both in RAM and in INDEX_FILE. It is
+// updated as records are appended and outlives log compaction, so roll
+// calls and per-student counts need no pass over the log.
+
+// Function prototypes
+void initAttendanceIndex();
+void indexAttendance(const char *date, uint16_t slot);
+void indexLogEntry(const LogEntry &record);
+void clearAttendanceIndex();
+void rollCallCommand(const char *args);
+void studentDaysCommand(const char *args);
+
+#endif // ATTENDANCE_INDEX_H
@@ -2,11 +2,13 @@
 #define BLE_MANAGER_H
 
 #include <Arduino.h>
+#include "config.h"
+
+#if FEATURE_BLE_CONSOLE
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
-#include "config.h"
 
 // Globals
 extern BLEServer *pServer;
@@ -14,8 +16,9 @@ extern BLECharacteristic *pTxCharacteristic;
 extern BLECharacteristic *pRxCharacteristic;
 extern bool deviceConnected;
 extern bool oldDeviceConnected;
-extern std::string receivedCommand;
-extern String bleCommandBuffer;
+extern uint32_t bleConnections;
+extern char receivedCommand[INPUT_LINE_MAX];
+extern volatile bool commandReady;
 
 // Class declarations
 class ServerCallbacks : public BLEServerCallbacks
@@ -31,7 +34,22 @@ class CharacteristicCallbacks : public BLECharacteristicCallbacks
 
 // Function prototypes
 void setupBLE();
-void printBoth(String message);
-String readInput();
+void startBLEAdvertising();
+void serviceBLE();
+#else
+// BLE console compiled out: no link, nothing to set up
+constexpr bool deviceConnected = false;
+constexpr uint32_t bleConnections = 0;
+
+inline void setupBLE() {}
+inline void startBLEAdvertising() {}
+inline void serviceBLE() {}
+#endif
+
+// Console output and input, over Serial and/or BLE
+void printBoth(const char *message);
+void printfBoth(const char *format, ...) __attribute__((format(printf, 1, 2)));
+bool pollInput(char *line, size_t size);
+bool inputAvailable();
 
 #endif // BLE_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef BOOT_PROFILER_H
+#define BOOT_PROFILER_H
+
+#include <Arduino.h>
+
+#define BOOT_MAX_PHASES 16
+
+struct BootPhase
+{
+    const char *name;
+    uint32_t atUs; // Microseconds since the app started
+};
+
+// Function prototypes
+void bootMark(const char *phase);
+void printBootReport();
+
+#endif // BOOT_PROFILER_H
@@ -0,0 +1,44 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// What a session does with an input line or tick
+enum SessionStatus
+{
+    SESSION_CONTINUE, // Session stays active
+    SESSION_DONE,     // Session finished, back to the command prompt
+    SESSION_PASS      // Line isn't for this session, run it as a command
+};
+
+// A session is a resumable multi-step command (dialog or mode). It receives
+// input lines instead of the dispatcher and, optionally, a tick every loop.
+typedef SessionStatus (*SessionInputHandler)(const char *line);
+typedef SessionStatus (*SessionTickHandler)();
+
+// Command handlers get a view of everything after the command word, e.g.
+// "19/5" for "date 19/5". It points into the input buffer and is only valid
+// for the duration of the call.
+typedef void (*CommandHandler)(const char *args);
+
+struct Command
+{
+    const char *name;   // Word typed by the user
+    const char *number; // Menu number
+    const char *usage;  // Arguments accepted for one-shot use
+    const char *help;
+    CommandHandler handler;
+};
+
+// Function prototypes
+void serviceCommands();
+void beginSession(SessionInputHandler onInput, SessionTickHandler onTick = nullptr);
+bool sessionActive();
+char *nextArg(char *&cursor);
+#if FEATURE_CONSOLE
+void dispatchCommand(char *line);
+void showMainMenu();
+#endif
+
+#endif // COMMANDS_H
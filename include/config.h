@@ -3,19 +3,197 @@
 
 #include <Arduino.h>
 
+// Subsystems built into the firmware; each env in platformio.ini overrides
+// them with -D. A disabled subsystem's code and libraries stay out of the
+// image and its entry points become empty inline functions in its header,
+// so call sites compile unchanged and nothing is checked at run time.
+#ifndef FEATURE_BLE_CONSOLE
+#define FEATURE_BLE_CONSOLE 1 // Command console over the BLE UART service
+#endif
+#ifndef FEATURE_LEDS
+#define FEATURE_LEDS 1        // NeoPixel status LED
+#endif
+#ifndef FEATURE_SYNC
+#define FEATURE_SYNC 1        // WiFi, Google Sheets sync and the sync scheduler
+#endif
+#ifndef FEATURE_SERIAL_UI
+#define FEATURE_SERIAL_UI 1   // Menu and commands on the USB serial port
+#endif
+#ifndef FEATURE_USB_EXPORT
+#define FEATURE_USB_EXPORT 1  // Framed bulk export on the native USB port (tools/usb_export.py)
+#endif
+
+// Without any console the reader boots straight into attendance mode
+#define FEATURE_CONSOLE (FEATURE_BLE_CONSOLE || FEATURE_SERIAL_UI)
+
 // Pin Definitions
 #define NEOPIXEL_PIN 48
 #define NUM_PIXELS 1
 #define SERIAL1RX 17
 #define SERIAL1TX 16
+#define SERIAL2RX 18                 // Second sensor, used when SENSOR_COUNT is 2
+#define SERIAL2TX 8
+// Sensor touch/wakeup outputs (GPIO4 and GPIO5 on the reference wiring).
+// Off unless wired: a floating input would wake the CPU at random.
+#ifndef FINGER_TOUCH_PIN
+#define FINGER_TOUCH_PIN -1
+#endif
+#ifndef FINGER2_TOUCH_PIN
+#define FINGER2_TOUCH_PIN -1
+#endif
+#define FINGER_TOUCH_ACTIVE_LEVEL 1  // Level the sensors drive while a finger is present
+
+// Fingerprint sensors, one row per reader: {UART, RX pin, TX pin, touch pin}.
+// UART0 is the console, so the ESP32-S3 takes up to two sensors.
+#ifndef SENSOR_COUNT
+#define SENSOR_COUNT 1
+#endif
+#define SENSOR_PINS {{1, SERIAL1RX, SERIAL1TX, FINGER_TOUCH_PIN}, {2, SERIAL2RX, SERIAL2TX, FINGER2_TOUCH_PIN}}
+#define SENSOR_TASK_STACK 4096
+#define SCAN_QUEUE_LENGTH 16              // Results waiting for the main loop (e.g. during a sync)
+#define SCAN_DUPLICATE_WINDOW_MS 60000    // Same ID on any sensor within this window is recorded once
 
 // WiFi and Google Sheets Configuration
 #define WIFI_CONFIG_FILE "/wifi_config.txt"
-#define ATTENDANCE_FILE_PATH "/attendance.csv"
+#define WIFI_CACHE_FILE "/wifi_cache.bin"
+#define WIFI_CONNECT_TIMEOUT_MS 20000      // Full scan + DHCP
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 4000  // Cached BSSID/channel + lease
+#define ATTENDANCE_FILE_PATH "/attendance.csv"  // Pre-segmentation log, migrated at boot
 #define GSCRIPT_ID "AKfycby_2izhGidfcOPhpAfs7zhAWXHcK7oeZnUniauozbuc9rR52E7b_BaRJW4IgwTPPsz_rQ"
 #define HOST "script.google.com"
 #define HTTPS_PORT 443
 
+// Attendance log segments (/att_00001.csv, ...)
+#define LOG_SEGMENT_RECORDS 200       // Rotate to a new segment after this many records
+#define LOG_RETAIN_SEGMENTS 4         // Fully synced segments kept readable before compaction
+#define LOG_FULL_PERCENT 85           // Above this SPIFFS usage every synced segment is compacted
+#define LOG_SUMMARY_FILE "/summary.csv" // Per-date record counts of compacted segments
+#define LOG_PATH_MAX 32               // SPIFFS object name limit
+#define LOG_COMMIT_RECORDS 8          // Appended records are buffered and committed in batches of this many...
+#define LOG_COMMIT_MS 5000            // ...or this long after the first (below POWER_IDLE_BEFORE_SLEEP_MS)
+#define LOG_PENDING_BYTES 512         // Room for a batch of uncommitted lines
+
+// Crash-consistent file replacement (journal.h)
+#define JOURNAL_FILE "/journal.bin"   // Names the committed copy while it is being installed
+#define JOURNAL_TEMP_SUFFIX "~"       // New contents are written to path + suffix first
+
+// Attendance log backend: 0 keeps the CSV segments above on SPIFFS, 1 writes
+// fixed-size records straight into the "records" partition. Only
+// partitions_16MB.csv has it; set that table in the env along with this flag.
+#ifndef LOG_BACKEND_PARTITION
+#define LOG_BACKEND_PARTITION 0
+#endif
+#define LOG_PARTITION_LABEL "records"
+#define LOG_PARTITION_SUBTYPE 0x40    // First custom data subtype
+
+// Wall clock: SNTP while WiFi is up, the RTC in between (time_source.h)
+#define TIME_ZONE "UTC0"                  // POSIX TZ for local dates, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+#define NTP_SERVER_1 "pool.ntp.org"
+#define NTP_SERVER_2 "time.google.com"
+#define TIME_STATE_FILE "/time_state.bin" // Last known time and next session number
+#define TIME_VALID_AFTER 1704067200UL     // 2024-01-01; an earlier system time was never set
+#define TIME_SAVE_INTERVAL_S 3600         // Saved time falls at most this far behind before a power loss
+#define TIME_SYNC_RETRY_MS (15UL * 60 * 1000) // Connect just for SNTP this often while the clock isn't trusted
+#define TIME_SYNC_WAIT_MS 5000            // A headless reader waits this long for SNTP before scanning on an untrusted clock
+#define TIME_FIXES_MAX 8                  // Stamp corrections kept, one per run of an untrusted clock
+
+// Sync endpoint (overridable at runtime, stored in SYNC_CONFIG_FILE)
+#define SYNC_CONFIG_FILE "/sync_config.txt"
+#define DEFAULT_SYNC_URL "https://" HOST "/macros/s/" GSCRIPT_ID "/exec"
+#define SYNC_SHEET_NAME "Attendance"
+#define SYNC_HTTP_TIMEOUT_MS 20000
+
+// Background sync scheduler
+#define SYNC_BACKLOG_THRESHOLD 50            // Sync as soon as this many records are pending
+#define SYNC_IDLE_MS (2UL * 60 * 1000)       // ...or once the device has been idle this long
+#define SYNC_INTERVAL_MS (30UL * 60 * 1000)  // ...or at least this often while a backlog exists
+#define SYNC_BACKOFF_BASE_MS (30UL * 1000)   // First retry delay, doubled per failure
+#define SYNC_BACKOFF_MAX_MS (30UL * 60 * 1000)
+#define SYNC_BREAKER_THRESHOLD 4             // Consecutive uplink failures before the breaker opens
+#define SYNC_BREAKER_COOLDOWN_MS (60UL * 60 * 1000)
+#define SYNC_WIFI_LINGER_MS (60UL * 1000)    // Keep WiFi up this long after a sync
+
+// MQTT sync backend, endpoint mqtt://[user:pass@]host[:port][/topic] (mqtts:// for TLS)
+#define MQTT_DEFAULT_TOPIC "attendance"
+#define MQTT_KEEPALIVE_S 120        // Outlasts SYNC_WIFI_LINGER_MS, so a lingering session needs no pings
+#define MQTT_ACK_TIMEOUT_MS 10000   // CONNACK or PUBACK wait
+#define MQTT_CLIENT_ID_MAX 24       // "attendance-" + last three MAC bytes
+#define MQTT_TOPIC_MAX 64
+
+// Capture pipeline: quality retries and the adaptive match threshold
+#define CAPTURE_MAX_IMAGES 3            // Images per touch before a poor image counts as a failed touch
+#define CAPTURE_CHECKIN_GAP_MS 15000    // Failed touches this soon before a match count as its attempts
+#define CAPTURE_SECURITY_MIN 2          // Bounds of the adaptive sensor security level (1 lenient - 5 strict)
+#define CAPTURE_SECURITY_MAX 4
+#define CAPTURE_ADAPT_WINDOW 20         // Judged touches between security level adjustments
+#define CAPTURE_ADAPT_LOWER_PERCENT 25  // No-match share of the window that lowers the level one step...
+#define CAPTURE_ADAPT_RAISE_PERCENT 5   // ...and the share at or below which it goes back up
+
+// Fingerprint sensor startup
+#define SENSOR_PROBE_TIMEOUT_MS 100  // Per handshake attempt while the sensor powers up
+#define SENSOR_INIT_TIMEOUT_MS 800   // Give up and boot without a sensor after this
+
+// Sensor link tuning ('link tune'), results kept in SENSOR_LINK_FILE
+#define SENSOR_LINK_FILE "/sensor_link.bin"
+#define SENSOR_DEFAULT_BAUD 57600       // Factory rate, the fallback whenever the link fails
+#define SENSOR_DEFAULT_PACKET_LEN 128   // Factory data packet size
+#define SENSOR_LINK_TEST_ROUNDS 20      // Clean round trips before a rate is kept
+#define SENSOR_LINK_TIMING_ROUNDS 5     // Repetitions per command in the timing report
+#define SENSOR_UPLOAD_TIMEOUT_MS 1000   // One template transfer at the slowest rate
+
+// Roster: sensor slot -> student ID and name, direct-indexed by slot
+#define ROSTER_FILE "/roster.bin"
+#define ROSTER_MAX_SLOTS 1000  // Largest template library among supported sensors
+#define ROSTER_ID_MAX 16       // Student number incl. terminator
+#define ROSTER_NAME_MAX 32     // Display name incl. terminator
+
+// Attendance index: date -> presence bitmap by slot, slot -> days present
+#define INDEX_FILE "/att_index.bin"
+#define INDEX_MAX_DATES 200    // A school year of dates; the oldest is reused after that
+
+// Template search: a hot slot range is searched before the full library
+#define SEARCH_CONFIG_FILE "/search_config.txt"
+#define SEARCH_HOT_RECENT 16       // Recent matches the automatic hot range is built from
+#define SEARCH_HOT_MIN_MATCHES 4   // ...and how many it needs before it is used
+#define SEARCH_HOT_PAD 2           // Slots added on each side of the recent span
+#define SEARCH_HOT_MAX_SPAN 64     // Wider automatic ranges aren't worth a second search
+#define SEARCH_BENCH_RUNS 10       // Searches per strategy in 'hotset bench'
+
+// Power management
+#define POWER_IDLE_BEFORE_SLEEP_MS 10000  // Stay awake this long after the last event
+#define POWER_SLEEP_SLICE_MS 2000         // Longest single light sleep; BLE and scheduler run between slices
+#define POWER_UART_WAKE_THRESHOLD 3       // RX edges that wake the CPU; these characters are lost
+
+// Fixed buffer sizes (no String concatenation on the hot paths)
+#define INPUT_LINE_MAX 128     // One command line from Serial or BLE
+#define PRINT_BUFFER_SIZE 256  // One formatted printfBoth() message
+#define BLE_CHUNK_SIZE 20      // Default ATT payload per notification
+#define RECORD_LINE_MAX 64     // One attendance CSV line
+#define DATE_MAX 12            // "DD/MM" plus room for longer formats
+#define WIFI_SSID_MAX 33       // 32 bytes per 802.11 plus terminator
+#define WIFI_PASSWORD_MAX 65   // 64-character WPA2 passphrase
+#define WIFI_STATIC_IP_MAX 64  // "ip,gateway,subnet,dns"
+#define SYNC_URL_MAX 192       // Endpoint URL incl. Apps Script ID
+#define SYNC_PAYLOAD_MAX 32768 // One batch_attendance request (capped by the arena); larger backlogs go in several batches
+#define SYNC_RESPONSE_MAX 2048 // Response body kept for the log, the rest is drained
+#define EXPORT_BLOCK_SIZE 4096 // File read size for the records export, payload of one USB export frame
+
+// Native USB export
+#define USB_EXPORT_TX_TIMEOUT_MS 2000 // A host that stops reading this long aborts the export
+#define USB_EXPORT_TEMPLATE_MAX 2048  // Largest template upload accepted
+
+// Per-operation arena (sync and export buffers)
+#define ARENA_PSRAM_BYTES (64 * 1024)    // Boards with PSRAM
+#define ARENA_INTERNAL_BYTES (12 * 1024) // Fallback without PSRAM
+
+// Heap monitoring
+#define HEAP_SAMPLE_INTERVAL_MS 5000  // How often loop() samples fragmentation
+#define TRACE_HEAP_INTERVAL_MS 60000  // How often the heap level goes into the trace ring
+
+// Health telemetry
+#define SYNC_SEND_HEALTH 1       // Attach a "health" object to every sync batch
+#define TELEMETRY_MAX_TASKS 24   // Tasks listed by the health command
+
 // BLE UUIDs
 #define SERVICE_UUID "6E400001-B5A3-F393-E0A9-E50E24DCCA9E"           // UART service UUID
 #define CHARACTERISTIC_UUID_RX "6E400002-B5A3-F393-E0A9-E50E24DCCA9E" // RX Characteristic UUID
@@ -4,19 +4,87 @@
 #include <Adafruit_Fingerprint.h>
 #include <Arduino.h>
 #include <HardwareSerial.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "config.h"
 
-extern Adafruit_Fingerprint finger;
+struct SensorPins {
+  uint8_t uart;
+  int8_t rx;
+  int8_t tx;
+  int8_t touch;  // -1 if not wired
+};
+
+// Final result of one touch, after any quality retries
+enum CaptureOutcome : uint8_t {
+  CAPTURE_MATCH,
+  CAPTURE_NO_MATCH,      // Usable image, no enrolled finger matches
+  CAPTURE_POOR_IMAGE,    // Image failed or too messy on every retry
+  CAPTURE_FEATURE_FAIL,  // Too few features on every retry
+  CAPTURE_ERROR          // Link or sensor error
+};
+
+struct SensorStats {
+  uint32_t images;      // Finger detected and imaged, once per touch
+  uint32_t matches;
+  uint32_t misses;      // Touches that ended without a match, any cause
+  uint32_t poorImages;  // ...of which gave up on image quality
+  uint32_t featureFails;
+  uint32_t errors;
+  uint32_t retries;     // Immediate recaptures after a poor image
+  uint32_t duplicates;  // Matches suppressed as repeats
+  uint32_t dropped;     // Results lost to a full queue
+  uint32_t checkIns;    // Recorded matches
+  uint32_t firstAttemptCheckIns;  // ...whose first image matched
+  uint32_t checkInImages;         // Images taken for them, failed touches included
+  uint32_t securityChanges;       // Adaptive threshold adjustments
+  uint32_t lastScanMs;  // Image to search result
+  uint32_t maxScanMs;
+  uint32_t totalScanMs;
+};
+
+// One reader. The capture task and the main loop share the UART, so every
+// transaction runs under the sensor's lock.
+struct FingerprintSensor {
+  HardwareSerial *serial;
+  Adafruit_Fingerprint *finger;
+  SemaphoreHandle_t lock;
+  TaskHandle_t task;
+  bool ready;
+  uint32_t baud;       // Rate the sensor currently answers at
+  uint16_t packetLen;  // Data packet payload reported by the sensor
+  uint8_t securityLevel;  // Match threshold in use, adapted within CAPTURE_SECURITY_MIN/MAX
+  SensorStats stats;
+};
+
+// Posted by a capture task, consumed by attendance mode on the main loop
+struct ScanEvent {
+  uint8_t sensor;
+  bool matched;
+  CaptureOutcome outcome;
+  uint8_t status;  // Sensor status code when not matched
+  uint8_t images;  // Taken since the last check-in, this touch's retries included
+  uint16_t id;
+  uint16_t confidence;
+};
+
+extern Adafruit_Fingerprint finger;  // Sensor 1
 extern HardwareSerial SerialX;
+extern FingerprintSensor sensors[SENSOR_COUNT];
+extern bool sensorReady;  // At least one sensor answered
 
 // Function prototypes
-void initFingerprint();
-uint8_t getFingerprintEnroll(uint8_t id);
-int getFingerprintID();
-void enrollFingerprint();
-void enrollMode();
-void attendanceMode();
-void clearAllFingerprints();
+bool initFingerprint();
+bool requireSensor();
+bool lockSensor(FingerprintSensor &sensor);
+void unlockSensor(FingerprintSensor &sensor);
+void setSensorAura(bool on);
+const SensorPins &sensorPins(uint8_t index);
+bool captureActive();
+void enrollMode(const char *args);
+void attendanceMode(const char *args);
+void clearAllFingerprints(const char *args);
 void showFingerprintCount();
-uint8_t readnumber();
+void showSensorStats();
 
-#endif  // FINGERPRINT_H
\ No newline at end of file
+#endif  // FINGERPRINT_H
@@ -0,0 +1,26 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <Arduino.h>
+
+// Internal-RAM fragmentation: how much of the free heap is not usable as one
+// contiguous block. 0% = one block, near 100% = free space in crumbs.
+struct HeapStats
+{
+    uint32_t freeBytes;         // Latest sample
+    uint32_t largestBlock;      // Latest sample
+    uint32_t minFreeBytes;      // Low-water mark since boot
+    uint8_t fragmentation;      // Latest sample, percent
+    uint8_t worstFragmentation; // Highest seen since boot, percent
+    uint32_t samples;
+};
+
+// Globals
+extern HeapStats heapStats;
+
+// Function prototypes
+void sampleHeap();
+void serviceHeapMonitor();
+void showHeapStats();
+
+#endif // HEAP_MONITOR_H
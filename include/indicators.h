@@ -2,15 +2,27 @@
 #define INDICATORS_H
 
 #include <Arduino.h>
-#include <Adafruit_NeoPixel.h>
 #include "config.h"
 
+#if FEATURE_LEDS
+#include <Adafruit_NeoPixel.h>
+
 // Globals
 extern Adafruit_NeoPixel pixels;
 
 // Function prototypes
 void setupRGB();
+void setIndicator(uint8_t red, uint8_t green, uint8_t blue);
 void indicateSuccess();
 void indicateFailure();
+void serviceIndicators();
+#else
+// No LED fitted: status is only printed
+inline void setupRGB() {}
+inline void setIndicator(uint8_t red, uint8_t green, uint8_t blue) {}
+inline void indicateSuccess() {}
+inline void indicateFailure() {}
+inline void serviceIndicators() {}
+#endif
 
-#endif // INDICATORS_H
\ No newline at end of file
+#endif // INDICATORS_H
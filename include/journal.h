@@ -0,0 +1,29 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "config.h"
+
+// Crash-consistent file replacement on SPIFFS, which can't rename over an
+// existing file. The new contents go to path + JOURNAL_TEMP_SUFFIX first;
+// once that copy is closed, a checksummed JOURNAL_FILE naming it is the
+// commit point. Only then is the old file removed and the copy renamed.
+// At mount, recoverJournal() finishes a committed replacement and deletes
+// uncommitted copies, so every file is either wholly old or wholly new.
+struct JournalEntry
+{
+    uint32_t magic;
+    uint32_t size; // Bytes in the committed copy
+    char path[LOG_PATH_MAX];
+    uint32_t crc; // CRC-32 of everything before it
+};
+
+// Function prototypes
+void recoverJournal();
+File beginReplace(const char *path);
+bool commitReplace(File &file, const char *path);
+void abortReplace(File &file, const char *path);
+bool replaceFile(const char *path, const void *data, size_t size);
+
+#endif // JOURNAL_H
@@ -0,0 +1,31 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+
+struct PowerStats
+{
+    uint32_t sleeps;
+    uint64_t sleptUs;
+    uint32_t touchWakes;
+    uint32_t uartWakes;
+    uint32_t timerWakes;
+    uint32_t scansAfterWake;     // Touch wakes that led to a captured image
+    uint32_t lastWakeToScanMs;
+    uint32_t maxWakeToScanMs;
+    uint32_t totalWakeToScanMs;
+};
+
+// Globals
+extern PowerStats powerStats;
+extern bool powerSaveEnabled;
+
+// Function prototypes
+void initPowerManager();
+void notePowerActivity();
+bool powerIdle();
+bool idleLightSleep();
+void noteFingerImaged();
+void showPowerStats();
+
+#endif // POWER_MANAGER_H
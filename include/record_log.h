@@ -0,0 +1,111 @@
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "config.h"
+#include "time_source.h"
+
+// The attendance log is a run of segments. With the SPIFFS backend they are
+// CSV files, /att_00001.csv onwards, each with the usual header; with
+// LOG_BACKEND_PARTITION each segment is one erase sector of the records
+// partition. New records go to the last segment, which rotates when full.
+// Records are synced oldest first, so every segment before syncSegment is
+// fully synced and sync starts reading there.
+struct RecordLog
+{
+    uint32_t firstSegment;      // Oldest segment still on flash
+    uint32_t lastSegment;       // Segment taking new records
+    uint32_t syncSegment;       // Oldest segment that may hold unsynced records
+    uint16_t activeRecords;     // Records in lastSegment
+    uint32_t compactedSegments; // Folded into LOG_SUMMARY_FILE since boot
+};
+
+#if LOG_BACKEND_PARTITION
+// One record in the records partition, read in place through the flash
+// mapping. A blank slot reads 0xFF throughout; synced starts as 0xFF and is
+// cleared to 0 in place, which flash allows without an erase.
+struct LogRecord
+{
+    uint32_t sequence;  // 1-based record number, fixes segment and slot
+    uint32_t timestamp; // Epoch seconds, see recordStamp()
+    uint16_t session;   // Attendance mode run the scan belongs to
+    char studentId[ROSTER_ID_MAX];
+    uint8_t untrusted;  // 1 if stamped by an untrusted clock, see correctStamp()
+    uint8_t reserved0;  // Keeps checksum aligned
+    uint16_t checksum;  // Over everything before it
+    uint8_t synced;     // 0xFF unsynced, 0 synced
+    uint8_t reserved;   // Pads the record to 32 bytes
+};
+
+#define LOG_SECTOR_SIZE 4096
+#define LOG_SECTOR_RECORDS (LOG_SECTOR_SIZE / sizeof(LogRecord))
+#endif
+
+// One record as read back, from either backend. SPIFFS segments written
+// before records carried timestamps keep their typed date and have
+// timestamp 0. A flagged stamp is already corrected, or 0 if it has no date.
+struct LogEntry
+{
+    uint32_t timestamp;
+    uint16_t session;
+    char date[DATE_MAX]; // Local date of the timestamp
+    const char *studentId;
+    bool synced;
+    StampState stamp; // Held records stay out of sync until the clock is set
+};
+
+// Called for every record still on flash, oldest first
+typedef void (*RecordVisitor)(const LogEntry &entry);
+
+// Globals
+extern RecordLog recordLog;
+
+// Function prototypes
+void initRecordLog();
+bool appendRecord(uint32_t timestamp, bool trusted, uint16_t session, const char *studentId, uint16_t slot);
+void indexCommittedRecord(uint32_t timestamp, uint16_t slot);
+void releaseHeldRecords();
+bool commitRecordLog();
+void serviceRecordLog();
+bool markSegmentSynced(uint32_t segment, size_t recordCount);
+void compactRecordLog();
+bool clearRecordLog();
+void forEachRecord(RecordVisitor visit);
+#if LOG_BACKEND_PARTITION
+const LogRecord *segmentRecords(uint32_t segment, uint16_t &count);
+bool recordValid(const LogRecord &record);
+void recordEntry(const LogRecord &record, LogEntry &entry);
+#else
+void segmentPath(uint32_t segment, char *path, size_t size);
+bool legacySegment(const char *header);
+bool parseRecordLine(char *line, bool legacy, LogEntry &entry);
+#endif
+
+// Per-date counts of a segment, added to LOG_SUMMARY_FILE through the
+// journal before the segment is deleted or erased; shared by both backends.
+// The segment column makes the step idempotent: a segment the summary
+// already lists isn't counted again after a reset.
+#define LOG_SUMMARY_DATES 16 // Distinct dates buffered while summarising a segment
+
+struct DateCount
+{
+    char date[DATE_MAX];
+    uint16_t records;
+};
+
+struct LogSummary
+{
+    File file;
+    uint32_t segment;
+    DateCount dates[LOG_SUMMARY_DATES];
+    uint8_t dateCount;
+    bool covered; // Already in the summary, nothing to add
+    size_t written;
+};
+
+bool beginSummary(LogSummary &summary, uint32_t segment);
+void tallySummary(LogSummary &summary, const char *date);
+bool endSummary(LogSummary &summary);
+
+#endif // RECORD_LOG_H
@@ -0,0 +1,28 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// One sensor slot; an empty studentId marks an unassigned slot
+struct RosterEntry
+{
+    char studentId[ROSTER_ID_MAX];
+    char name[ROSTER_NAME_MAX];
+};
+
+// ROSTER_FILE is this header followed by `slots` entries, entry N for slot N
+struct RosterHeader
+{
+    uint32_t magic;
+    uint16_t slots;
+    uint16_t entrySize;
+};
+
+// Function prototypes
+void loadRoster();
+const RosterEntry *rosterLookup(uint16_t slot);
+int rosterSlotOf(const char *studentId);
+void rosterCommand(const char *args);
+
+#endif // ROSTER_H
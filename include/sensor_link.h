@@ -0,0 +1,27 @@
+#ifndef SENSOR_LINK_H
+#define SENSOR_LINK_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "fingerprint.h"
+
+// Tuned UART settings, persisted per sensor in SENSOR_LINK_FILE
+struct SensorLinkCache {
+  uint32_t magic;
+  uint32_t baud[SENSOR_COUNT];
+  uint16_t packetLen[SENSOR_COUNT];
+};
+
+#define SENSOR_INDEX_PAGE_SLOTS 256  // Slots per index table page
+
+// Function prototypes
+void loadSensorLinks();
+bool probeSensor(Adafruit_Fingerprint &reader, uint16_t timeoutMs);
+bool openSensorLink(uint8_t index);
+void sensorLinkCommand(const char *args);
+bool readTemplateIndex(FingerprintSensor &sensor, uint8_t page,
+                       uint8_t *bitmap);
+size_t readTemplate(FingerprintSensor &sensor, uint16_t slot, uint8_t *out,
+                    size_t size);
+
+#endif  // SENSOR_LINK_H
@@ -4,16 +4,22 @@
 #include <Arduino.h>
 #include <FS.h>
 #include <SPIFFS.h>
+#include "config.h"
 
 // Globals
-extern String currentDate;
+extern char currentDate[DATE_MAX];
+extern uint32_t unsyncedRecordCount; // Backlog waiting for the next sync
+extern uint32_t heldRecordCount;     // Unsynced records waiting for the clock to be set
 
 // Function prototypes
 void initSPIFFS();
-void saveAttendanceToFile(String studentId);
-void viewStoredRecords();
-void clearAttendanceData();
-void setCurrentDate();
+size_t readRecordLine(File &file, char *line, size_t size);
+bool saveAttendanceToFile(uint32_t timestamp, bool trusted, const char *studentId, uint16_t slot);
+void viewStoredRecords(const char *args);
+void clearAttendanceData(const char *args);
+void setCurrentDate(const char *args);
+void promptCurrentDate();
+bool applyCurrentDate(const char *dateInput);
 void addAttendance(int fingerprintID);
 
 #endif // STORAGE_H
\ No newline at end of file
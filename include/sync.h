@@ -2,11 +2,29 @@
 #define SYNC_H
 
 #include <Arduino.h>
-#include <WiFiClientSecure.h>
-#include <HTTPClient.h>
 #include "config.h"
 
+// Outcome of one sync attempt, used by the scheduler's backoff
+enum SyncResult
+{
+    SYNC_OK,
+    SYNC_NO_UPLINK, // WiFi did not come up
+    SYNC_FAILED     // Connected, but the upload or local update failed
+};
+
+#if FEATURE_SYNC
+// Globals
+extern char syncUrl[SYNC_URL_MAX];
+
 // Function prototypes
-void syncToGoogle();
+void loadSyncSettings();
+void saveSyncSettings(const char *newUrl);
+void updateSyncSettings(const char *args);
+SyncResult syncRecords(); // Leaves WiFi up, see disconnectWiFi()
+void closeSyncSession();
+#else
+inline void loadSyncSettings() {}
+inline void closeSyncSession() {}
+#endif
 
-#endif // SYNC_H
\ No newline at end of file
+#endif // SYNC_H
@@ -0,0 +1,30 @@
+#ifndef SYNC_BACKEND_H
+#define SYNC_BACKEND_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// A transport for batch_attendance payloads. syncRecords() builds the
+// batches from the log and hands them to the backend chosen by the
+// endpoint URL's scheme; records are only marked synced once send()
+// reports the batch as delivered, so every backend is at-least-once.
+struct SyncBackend
+{
+    const char *name;
+    // WiFi is up and opArena is claimed; may carve buffers from it before
+    // the payload takes the rest. Reuses a session left open by close(true).
+    bool (*open)(const char *url);
+    // One batch; true once the far end has acknowledged it
+    bool (*send)(const char *payload, size_t length);
+    // keepSession leaves the connection up for the next sync while WiFi lingers
+    void (*close)(bool keepSession);
+};
+
+// Globals
+extern const SyncBackend httpBackend; // http(s)://, Google Apps Script or tools/sync_server.py
+extern const SyncBackend mqttBackend; // mqtt(s)://, QoS 1 publishes on a persistent session
+
+// Function prototypes
+const SyncBackend *backendForUrl(const char *url);
+
+#endif // SYNC_BACKEND_H
@@ -0,0 +1,50 @@
+#ifndef SYNC_SCHEDULER_H
+#define SYNC_SCHEDULER_H
+
+#include <Arduino.h>
+#include "sync.h"
+
+enum BreakerState
+{
+    BREAKER_CLOSED,   // Normal operation
+    BREAKER_OPEN,     // Uplink considered down, no attempts until cooldown ends
+    BREAKER_HALF_OPEN // Cooldown over, next attempt decides
+};
+
+struct SyncSchedulerState
+{
+    unsigned long lastActivity;    // Last scan or operator input
+    unsigned long lastSuccess;     // Last completed sync
+    unsigned long nextAttempt;     // Earliest time the next automatic attempt may run
+    unsigned long wifiIdleSince;   // WiFi left up after a sync, 0 when down
+    unsigned long lastClockSync;   // Last connection made only for SNTP
+    uint32_t consecutiveFailures;  // Drives the backoff exponent
+    uint32_t uplinkFailures;       // Consecutive SYNC_NO_UPLINK results, drives the breaker
+    uint32_t attempts;
+    uint32_t successes;
+    BreakerState breaker;
+    bool enabled;
+};
+
+#if FEATURE_SYNC
+// Globals
+extern SyncSchedulerState syncScheduler;
+
+// Function prototypes
+void initSyncScheduler();
+void serviceSyncScheduler();
+SyncResult runSync();
+void noteSyncActivity();
+uint32_t syncBacklogSize();
+long msUntilNextSync();
+void showSyncStatus();
+bool fetchClock();
+#else
+// Nothing to schedule: records stay on flash until exported
+inline void initSyncScheduler() {}
+inline void serviceSyncScheduler() {}
+inline void noteSyncActivity() {}
+inline bool fetchClock() { return false; }
+#endif
+
+#endif // SYNC_SCHEDULER_H
@@ -0,0 +1,23 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+// Counters the rest of the firmware feeds; everything else is sampled
+// on demand by the health command or the sync payload
+struct TelemetryCounters
+{
+    uint32_t flashWrites;       // SPIFFS write operations since boot
+    uint32_t flashBytesWritten;
+};
+
+// Globals
+extern TelemetryCounters telemetry;
+
+// Function prototypes
+void initTelemetry();
+void noteFlashWrite(size_t bytes);
+int formatHealthJson(char *buffer, size_t size);
+void showHealth();
+
+#endif // TELEMETRY_H
@@ -0,0 +1,36 @@
+#ifndef TEMPLATE_SEARCH_H
+#define TEMPLATE_SEARCH_H
+
+#include <Adafruit_Fingerprint.h>
+#include <Arduino.h>
+#include "config.h"
+
+enum SearchStrategy {
+  SEARCH_HOT,   // Roster or recently matched slot range
+  SEARCH_FULL,  // Whole library
+  SEARCH_STRATEGIES
+};
+
+enum HotSetMode {
+  HOTSET_OFF,
+  HOTSET_AUTO,    // Span of the last SEARCH_HOT_RECENT matches
+  HOTSET_ROSTER   // Fixed slot range, e.g. the class being taught
+};
+
+struct SearchStats {
+  uint32_t searches;
+  uint32_t hits;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+// Globals
+extern SearchStats searchStats[SEARCH_STRATEGIES];
+
+// Function prototypes
+void loadSearchSettings();
+uint8_t searchTemplates(Adafruit_Fingerprint &reader, uint16_t &id,
+                        uint16_t &confidence);
+void hotSetCommand(const char *args);
+
+#endif  // TEMPLATE_SEARCH_H
@@ -0,0 +1,50 @@
+#ifndef TIME_SOURCE_H
+#define TIME_SOURCE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Wall clock for attendance records. The ESP32's RTC keeps the system time
+// running through light sleep, deep sleep and soft resets; SNTP corrects it
+// whenever WiFi is up, and the 'date' command sets it by hand. After a power
+// loss the last saved time is restored so records stay in order, but it is
+// only trusted again once SNTP or the operator has set it.
+enum TimeSourceKind : uint8_t
+{
+    TIME_UNSET,    // Never set: records carry timestamp 0
+    TIME_RESTORED, // Last saved time after a power loss, running late
+    TIME_MANUAL,   // Set with 'date'
+    TIME_SNTP      // Set by SNTP
+};
+
+// How far a record's timestamp can be relied on. A record stamped while
+// the clock isn't trusted is flagged; the clock's run (power-on until SNTP
+// or 'date' sets it) ends with the offset the clock jumped by, which
+// re-stamps every flagged record of the run's sessions.
+enum StampState : uint8_t
+{
+    STAMP_TRUSTED,   // From a clock set by SNTP or by hand
+    STAMP_CORRECTED, // Flagged, moved by its run's offset
+    STAMP_HELD,      // Flagged, from the run still going: kept back from sync
+    STAMP_UNVERIFIED // Flagged, from a run a power loss ended before the clock was set
+};
+
+// Globals
+extern uint16_t attendanceSession; // Session of the current attendance mode, 0 before the first
+
+// Function prototypes
+void initTimeSource();
+void serviceTimeSource();
+void startTimeSync(); // Once WiFi is up
+bool timeTrusted();
+TimeSourceKind timeSource();
+uint32_t timeNow(); // Epoch seconds, 0 while the clock is unset
+uint32_t recordStamp(bool &trusted);                            // For a new record; counts from power-on if unset
+StampState correctStamp(uint16_t session, uint32_t &timestamp); // Of a flagged record; 0 if it has no date
+void formatDate(uint32_t timestamp, char *out, size_t size); // Local "19/5", "-" for 0
+void formatTime(uint32_t timestamp, char *out, size_t size); // Local "08:31:05", "-" for 0
+bool setClock(const char *args);                              // "DD/MM[/YYYY] [HH:MM[:SS]]"
+uint16_t beginAttendanceSession();
+void showClock();
+
+#endif // TIME_SOURCE_H
@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+#define TRACE_CAPACITY 256 // Entries; 8 bytes each in RTC slow memory
+
+// Event codes are part of the dump format, tools/trace_decode.py mirrors them.
+// Append new codes, never renumber.
+enum TraceEvent : uint8_t
+{
+    TRACE_BOOT = 1,      // arg8 reset reason, arg16 boot count
+    TRACE_SCAN_START,    // arg8 sensor index; sensor captured an image
+    TRACE_SCAN_MATCH,    // arg8 confidence (clamped), arg16 fingerprint ID
+    TRACE_SCAN_MISS,     // arg8 sensor status code
+    TRACE_FILE_WRITE,    // arg16 bytes written
+    TRACE_SYNC_START,    // arg16 backlog size
+    TRACE_SYNC_POST,     // arg16 records in the batch
+    TRACE_SYNC_RESPONSE, // arg16 HTTP status (negative HTTPClient errors as int16)
+    TRACE_SYNC_END,      // arg8 SyncResult
+    TRACE_HEAP,          // arg8 fragmentation %, arg16 free internal heap in KB
+    TRACE_WIFI_UP,       // arg8 1 if the cached AP was used, arg16 connect ms
+    TRACE_WIFI_FAIL,     // Same arguments as TRACE_WIFI_UP
+    TRACE_WAKE,          // arg8 esp_sleep wakeup cause (touch/serial only)
+    TRACE_BLE_CONNECT,
+    TRACE_BLE_DISCONNECT,
+};
+
+struct TraceEntry
+{
+    uint32_t us; // Low 32 bits of esp_timer_get_time(), wraps every ~71 min
+    uint8_t event;
+    uint8_t arg8;
+    uint16_t arg16;
+};
+
+struct TraceRing
+{
+    uint32_t magic;
+    uint32_t head;  // Next slot to write
+    uint32_t count; // Valid entries, up to TRACE_CAPACITY
+    uint32_t boots; // Boots since the ring was last initialised
+    TraceEntry entries[TRACE_CAPACITY];
+};
+
+// Function prototypes
+void initTrace();
+void trace(TraceEvent event, uint8_t arg8 = 0, uint16_t arg16 = 0);
+void dumpTrace(const char *args);
+
+#endif // TRACE_H
@@ -0,0 +1,73 @@
+#ifndef USB_EXPORT_H
+#define USB_EXPORT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Bulk export on the ESP32-S3's native USB port (USB Serial/JTAG, a CDC-ACM
+// device at USB full speed), separate from the UART0 console. The host opens
+// the port and sends one request line:
+//
+//     EXPORT [records] [roster] [templates]   (no parts: everything)
+//
+// and the reader answers with frames, all fields little-endian:
+//
+//     ExportFrameHeader, `length` payload bytes, CRC-32 of header and payload
+//
+// An export is one INFO frame, then per item BEGIN, DATA..., END, and last
+// DONE; ERROR ends it early. tools/usb_export.py is the reader.
+#define USB_EXPORT_MAGIC 0x31584541 // "AEX1"
+
+enum ExportFrameType : uint8_t
+{
+    EXPORT_INFO = 1,  // "key=value" lines describing the reader
+    EXPORT_BEGIN = 2, // Item name, e.g. "att_00003.csv" or "templates/s1_0012.tpl"
+    EXPORT_DATA = 3,  // Next chunk of the item, at most EXPORT_BLOCK_SIZE bytes
+    EXPORT_END = 4,   // uint32 item bytes, uint32 CRC-32 of the item
+    EXPORT_DONE = 5,  // uint32 items, uint32 bytes, uint32 milliseconds
+    EXPORT_ERROR = 6  // Message text
+};
+
+enum ExportItemKind : uint8_t
+{
+    EXPORT_ITEM_NONE = 0,
+    EXPORT_ITEM_SEGMENT = 1,  // Log segment as CSV
+    EXPORT_ITEM_SUMMARY = 2,  // LOG_SUMMARY_FILE
+    EXPORT_ITEM_ROSTER = 3,   // ROSTER_FILE as stored
+    EXPORT_ITEM_TEMPLATE = 4  // One sensor slot, as uploaded by the sensor
+};
+
+struct __attribute__((packed)) ExportFrameHeader
+{
+    uint32_t magic;
+    uint8_t type;
+    uint8_t kind;  // ExportItemKind of the current item
+    uint16_t item; // 1-based item number, 0 for INFO/DONE/ERROR
+    uint32_t length;
+};
+
+struct UsbExportStats
+{
+    uint32_t exports;   // Requests answered with DONE
+    uint32_t failures;  // Aborted: host stopped reading, arena busy, ...
+    uint32_t lastItems;
+    uint32_t lastBytes;
+    uint32_t lastMs;
+};
+
+#if FEATURE_USB_EXPORT
+// Globals
+extern UsbExportStats usbExportStats;
+
+// Function prototypes
+void initUsbExport();
+void serviceUsbExport();
+bool usbHostAttached();
+void usbExportCommand(const char *args);
+#else
+inline void initUsbExport() {}
+inline void serviceUsbExport() {}
+inline bool usbHostAttached() { return false; }
+#endif
+
+#endif // USB_EXPORT_H
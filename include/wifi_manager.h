@@ -2,17 +2,78 @@
 #define WIFI_MANAGER_H
 
 #include <Arduino.h>
+#include "config.h"
+
+#if FEATURE_SYNC
 #include <WiFi.h>
+#endif
+
+// Last successful association, reused so reconnects skip the scan, and
+// DHCP too while the lease it got is still good
+struct WiFiCache
+{
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t leaseRenewAt; // Epoch seconds of the lease's renewal time (T1), 0 if unknown
+};
+
+// Connect-time bookkeeping, one entry per attempt
+struct WiFiAttempt
+{
+    uint32_t durationMs;
+    bool fastPath;
+    bool success;
+};
+
+#define WIFI_ATTEMPT_HISTORY 8
 
+struct WiFiConnectStats
+{
+    uint32_t attempts;
+    uint32_t successes;
+    uint32_t fastAttempts;
+    uint32_t fastSuccesses;
+    uint32_t disconnects;    // Link drops reported by the driver, including failed attempts
+    uint32_t totalConnectMs; // Sum over successful attempts
+    uint32_t minConnectMs;
+    uint32_t maxConnectMs;
+    WiFiAttempt history[WIFI_ATTEMPT_HISTORY];
+    uint8_t historyHead;
+};
+
+#if FEATURE_SYNC
 // Globals
-extern String storedSSID;
-extern String storedPassword;
+extern char storedSSID[WIFI_SSID_MAX];
+extern char storedPassword[WIFI_PASSWORD_MAX];
+extern char storedStaticIP[WIFI_STATIC_IP_MAX];
+extern WiFiConnectStats wifiStats;
 
 // Function prototypes
 void loadWiFiCredentials();
-void saveWiFiCredentials(const String &newSSID, const String &newPassword);
-void updateWiFiSettings();
+void saveWiFiCredentials(const char *newSSID, const char *newPassword);
+void updateWiFiSettings(const char *args);
 void connectToWiFi();
 void disconnectWiFi();
+void showWiFiStats();
+
+inline bool wifiConnected()
+{
+    return WiFi.status() == WL_CONNECTED;
+}
+#else
+// WiFi compiled out: the radio is never started
+static const WiFiConnectStats wifiStats = {};
+
+inline bool wifiConnected()
+{
+    return false;
+}
+#endif
 
-#endif // WIFI_MANAGER_H
\ No newline at end of file
+#endif // WIFI_MANAGER_H
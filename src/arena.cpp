@@ -0,0 +1,96 @@
+#include "arena.h"
+#include "ble_manager.h"
+#include "config.h"
+#include <esp_heap_caps.h>
+
+#define ARENA_ALIGN 8
+
+// Globals
+Arena opArena = {};
+
+bool initArena(Arena &arena, size_t psramBytes, size_t internalBytes)
+{
+    arena = {};
+
+    if (psramFound())
+    {
+        arena.base = (uint8_t *)ps_malloc(psramBytes);
+        if (arena.base != nullptr)
+        {
+            arena.capacity = psramBytes;
+            arena.inPsram = true;
+        }
+    }
+
+    // No PSRAM fitted or it's exhausted: a smaller internal block still works,
+    // callers size their buffers from arenaAvailable()
+    if (arena.base == nullptr)
+    {
+        arena.base = (uint8_t *)heap_caps_malloc(internalBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (arena.base == nullptr)
+        {
+            printBoth("Failed to allocate operation arena");
+            return false;
+        }
+        arena.capacity = internalBytes;
+    }
+
+    printfBoth("Operation arena: %u KB in %s", (unsigned)(arena.capacity / 1024), arena.inPsram ? "PSRAM" : "internal RAM");
+    return true;
+}
+
+bool arenaBegin(Arena &arena, const char *owner)
+{
+    if (arena.base == nullptr || arena.owner != nullptr)
+    {
+        arena.failures++;
+        return false;
+    }
+    arena.owner = owner;
+    arena.used = 0;
+    return true;
+}
+
+void *arenaAlloc(Arena &arena, size_t size)
+{
+    size_t start = (arena.used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (arena.owner == nullptr || start + size > arena.capacity)
+    {
+        arena.failures++;
+        return nullptr;
+    }
+
+    arena.used = start + size;
+    if (arena.used > arena.highWater)
+    {
+        arena.highWater = arena.used;
+    }
+    return arena.base + start;
+}
+
+size_t arenaAvailable(const Arena &arena)
+{
+    size_t start = (arena.used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    return arena.capacity > start ? arena.capacity - start : 0;
+}
+
+// Everything allocated since arenaBegin() is released here
+void arenaEnd(Arena &arena)
+{
+    if (arena.owner == nullptr)
+    {
+        return;
+    }
+    arena.owner = nullptr;
+    arena.used = 0;
+    arena.operations++;
+}
+
+void showArenaStats(const Arena &arena)
+{
+    printfBoth("Arena: %u KB in %s, high water %u bytes (%u%%)", (unsigned)(arena.capacity / 1024),
+               arena.inPsram ? "PSRAM" : "internal RAM", (unsigned)arena.highWater,
+               arena.capacity > 0 ? (unsigned)(arena.highWater * 100 / arena.capacity) : 0);
+    printfBoth("Arena operations: %u, failed allocations: %u%s%s", (unsigned)arena.operations, (unsigned)arena.failures,
+               arena.owner != nullptr ? ", in use by " : "", arena.owner != nullptr ? arena.owner : "");
+}
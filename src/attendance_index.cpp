@@ -0,0 +1,514 @@
+#include "attendance_index.h"
+#include "ble_manager.h"
+#include "commands.h"
+#include "journal.h"
+#include "record_log.h"
+#include "roster.h"
+#include "storage.h"
+#include "telemetry.h"
+#include <SPIFFS.h>
+
+#define INDEX_MAGIC 0x58444931 // "IDX1"
+#define INDEX_BITMAP_BYTES ((ROSTER_MAX_SLOTS + 7) / 8)
+#define INDEX_DAY_KEYS (13 * 32) // "D/M" dates as month * 32 + day
+
+struct IndexHeader
+{
+    uint32_t magic;
+    uint16_t slots;
+    uint16_t maxDates;
+};
+
+// sequence orders dates by first scan; 0 marks a free entry
+struct IndexDate
+{
+    char date[DATE_MAX];
+    uint32_t sequence;
+};
+
+// INDEX_FILE is the header, every IndexDate entry, then one bitmap per
+// entry. It always has its full size, so recording a scan is an in-place
+// write of one bitmap byte, plus the date entry on a date's first scan.
+// Per-date and per-slot counts are derived from the bitmaps at boot.
+static IndexDate dates[INDEX_MAX_DATES];
+static uint8_t *bitmaps = nullptr; // INDEX_MAX_DATES bitmaps, PSRAM when fitted
+static uint16_t presentCount[INDEX_MAX_DATES];
+static uint16_t daysPresent[ROSTER_MAX_SLOTS];
+static int16_t dateByDay[INDEX_DAY_KEYS]; // Entry of each "D/M" date, -1 if none
+static uint16_t usedDates = 0;
+static uint32_t lastSequence = 0;
+
+static const size_t datesOffset = sizeof(IndexHeader);
+static const size_t bitmapsOffset = sizeof(IndexHeader) + sizeof(dates);
+static const size_t bitmapsSize = (size_t)INDEX_MAX_DATES * INDEX_BITMAP_BYTES;
+
+static uint8_t *bitmapOf(int16_t entry)
+{
+    return bitmaps + (size_t)entry * INDEX_BITMAP_BYTES;
+}
+
+static bool isPresent(int16_t entry, uint16_t slot)
+{
+    return bitmapOf(entry)[slot / 8] & (1 << (slot % 8));
+}
+
+// "19/5" -> 5 * 32 + 19; 0 for a date in any other format
+static uint16_t dayKey(const char *date)
+{
+    char *end;
+    long day = strtol(date, &end, 10);
+    if (*end != '/')
+    {
+        return 0;
+    }
+    long month = strtol(end + 1, &end, 10);
+    if (*end != '\0' || day < 1 || day > 31 || month < 1 || month > 12)
+    {
+        return 0;
+    }
+    return month * 32 + day;
+}
+
+// One table lookup for "D/M" dates; other formats, and dates seen for the
+// first time, scan the entries
+static int16_t findDate(const char *date)
+{
+    uint16_t key = dayKey(date);
+    if (key != 0 && dateByDay[key] >= 0 && strcmp(dates[dateByDay[key]].date, date) == 0)
+    {
+        return dateByDay[key];
+    }
+    for (int16_t entry = 0; entry < INDEX_MAX_DATES; entry++)
+    {
+        if (dates[entry].sequence != 0 && strcmp(dates[entry].date, date) == 0)
+        {
+            return entry;
+        }
+    }
+    return -1;
+}
+
+// Counts, lookup table and sequence from the dates and bitmaps
+static void recount()
+{
+    memset(presentCount, 0, sizeof(presentCount));
+    memset(daysPresent, 0, sizeof(daysPresent));
+    memset(dateByDay, 0xFF, sizeof(dateByDay));
+    usedDates = 0;
+    lastSequence = 0;
+
+    for (int16_t entry = 0; entry < INDEX_MAX_DATES; entry++)
+    {
+        if (dates[entry].sequence == 0)
+        {
+            continue;
+        }
+        usedDates++;
+        lastSequence = max(lastSequence, dates[entry].sequence);
+        uint16_t key = dayKey(dates[entry].date);
+        if (key != 0)
+        {
+            dateByDay[key] = entry;
+        }
+        for (uint16_t slot = 0; slot < ROSTER_MAX_SLOTS; slot++)
+        {
+            if (isPresent(entry, slot))
+            {
+                presentCount[entry]++;
+                daysPresent[slot]++;
+            }
+        }
+    }
+}
+
+static void resetIndex()
+{
+    memset(dates, 0, sizeof(dates));
+    memset(bitmaps, 0, bitmapsSize);
+    recount();
+}
+
+static bool writeAt(size_t offset, const void *data, size_t size)
+{
+    File file = SPIFFS.open(INDEX_FILE, "r+");
+    if (!file)
+    {
+        return false;
+    }
+    bool written = file.seek(offset) && file.write((const uint8_t *)data, size) == size;
+    file.close();
+    noteFlashWrite(written ? size : 0);
+    return written;
+}
+
+// Replaced through the journal, so a power cut keeps the old index
+static bool saveIndex()
+{
+    File file = beginReplace(INDEX_FILE);
+    if (!file)
+    {
+        return false;
+    }
+
+    IndexHeader header = {INDEX_MAGIC, ROSTER_MAX_SLOTS, INDEX_MAX_DATES};
+    size_t written = file.write((const uint8_t *)&header, sizeof(header));
+    written += file.write((const uint8_t *)dates, sizeof(dates));
+    written += file.write(bitmaps, bitmapsSize);
+    noteFlashWrite(written);
+
+    if (written != bitmapsOffset + bitmapsSize)
+    {
+        abortReplace(file, INDEX_FILE);
+        return false;
+    }
+    return commitReplace(file, INDEX_FILE);
+}
+
+static bool loadIndex()
+{
+    if (!SPIFFS.exists(INDEX_FILE))
+    {
+        return false;
+    }
+    File file = SPIFFS.open(INDEX_FILE, FILE_READ);
+    if (!file)
+    {
+        return false;
+    }
+
+    IndexHeader header;
+    bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && header.magic == INDEX_MAGIC &&
+                 header.slots == ROSTER_MAX_SLOTS && header.maxDates == INDEX_MAX_DATES &&
+                 file.read((uint8_t *)dates, sizeof(dates)) == sizeof(dates) &&
+                 file.read(bitmaps, bitmapsSize) == bitmapsSize;
+    file.close();
+    return valid;
+}
+
+// Takes a free entry, or the oldest date's once all are in use. The old
+// bitmap is cleared on flash before the entry is renamed, so a power cut in
+// between leaves an empty old date rather than a wrong new one.
+static int16_t addDate(const char *date, bool persist)
+{
+    int16_t entry = 0;
+    for (int16_t i = 1; i < INDEX_MAX_DATES && dates[entry].sequence != 0; i++)
+    {
+        if (dates[i].sequence < dates[entry].sequence)
+        {
+            entry = i;
+        }
+    }
+
+    if (dates[entry].sequence != 0)
+    {
+        for (uint16_t slot = 0; slot < ROSTER_MAX_SLOTS; slot++)
+        {
+            if (isPresent(entry, slot))
+            {
+                daysPresent[slot]--;
+            }
+        }
+        uint16_t oldKey = dayKey(dates[entry].date);
+        if (oldKey != 0 && dateByDay[oldKey] == entry)
+        {
+            dateByDay[oldKey] = -1;
+        }
+        memset(bitmapOf(entry), 0, INDEX_BITMAP_BYTES);
+        presentCount[entry] = 0;
+        if (persist)
+        {
+            writeAt(bitmapsOffset + (size_t)entry * INDEX_BITMAP_BYTES, bitmapOf(entry), INDEX_BITMAP_BYTES);
+        }
+    }
+    else
+    {
+        usedDates++;
+    }
+
+    memset(&dates[entry], 0, sizeof(dates[entry]));
+    strlcpy(dates[entry].date, date, sizeof(dates[entry].date));
+    dates[entry].sequence = ++lastSequence;
+    uint16_t key = dayKey(date);
+    if (key != 0)
+    {
+        dateByDay[key] = entry;
+    }
+    if (persist)
+    {
+        writeAt(datesOffset + (size_t)entry * sizeof(IndexDate), &dates[entry], sizeof(IndexDate));
+    }
+    return entry;
+}
+
+// False if the slot was already marked for that date
+static bool markPresent(int16_t entry, uint16_t slot)
+{
+    if (isPresent(entry, slot))
+    {
+        return false;
+    }
+    bitmapOf(entry)[slot / 8] |= 1 << (slot % 8);
+    presentCount[entry]++;
+    daysPresent[slot]++;
+    return true;
+}
+
+void indexAttendance(const char *date, uint16_t slot)
+{
+    if (bitmaps == nullptr || slot >= ROSTER_MAX_SLOTS)
+    {
+        return;
+    }
+
+    int16_t entry = findDate(date);
+    if (entry < 0)
+    {
+        entry = addDate(date, true);
+    }
+    if (markPresent(entry, slot))
+    {
+        size_t byte = slot / 8;
+        writeAt(bitmapsOffset + (size_t)entry * INDEX_BITMAP_BYTES + byte, &bitmapOf(entry)[byte], 1);
+    }
+}
+
+// Records hold the roster's student number, or the bare slot number for
+// students who weren't on the roster
+static int slotOfStudent(const char *studentId)
+{
+    int slot = rosterSlotOf(studentId);
+    if (slot < 0 && studentId[0] != '\0' && studentId[strspn(studentId, "0123456789")] == '\0')
+    {
+        slot = atoi(studentId);
+    }
+    return slot < ROSTER_MAX_SLOTS ? slot : -1;
+}
+
+// Only records with a date that can be relied on count: held records wait
+// for the clock, and unverified or undated ones never get a trusted date
+static bool indexable(const LogEntry &record)
+{
+    return (record.stamp == STAMP_TRUSTED || record.stamp == STAMP_CORRECTED) && strcmp(record.date, "-") != 0;
+}
+
+// Persisted at once, like a committed scan
+void indexLogEntry(const LogEntry &record)
+{
+    int slot = slotOfStudent(record.studentId);
+    if (slot >= 0 && indexable(record))
+    {
+        indexAttendance(record.date, slot);
+    }
+}
+
+static void indexRecord(const LogEntry &record)
+{
+    int slot = slotOfStudent(record.studentId);
+    if (slot < 0 || !indexable(record))
+    {
+        return;
+    }
+    int16_t entry = findDate(record.date);
+    if (entry < 0)
+    {
+        entry = addDate(record.date, false);
+    }
+    markPresent(entry, slot);
+}
+
+// Built in RAM from every record still on flash, then saved in one write.
+// Dates whose segments were already compacted only survive in an existing
+// index, not in a rebuild.
+static bool rebuildIndex()
+{
+    resetIndex();
+    forEachRecord(indexRecord);
+    return saveIndex();
+}
+
+void initAttendanceIndex()
+{
+    bitmaps = psramFound() ? (uint8_t *)ps_malloc(bitmapsSize) : nullptr;
+    if (bitmaps == nullptr)
+    {
+        bitmaps = (uint8_t *)malloc(bitmapsSize);
+    }
+    if (bitmaps == nullptr)
+    {
+        printBoth("Not enough memory for the attendance index");
+        return;
+    }
+
+    if (loadIndex())
+    {
+        recount();
+    }
+    else
+    {
+        printBoth("Building the attendance index from the log...");
+        if (!rebuildIndex())
+        {
+            printBoth("Failed to save the attendance index");
+        }
+    }
+    printfBoth("Attendance index: %u dates", usedDates);
+}
+
+void clearAttendanceIndex()
+{
+    if (bitmaps == nullptr)
+    {
+        return;
+    }
+    resetIndex();
+    if (!saveIndex())
+    {
+        printBoth("Failed to clear the attendance index");
+    }
+}
+
+static void printStudent(uint16_t slot)
+{
+    const RosterEntry *student = rosterLookup(slot);
+    if (student != nullptr)
+    {
+        printfBoth("%u: %s %s", slot, student->studentId, student->name);
+    }
+    else
+    {
+        printfBoth("%u", slot);
+    }
+}
+
+// "present" is today's roll call, "present 18/5" another date's; with
+// "absent" it lists the roster students who didn't scan instead
+void rollCallCommand(const char *args)
+{
+    if (bitmaps == nullptr)
+    {
+        printBoth("Attendance index unavailable");
+        return;
+    }
+
+    char buffer[INPUT_LINE_MAX];
+    strlcpy(buffer, args, sizeof(buffer));
+    char *cursor = buffer;
+    const char *date = currentDate;
+    bool absent = false;
+    for (char *word = nextArg(cursor); *word != '\0'; word = nextArg(cursor))
+    {
+        if (strcasecmp(word, "absent") == 0)
+        {
+            absent = true;
+        }
+        else
+        {
+            date = word;
+        }
+    }
+
+    int16_t entry = findDate(date);
+    printfBoth("=== Roll call %s: %u present ===", date, entry >= 0 ? presentCount[entry] : 0);
+    if (!absent)
+    {
+        for (uint16_t slot = 0; entry >= 0 && slot < ROSTER_MAX_SLOTS; slot++)
+        {
+            if (isPresent(entry, slot))
+            {
+                printStudent(slot);
+            }
+        }
+        return;
+    }
+
+    uint16_t missing = 0;
+    for (uint16_t slot = 0; slot < ROSTER_MAX_SLOTS; slot++)
+    {
+        if (rosterLookup(slot) != nullptr && (entry < 0 || !isPresent(entry, slot)))
+        {
+            printStudent(slot);
+            missing++;
+        }
+    }
+    printfBoth("%u roster students absent", missing);
+}
+
+static int16_t dateWithSequence(bool newest)
+{
+    int16_t found = -1;
+    for (int16_t entry = 0; entry < INDEX_MAX_DATES; entry++)
+    {
+        if (dates[entry].sequence != 0 &&
+            (found < 0 || (newest ? dates[entry].sequence > dates[found].sequence
+                                  : dates[entry].sequence < dates[found].sequence)))
+        {
+            found = entry;
+        }
+    }
+    return found;
+}
+
+static void showIndex()
+{
+    uint16_t students = 0;
+    for (uint16_t slot = 0; slot < ROSTER_MAX_SLOTS; slot++)
+    {
+        students += daysPresent[slot] > 0 ? 1 : 0;
+    }
+
+    printBoth("=== Attendance Index ===");
+    int16_t oldest = dateWithSequence(false);
+    int16_t newest = dateWithSequence(true);
+    printfBoth("%u of %u dates, %s to %s", usedDates, INDEX_MAX_DATES, oldest >= 0 ? dates[oldest].date : "-",
+               newest >= 0 ? dates[newest].date : "-");
+    printfBoth("%u students seen, %u KB in RAM", students,
+               (unsigned)((sizeof(dates) + bitmapsSize + sizeof(daysPresent) + sizeof(presentCount)) / 1024));
+    printBoth("========================");
+}
+
+// "days" shows the index, "days 12" or "days S1234" one student's days
+// present, "days rebuild" re-reads the log
+void studentDaysCommand(const char *args)
+{
+    if (bitmaps == nullptr)
+    {
+        printBoth("Attendance index unavailable");
+        return;
+    }
+    if (args[0] == '\0')
+    {
+        showIndex();
+        return;
+    }
+    if (strcasecmp(args, "rebuild") == 0)
+    {
+        unsigned long start = millis();
+        bool saved = rebuildIndex();
+        printfBoth("Attendance index rebuilt: %u dates in %lu ms%s", usedDates, millis() - start,
+                   saved ? "" : ", failed to save it");
+        return;
+    }
+
+    int slot = slotOfStudent(args);
+    if (slot < 0)
+    {
+        printBoth("Usage: days [slot|student_id|rebuild]");
+        return;
+    }
+
+    // Newest date the student was present on
+    int16_t last = -1;
+    for (int16_t entry = 0; entry < INDEX_MAX_DATES; entry++)
+    {
+        if (dates[entry].sequence != 0 && isPresent(entry, slot) &&
+            (last < 0 || dates[entry].sequence > dates[last].sequence))
+        {
+            last = entry;
+        }
+    }
+
+    const RosterEntry *student = rosterLookup(slot);
+    printfBoth("%u %s %s: present on %u of %u days, last %s", slot, student != nullptr ? student->studentId : "",
+               student != nullptr ? student->name : "", daysPresent[slot], usedDates,
+               last >= 0 ? dates[last].date : "never");
+}
@@ -1,25 +1,56 @@
 #include "ble_manager.h"
 #include "config.h"
 #include "indicators.h"
+#include "power_manager.h"
+#include "sync_scheduler.h"
+#include "trace.h"
 
+#if FEATURE_BLE_CONSOLE
 // Globals
 BLEServer *pServer = nullptr;
 BLECharacteristic *pTxCharacteristic = nullptr;
 BLECharacteristic *pRxCharacteristic = nullptr;
 bool deviceConnected = false;
+uint32_t bleConnections = 0; // Client connects since boot
 bool oldDeviceConnected = false;
-std::string receivedCommand = "";
-String bleCommandBuffer = "";
+char receivedCommand[INPUT_LINE_MAX] = "";
+volatile bool commandReady = false;
+
+static char bleCommandBuffer[INPUT_LINE_MAX];
+static size_t bleCommandLength = 0;
+#endif
+
+#if FEATURE_SERIAL_UI
+// Serial bytes of the line being typed, collected across loop iterations
+static char serialLine[INPUT_LINE_MAX];
+static size_t serialLineLength = 0;
+static bool serialAfterCR = false; // Swallows the LF of a CRLF
+static uint32_t lastSerialByteAt = 0;
+#endif
+
+// Strips trailing CR/LF/spaces in place
+static void trimLine(char *line)
+{
+    size_t length = strlen(line);
+    while (length > 0 && isspace((unsigned char)line[length - 1]))
+    {
+        line[--length] = '\0';
+    }
+}
 
+#if FEATURE_BLE_CONSOLE
 void ServerCallbacks::onConnect(BLEServer *pServer)
 {
     deviceConnected = true;
+    bleConnections++;
+    trace(TRACE_BLE_CONNECT);
     Serial.println("BLE Client connected");
 }
 
 void ServerCallbacks::onDisconnect(BLEServer *pServer)
 {
     deviceConnected = false;
+    trace(TRACE_BLE_DISCONNECT);
     Serial.println("BLE Client disconnected");
 
     // Start advertising again so client can reconnect
@@ -28,28 +59,34 @@ void ServerCallbacks::onDisconnect(BLEServer *pServer)
 
 void CharacteristicCallbacks::onWrite(BLECharacteristic *pCharacteristic)
 {
-    std::string rxValue = pCharacteristic->getValue();
+    const uint8_t *rxValue = pCharacteristic->getData();
+    size_t rxLength = pCharacteristic->getLength();
 
-    if (rxValue.length() > 0)
+    if (rxLength > 0)
     {
         Serial.println("*********");
         Serial.print("Received Value: ");
-
-        // Convert received command to String and add to buffer
-        for (int i = 0; i < rxValue.length(); i++)
-        {
-            Serial.print(rxValue[i]);
-            bleCommandBuffer += rxValue[i];
-        }
+        Serial.write(rxValue, rxLength);
         Serial.println();
 
-        // Check if the command is complete (ends with newline)
-        if (bleCommandBuffer.endsWith("\n"))
+        for (size_t i = 0; i < rxLength; i++)
         {
-            // Remove newline character
-            bleCommandBuffer.trim();
-            receivedCommand = bleCommandBuffer.c_str();
-            bleCommandBuffer = ""; // Clear buffer for next command
+            char c = (char)rxValue[i];
+
+            // Check if the command is complete (ends with newline)
+            if (c == '\n')
+            {
+                bleCommandBuffer[bleCommandLength] = '\0';
+                trimLine(bleCommandBuffer);
+                // Previous line not consumed yet: the newer one wins, as before
+                memcpy(receivedCommand, bleCommandBuffer, bleCommandLength + 1);
+                commandReady = true;
+                bleCommandLength = 0; // Clear buffer for next command
+            }
+            else if (bleCommandLength < INPUT_LINE_MAX - 1)
+            {
+                bleCommandBuffer[bleCommandLength++] = c;
+            }
         }
 
         Serial.println("*********");
@@ -84,104 +121,161 @@ void setupBLE()
     // Start the service
     pService->start();
 
-    // Start advertising
-    pServer->getAdvertising()->start();
+    // Advertising is started separately, once the rest of the system is ready
+    Serial.println("BLE device initialized");
+}
 
-    Serial.println("BLE device initialized. Waiting for client connections...");
+void startBLEAdvertising()
+{
+    pServer->getAdvertising()->start();
+    Serial.println("BLE advertising. Waiting for client connections...");
 }
+#endif
 
 // Helper function to print messages to both Serial and BLE
-void printBoth(String message)
+void printBoth(const char *message)
 {
     Serial.println(message);
 
+#if FEATURE_BLE_CONSOLE
     // Send to BLE if connected
     if (deviceConnected && pTxCharacteristic != nullptr)
     {
-        // BLE can only send chunks of up to 20 bytes, so we may need to split longer messages
-        const int chunkSize = 20;
-        int messageLength = message.length();
+        // BLE can only send chunks of up to 20 bytes, so we may need to split longer messages.
+        // Chunks point straight into the message; nothing is copied.
+        size_t messageLength = strlen(message);
 
-        for (int i = 0; i < messageLength; i += chunkSize)
+        for (size_t i = 0; i < messageLength; i += BLE_CHUNK_SIZE)
         {
-            int endIndex = min(i + chunkSize, messageLength);
-            String chunk = message.substring(i, endIndex);
-            pTxCharacteristic->setValue(chunk.c_str());
+            size_t chunkLength = min(messageLength - i, (size_t)BLE_CHUNK_SIZE);
+            pTxCharacteristic->setValue((uint8_t *)message + i, chunkLength);
             pTxCharacteristic->notify();
-            // delay(10); // Small delay to ensure proper transmission
         }
 
         // Send a newline to mark the end of the message
-        pTxCharacteristic->setValue("\n");
+        pTxCharacteristic->setValue((uint8_t *)"\n", 1);
         pTxCharacteristic->notify();
     }
+#endif
 }
 
-// Helper function to read input from Serial or BLE
-String readInput()
+// printf-style printBoth() formatting into a stack buffer
+void printfBoth(const char *format, ...)
 {
-    String input = "";
-
-    bool blinkState = false;
-    unsigned long lastBlinkTime = 0;
-
-    // Indicate waiting for input with RGB LED pulse
-    pixels.setPixelColor(0, pixels.Color(0, 0, 32)); // Soft blue to indicate waiting
-    pixels.show();
+    char message[PRINT_BUFFER_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    printBoth(message);
+}
 
-    // Keep checking until we get input or timeout
-    while (input.length() == 0)
+#if FEATURE_SERIAL_UI
+// Moves what the UART has already received into serialLine, never waiting
+// for more; true once a CR or LF completes a line
+static bool collectSerialLine()
+{
+    while (Serial.available() > 0)
     {
-        // Check if there's a BLE command waiting
-        if (receivedCommand.length() > 0)
-        {
-            input = String(receivedCommand.c_str());
-            receivedCommand = ""; // Clear the received command
-            break;
-        }
-
-        // Otherwise check Serial
-        if (Serial.available())
+        char c = (char)Serial.read();
+        lastSerialByteAt = millis();
+        bool afterCR = serialAfterCR;
+        serialAfterCR = c == '\r';
+        if (c == '\n' && afterCR)
         {
-            input = Serial.readStringUntil('\n');
-            input.trim();
-            break;
+            continue;
         }
-
-        // Handle BLE connection events
-        if (!deviceConnected && oldDeviceConnected)
+        if (c == '\r' || c == '\n')
         {
-            delay(100);                  // Give the bluetooth stack time to process
-            pServer->startAdvertising(); // Restart advertising
-            oldDeviceConnected = deviceConnected;
+            serialLine[serialLineLength] = '\0';
+            serialLineLength = 0;
+            return true;
         }
-        if (deviceConnected && !oldDeviceConnected)
+        if (serialLineLength < INPUT_LINE_MAX - 1)
         {
-            oldDeviceConnected = deviceConnected;
+            serialLine[serialLineLength++] = c;
         }
+    }
+    return false;
+}
+#endif
 
-        // Pulse the LED while waiting to indicate system is ready for input
-        if (millis() - lastBlinkTime > 500)
-        {
-            lastBlinkTime = millis();
-            blinkState = !blinkState;
-            if (blinkState)
-            {
-                pixels.setPixelColor(0, pixels.Color(0, 0, 48)); // Brighter blue
-            }
-            else
-            {
-                pixels.setPixelColor(0, pixels.Color(0, 0, 16)); // Dimmer blue
-            }
-            pixels.show();
-        }
+// One waiting line from whichever consoles are built in
+static bool readInputLine(char *line, size_t size)
+{
+#if FEATURE_BLE_CONSOLE
+    // Check if there's a BLE command waiting
+    if (commandReady)
+    {
+        strncpy(line, receivedCommand, size - 1);
+        line[size - 1] = '\0';
+        commandReady = false; // Clear the received command
+        return true;
+    }
+#endif
+#if FEATURE_SERIAL_UI
+    if (collectSerialLine())
+    {
+        strncpy(line, serialLine, size - 1);
+        line[size - 1] = '\0';
+        trimLine(line);
+        return true;
+    }
+#endif
+    return false;
+}
 
-        delay(10); // Short delay to prevent CPU hogging
+// Non-blocking read of one line from Serial or BLE; returns false if none is waiting
+bool pollInput(char *line, size_t size)
+{
+    if (!readInputLine(line, size))
+    {
+        return false;
     }
 
-    // Turn off the LED after input is received
-    pixels.setPixelColor(0, pixels.Color(0, 0, 0));
-    pixels.show();
+    // Operator is at the device, hold off idle-triggered syncs and sleep
+    noteSyncActivity();
+    notePowerActivity();
+    return true;
+}
 
-    return input;
+// Non-blocking check used by loops that must keep running between commands
+bool inputAvailable()
+{
+#if FEATURE_BLE_CONSOLE
+    if (commandReady)
+    {
+        return true;
+    }
+#endif
+#if FEATURE_SERIAL_UI
+    if (Serial.available())
+    {
+        return true;
+    }
+    // A half-typed line counts too while the operator is still typing, but
+    // not one abandoned mid-line, which would otherwise keep sleep off
+    if (serialLineLength > 0 && millis() - lastSerialByteAt < POWER_IDLE_BEFORE_SLEEP_MS)
+    {
+        return true;
+    }
+#endif
+    return false;
+}
+
+#if FEATURE_BLE_CONSOLE
+// Handle BLE connection events
+void serviceBLE()
+{
+    if (!deviceConnected && oldDeviceConnected)
+    {
+        // onDisconnect already restarted advertising; just track the edge
+        Serial.println("Start advertising");
+        oldDeviceConnected = deviceConnected;
+    }
+    if (deviceConnected && !oldDeviceConnected)
+    {
+        oldDeviceConnected = deviceConnected;
+    }
 }
+#endif
@@ -0,0 +1,32 @@
+#include "boot_profiler.h"
+#include "ble_manager.h"
+#include <esp_timer.h>
+
+static BootPhase phases[BOOT_MAX_PHASES];
+static uint8_t phaseCount = 0;
+static portMUX_TYPE phaseLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Safe to call from the init tasks running alongside setup()
+void bootMark(const char *phase)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    portENTER_CRITICAL(&phaseLock);
+    if (phaseCount < BOOT_MAX_PHASES)
+    {
+        phases[phaseCount].name = phase;
+        phases[phaseCount].atUs = now;
+        phaseCount++;
+    }
+    portEXIT_CRITICAL(&phaseLock);
+}
+
+void printBootReport()
+{
+    printBoth("=== Boot Timing (ms since start) ===");
+    for (uint8_t i = 0; i < phaseCount; i++)
+    {
+        printfBoth("%s: %.1f", phases[i].name, phases[i].atUs / 1000.0f);
+    }
+    printBoth("====================================");
+}
@@ -0,0 +1,227 @@
+#include "commands.h"
+#include "attendance_index.h"
+#include "ble_manager.h"
+#include "fingerprint.h"
+#include "heap_monitor.h"
+#include "indicators.h"
+#include "power_manager.h"
+#include "roster.h"
+#include "sensor_link.h"
+#include "storage.h"
+#include "sync.h"
+#include "sync_scheduler.h"
+#include "telemetry.h"
+#include "template_search.h"
+#include "trace.h"
+#include "usb_export.h"
+#include "wifi_manager.h"
+
+static SessionInputHandler sessionInput = nullptr;
+static SessionTickHandler sessionTick = nullptr;
+static unsigned long lastPulse = 0;
+static bool pulseBright = false;
+
+#if FEATURE_CONSOLE
+static void showHelp(const char *args)
+{
+    showMainMenu();
+}
+
+// Menu numbers are kept from the original if/else menu so muscle memory still works
+static const Command commands[] = {
+    {"enroll", "1", "[id]", "Enroll Mode", enrollMode},
+    {"attend", "2", "[DD/MM HH:MM]", "Attendance Mode", attendanceMode},
+    {"clear-prints", "3", "[Y]", "Clear All Fingerprints", clearAllFingerprints},
+    {"records", "4", "[all|summary]", "View Stored Records", viewStoredRecords},
+#if FEATURE_SYNC
+    {"sync", "5", "", "Sync Now", [](const char *) {
+         printBoth("Syncing attendance data...");
+         runSync();
+     }},
+#endif
+    {"clear-records", "6", "[CONFIRM]", "Clear Attendance Data", clearAttendanceData},
+    {"date", "7", "[DD/MM[/YYYY]] [HH:MM]", "Set Clock", setCurrentDate},
+#if FEATURE_SYNC
+    {"wifi", "8", "[ssid password [ip,gw,mask,dns]]", "Update WiFi Settings", updateWiFiSettings},
+#endif
+    {"count", "9", "", "Show Fingerprint Count", [](const char *) { showFingerprintCount(); }},
+    {"help", "10", "", "Show Menu (Help)", showHelp},
+#if FEATURE_SYNC
+    {"endpoint", "11", "[url|default]", "Update Sync Endpoint", updateSyncSettings},
+    {"wifi-stats", "12", "", "Show WiFi Statistics", [](const char *) { showWiFiStats(); }},
+    {"sync-status", "13", "", "Show Sync Status", [](const char *) { showSyncStatus(); }},
+    {"autosync", "14", "", "Toggle Auto-Sync", [](const char *) {
+         syncScheduler.enabled = !syncScheduler.enabled;
+         printBoth(syncScheduler.enabled ? "Auto-sync enabled" : "Auto-sync disabled");
+     }},
+#endif
+    {"power", "15", "", "Show Power Statistics", [](const char *) { showPowerStats(); }},
+    {"powersave", "16", "", "Toggle Power Save", [](const char *) {
+         powerSaveEnabled = !powerSaveEnabled;
+         printBoth(powerSaveEnabled ? "Power save enabled" : "Power save disabled");
+     }},
+    {"sensor", "17", "", "Retry Sensor Init", [](const char *) { initFingerprint(); }},
+    {"heap", "18", "", "Show Heap Statistics", [](const char *) { showHeapStats(); }},
+    {"health", "19", "", "Show Health Telemetry", [](const char *) { showHealth(); }},
+    {"trace", "20", "[clear]", "Dump Event Trace", dumpTrace},
+    {"sensors", "21", "", "Show Sensor Statistics", [](const char *) { showSensorStats(); }},
+    {"link", "22", "[tune|reset]", "Sensor Link Tuning", sensorLinkCommand},
+    {"hotset", "23", "[first-last|auto|off|reset|bench <slot>]", "Template Search Hot Set", hotSetCommand},
+    {"roster", "24", "[slot|load [merge]|clear]", "Student Roster", rosterCommand},
+#if FEATURE_USB_EXPORT
+    {"usb", "25", "", "USB Export Status", usbExportCommand},
+#endif
+    {"present", "26", "[date] [absent]", "Roll Call", rollCallCommand},
+    {"days", "27", "[slot|student_id|rebuild]", "Student Attendance Days", studentDaysCommand},
+};
+
+static const size_t commandCount = sizeof(commands) / sizeof(commands[0]);
+
+static const Command *findCommand(const char *word)
+{
+    for (size_t i = 0; i < commandCount; i++)
+    {
+        if (strcasecmp(word, commands[i].name) == 0 || strcmp(word, commands[i].number) == 0)
+        {
+            return &commands[i];
+        }
+    }
+    return nullptr;
+}
+#endif // FEATURE_CONSOLE
+
+// Splits the next whitespace-separated token off in place and advances the cursor
+char *nextArg(char *&cursor)
+{
+    while (*cursor == ' ')
+    {
+        cursor++;
+    }
+
+    char *token = cursor;
+    while (*cursor != '\0' && *cursor != ' ')
+    {
+        cursor++;
+    }
+
+    if (*cursor == ' ')
+    {
+        *cursor++ = '\0';
+        while (*cursor == ' ')
+        {
+            cursor++;
+        }
+    }
+    return token;
+}
+
+#if FEATURE_CONSOLE
+void showMainMenu()
+{
+    printBoth("\n=== Attendance System Menu ===");
+    for (size_t i = 0; i < commandCount; i++)
+    {
+        const Command &command = commands[i];
+        printfBoth("%s. %s (%s%s%s)", command.number, command.help, command.name,
+                   command.usage[0] != '\0' ? " " : "", command.usage);
+    }
+    printBoth("==============================");
+}
+#endif
+
+void beginSession(SessionInputHandler onInput, SessionTickHandler onTick)
+{
+    sessionInput = onInput;
+    sessionTick = onTick;
+}
+
+bool sessionActive()
+{
+    return sessionInput != nullptr || sessionTick != nullptr;
+}
+
+static void endSession()
+{
+    sessionInput = nullptr;
+    sessionTick = nullptr;
+    setIndicator(0, 0, 0);
+}
+
+#if FEATURE_CONSOLE
+void dispatchCommand(char *line)
+{
+    char *args = line;
+    const char *word = nextArg(args);
+    if (word[0] == '\0')
+    {
+        return;
+    }
+
+    if (strcmp(word, "?") == 0)
+    {
+        word = "help";
+    }
+
+    const Command *command = findCommand(word);
+    if (command == nullptr)
+    {
+        printfBoth("Unknown command '%s'. Type 'help' for the menu.", word);
+        return;
+    }
+
+    command->handler(args);
+}
+#endif
+
+// Soft blue pulse while a dialog is waiting for the operator
+static void pulseWaitingLed()
+{
+    if (sessionTick != nullptr || powerIdle() || millis() - lastPulse < 500)
+    {
+        return;
+    }
+    lastPulse = millis();
+    pulseBright = !pulseBright;
+    setIndicator(0, 0, pulseBright ? 48 : 16);
+}
+
+// Called every loop: routes one pending input line and ticks the active session
+void serviceCommands()
+{
+#if FEATURE_CONSOLE
+    char line[INPUT_LINE_MAX];
+    if (pollInput(line, sizeof(line)))
+    {
+        SessionStatus status = SESSION_PASS;
+        if (sessionInput != nullptr)
+        {
+            status = sessionInput(line);
+        }
+
+        if (status == SESSION_DONE)
+        {
+            endSession();
+        }
+        else if (status == SESSION_PASS)
+        {
+            // Commands still run during a mode; the handler may start a new session
+            SessionInputHandler before = sessionInput;
+            dispatchCommand(line);
+            if (sessionInput != before && before != nullptr)
+            {
+                printBoth("Previous operation replaced");
+            }
+        }
+    }
+#endif
+
+    if (sessionTick != nullptr && sessionTick() == SESSION_DONE)
+    {
+        endSession();
+    }
+
+    if (sessionInput != nullptr)
+    {
+        pulseWaitingLed();
+    }
+}
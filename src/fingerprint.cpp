@@ -1,206 +1,398 @@
 #include "fingerprint.h"
 #include "ble_manager.h"
+#include "commands.h"
 #include "config.h"
 #include "indicators.h"
+#include "power_manager.h"
+#include "record_log.h"
+#include "sensor_link.h"
 #include "storage.h"
+#include "sync_scheduler.h"
+#include "template_search.h"
+#include "time_source.h"
+#include "trace.h"
+
+#define ATTEND_POLL_MS 100    // Avoid spamming the sensor
+#define ATTEND_HOLD_MS 2000   // Pause after a recorded scan
+#define CAPTURE_LEASE_MS 500  // Capture tasks stop this long after attendance mode stops ticking
 
 // Initialize the globals
 HardwareSerial SerialX(1);  // define a Serial for UART1
 Adafruit_Fingerprint finger = Adafruit_Fingerprint(&SerialX);
+FingerprintSensor sensors[SENSOR_COUNT] = {};
+bool sensorReady = false;
 
-void initFingerprint() {
-  printBoth("Initializing sensor...");
+static const SensorPins pinTable[] = SENSOR_PINS;
+static_assert(SENSOR_COUNT >= 1 &&
+                  SENSOR_COUNT <= sizeof(pinTable) / sizeof(pinTable[0]),
+              "SENSOR_PINS needs a row per sensor");
 
-  SerialX.begin(57600, SERIAL_8N1, SERIAL1RX, SERIAL1TX);
+static QueueHandle_t scanQueue = nullptr;
+static volatile unsigned long captureLeaseUntil = 0;
 
-  finger.begin(57600);
-  if (finger.verifyPassword()) {
-    printBoth("Found fingerprint sensor!");
-  } else {
-    printBoth("Did not find fingerprint sensor :(");
-    while (1) {
-      delay(1000);
-    }
+const SensorPins &sensorPins(uint8_t index) { return pinTable[index]; }
+
+bool lockSensor(FingerprintSensor &sensor) {
+  return xSemaphoreTake(sensor.lock, portMAX_DELAY) == pdTRUE;
+}
+
+void unlockSensor(FingerprintSensor &sensor) {
+  xSemaphoreGive(sensor.lock);
+}
+
+// Attendance mode holds the capture lease
+bool captureActive() {
+  return (long)(millis() - captureLeaseUntil) < 0;
+}
+
+// Per-sensor pipeline state, owned by the capture task
+struct CaptureTrack {
+  uint8_t pendingImages;  // Images of failed touches since the last match
+  unsigned long lastFailureAt;
+  uint8_t windowTouches;  // Security level adaptation window
+  uint8_t windowMisses;
+};
+
+static CaptureTrack captureTracks[SENSOR_COUNT];
+
+static CaptureOutcome classifyCapture(uint8_t p) {
+  switch (p) {
+    case FINGERPRINT_OK:
+      return CAPTURE_MATCH;
+    case FINGERPRINT_NOTFOUND:
+    case FINGERPRINT_NOMATCH:
+      return CAPTURE_NO_MATCH;
+    case FINGERPRINT_IMAGEFAIL:
+    case FINGERPRINT_IMAGEMESS:
+      return CAPTURE_POOR_IMAGE;
+    case FINGERPRINT_FEATUREFAIL:
+    case FINGERPRINT_INVALIDIMAGE:
+      return CAPTURE_FEATURE_FAIL;
+    default:
+      return CAPTURE_ERROR;
   }
+}
 
-  finger.getTemplateCount();
-  printBoth("Stored Prints: " + String(finger.templateCount));
+// Worth another image while the finger is still down
+static bool qualityFailure(CaptureOutcome outcome) {
+  return outcome == CAPTURE_POOR_IMAGE || outcome == CAPTURE_FEATURE_FAIL;
+}
 
-  if (finger.templateCount == 0) {
-    printBoth(
-        "Sensor doesn't contain any fingerprint data. Please enroll a "
-        "fingerprint.");
-  } else {
-    printBoth("Sensor contains " + String(finger.templateCount) + " templates");
+// Moves the security level one step within CAPTURE_SECURITY_MIN/MAX
+static void setSecurity(FingerprintSensor &sensor, uint8_t level) {
+  if (sensor.finger->setSecurityLevel(level) == FINGERPRINT_OK) {
+    sensor.securityLevel = level;
+    sensor.stats.securityChanges++;
   }
 }
 
-uint8_t getFingerprintEnroll(uint8_t id) {
-  int p = -1;
-  printBoth("Waiting for valid finger to enroll as #" + String(id));
-  printBoth("(Press 'C' to cancel enrollment)");
+// Judged touches (a match or a clean no-match; quality failures say nothing
+// about the threshold) fill a window. Many no-matches lower the level, so
+// genuine but worn fingers pass; a clean window raises it back.
+static void adaptSecurity(uint8_t index, CaptureOutcome outcome) {
+  FingerprintSensor &sensor = sensors[index];
+  CaptureTrack &track = captureTracks[index];
+  // Level unknown: stepping from 0 would leave the configured range
+  if (sensor.securityLevel == 0 ||
+      (outcome != CAPTURE_MATCH && outcome != CAPTURE_NO_MATCH)) {
+    return;
+  }
 
-  while (p != FINGERPRINT_OK) {
-    // Check for cancellation command
-    if (Serial.available() || receivedCommand.length() > 0) {
-      String cmd = "";
-
-      if (receivedCommand.length() > 0) {
-        cmd = String(receivedCommand.c_str());
-        receivedCommand = "";
-      } else {
-        cmd = Serial.readStringUntil('\n');
-        cmd.trim();
-      }
+  track.windowTouches++;
+  track.windowMisses += outcome == CAPTURE_NO_MATCH ? 1 : 0;
+  if (track.windowTouches < CAPTURE_ADAPT_WINDOW) {
+    return;
+  }
 
-      if (cmd == "c" || cmd == "C") {
-        printBoth("Enrollment cancelled by user");
-        return FINGERPRINT_PACKETRECIEVEERR;  // Return error to indicate
-                                              // cancellation
-      }
-    }
+  uint32_t missPercent = track.windowMisses * 100u / track.windowTouches;
+  track.windowTouches = 0;
+  track.windowMisses = 0;
+  if (missPercent >= CAPTURE_ADAPT_LOWER_PERCENT &&
+      sensor.securityLevel > CAPTURE_SECURITY_MIN) {
+    setSecurity(sensor, sensor.securityLevel - 1);
+  } else if (missPercent <= CAPTURE_ADAPT_RAISE_PERCENT &&
+             sensor.securityLevel < CAPTURE_SECURITY_MAX) {
+    setSecurity(sensor, sensor.securityLevel + 1);
+  }
+}
 
-    p = finger.getImage();
-    switch (p) {
-      case FINGERPRINT_OK:
-        printBoth("Image taken");
-        break;
-      case FINGERPRINT_NOFINGER:
-        printBoth(".");
-        break;
-      case FINGERPRINT_PACKETRECIEVEERR:
-        printBoth("Communication error");
-        break;
-      case FINGERPRINT_IMAGEFAIL:
-        printBoth("Imaging error");
-        break;
-      default:
-        printBoth("Unknown error");
-        break;
-    }
+// One touch; false when no finger was on the sensor. Poor images are
+// recaptured straight away, up to CAPTURE_MAX_IMAGES, so a dry or smudged
+// finger costs a few hundred milliseconds instead of a failed scan.
+static bool captureOnce(uint8_t index, ScanEvent &event) {
+  FingerprintSensor &sensor = sensors[index];
+  Adafruit_Fingerprint &reader = *sensor.finger;
+  CaptureTrack &track = captureTracks[index];
+
+  uint8_t p = reader.getImage();
+  if (p != FINGERPRINT_OK && p != FINGERPRINT_IMAGEFAIL) {
+    return false;
+  }
 
+  // Keeps the main loop out of light sleep; wake latency is closed there
+  notePowerActivity();
+  trace(TRACE_SCAN_START, index);
+  unsigned long imagedAt = millis();
+  sensor.stats.images++;
+
+  event.sensor = index;
+  event.matched = false;
+  event.id = 0;
+  event.confidence = 0;
+
+  uint8_t images = 0;
+  CaptureOutcome outcome;
+  for (;;) {
+    images++;
     if (p == FINGERPRINT_OK) {
-      printBoth("Stored!");
-      indicateSuccess();  // Success indicator
-    } else {
-      // In failure cases
-      indicateFailure();  // Failure indicator
+      p = reader.image2Tz();
+    }
+    if (p == FINGERPRINT_OK) {
+      p = searchTemplates(reader, event.id, event.confidence);
+    }
+    outcome = classifyCapture(p);
+    if (!qualityFailure(outcome) || images >= CAPTURE_MAX_IMAGES) {
+      break;
     }
-  }
 
-  p = finger.image2Tz(1);
-  switch (p) {
-    case FINGERPRINT_OK:
-      printBoth("Image converted");
+    // Finger lifted: the last failure stands
+    uint8_t next = reader.getImage();
+    if (next == FINGERPRINT_NOFINGER) {
       break;
-    case FINGERPRINT_IMAGEMESS:
-      printBoth("Image too messy");
-      return p;
-    case FINGERPRINT_PACKETRECIEVEERR:
-      printBoth("Communication error");
-      return p;
-    case FINGERPRINT_FEATUREFAIL:
-      printBoth("Could not find fingerprint features");
-      return p;
-    case FINGERPRINT_INVALIDIMAGE:
-      printBoth("Could not find fingerprint features");
-      return p;
-    default:
-      printBoth("Unknown error");
-      return p;
+    }
+    sensor.stats.retries++;
+    p = next;
+  }
+  event.status = p;
+  event.outcome = outcome;
+
+  uint32_t scanMs = millis() - imagedAt;
+  sensor.stats.lastScanMs = scanMs;
+  sensor.stats.totalScanMs += scanMs;
+  if (scanMs > sensor.stats.maxScanMs) {
+    sensor.stats.maxScanMs = scanMs;
   }
 
-  printBoth("Remove finger");
-  printBoth("(Press 'C' to cancel enrollment)");
-  delay(2000);
-  p = 0;
-  while (p != FINGERPRINT_NOFINGER) {
-    // Check for cancellation during finger removal wait
-    if (Serial.available() || receivedCommand.length() > 0) {
-      String cmd = "";
-
-      if (receivedCommand.length() > 0) {
-        cmd = String(receivedCommand.c_str());
-        receivedCommand = "";
-      } else {
-        cmd = Serial.readStringUntil('\n');
-        cmd.trim();
-      }
+  // Failed touches shortly before a match were the same person trying again
+  if (track.pendingImages > 0 &&
+      millis() - track.lastFailureAt >= CAPTURE_CHECKIN_GAP_MS) {
+    track.pendingImages = 0;
+  }
+  event.images = (uint8_t)min(track.pendingImages + images, 255);
+  adaptSecurity(index, outcome);
+
+  if (outcome != CAPTURE_MATCH) {
+    trace(TRACE_SCAN_MISS, p);
+    sensor.stats.misses++;
+    sensor.stats.poorImages += outcome == CAPTURE_POOR_IMAGE ? 1 : 0;
+    sensor.stats.featureFails += outcome == CAPTURE_FEATURE_FAIL ? 1 : 0;
+    sensor.stats.errors += outcome == CAPTURE_ERROR ? 1 : 0;
+    track.pendingImages = event.images;
+    track.lastFailureAt = millis();
+    return true;
+  }
 
-      if (cmd == "c" || cmd == "C") {
-        printBoth("Enrollment cancelled by user");
-        return FINGERPRINT_PACKETRECIEVEERR;
-      }
+  track.pendingImages = 0;
+  event.matched = true;
+  trace(TRACE_SCAN_MATCH, (uint8_t)min(event.confidence, (uint16_t)255),
+        event.id);
+  sensor.stats.matches++;
+  return true;
+}
+
+// Per-sensor capture loop. Idles until attendance mode holds the capture
+// lease, then polls the sensor and posts results to the shared queue; the
+// main loop does the file writes and output.
+static void captureTask(void *param) {
+  uint8_t index = (uint8_t)(uintptr_t)param;
+  FingerprintSensor &sensor = sensors[index];
+
+  for (;;) {
+    if (!sensor.ready || !captureActive()) {
+      vTaskDelay(pdMS_TO_TICKS(ATTEND_POLL_MS));
+      continue;
     }
-    p = finger.getImage();
+
+    ScanEvent event;
+    bool scanned = false;
+    if (lockSensor(sensor)) {
+      scanned = captureOnce(index, event);
+      unlockSensor(sensor);
+    }
+
+    if (scanned && xQueueSend(scanQueue, &event, 0) != pdTRUE) {
+      sensor.stats.dropped++;
+    }
+    vTaskDelay(pdMS_TO_TICKS(scanned && event.matched ? ATTEND_HOLD_MS
+                                                      : ATTEND_POLL_MS));
   }
+}
 
-  printBoth("Place same finger again");
-  printBoth("(Press 'C' to cancel enrollment)");
-  p = -1;
-  while (p != FINGERPRINT_OK) {
-    // Check for cancellation during second finger placement
-    if (Serial.available() || receivedCommand.length() > 0) {
-      String cmd = "";
-
-      if (receivedCommand.length() > 0) {
-        cmd = String(receivedCommand.c_str());
-        receivedCommand = "";
-      } else {
-        cmd = Serial.readStringUntil('\n');
-        cmd.trim();
-      }
+static bool initSensor(uint8_t index) {
+  FingerprintSensor &sensor = sensors[index];
+  const SensorPins &pins = pinTable[index];
 
-      if (cmd == "c" || cmd == "C") {
-        printBoth("Enrollment cancelled by user");
-        return FINGERPRINT_PACKETRECIEVEERR;
-      }
+  if (sensor.finger == nullptr) {
+    // Sensor 1 keeps the original globals; the others are created once
+    sensor.serial = index == 0 ? &SerialX : new HardwareSerial(pins.uart);
+    sensor.finger =
+        index == 0 ? &finger : new Adafruit_Fingerprint(sensor.serial);
+    sensor.lock = xSemaphoreCreateMutex();
+  }
+
+  lockSensor(sensor);
+  bool ready = openSensorLink(index);
+  if (ready) {
+    sensor.finger->getTemplateCount();
+
+    // Adaptation starts from the sensor's stored level, pulled into range.
+    // A level that couldn't be read (0) is written too; if that fails as
+    // well it stays 0 and adaptSecurity leaves the sensor alone.
+    uint8_t level = constrain(sensor.securityLevel, CAPTURE_SECURITY_MIN,
+                              CAPTURE_SECURITY_MAX);
+    if (level != sensor.securityLevel &&
+        sensor.finger->setSecurityLevel(level) == FINGERPRINT_OK) {
+      sensor.securityLevel = level;
     }
+  }
+  unlockSensor(sensor);
+  sensor.ready = ready;
 
-    p = finger.getImage();
-    switch (p) {
-      case FINGERPRINT_OK:
-        printBoth("Image taken");
-        break;
-      case FINGERPRINT_NOFINGER:
-        printBoth(".");
-        break;
-      case FINGERPRINT_PACKETRECIEVEERR:
-        printBoth("Communication error");
-        break;
-      case FINGERPRINT_IMAGEFAIL:
-        printBoth("Imaging error");
-        break;
-      default:
-        printBoth("Unknown error");
-        break;
+  if (!ready) {
+    printfBoth("Did not find fingerprint sensor %u :(", index + 1);
+    return false;
+  }
+
+  printfBoth("Found fingerprint sensor %u! Stored Prints: %u of %u",
+             index + 1, sensor.finger->templateCount, sensor.finger->capacity);
+  if (sensor.finger->capacity > ROSTER_MAX_SLOTS) {
+    printfBoth("Sensor %u: slots from %u on can't be enrolled (ROSTER_MAX_SLOTS)",
+               index + 1, ROSTER_MAX_SLOTS);
+  }
+  if (sensor.finger->templateCount == 0) {
+    printfBoth(
+        "Sensor %u doesn't contain any fingerprint data. Please enroll a "
+        "fingerprint.",
+        index + 1);
+  }
+
+  if (sensor.task == nullptr) {
+    char name[16];
+    snprintf(name, sizeof(name), "capture%u", index + 1);
+    xTaskCreate(captureTask, name, SENSOR_TASK_STACK,
+                (void *)(uintptr_t)index, 2, &sensor.task);
+  }
+  return true;
+}
+
+bool initFingerprint() {
+  printBoth("Initializing sensor...");
+
+  if (scanQueue == nullptr) {
+    scanQueue = xQueueCreate(SCAN_QUEUE_LENGTH, sizeof(ScanEvent));
+  }
+
+  // Tuned UART rates; SPIFFS is mounted before this runs
+  loadSensorLinks();
+
+  bool anyReady = false;
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    anyReady |= initSensor(i);
+  }
+  sensorReady = anyReady;
+
+  // Keep booting so sync, BLE and the stored records stay usable
+  return sensorReady;
+}
+
+bool requireSensor() {
+  if (!sensorReady) {
+    printBoth("Fingerprint sensor not available. Use option 17 to retry.");
+  }
+  return sensorReady;
+}
+
+// Aura on/off for every sensor, used by the power manager around idle
+void setSensorAura(bool on) {
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    FingerprintSensor &sensor = sensors[i];
+    if (!sensor.ready || !lockSensor(sensor)) {
+      continue;
     }
+    sensor.finger->LEDcontrol(on ? FINGERPRINT_LED_ON : FINGERPRINT_LED_OFF, 0,
+                              FINGERPRINT_LED_BLUE);
+    unlockSensor(sensor);
+  }
+}
+
+// Enrollment runs as a session: each tick advances one sensor step, so the
+// device keeps serving BLE and serial while it waits for the finger.
+// Templates live on the sensor, so the finger is enrolled on each ready
+// sensor in turn.
+enum EnrollStep {
+  ENROLL_ASK_ID,        // Waiting for the slot number
+  ENROLL_FIRST_IMAGE,   // Waiting for the first placement
+  ENROLL_REMOVE,        // Waiting for the finger to lift
+  ENROLL_SECOND_IMAGE,  // Waiting for the second placement
+  ENROLL_ASK_AGAIN      // "Enroll another?" prompt
+};
+
+#define ENROLL_POLL_MS 250
+#define ENROLL_REMOVE_DELAY_MS 2000
+
+static EnrollStep enrollStep = ENROLL_ASK_ID;
+static uint16_t enrollId = 0;
+static uint8_t enrollSensor = 0;
+static unsigned long enrollNextPoll = 0;
+
+static void reportImageResult(uint8_t p) {
+  switch (p) {
+    case FINGERPRINT_OK:
+      printBoth("Image taken");
+      indicateSuccess();
+      break;
+    case FINGERPRINT_NOFINGER:
+      break;
+    case FINGERPRINT_PACKETRECIEVEERR:
+      printBoth("Communication error");
+      indicateFailure();
+      break;
+    case FINGERPRINT_IMAGEFAIL:
+      printBoth("Imaging error");
+      indicateFailure();
+      break;
+    default:
+      printBoth("Unknown error");
+      indicateFailure();
+      break;
   }
+}
 
-  // Continue with the rest of the enrollment process...
-  p = finger.image2Tz(2);
+static uint8_t convertImage(Adafruit_Fingerprint &reader, uint8_t slot) {
+  uint8_t p = reader.image2Tz(slot);
   switch (p) {
     case FINGERPRINT_OK:
       printBoth("Image converted");
       break;
     case FINGERPRINT_IMAGEMESS:
       printBoth("Image too messy");
-      return p;
+      break;
     case FINGERPRINT_PACKETRECIEVEERR:
       printBoth("Communication error");
-      return p;
+      break;
     case FINGERPRINT_FEATUREFAIL:
-      printBoth("Could not find fingerprint features");
-      return p;
     case FINGERPRINT_INVALIDIMAGE:
       printBoth("Could not find fingerprint features");
-      return p;
+      break;
     default:
       printBoth("Unknown error");
-      return p;
+      break;
   }
+  return p;
+}
 
-  p = finger.createModel();
+static uint8_t storeEnrollment(Adafruit_Fingerprint &reader, uint16_t id) {
+  uint8_t p = reader.createModel();
   if (p == FINGERPRINT_OK) {
     printBoth("Prints matched!");
   } else if (p == FINGERPRINT_PACKETRECIEVEERR) {
@@ -214,199 +406,464 @@ uint8_t getFingerprintEnroll(uint8_t id) {
     return p;
   }
 
-  p = finger.storeModel(id);
+  p = reader.storeModel(id);
   if (p == FINGERPRINT_OK) {
     printBoth("Stored!");
   } else if (p == FINGERPRINT_PACKETRECIEVEERR) {
     printBoth("Communication error");
-    return p;
   } else if (p == FINGERPRINT_BADLOCATION) {
     printBoth("Could not store in that location");
-    return p;
   } else if (p == FINGERPRINT_FLASHERR) {
     printBoth("Error writing to flash");
-    return p;
   } else {
     printBoth("Unknown error");
-    return p;
   }
+  return p;
+}
 
+// Highest ID enrollment accepts. The template goes to every ready sensor,
+// so the smallest library decides; the roster and roll call index end at
+// ROSTER_MAX_SLOTS. Slot 0 is never used.
+static uint16_t maxEnrollId() {
+  uint16_t slots = ROSTER_MAX_SLOTS;
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    if (sensors[i].ready && sensors[i].finger->capacity > 0) {
+      slots = min(slots, sensors[i].finger->capacity);
+    }
+  }
+  return slots - 1;
+}
+
+static bool validEnrollId(long id) {
+  if (id < 1 || id > maxEnrollId()) {
+    printfBoth("Invalid ID, use 1 to %u", maxEnrollId());
+    return false;
+  }
   return true;
 }
 
-int getFingerprintID() {
-  uint8_t p = finger.getImage();
-  if (p != FINGERPRINT_OK)
-    return -1;
+static void promptEnrollId() {
+  printBoth("Ready to enroll a fingerprint!");
+  printfBoth("Please type in the ID # (from 1 to %u) you want to save this "
+             "finger as...",
+             maxEnrollId());
+  printBoth("(Press 'C' to cancel and return to main menu)");
+  enrollStep = ENROLL_ASK_ID;
+}
 
-  p = finger.image2Tz();
-  if (p != FINGERPRINT_OK)
-    return -1;
+// Next ready sensor at or after index, SENSOR_COUNT if none
+static uint8_t nextReadySensor(uint8_t index) {
+  while (index < SENSOR_COUNT && !sensors[index].ready) {
+    index++;
+  }
+  return index;
+}
 
-  p = finger.fingerFastSearch();
-  if (p != FINGERPRINT_OK) {
-    // LED failure indication
+static void startSensorCapture() {
+  if (SENSOR_COUNT > 1) {
+    printfBoth("Place finger on sensor %u to enroll as #%u", enrollSensor + 1,
+               enrollId);
+  } else {
+    printfBoth("Waiting for valid finger to enroll as #%u", enrollId);
+  }
+  printBoth("(Press 'C' to cancel enrollment)");
+  enrollStep = ENROLL_FIRST_IMAGE;
+  enrollNextPoll = millis();
+}
+
+static void startEnrollCapture(uint16_t id) {
+  enrollId = id;
+  enrollSensor = nextReadySensor(0);
+  printfBoth("Enrolling ID #%u", id);
+  startSensorCapture();
+}
+
+static void finishEnrollment(bool enrolled) {
+  if (enrolled) {
+    // Same finger on the remaining sensors before reporting success
+    uint8_t next = nextReadySensor(enrollSensor + 1);
+    if (next < SENSOR_COUNT) {
+      enrollSensor = next;
+      indicateSuccess();
+      startSensorCapture();
+      return;
+    }
+    printBoth("Fingerprint enrolled successfully!");
+    indicateSuccess();
+  } else {
+    printBoth("Enrollment failed or was cancelled.");
     indicateFailure();
-    return -1;
   }
 
-  printBoth("Found ID #" + String(finger.fingerID) + " with confidence of " +
-            String(finger.confidence));
-  return finger.fingerID;
+  printBoth("\nEnrollment options:");
+  printBoth("1. Enroll another fingerprint");
+  printBoth("2. Return to main menu");
+  enrollStep = ENROLL_ASK_AGAIN;
 }
 
-void enrollFingerprint() {
-  printBoth("Ready to enroll a fingerprint!");
-  printBoth(
-      "Please type in the ID # (from 1 to 127) you want to save this finger "
-      "as...");
-  printBoth("(Press 'C' to cancel and return to main menu)");
+static SessionStatus enrollInput(const char *line) {
+  bool cancel = strcasecmp(line, "c") == 0;
 
-  // Check for cancellation during ID input
-  String input = readInput();
-  if (input == "c" || input == "C") {
-    printBoth("Enrollment cancelled by user");
-    return;
+  switch (enrollStep) {
+    case ENROLL_ASK_ID: {
+      if (cancel) {
+        printBoth("Enrollment cancelled by user");
+        return SESSION_DONE;
+      }
+      long id = atol(line);
+      if (!validEnrollId(id)) {  // ID #0 not allowed
+        printBoth("Returning to main menu.");
+        return SESSION_DONE;
+      }
+      startEnrollCapture(id);
+      return SESSION_CONTINUE;
+    }
+
+    case ENROLL_ASK_AGAIN:
+      if (strcmp(line, "1") == 0) {
+        promptEnrollId();
+        return SESSION_CONTINUE;
+      }
+      return SESSION_DONE;
+
+    default:
+      // Capture in progress: only cancellation is accepted
+      if (cancel) {
+        printBoth("Enrollment cancelled by user");
+        finishEnrollment(false);
+      }
+      return SESSION_CONTINUE;
   }
+}
 
-  uint8_t id = input.toInt();
-  if (id == 0) {  // ID #0 not allowed
-    printBoth("Invalid ID. Returning to main menu.");
-    return;
+// One step of the capture for the current sensor; called with its lock held
+static void enrollStepOnSensor(Adafruit_Fingerprint &reader) {
+  uint8_t p = reader.getImage();
+
+  switch (enrollStep) {
+    case ENROLL_FIRST_IMAGE:
+      reportImageResult(p);
+      if (p != FINGERPRINT_OK) {
+        break;
+      }
+      if (convertImage(reader, 1) != FINGERPRINT_OK) {
+        finishEnrollment(false);
+        break;
+      }
+      printBoth("Remove finger");
+      printBoth("(Press 'C' to cancel enrollment)");
+      enrollStep = ENROLL_REMOVE;
+      enrollNextPoll = millis() + ENROLL_REMOVE_DELAY_MS;
+      break;
+
+    case ENROLL_REMOVE:
+      if (p == FINGERPRINT_NOFINGER) {
+        printBoth("Place same finger again");
+        printBoth("(Press 'C' to cancel enrollment)");
+        enrollStep = ENROLL_SECOND_IMAGE;
+      }
+      break;
+
+    case ENROLL_SECOND_IMAGE:
+      reportImageResult(p);
+      if (p != FINGERPRINT_OK) {
+        break;
+      }
+      finishEnrollment(convertImage(reader, 2) == FINGERPRINT_OK &&
+                       storeEnrollment(reader, enrollId) == FINGERPRINT_OK);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static SessionStatus enrollTick() {
+  if (enrollStep == ENROLL_ASK_ID || enrollStep == ENROLL_ASK_AGAIN) {
+    return SESSION_CONTINUE;
   }
 
-  printBoth("Enrolling ID #" + String(id));
+  // Someone is standing at the sensor; don't light-sleep mid-enrollment
+  notePowerActivity();
 
-  // Try to enroll the fingerprint
-  uint8_t result = getFingerprintEnroll(id);
+  if ((long)(millis() - enrollNextPoll) < 0) {
+    return SESSION_CONTINUE;
+  }
+  enrollNextPoll = millis() + ENROLL_POLL_MS;
 
-  // Check if enrollment was successful
-  if (result == FINGERPRINT_OK || result == true) {
-    printBoth("Fingerprint enrolled successfully!");
-  } else {
-    printBoth("Enrollment failed or was cancelled.");
+  FingerprintSensor &sensor = sensors[enrollSensor];
+  if (lockSensor(sensor)) {
+    enrollStepOnSensor(*sensor.finger);
+    unlockSensor(sensor);
   }
+  return SESSION_CONTINUE;
 }
 
-void enrollMode() {
+// "enroll 5" starts capturing for slot 5 right away
+void enrollMode(const char *args) {
+  if (!requireSensor())
+    return;
+
   printBoth("Entering Enroll Mode...");
   printBoth("Follow instructions on serial monitor");
 
-  while (true) {
-    enrollFingerprint();
+  long id = atol(args);
+  if (args[0] != '\0' && validEnrollId(id)) {
+    startEnrollCapture(id);
+  } else {
+    promptEnrollId();
+  }
+  beginSession(enrollInput, enrollTick);
+}
 
-    printBoth("\nEnrollment options:");
-    printBoth("1. Enroll another fingerprint");
-    printBoth("2. Return to main menu");
+// Attendance mode is a session too: the capture tasks scan while it holds
+// the capture lease, its tick records their results. Other commands keep
+// working; only 'X' is consumed.
+enum AttendanceStep { ATTEND_ASK_DATE, ATTEND_SCANNING };
+
+static AttendanceStep attendStep = ATTEND_ASK_DATE;
+static unsigned long attendPromptAt = 0;
+static bool attendPromptPending = false;
+// When each template slot was last recorded, shared by all sensors
+// (millis() | 1; 0 means not since boot). One entry per slot, so no number
+// of other check-ins can push a student out of the duplicate window.
+static unsigned long lastRecordedAt[ROSTER_MAX_SLOTS];
+
+static void startScanning() {
+  printfBoth("Entering Attendance Mode for date: %s (session %u)", currentDate,
+             beginAttendanceSession());
+  printBoth("Place Finger... (Press 'X' to exit)");
+  attendStep = ATTEND_SCANNING;
+  attendPromptPending = false;
+  xQueueReset(scanQueue);  // Drop results left over from an earlier session
+  captureLeaseUntil = millis() + CAPTURE_LEASE_MS;
+}
 
-    String option = readInput();
-    if (option != "1") {
-      break;
+static SessionStatus attendanceInput(const char *line) {
+  if (attendStep == ATTEND_ASK_DATE) {
+    // Empty or 'x' keeps the clock; a mistyped date asks again
+    if (!applyCurrentDate(line) && line[0] != '\0' &&
+        strcasecmp(line, "x") != 0) {
+      promptCurrentDate();
+      return SESSION_CONTINUE;
     }
+    startScanning();
+    return SESSION_CONTINUE;
   }
+
+  if (strcasecmp(line, "x") == 0) {
+    printBoth("Exiting Attendance Mode...");
+    captureLeaseUntil = millis();
+    commitRecordLog();
+    return SESSION_DONE;
+  }
+  return SESSION_PASS;
 }
 
-void attendanceMode() {
-  // First set the date for attendance
-  setCurrentDate();
+// True if the ID was recorded within SCAN_DUPLICATE_WINDOW_MS, on any sensor
+static bool recentlyRecorded(uint16_t id) {
+  // Rounded like the stamp, or a repeat in the same millisecond would
+  // look 2^32 ms old
+  return id < ROSTER_MAX_SLOTS && lastRecordedAt[id] != 0 &&
+         (millis() | 1) - lastRecordedAt[id] < SCAN_DUPLICATE_WINDOW_MS;
+}
 
-  printBoth("Entering Attendance Mode for date: " + currentDate);
-  printBoth("Place Finger... (Press 'X' to exit)");
+static void rememberScan(uint16_t id) {
+  if (id < ROSTER_MAX_SLOTS) {
+    lastRecordedAt[id] = millis() | 1;
+  }
+}
 
-  while (true) {
-    // Check for exit command first (without blocking)
-    if (Serial.available() || receivedCommand.length() > 0) {
-      String cmd = "";
-
-      if (receivedCommand.length() > 0) {
-        cmd = String(receivedCommand.c_str());
-        receivedCommand = "";
-      } else {
-        cmd = Serial.readStringUntil('\n');
-        cmd.trim();
-      }
+static void handleScan(const ScanEvent &event) {
+  noteFingerImaged();
 
-      if (cmd == "x" || cmd == "X") {
-        printBoth("Exiting Attendance Mode...");
-        return;
-      }
+  if (!event.matched) {
+    // Only reached once quality retries are used up
+    if (event.outcome == CAPTURE_POOR_IMAGE ||
+        event.outcome == CAPTURE_FEATURE_FAIL) {
+      printBoth("Image unclear, press the whole finger flat and try again");
     }
+    // LED failure indication
+    indicateFailure();
+    return;
+  }
 
-    // Wait for a fingerprint to be detected
-    int fingerprintID = getFingerprintID();
+  if (recentlyRecorded(event.id)) {
+    sensors[event.sensor].stats.duplicates++;
+    printfBoth("ID #%u already recorded (sensor %u)", event.id,
+               event.sensor + 1);
+    return;
+  }
 
-    if (fingerprintID > 0) {
-      // Fingerprint found, add attendance
-      addAttendance(fingerprintID);
-      delay(2000);  // Delay before next scan
-      printBoth("Place Finger... (Press 'X' to exit)");
-    }
+  printfBoth("Found ID #%u with confidence of %u (sensor %u)", event.id,
+             event.confidence, event.sensor + 1);
+  SensorStats &stats = sensors[event.sensor].stats;
+  stats.checkIns++;
+  stats.checkInImages += event.images;
+  stats.firstAttemptCheckIns += event.images == 1 ? 1 : 0;
+  rememberScan(event.id);
+  addAttendance(event.id);
+  noteSyncActivity();
+  attendPromptAt = millis() + ATTEND_HOLD_MS;
+  attendPromptPending = true;
+}
 
-    // Handle BLE connection states
-    if (!deviceConnected && oldDeviceConnected) {
-      delay(500);
-      pServer->startAdvertising();
-      oldDeviceConnected = deviceConnected;
-    }
-    if (deviceConnected && !oldDeviceConnected) {
-      oldDeviceConnected = deviceConnected;
-    }
+static SessionStatus attendanceTick() {
+  if (attendStep != ATTEND_SCANNING) {
+    return SESSION_CONTINUE;
+  }
+
+  // Capture tasks keep scanning while this tick keeps renewing the lease
+  captureLeaseUntil = millis() + CAPTURE_LEASE_MS;
 
-    delay(100);  // Small delay to avoid spamming the sensor
+  if (attendPromptPending && (long)(millis() - attendPromptAt) >= 0) {
+    printBoth("Place Finger... (Press 'X' to exit)");
+    attendPromptPending = false;
   }
+
+  ScanEvent event;
+  bool handled = false;
+  while (xQueueReceive(scanQueue, &event, 0) == pdTRUE) {
+    handleScan(event);
+    handled = true;
+  }
+
+  if (!handled) {
+    // Uploads the backlog only after a lull in scanning (SYNC_IDLE_MS);
+    // scans taken meanwhile wait in the queue
+    serviceSyncScheduler();
+  }
+  return SESSION_CONTINUE;
 }
 
-void clearAllFingerprints() {
-  printBoth("Are you sure you want to clear all fingerprints? (Y/N)");
+// Scans are stamped by the clock, so "attend" starts right away once it is
+// set; "attend 19/5 08:30" sets it first. Only an untrusted clock (never
+// set, or restored after a power loss) still asks for the date, or on a
+// headless reader first tries SNTP. Records it stamps anyway are held back
+// from sync until the clock is set.
+void attendanceMode(const char *args) {
+  if (!requireSensor())
+    return;
 
-  String confirmation = readInput();
-  if (confirmation == "Y" || confirmation == "y") {
-    printBoth("Clearing all fingerprints...");
+  if (!FEATURE_CONSOLE && !timeTrusted()) {
+    fetchClock();
+  }
+
+  if (args[0] != '\0' ? applyCurrentDate(args)
+                      : timeTrusted() || !FEATURE_CONSOLE) {
+    startScanning();
+  } else {
+    showClock();
+    promptCurrentDate();
+    attendStep = ATTEND_ASK_DATE;
+  }
+  beginSession(attendanceInput, attendanceTick);
+}
+
+static void eraseAllFingerprints() {
+  printBoth("Clearing all fingerprints...");
+
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    FingerprintSensor &sensor = sensors[i];
+    if (!sensor.ready || !lockSensor(sensor)) {
+      continue;
+    }
+    uint8_t p = sensor.finger->emptyDatabase();
+    unlockSensor(sensor);
 
-    uint8_t p = finger.emptyDatabase();
     if (p == FINGERPRINT_OK) {
-      printBoth("All fingerprints cleared successfully!");
+      printfBoth("All fingerprints cleared successfully on sensor %u!", i + 1);
     } else {
-      printBoth("Failed to clear fingerprints.");
+      printfBoth("Failed to clear fingerprints on sensor %u.", i + 1);
     }
+  }
+}
+
+static SessionStatus clearFingerprintsInput(const char *line) {
+  if (strcasecmp(line, "Y") == 0) {
+    eraseAllFingerprints();
   } else {
     printBoth("Clear operation canceled.");
   }
-  delay(2000);
+  return SESSION_DONE;
 }
 
-void showFingerprintCount() {
-  printBoth("Retrieving fingerprint count...");
-
-  // Get the current template count from the sensor
-  uint8_t p = finger.getTemplateCount();
+// "clear-prints Y" skips the confirmation prompt
+void clearAllFingerprints(const char *args) {
+  if (!requireSensor())
+    return;
 
-  if (p == FINGERPRINT_OK) {
-    printBoth("=== Fingerprint Count ===");
-    printBoth("Total registered fingerprints: " + String(finger.templateCount));
-    printBoth("Maximum capacity: 127");
-    printBoth("Available slots: " + String(127 - finger.templateCount));
-    printBoth("========================");
-  } else {
-    printBoth("Error retrieving fingerprint count from sensor.");
+  if (strcasecmp(args, "Y") == 0) {
+    eraseAllFingerprints();
+    return;
   }
 
-  delay(2000);
+  printBoth("Are you sure you want to clear all fingerprints? (Y/N)");
+  beginSession(clearFingerprintsInput);
 }
 
-uint8_t readnumber() {
-  uint8_t num = 0;
+void showFingerprintCount() {
+  if (!requireSensor())
+    return;
+
+  printBoth("Retrieving fingerprint count...");
+  printBoth("=== Fingerprint Count ===");
+
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    FingerprintSensor &sensor = sensors[i];
+    if (!sensor.ready || !lockSensor(sensor)) {
+      printfBoth("Sensor %u: not available", i + 1);
+      continue;
+    }
 
-  while (num == 0) {
-    String input = readInput();
-    if (input.length() > 0) {
-      num = input.toInt();
+    // Get the current template count from the sensor
+    uint8_t p = sensor.finger->getTemplateCount();
+    uint16_t templates = sensor.finger->templateCount;
+    unlockSensor(sensor);
 
-      // If conversion resulted in 0, check if it was actually "0"
-      if (num == 0 && input != "0") {
-        printBoth("Please enter a valid number");
-      }
+    if (p == FINGERPRINT_OK) {
+      uint16_t capacity = sensor.finger->capacity;
+      printfBoth("Sensor %u: %u registered, capacity %u, %d free", i + 1,
+                 templates, capacity, (int)capacity - templates);
+    } else {
+      printfBoth("Sensor %u: error retrieving fingerprint count", i + 1);
+    }
+  }
+  printBoth("========================");
+}
+
+void showSensorStats() {
+  printBoth("=== Sensor Statistics ===");
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    const FingerprintSensor &sensor = sensors[i];
+    const SensorStats &stats = sensor.stats;
+    printfBoth("Sensor %u (UART%u): %s", i + 1, pinTable[i].uart,
+               sensor.ready ? "ready" : "not found");
+    printfBoth("  scans %u, matched %u, missed %u, duplicates %u, dropped %u",
+               (unsigned)stats.images, (unsigned)stats.matches,
+               (unsigned)stats.misses, (unsigned)stats.duplicates,
+               (unsigned)stats.dropped);
+    printfBoth(
+        "  unmatched: %u poor image, %u feature fail, %u error; %u retries",
+        (unsigned)stats.poorImages, (unsigned)stats.featureFails,
+        (unsigned)stats.errors, (unsigned)stats.retries);
+    if (stats.images > 0) {
+      printfBoth("  scan ms: last %u, avg %u, max %u",
+                 (unsigned)stats.lastScanMs,
+                 (unsigned)(stats.totalScanMs / stats.images),
+                 (unsigned)stats.maxScanMs);
     }
+    if (stats.checkIns > 0) {
+      uint32_t meanHundredths = stats.checkInImages * 100 / stats.checkIns;
+      printfBoth("  check-ins %u, first attempt %u%%, mean attempts %u.%02u",
+                 (unsigned)stats.checkIns,
+                 (unsigned)(stats.firstAttemptCheckIns * 100 / stats.checkIns),
+                 (unsigned)(meanHundredths / 100),
+                 (unsigned)(meanHundredths % 100));
+    }
+    printfBoth("  security level %u (adapts %u-%u), changed %u times",
+               sensor.securityLevel, CAPTURE_SECURITY_MIN,
+               CAPTURE_SECURITY_MAX, (unsigned)stats.securityChanges);
   }
-  return num;
-}
\ No newline at end of file
+  printBoth("=========================");
+}
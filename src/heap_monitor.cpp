@@ -0,0 +1,65 @@
+#include "heap_monitor.h"
+#include "arena.h"
+#include "ble_manager.h"
+#include "config.h"
+#include "trace.h"
+#include <esp_heap_caps.h>
+
+// Globals
+HeapStats heapStats = {};
+
+static unsigned long lastSample = 0;
+static unsigned long lastTraced = 0;
+
+void sampleHeap()
+{
+    uint32_t freeBytes = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    uint32_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    uint8_t fragmentation = freeBytes > 0 ? 100 - (uint8_t)((uint64_t)largestBlock * 100 / freeBytes) : 0;
+
+    heapStats.freeBytes = freeBytes;
+    heapStats.largestBlock = largestBlock;
+    heapStats.fragmentation = fragmentation;
+    if (heapStats.samples == 0 || freeBytes < heapStats.minFreeBytes)
+    {
+        heapStats.minFreeBytes = freeBytes;
+    }
+    if (fragmentation > heapStats.worstFragmentation)
+    {
+        heapStats.worstFragmentation = fragmentation;
+    }
+    heapStats.samples++;
+}
+
+// Cheap enough for loop(); sampling on a timer catches drift between commands
+void serviceHeapMonitor()
+{
+    if (heapStats.samples > 0 && millis() - lastSample < HEAP_SAMPLE_INTERVAL_MS)
+    {
+        return;
+    }
+    lastSample = millis();
+    sampleHeap();
+
+    // Coarser than the sampling so heap entries don't crowd scans out of the trace
+    if (millis() - lastTraced >= TRACE_HEAP_INTERVAL_MS || lastTraced == 0)
+    {
+        lastTraced = millis();
+        trace(TRACE_HEAP, heapStats.fragmentation, (uint16_t)(heapStats.freeBytes / 1024));
+    }
+}
+
+void showHeapStats()
+{
+    sampleHeap();
+    printBoth("=== Heap (internal RAM) ===");
+    printfBoth("Free: %u bytes, largest block: %u bytes", (unsigned)heapStats.freeBytes, (unsigned)heapStats.largestBlock);
+    printfBoth("Fragmentation: %u%% (worst %u%%)", heapStats.fragmentation, heapStats.worstFragmentation);
+    printfBoth("Minimum free since boot: %u bytes (%u samples)", (unsigned)heapStats.minFreeBytes, (unsigned)heapStats.samples);
+    if (psramFound())
+    {
+        printfBoth("PSRAM free: %u bytes", (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    }
+    showArenaStats(opArena);
+    printBoth("===========================");
+}
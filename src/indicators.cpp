@@ -1,42 +1,61 @@
 #include "indicators.h"
 #include "ble_manager.h"
 
+#if FEATURE_LEDS
 // Globals
 Adafruit_NeoPixel pixels(NUM_PIXELS, NEOPIXEL_PIN, NEO_GRB + NEO_KHZ800);
 
+static unsigned long indicatorOffAt = 0;
+
+// Shows a status colour for a second without blocking; serviceIndicators() turns it off
+static void flashIndicator(uint32_t color)
+{
+    pixels.setPixelColor(0, color);
+    pixels.show();
+    indicatorOffAt = millis() + 1000;
+    if (indicatorOffAt == 0)
+    {
+        indicatorOffAt = 1;
+    }
+}
+
 void setupRGB()
 {
     // Initialize NeoPixel
     pixels.begin();
     pixels.setBrightness(50); // Set brightness (0-255)
 
-    // Quick test flash - red then green
-    pixels.setPixelColor(0, pixels.Color(0, 255, 0)); // Green
-    pixels.show();
-    delay(300);
-    pixels.setPixelColor(0, pixels.Color(255, 0, 0)); // Red
-    pixels.show();
-    delay(300);
-    pixels.setPixelColor(0, pixels.Color(0, 0, 0)); // Turn off
+    // Start dark; the boot sequence shows green once it's ready to scan
+    pixels.setPixelColor(0, pixels.Color(0, 0, 0));
     pixels.show();
 
     printBoth("NeoPixel LED initialized");
 }
 
-void indicateSuccess()
+// Steady colour, until the next call or status flash
+void setIndicator(uint8_t red, uint8_t green, uint8_t blue)
 {
-    pixels.setPixelColor(0, pixels.Color(0, 255, 0)); // Green
-    pixels.show();
-    delay(1000);
-    pixels.setPixelColor(0, pixels.Color(0, 0, 0)); // Turn off
+    pixels.setPixelColor(0, pixels.Color(red, green, blue));
     pixels.show();
 }
 
+void indicateSuccess()
+{
+    flashIndicator(pixels.Color(0, 255, 0)); // Green
+}
+
 void indicateFailure()
 {
-    pixels.setPixelColor(0, pixels.Color(255, 0, 0)); // Red
-    pixels.show();
-    delay(1000);
-    pixels.setPixelColor(0, pixels.Color(0, 0, 0)); // Turn off
-    pixels.show();
-}
\ No newline at end of file
+    flashIndicator(pixels.Color(255, 0, 0)); // Red
+}
+
+void serviceIndicators()
+{
+    if (indicatorOffAt != 0 && (long)(millis() - indicatorOffAt) >= 0)
+    {
+        pixels.setPixelColor(0, pixels.Color(0, 0, 0)); // Turn off
+        pixels.show();
+        indicatorOffAt = 0;
+    }
+}
+#endif // FEATURE_LEDS
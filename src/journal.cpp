@@ -0,0 +1,221 @@
+#include "journal.h"
+#include "ble_manager.h"
+#include "telemetry.h"
+#include <SPIFFS.h>
+#include <esp_rom_crc.h>
+
+#define JOURNAL_MAGIC 0x314C4E4A // "JNL1"
+#define JOURNAL_RECOVER_MAX 8    // Uncommitted copies removed per boot
+
+static void tempPath(const char *path, char *out, size_t size)
+{
+    snprintf(out, size, "%s" JOURNAL_TEMP_SUFFIX, path);
+}
+
+static uint32_t entryCrc(const JournalEntry &entry)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&entry, offsetof(JournalEntry, crc));
+}
+
+// Removes the old file and renames the committed copy over it. Safe to
+// repeat: after a reset part-way through, the next mount runs it again.
+static bool install(const char *path, const char *temp)
+{
+    if (!SPIFFS.exists(temp))
+    {
+        return SPIFFS.exists(path); // Renamed before the reset
+    }
+    if (SPIFFS.exists(path) && !SPIFFS.remove(path))
+    {
+        return false;
+    }
+    return SPIFFS.rename(temp, path);
+}
+
+// True with entry filled when the journal commits a replacement. A torn
+// journal write fails the CRC: that replacement never committed.
+static bool readJournal(JournalEntry &entry)
+{
+    memset(&entry, 0, sizeof(entry));
+    File file = SPIFFS.open(JOURNAL_FILE, FILE_READ);
+    if (!file)
+    {
+        return false;
+    }
+    bool committed = file.read((uint8_t *)&entry, sizeof(entry)) == sizeof(entry) && entry.magic == JOURNAL_MAGIC &&
+                     entry.crc == entryCrc(entry) && memchr(entry.path, '\0', sizeof(entry.path)) != nullptr;
+    file.close();
+    return committed;
+}
+
+// Deletes copies no journal entry commits. The copy a pending journal
+// names is kept: it holds the committed contents.
+static void removeUncommitted()
+{
+    char stale[JOURNAL_RECOVER_MAX][LOG_PATH_MAX];
+    uint8_t count = 0;
+    size_t suffixLength = strlen(JOURNAL_TEMP_SUFFIX);
+
+    char pending[LOG_PATH_MAX + 4] = "";
+    JournalEntry entry;
+    if (readJournal(entry))
+    {
+        tempPath(entry.path, pending, sizeof(pending));
+    }
+
+    File root = SPIFFS.open("/");
+    File file = root.openNextFile();
+    while (file && count < JOURNAL_RECOVER_MAX)
+    {
+        const char *name = file.name();
+        size_t length = strlen(name);
+        if (length > suffixLength && strcmp(name + length - suffixLength, JOURNAL_TEMP_SUFFIX) == 0)
+        {
+            snprintf(stale[count], LOG_PATH_MAX, "%s%s", name[0] == '/' ? "" : "/", name);
+            count += strcmp(stale[count], pending) != 0 ? 1 : 0;
+        }
+        file.close();
+        file = root.openNextFile();
+    }
+    root.close();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        SPIFFS.remove(stale[i]);
+    }
+    if (count > 0)
+    {
+        printfBoth("Removed %u uncommitted file copies", count);
+    }
+}
+
+// Installs the replacement the journal commits, if any, and only then
+// removes the journal. False while it is still pending: the journal and
+// its copy stay, and no other replacement may start.
+static bool finishCommitted()
+{
+    if (!SPIFFS.exists(JOURNAL_FILE))
+    {
+        return true;
+    }
+
+    JournalEntry entry;
+    if (!readJournal(entry))
+    {
+        SPIFFS.remove(JOURNAL_FILE);
+        return true;
+    }
+
+    char temp[LOG_PATH_MAX + 4];
+    tempPath(entry.path, temp, sizeof(temp));
+    if (SPIFFS.exists(temp))
+    {
+        // The copy was closed before the commit, so a size mismatch means
+        // it was damaged since; the old file is the best left
+        File copy = SPIFFS.open(temp, FILE_READ);
+        bool intact = copy && copy.size() == entry.size;
+        copy.close();
+        if (!intact)
+        {
+            printfBoth("Committed copy of %s is damaged, keeping the old file", entry.path);
+            SPIFFS.remove(temp);
+            SPIFFS.remove(JOURNAL_FILE);
+            return true;
+        }
+    }
+
+    if (!install(entry.path, temp))
+    {
+        printfBoth("Update of %s is still pending", entry.path);
+        return false;
+    }
+    SPIFFS.remove(JOURNAL_FILE);
+    printfBoth("Completed interrupted update of %s", entry.path);
+    return true;
+}
+
+// Runs once after mounting, before anything reads a journaled file
+void recoverJournal()
+{
+    finishCommitted();
+    removeUncommitted();
+}
+
+// Refused while an earlier committed replacement can't be installed, so
+// the single journal never has to describe two
+File beginReplace(const char *path)
+{
+    if (!finishCommitted())
+    {
+        return File();
+    }
+    char temp[LOG_PATH_MAX + 4];
+    tempPath(path, temp, sizeof(temp));
+    return SPIFFS.open(temp, FILE_WRITE);
+}
+
+void abortReplace(File &file, const char *path)
+{
+    file.close();
+    char temp[LOG_PATH_MAX + 4];
+    tempPath(path, temp, sizeof(temp));
+    SPIFFS.remove(temp);
+}
+
+// Closes the copy, commits it in the journal and installs it. A reset at
+// any point leaves either the old file or, after recovery, the new one.
+bool commitReplace(File &file, const char *path)
+{
+    size_t size = file.size();
+    file.close();
+
+    JournalEntry entry = {};
+    entry.magic = JOURNAL_MAGIC;
+    entry.size = size;
+    strlcpy(entry.path, path, sizeof(entry.path));
+    entry.crc = entryCrc(entry);
+
+    File journal = SPIFFS.open(JOURNAL_FILE, FILE_WRITE);
+    if (!journal)
+    {
+        abortReplace(file, path);
+        return false;
+    }
+    size_t written = journal.write((const uint8_t *)&entry, sizeof(entry));
+    journal.close();
+    noteFlashWrite(written);
+    if (written != sizeof(entry))
+    {
+        SPIFFS.remove(JOURNAL_FILE);
+        abortReplace(file, path);
+        return false;
+    }
+
+    // Committed: if this fails the journal stays, and the next replacement
+    // or the next mount finishes the job before anything else
+    char temp[LOG_PATH_MAX + 4];
+    tempPath(path, temp, sizeof(temp));
+    bool installed = install(path, temp);
+    if (installed)
+    {
+        SPIFFS.remove(JOURNAL_FILE);
+    }
+    return installed;
+}
+
+bool replaceFile(const char *path, const void *data, size_t size)
+{
+    File file = beginReplace(path);
+    if (!file)
+    {
+        return false;
+    }
+    size_t written = file.write((const uint8_t *)data, size);
+    noteFlashWrite(written);
+    if (written != size)
+    {
+        abortReplace(file, path);
+        return false;
+    }
+    return commitReplace(file, path);
+}
@@ -1,112 +1,156 @@
 #include <Arduino.h>
+#include "arena.h"
+#include "attendance_index.h"
 #include "ble_manager.h"
+#include "boot_profiler.h"
+#include "commands.h"
 #include "config.h"
 #include "fingerprint.h"
+#include "heap_monitor.h"
 #include "indicators.h"
+#include "power_manager.h"
+#include "record_log.h"
+#include "roster.h"
 #include "storage.h"
 #include "sync.h"
+#include "sync_scheduler.h"
+#include "telemetry.h"
+#include "template_search.h"
+#include "time_source.h"
+#include "trace.h"
+#include "usb_export.h"
 #include "wifi_manager.h"
+#include <freertos/event_groups.h>
 
 // Global variables
 int u = 0;
 int v = 0;
 int count = 0;
 
-// Function prototypes
-void showMainMenu();
+#define BOOT_SENSOR_DONE BIT0
+#define BOOT_BLE_DONE BIT1
+#define BOOT_STORAGE_DONE BIT2
 
-void setup() {
-  Serial.begin(115200);
-  delay(1000);  // Allow serial to stabilize
+static EventGroupHandle_t bootEvents = nullptr;
 
-  Serial.println("System initializing...");
+// Sensor handshake runs alongside BLE bring-up; it needs SPIFFS for the
+// tuned UART rate, and the sensor is still powering up meanwhile anyway
+static void sensorInitTask(void *param) {
+  xEventGroupWaitBits(bootEvents, BOOT_STORAGE_DONE, pdFALSE, pdTRUE,
+                      portMAX_DELAY);
+  initFingerprint();
+  bootMark("sensor");
+  xEventGroupSetBits(bootEvents, BOOT_SENSOR_DONE);
+  vTaskDelete(nullptr);
+}
 
-  // Setup BLE
+#if FEATURE_BLE_CONSOLE
+// BLE stack bring-up is slow; advertising starts later from setup()
+static void bleInitTask(void *param) {
   setupBLE();
+  bootMark("ble");
+  xEventGroupSetBits(bootEvents, BOOT_BLE_DONE);
+  vTaskDelete(nullptr);
+}
+#endif
 
-  // Initialize SPIFFS
-  initSPIFFS();
+void setup() {
+  // First, so nothing traces into an uninitialised ring
+  initTrace();
+  initTelemetry();
 
-  // Initialize fingerprint sensor
-  initFingerprint();
+  Serial.begin(115200);
+  bootMark("serial");
+
+  Serial.println("System initializing...");
 
   // Initialize RGB LED
   setupRGB();
 
-  delay(2000);
+  // Independent subsystems come up concurrently
+  bootEvents = xEventGroupCreate();
+  xTaskCreate(sensorInitTask, "sensor_init", 4096, nullptr, 2, nullptr);
+#if FEATURE_BLE_CONSOLE
+  xTaskCreate(bleInitTask, "ble_init", 4096, nullptr, 1, nullptr);
+#else
+  xEventGroupSetBits(bootEvents, BOOT_BLE_DONE);
+#endif
 
-  // Prompt user to select mode
-  showMainMenu();
-}
+  // Sync and export buffers come from PSRAM, away from the WiFi/BLE heap
+  initArena(opArena, ARENA_PSRAM_BYTES, ARENA_INTERNAL_BYTES);
 
-void showMainMenu() {
-  printBoth("\n=== Attendance System Menu ===");
-  printBoth("1. Enroll Mode");
-  printBoth("2. Attendance Mode");
-  printBoth("3. Clear All Fingerprints");
-  printBoth("4. View Stored Records");
-  printBoth("5. Sync to Google Sheets");
-  printBoth("6. Clear Attendance Data");
-  printBoth("7. Set Current Date");
-  printBoth("8. Update WiFi Settings");
-  printBoth("9. Show Fingerprint Count");
-  printBoth("10. Show Menu (Help)");
-  printBoth("==============================");
-}
+  // Initialize SPIFFS
+  initSPIFFS();
+  xEventGroupSetBits(bootEvents, BOOT_STORAGE_DONE);
 
-void loop() {
-  // Handle BLE connectivity changes
-  if (!deviceConnected && oldDeviceConnected) {
-    delay(500);                   // Give the bluetooth stack time to catch up
-    pServer->startAdvertising();  // Restart advertising
-    Serial.println("Start advertising");
-    oldDeviceConnected = deviceConnected;
-  }
+  // Load the sync endpoint (defaults to the Google Apps Script deployment)
+  loadSyncSettings();
 
-  if (deviceConnected && !oldDeviceConnected) {
-    // Device just connected
-    oldDeviceConnected = deviceConnected;
-  }
+  // Slot range searched before the full template library
+  loadSearchSettings();
 
-  // Check for input from either Serial or BLE
-  String mode = readInput();
+  // Slot -> student table, held in RAM so scans don't touch the file
+  loadRoster();
 
-  if (mode.length() > 0) {
-    if (mode == "1") {
-      enrollMode();
+  // Per-date roll calls and per-student counts; needs the roster to map
+  // student numbers back to slots if it has to rebuild from the log
+  initAttendanceIndex();
+  bootMark("spiffs");
 
-    } else if (mode == "2") {
-      attendanceMode();
+  // Start background sync once storage has counted the backlog
+  initSyncScheduler();
 
-    } else if (mode == "3") {
-      clearAllFingerprints();
+  initPowerManager();
 
-    } else if (mode == "4") {
-      viewStoredRecords();
+  // Bulk export port, separate from the UART0 console
+  initUsbExport();
 
-    } else if (mode == "5") {
-      printBoth("Syncing data to Google Sheets...");
-      syncToGoogle();
+  // Both init tasks have bounded timeouts, so this wait is bounded too
+  xEventGroupWaitBits(bootEvents, BOOT_SENSOR_DONE | BOOT_BLE_DONE, pdFALSE,
+                      pdTRUE, portMAX_DELAY);
 
-    } else if (mode == "6") {
-      clearAttendanceData();
+  // Only advertise once a connecting client would find a working reader
+  startBLEAdvertising();
+  bootMark("ready");
 
-    } else if (mode == "7") {
-      setCurrentDate();
+  if (sensorReady) {
+    setIndicator(0, 32, 0);
+  } else {
+    setIndicator(32, 0, 0);
+  }
 
-    } else if (mode == "8") {
-      updateWiFiSettings();
+  printBootReport();
 
-    } else if (mode == "9") {
-      showFingerprintCount();
+#if FEATURE_CONSOLE
+  // Prompt user to select mode
+  showMainMenu();
+#else
+  // Nobody to pick a mode: scan straight away, after one try at SNTP if
+  // the clock isn't trusted
+  attendanceMode("");
+#endif
+}
 
-    } else if (mode == "10" || mode == "?" || mode.equalsIgnoreCase("help")) {
-      // Allow multiple inputs to trigger the help menu
-      showMainMenu();
-    } else {
-      showMainMenu();
-    }
+void loop() {
+  serviceBLE();
+
+  // Route input to the active dialog/mode or the command table, tick sessions
+  serviceCommands();
+  serviceIndicators();
+  serviceHeapMonitor();
+  serviceTimeSource();
+  serviceRecordLog();
+
+  // Runs in every mode: a headless reader is always in attendance mode
+  serviceUsbExport();
+
+  // Attendance mode runs the scheduler between scans itself; other
+  // sessions (dialogs, enrollment) shouldn't be interrupted by an upload
+  if (!sessionActive()) {
+    serviceSyncScheduler();
   }
 
-  delay(20);  // Short delay to avoid taxing the CPU
-}
\ No newline at end of file
+  if (!idleLightSleep()) {
+    delay(10);  // Short delay to avoid taxing the CPU
+  }
+}
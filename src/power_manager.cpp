@@ -0,0 +1,183 @@
+#include "power_manager.h"
+#include "ble_manager.h"
+#include "config.h"
+#include "fingerprint.h"
+#include "indicators.h"
+#include "trace.h"
+#include "usb_export.h"
+#include "wifi_manager.h"
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+
+// Globals
+PowerStats powerStats = {};
+bool powerSaveEnabled = true;
+
+static unsigned long lastActivity = 0;
+static unsigned long touchWakeAt = 0;
+static bool awaitingScan = false;
+static bool peripheralsDimmed = false;
+
+void initPowerManager()
+{
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensorPins(i).touch >= 0)
+        {
+            pinMode(sensorPins(i).touch, INPUT);
+        }
+    }
+    lastActivity = millis();
+}
+
+void notePowerActivity()
+{
+    lastActivity = millis();
+}
+
+bool powerIdle()
+{
+    return powerSaveEnabled && millis() - lastActivity >= POWER_IDLE_BEFORE_SLEEP_MS;
+}
+
+static bool touchWakeWired()
+{
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensorPins(i).touch >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sensor aura and NeoPixel off; done once per idle period to keep UART quiet
+static void dimPeripherals()
+{
+    if (peripheralsDimmed)
+    {
+        return;
+    }
+
+    setSensorAura(false);
+    setIndicator(0, 0, 0);
+    peripheralsDimmed = true;
+}
+
+// Light-sleeps for up to one slice when nothing needs the CPU.
+// Wake sources: sensor touch line, UART0 RX, and the slice timer (which
+// also gives the BLE stack and the sync scheduler a chance to run).
+bool idleLightSleep()
+{
+    if (!powerIdle())
+    {
+        return false;
+    }
+
+    // An active BLE link, WiFi session or USB host would be dropped by light sleep
+    if (deviceConnected || wifiConnected() || usbHostAttached() || inputAvailable())
+    {
+        return false;
+    }
+
+    // Without a touch line nothing would wake the CPU for a finger, and
+    // check-ins would wait out a whole slice
+    if (captureActive() && !touchWakeWired())
+    {
+        return false;
+    }
+
+    dimPeripherals();
+    Serial.flush();
+
+    esp_sleep_enable_timer_wakeup((uint64_t)POWER_SLEEP_SLICE_MS * 1000);
+    // Any sensor's touch line wakes the CPU
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensorPins(i).touch >= 0)
+        {
+            gpio_wakeup_enable((gpio_num_t)sensorPins(i).touch,
+                               FINGER_TOUCH_ACTIVE_LEVEL ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+            esp_sleep_enable_gpio_wakeup();
+        }
+    }
+    uart_set_wakeup_threshold(UART_NUM_0, POWER_UART_WAKE_THRESHOLD);
+    esp_sleep_enable_uart_wakeup(UART_NUM_0);
+
+    int64_t sleepStart = esp_timer_get_time();
+    esp_light_sleep_start();
+    powerStats.sleptUs += esp_timer_get_time() - sleepStart;
+    powerStats.sleeps++;
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensorPins(i).touch >= 0)
+        {
+            gpio_wakeup_disable((gpio_num_t)sensorPins(i).touch);
+        }
+    }
+
+    switch (esp_sleep_get_wakeup_cause())
+    {
+    case ESP_SLEEP_WAKEUP_GPIO:
+        trace(TRACE_WAKE, ESP_SLEEP_WAKEUP_GPIO);
+        powerStats.touchWakes++;
+        touchWakeAt = millis();
+        awaitingScan = true;
+        peripheralsDimmed = false;
+        setSensorAura(true);
+        notePowerActivity();
+        break;
+    case ESP_SLEEP_WAKEUP_UART:
+        trace(TRACE_WAKE, ESP_SLEEP_WAKEUP_UART);
+        powerStats.uartWakes++;
+        notePowerActivity();
+        break;
+    default:
+        powerStats.timerWakes++;
+        break;
+    }
+
+    return true;
+}
+
+// Called once the sensor has captured an image; closes a wake-to-scan measurement
+void noteFingerImaged()
+{
+    notePowerActivity();
+    if (!awaitingScan)
+    {
+        return;
+    }
+    awaitingScan = false;
+
+    uint32_t latency = millis() - touchWakeAt;
+    powerStats.scansAfterWake++;
+    powerStats.lastWakeToScanMs = latency;
+    powerStats.totalWakeToScanMs += latency;
+    if (latency > powerStats.maxWakeToScanMs)
+    {
+        powerStats.maxWakeToScanMs = latency;
+    }
+}
+
+void showPowerStats()
+{
+    printBoth("=== Power Statistics ===");
+    printfBoth("Power save: %s", powerSaveEnabled ? "on" : "off");
+    printfBoth("Light sleeps: %u, asleep %u s of %lu s", (unsigned)powerStats.sleeps,
+               (unsigned)(powerStats.sleptUs / 1000000ULL), millis() / 1000);
+    printfBoth("Wakes: touch %u, serial %u, timer %u", (unsigned)powerStats.touchWakes,
+               (unsigned)powerStats.uartWakes, (unsigned)powerStats.timerWakes);
+
+    if (powerStats.scansAfterWake > 0)
+    {
+        printfBoth("Wake-to-scan ms: last %u, avg %u, max %u", (unsigned)powerStats.lastWakeToScanMs,
+                   (unsigned)(powerStats.totalWakeToScanMs / powerStats.scansAfterWake),
+                   (unsigned)powerStats.maxWakeToScanMs);
+    }
+    printBoth("========================");
+}
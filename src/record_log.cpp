@@ -0,0 +1,710 @@
+#include "record_log.h"
+#include "attendance_index.h"
+#include "ble_manager.h"
+#include "journal.h"
+#include "storage.h"
+#include "telemetry.h"
+#include "time_source.h"
+#include <SPIFFS.h>
+
+#define LOG_SEGMENT_PREFIX "att_"
+
+// Globals
+RecordLog recordLog = {};
+
+#if !LOG_BACKEND_PARTITION
+#define LOG_PENDING_MARKS (LOG_COMMIT_RECORDS * 4) // Buffered records before a failing commit refuses more
+
+// Roll call entry of a buffered record, applied once the record is on flash
+struct PendingMark
+{
+    uint32_t timestamp;
+    uint16_t slot;
+};
+
+// Appended lines not yet on flash; they belong to lastSegment
+static char pendingLines[LOG_PENDING_BYTES];
+static size_t pendingLength = 0;
+static uint16_t pendingRecords = 0;
+static unsigned long pendingSince = 0;
+static PendingMark pendingMarks[LOG_PENDING_MARKS];
+#endif
+
+// Marks a committed record present in the roll call. Only committed records
+// are indexed, so a reset can't leave the index counting a lost check-in.
+void indexCommittedRecord(uint32_t timestamp, uint16_t slot)
+{
+    if (timestamp == 0 || slot == 0)
+    {
+        return; // Undated, or not from a sensor slot
+    }
+    char date[DATE_MAX];
+    formatDate(timestamp, date, sizeof(date));
+    indexAttendance(date, slot);
+}
+
+// Corrected records that were held: unsynced ones were held until now
+static void indexReleasedRecord(const LogEntry &entry)
+{
+    if (entry.stamp == STAMP_CORRECTED && !entry.synced)
+    {
+        indexLogEntry(entry);
+    }
+}
+
+// The clock has been set, so held records now read back re-stamped. They
+// join the backlog, and the roll call, which skipped them while their date
+// was unknown, marks them present.
+void releaseHeldRecords()
+{
+    if (heldRecordCount == 0)
+    {
+        return;
+    }
+    unsyncedRecordCount += heldRecordCount;
+    heldRecordCount = 0;
+    forEachRecord(indexReleasedRecord);
+}
+
+// Starts a journaled replacement of LOG_SUMMARY_FILE holding its current
+// lines. A segment the summary already lists was summarised before a reset
+// stopped its removal: covered is set and nothing is added a second time.
+bool beginSummary(LogSummary &summary, uint32_t segment)
+{
+    summary.segment = segment;
+    summary.dateCount = 0;
+    summary.covered = false;
+    summary.written = 0;
+
+    File old = SPIFFS.open(LOG_SUMMARY_FILE, FILE_READ);
+    summary.file = beginReplace(LOG_SUMMARY_FILE);
+    if (!summary.file)
+    {
+        if (old)
+        {
+            old.close();
+        }
+        return false;
+    }
+
+    if (!old)
+    {
+        summary.written = summary.file.println("date,records,segment");
+        return true;
+    }
+    char line[RECORD_LINE_MAX];
+    while (old.available())
+    {
+        if (readRecordLine(old, line, sizeof(line)) == 0)
+        {
+            continue;
+        }
+        const char *comma = strrchr(line, ',');
+        summary.covered |= comma != nullptr && strtoul(comma + 1, nullptr, 10) == segment;
+        summary.written += summary.file.println(line);
+    }
+    old.close();
+
+    if (summary.covered)
+    {
+        abortReplace(summary.file, LOG_SUMMARY_FILE);
+    }
+    return true;
+}
+
+static void flushSummary(LogSummary &summary)
+{
+    char line[RECORD_LINE_MAX];
+    for (uint8_t i = 0; i < summary.dateCount; i++)
+    {
+        snprintf(line, sizeof(line), "%s,%u,%u", summary.dates[i].date, summary.dates[i].records,
+                 (unsigned)summary.segment);
+        summary.written += summary.file.println(line);
+    }
+    summary.dateCount = 0;
+}
+
+void tallySummary(LogSummary &summary, const char *date)
+{
+    if (summary.covered)
+    {
+        return;
+    }
+
+    uint8_t i = 0;
+    while (i < summary.dateCount && strcmp(summary.dates[i].date, date) != 0)
+    {
+        i++;
+    }
+    if (i == summary.dateCount)
+    {
+        if (summary.dateCount == LOG_SUMMARY_DATES)
+        {
+            flushSummary(summary);
+            i = 0;
+        }
+        strlcpy(summary.dates[i].date, date, sizeof(summary.dates[i].date));
+        summary.dates[i].records = 0;
+        summary.dateCount++;
+    }
+    summary.dates[i].records++;
+}
+
+// The commit point of the segment's counts; false if they weren't added
+bool endSummary(LogSummary &summary)
+{
+    if (summary.covered)
+    {
+        return true;
+    }
+    flushSummary(summary);
+    noteFlashWrite(summary.written);
+    return commitReplace(summary.file, LOG_SUMMARY_FILE);
+}
+
+#if !LOG_BACKEND_PARTITION
+
+static const char recordHeader[] = "timestamp,session,student_id,synced";
+
+void segmentPath(uint32_t segment, char *path, size_t size)
+{
+    snprintf(path, size, "/" LOG_SEGMENT_PREFIX "%05u.csv", (unsigned)segment);
+}
+
+// Segments written before records carried timestamps start "date,"
+bool legacySegment(const char *header)
+{
+    return strncmp(header, "date,", 5) == 0;
+}
+
+// Splits one line in place, "timestamp,session,student_id,synced" or the
+// legacy "date,student_id,status,synced"; false for malformed lines. A
+// timestamp taken by an untrusted clock starts with '~'. The synced field
+// must be exactly "0" or "1": a torn line that ran into the next one would
+// otherwise read as synced and its record never be sent.
+bool parseRecordLine(char *line, bool legacy, LogEntry &entry)
+{
+    char *fields[4];
+    fields[0] = line;
+    for (int i = 1; i < 4; i++)
+    {
+        char *comma = strchr(fields[i - 1], ',');
+        if (comma == nullptr)
+        {
+            return false;
+        }
+        *comma = '\0';
+        fields[i] = comma + 1;
+    }
+
+    if (strcmp(fields[3], "0") != 0 && strcmp(fields[3], "1") != 0)
+    {
+        return false;
+    }
+    entry.synced = fields[3][0] == '1';
+    entry.stamp = STAMP_TRUSTED;
+    if (legacy)
+    {
+        entry.timestamp = 0;
+        entry.session = 0;
+        strlcpy(entry.date, fields[0], sizeof(entry.date));
+        entry.studentId = fields[1];
+        return true;
+    }
+    bool trusted = fields[0][0] != '~';
+    entry.timestamp = strtoul(fields[0] + (trusted ? 0 : 1), nullptr, 10);
+    entry.session = strtoul(fields[1], nullptr, 10);
+    if (!trusted)
+    {
+        entry.stamp = correctStamp(entry.session, entry.timestamp);
+    }
+    formatDate(entry.timestamp, entry.date, sizeof(entry.date));
+    entry.studentId = fields[2];
+    return true;
+}
+
+// Segment number of a directory entry, 0 if it isn't a segment
+static uint32_t segmentNumber(const char *name)
+{
+    if (name[0] == '/')
+    {
+        name++;
+    }
+
+    size_t prefixLength = strlen(LOG_SEGMENT_PREFIX);
+    if (strncmp(name, LOG_SEGMENT_PREFIX, prefixLength) != 0)
+    {
+        return 0;
+    }
+
+    const char *digits = name + prefixLength;
+    size_t digitCount = strspn(digits, "0123456789");
+    if (digitCount == 0 || strcmp(digits + digitCount, ".csv") != 0)
+    {
+        return 0;
+    }
+    return strtoul(digits, nullptr, 10);
+}
+
+// Through the journal, so a segment never exists without its header
+static bool createSegment(uint32_t segment)
+{
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+
+    char header[sizeof(recordHeader) + 2];
+    int length = snprintf(header, sizeof(header), "%s\r\n", recordHeader);
+    return replaceFile(path, header, length);
+}
+
+// Parses a copy, leaving the line intact; false for malformed lines, which
+// sync skips and so must never be counted or marked. Held records are
+// unsynced too, but sync leaves them alone until the clock is set.
+static bool recordLineSynced(const char *line, bool legacy, bool &synced, bool &held)
+{
+    char fields[RECORD_LINE_MAX];
+    strlcpy(fields, line, sizeof(fields));
+    LogEntry entry;
+    if (!parseRecordLine(fields, legacy, entry))
+    {
+        return false;
+    }
+    synced = entry.synced;
+    held = !entry.synced && entry.stamp == STAMP_HELD;
+    return true;
+}
+
+// Record, unsynced-record and held-record counts of one segment
+static void scanSegment(uint32_t segment, uint32_t &records, uint32_t &unsynced, uint32_t &held)
+{
+    records = 0;
+    unsynced = 0;
+    held = 0;
+
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        return;
+    }
+
+    char line[RECORD_LINE_MAX];
+    readRecordLine(file, line, sizeof(line)); // Skip header
+    bool legacy = legacySegment(line);
+    bool synced, isHeld;
+    while (file.available())
+    {
+        if (readRecordLine(file, line, sizeof(line)) == 0 || !recordLineSynced(line, legacy, synced, isHeld))
+        {
+            continue;
+        }
+        records++;
+        if (!synced)
+        {
+            unsynced++;
+        }
+        if (isHeld)
+        {
+            held++;
+        }
+    }
+    file.close();
+}
+
+static bool segmentIsLegacy(uint32_t segment)
+{
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        return false;
+    }
+
+    char header[RECORD_LINE_MAX];
+    readRecordLine(file, header, sizeof(header));
+    file.close();
+    return legacySegment(header);
+}
+
+static void discoverSegments()
+{
+    recordLog.firstSegment = 0;
+    recordLog.lastSegment = 0;
+
+    File root = SPIFFS.open("/");
+    File entry = root.openNextFile();
+    while (entry)
+    {
+        uint32_t segment = segmentNumber(entry.name());
+        entry.close();
+        if (segment != 0)
+        {
+            if (recordLog.firstSegment == 0 || segment < recordLog.firstSegment)
+            {
+                recordLog.firstSegment = segment;
+            }
+            recordLog.lastSegment = max(recordLog.lastSegment, segment);
+        }
+        entry = root.openNextFile();
+    }
+    root.close();
+}
+
+// A reset during a commit can leave the active segment ending in part of a
+// line. Ending it there makes the next commit start a line of its own
+// instead of joining onto it; the fragment is left as a malformed line.
+static void terminateTornLine(uint32_t segment)
+{
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        return;
+    }
+    size_t size = file.size();
+    bool torn = size > 0 && file.seek(size - 1) && file.read() != '\n';
+    file.close();
+    if (!torn)
+    {
+        return;
+    }
+
+    file = SPIFFS.open(path, FILE_APPEND);
+    if (file)
+    {
+        size_t written = file.write((const uint8_t *)"\r\n", 2);
+        file.close();
+        noteFlashWrite(written);
+        printfBoth("Closed a torn line at the end of %s", path);
+    }
+}
+
+// Finds the segments, migrates a pre-segmentation log and rebuilds the
+// backlog counter. Only the segments that still hold unsynced records are
+// read: the backlog is a suffix of the log.
+void initRecordLog()
+{
+    discoverSegments();
+
+    if (recordLog.lastSegment == 0)
+    {
+        char path[LOG_PATH_MAX];
+        segmentPath(1, path, sizeof(path));
+        if (SPIFFS.exists(ATTENDANCE_FILE_PATH) && SPIFFS.rename(ATTENDANCE_FILE_PATH, path))
+        {
+            printBoth("Moved the attendance file into the first log segment");
+        }
+        else if (!createSegment(1))
+        {
+            printBoth("Failed to create the attendance log");
+            return;
+        }
+        recordLog.firstSegment = 1;
+        recordLog.lastSegment = 1;
+    }
+    terminateTornLine(recordLog.lastSegment);
+
+    unsyncedRecordCount = 0;
+    heldRecordCount = 0;
+    recordLog.syncSegment = recordLog.lastSegment;
+    for (uint32_t segment = recordLog.lastSegment; segment >= recordLog.firstSegment && segment > 0; segment--)
+    {
+        uint32_t records, unsynced, held;
+        scanSegment(segment, records, unsynced, held);
+        if (segment == recordLog.lastSegment)
+        {
+            recordLog.activeRecords = min(records, (uint32_t)UINT16_MAX);
+        }
+        if (unsynced == 0)
+        {
+            break;
+        }
+        unsyncedRecordCount += unsynced - held;
+        heldRecordCount += held;
+        recordLog.syncSegment = segment;
+    }
+
+    // New records never go into a segment in the old line format
+    if (segmentIsLegacy(recordLog.lastSegment) && createSegment(recordLog.lastSegment + 1))
+    {
+        recordLog.lastSegment++;
+        recordLog.activeRecords = 0;
+    }
+
+    printfBoth("Attendance log: segments %u-%u, unsynced records: %u, held for the clock: %u",
+               (unsigned)recordLog.firstSegment, (unsigned)recordLog.lastSegment, (unsigned)unsyncedRecordCount,
+               (unsigned)heldRecordCount);
+    compactRecordLog();
+}
+
+// Writes the pending lines to the active segment in one append. This is the
+// commit point for new records: everything before it is lost on a reset.
+bool commitRecordLog()
+{
+    if (pendingLength == 0)
+    {
+        return true;
+    }
+
+    char path[LOG_PATH_MAX];
+    segmentPath(recordLog.lastSegment, path, sizeof(path));
+    File file = SPIFFS.open(path, FILE_APPEND);
+    if (!file)
+    {
+        return false;
+    }
+    size_t written = file.write((const uint8_t *)pendingLines, pendingLength);
+    file.close();
+    noteFlashWrite(written);
+
+    // A short write keeps the rest for the next attempt
+    pendingLength -= written;
+    memmove(pendingLines, pendingLines + written, pendingLength);
+    if (pendingLength > 0)
+    {
+        return false;
+    }
+    for (uint16_t i = 0; i < pendingRecords; i++)
+    {
+        indexCommittedRecord(pendingMarks[i].timestamp, pendingMarks[i].slot);
+    }
+    pendingRecords = 0;
+    return true;
+}
+
+void serviceRecordLog()
+{
+    if (pendingLength > 0 && millis() - pendingSince >= LOG_COMMIT_MS)
+    {
+        commitRecordLog();
+    }
+}
+
+// Buffers the record; it reaches flash at the next commit, after at most
+// LOG_COMMIT_RECORDS records or LOG_COMMIT_MS, and is indexed under slot then
+// (a record stamped by an untrusted clock only once the clock is set)
+bool appendRecord(uint32_t timestamp, bool trusted, uint16_t session, const char *studentId, uint16_t slot)
+{
+    if (recordLog.activeRecords >= LOG_SEGMENT_RECORDS)
+    {
+        // Keep appending to the full segment if a new one can't be created
+        if (commitRecordLog() && createSegment(recordLog.lastSegment + 1))
+        {
+            recordLog.lastSegment++;
+            recordLog.activeRecords = 0;
+        }
+    }
+
+    // Format: timestamp,session,student_id,synced
+    char record[RECORD_LINE_MAX];
+    int length = snprintf(record, sizeof(record), "%s%lu,%u,%s,0\r\n", trusted ? "" : "~", (unsigned long)timestamp,
+                          session, studentId);
+    if ((pendingLength + length > sizeof(pendingLines) || pendingRecords >= LOG_PENDING_MARKS) && !commitRecordLog())
+    {
+        return false;
+    }
+
+    if (pendingLength == 0)
+    {
+        pendingSince = millis();
+    }
+    memcpy(pendingLines + pendingLength, record, length);
+    pendingLength += length;
+    pendingMarks[pendingRecords] = {trusted ? timestamp : 0, slot};
+    pendingRecords++;
+    recordLog.activeRecords++;
+
+    if (pendingRecords >= LOG_COMMIT_RECORDS)
+    {
+        commitRecordLog();
+    }
+    return true;
+}
+
+// Marks the first recordCount unsynced lines of one segment as synced by
+// replacing it through the journal. Only that segment is rewritten, so the
+// cost is bounded by LOG_SEGMENT_RECORDS whatever the size of the log.
+bool markSegmentSynced(uint32_t segment, size_t recordCount)
+{
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        printBoth("Failed to open file for reading");
+        return false;
+    }
+
+    File tempFile = beginReplace(path);
+    if (!tempFile)
+    {
+        printBoth("Failed to create temp file");
+        file.close();
+        return false;
+    }
+
+    // Copy the header
+    char line[RECORD_LINE_MAX];
+    readRecordLine(file, line, sizeof(line));
+    size_t written = tempFile.println(line);
+    bool legacy = legacySegment(line);
+    uint32_t remaining = 0;
+    bool synced, held;
+
+    while (file.available())
+    {
+        size_t length = readRecordLine(file, line, sizeof(line));
+        if (length == 0)
+        {
+            continue; // Skip empty lines
+        }
+
+        // Mark as synced by replacing the trailing 0 with 1. Malformed
+        // and held lines were never in a batch, so they're copied untouched.
+        if (recordLineSynced(line, legacy, synced, held) && !synced)
+        {
+            if (recordCount > 0 && !held)
+            {
+                line[length - 1] = '1';
+                recordCount--;
+            }
+            else
+            {
+                remaining++;
+            }
+        }
+        written += tempFile.println(line);
+    }
+
+    file.close();
+    noteFlashWrite(written);
+
+    // Replace the segment with the updated copy
+    if (!commitReplace(tempFile, path))
+    {
+        printBoth("Failed to replace the log segment");
+        return false;
+    }
+
+    if (remaining == 0 && segment == recordLog.syncSegment && segment < recordLog.lastSegment)
+    {
+        recordLog.syncSegment++;
+    }
+    return true;
+}
+
+// Adds "date,records,segment" lines for one segment to LOG_SUMMARY_FILE
+static bool summariseSegment(uint32_t segment)
+{
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        return true; // Nothing left to summarise
+    }
+
+    LogSummary summary;
+    if (!beginSummary(summary, segment))
+    {
+        file.close();
+        return false;
+    }
+
+    char line[RECORD_LINE_MAX];
+    readRecordLine(file, line, sizeof(line));
+    bool legacy = legacySegment(line);
+    LogEntry entry;
+    while (file.available())
+    {
+        if (readRecordLine(file, line, sizeof(line)) != 0 && parseRecordLine(line, legacy, entry))
+        {
+            tallySummary(summary, entry.date);
+        }
+    }
+
+    file.close();
+    return endSummary(summary);
+}
+
+static bool filesystemFull()
+{
+    size_t total = SPIFFS.totalBytes();
+    return total > 0 && SPIFFS.usedBytes() * 100 / total >= LOG_FULL_PERCENT;
+}
+
+// Fully synced segments beyond the newest LOG_RETAIN_SEGMENTS are folded
+// into per-date counts and deleted; all of them when flash is nearly full
+void compactRecordLog()
+{
+    while (recordLog.firstSegment < recordLog.syncSegment &&
+           (recordLog.syncSegment - recordLog.firstSegment > LOG_RETAIN_SEGMENTS || filesystemFull()))
+    {
+        if (!summariseSegment(recordLog.firstSegment))
+        {
+            printBoth("Failed to write the log summary, compaction stopped");
+            return;
+        }
+
+        char path[LOG_PATH_MAX];
+        segmentPath(recordLog.firstSegment, path, sizeof(path));
+        SPIFFS.remove(path);
+        recordLog.firstSegment++;
+        recordLog.compactedSegments++;
+    }
+}
+
+bool clearRecordLog()
+{
+    for (uint32_t segment = recordLog.firstSegment; segment <= recordLog.lastSegment && segment > 0; segment++)
+    {
+        char path[LOG_PATH_MAX];
+        segmentPath(segment, path, sizeof(path));
+        SPIFFS.remove(path);
+    }
+    SPIFFS.remove(LOG_SUMMARY_FILE);
+
+    pendingLength = 0;
+    pendingRecords = 0;
+    recordLog.firstSegment = 1;
+    recordLog.lastSegment = 1;
+    recordLog.syncSegment = 1;
+    recordLog.activeRecords = 0;
+    unsyncedRecordCount = 0;
+    heldRecordCount = 0;
+    return createSegment(1);
+}
+
+void forEachRecord(RecordVisitor visit)
+{
+    commitRecordLog();
+    for (uint32_t segment = recordLog.firstSegment; segment <= recordLog.lastSegment && segment > 0; segment++)
+    {
+        char path[LOG_PATH_MAX];
+        segmentPath(segment, path, sizeof(path));
+        File file = SPIFFS.open(path, FILE_READ);
+        if (!file)
+        {
+            continue;
+        }
+
+        char line[RECORD_LINE_MAX];
+        readRecordLine(file, line, sizeof(line));
+        bool legacy = legacySegment(line);
+        LogEntry entry;
+        while (file.available())
+        {
+            if (readRecordLine(file, line, sizeof(line)) != 0 && parseRecordLine(line, legacy, entry))
+            {
+                visit(entry);
+            }
+        }
+        file.close();
+    }
+}
+
+#endif // !LOG_BACKEND_PARTITION
@@ -0,0 +1,442 @@
+#include "record_log.h"
+#include "ble_manager.h"
+#include "storage.h"
+#include "telemetry.h"
+#include "time_source.h"
+
+#if LOG_BACKEND_PARTITION
+
+#include <esp_partition.h>
+#include <SPIFFS.h>
+
+static_assert(sizeof(LogRecord) == 32, "LogRecord layout changed");
+static_assert(LOG_SECTOR_SIZE % sizeof(LogRecord) == 0, "LogRecord must tile the erase sector");
+
+// The whole partition is mapped once at boot. Reads (boot scan, sync, the
+// records listing) go through the flash cache with no copies and no VFS;
+// writes and erases go through esp_partition_*, which invalidate the cached
+// lines of the mapped range, so the mapping always shows what is on flash.
+static const esp_partition_t *partition = nullptr;
+static const LogRecord *mapped = nullptr;
+static spi_flash_mmap_handle_t mapHandle;
+static uint32_t sectorCount = 0;
+
+static uint32_t sectorOf(uint32_t segment)
+{
+    return (segment - 1) % sectorCount;
+}
+
+static const LogRecord *sectorRecords(uint32_t sector)
+{
+    return mapped + sector * LOG_SECTOR_RECORDS;
+}
+
+static uint32_t segmentOf(const LogRecord &record)
+{
+    return (record.sequence - 1) / LOG_SECTOR_RECORDS + 1;
+}
+
+// Fletcher-16 over the fields before the checksum; never 0xFFFF, so a blank
+// or half-written slot can't pass
+static uint16_t recordChecksum(const LogRecord &record)
+{
+    const uint8_t *bytes = (const uint8_t *)&record;
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for (size_t i = 0; i < offsetof(LogRecord, checksum); i++)
+    {
+        sum1 = (sum1 + bytes[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+bool recordValid(const LogRecord &record)
+{
+    return record.sequence != 0 && record.sequence != UINT32_MAX && record.checksum == recordChecksum(record);
+}
+
+void recordEntry(const LogRecord &record, LogEntry &entry)
+{
+    entry.timestamp = record.timestamp;
+    entry.session = record.session;
+    entry.stamp = record.untrusted ? correctStamp(record.session, entry.timestamp) : STAMP_TRUSTED;
+    formatDate(entry.timestamp, entry.date, sizeof(entry.date));
+    entry.studentId = record.studentId;
+    entry.synced = record.synced == 0;
+}
+
+// Unsynced, but left alone by sync until the clock is set
+static bool recordHeld(const LogRecord &record)
+{
+    uint32_t timestamp = record.timestamp;
+    return record.untrusted && record.synced != 0 && correctStamp(record.session, timestamp) == STAMP_HELD;
+}
+
+static bool slotBlank(const LogRecord &record)
+{
+    const uint32_t *words = (const uint32_t *)&record;
+    for (size_t i = 0; i < sizeof(LogRecord) / sizeof(uint32_t); i++)
+    {
+        if (words[i] != UINT32_MAX)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Segment held by a sector, 0 if it holds no valid record
+static uint32_t sectorSegment(uint32_t sector)
+{
+    const LogRecord *records = sectorRecords(sector);
+    for (uint16_t slot = 0; slot < LOG_SECTOR_RECORDS; slot++)
+    {
+        if (recordValid(records[slot]))
+        {
+            return segmentOf(records[slot]);
+        }
+    }
+    return 0;
+}
+
+static bool sectorBlank(uint32_t sector)
+{
+    const LogRecord *records = sectorRecords(sector);
+    for (uint16_t slot = 0; slot < LOG_SECTOR_RECORDS; slot++)
+    {
+        if (!slotBlank(records[slot]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool eraseSector(uint32_t sector)
+{
+    return esp_partition_erase_range(partition, sector * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE) == ESP_OK;
+}
+
+// Used slots of the last segment, a torn write included
+static uint16_t usedSlots(uint32_t sector)
+{
+    const LogRecord *records = sectorRecords(sector);
+    uint16_t used = LOG_SECTOR_RECORDS;
+    while (used > 0 && slotBlank(records[used - 1]))
+    {
+        used--;
+    }
+    return used;
+}
+
+const LogRecord *segmentRecords(uint32_t segment, uint16_t &count)
+{
+    count = 0;
+    if (mapped == nullptr || segment < recordLog.firstSegment || segment > recordLog.lastSegment ||
+        sectorSegment(sectorOf(segment)) != segment)
+    {
+        return nullptr;
+    }
+    count = segment == recordLog.lastSegment ? recordLog.activeRecords : LOG_SECTOR_RECORDS;
+    return sectorRecords(sectorOf(segment));
+}
+
+// Held records count as unsynced too
+static uint32_t countUnsynced(uint32_t segment, uint32_t &held)
+{
+    uint16_t count;
+    const LogRecord *records = segmentRecords(segment, count);
+    uint32_t unsynced = 0;
+    held = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (recordValid(records[i]) && records[i].synced != 0)
+        {
+            unsynced++;
+            held += recordHeld(records[i]) ? 1 : 0;
+        }
+    }
+    return unsynced;
+}
+
+// Finds the ring of segments in the partition. Sectors that hold no valid
+// record but aren't blank (leftovers of an older partition table or record
+// layout, or a torn first write) are erased so a new segment can start in them.
+static void discoverSegments()
+{
+    recordLog.firstSegment = 0;
+    recordLog.lastSegment = 0;
+
+    for (uint32_t sector = 0; sector < sectorCount; sector++)
+    {
+        uint32_t segment = sectorSegment(sector);
+        if (segment == 0 || sectorOf(segment) != sector)
+        {
+            if (!sectorBlank(sector))
+            {
+                eraseSector(sector);
+            }
+            continue;
+        }
+        if (recordLog.firstSegment == 0 || segment < recordLog.firstSegment)
+        {
+            recordLog.firstSegment = segment;
+        }
+        recordLog.lastSegment = max(recordLog.lastSegment, segment);
+    }
+}
+
+void initRecordLog()
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)LOG_PARTITION_SUBTYPE,
+                                         LOG_PARTITION_LABEL);
+    if (partition == nullptr)
+    {
+        printBoth("No '" LOG_PARTITION_LABEL "' partition, attendance will not be recorded");
+        return;
+    }
+
+    const void *address;
+    if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &address, &mapHandle) != ESP_OK)
+    {
+        printBoth("Failed to map the records partition");
+        partition = nullptr;
+        return;
+    }
+    mapped = (const LogRecord *)address;
+    sectorCount = partition->size / LOG_SECTOR_SIZE;
+
+    discoverSegments();
+    if (recordLog.lastSegment == 0)
+    {
+        recordLog.firstSegment = 1;
+        recordLog.lastSegment = 1;
+        recordLog.activeRecords = 0;
+    }
+    else
+    {
+        recordLog.activeRecords = usedSlots(sectorOf(recordLog.lastSegment));
+    }
+
+    unsyncedRecordCount = 0;
+    heldRecordCount = 0;
+    recordLog.syncSegment = recordLog.lastSegment;
+    for (uint32_t segment = recordLog.lastSegment; segment >= recordLog.firstSegment && segment > 0; segment--)
+    {
+        uint32_t held;
+        uint32_t unsynced = countUnsynced(segment, held);
+        if (unsynced == 0)
+        {
+            break;
+        }
+        unsyncedRecordCount += unsynced - held;
+        heldRecordCount += held;
+        recordLog.syncSegment = segment;
+    }
+
+    printfBoth("Attendance log partition: %u KB, segments %u-%u, unsynced records: %u, held for the clock: %u",
+               (unsigned)(partition->size / 1024), (unsigned)recordLog.firstSegment,
+               (unsigned)recordLog.lastSegment, (unsigned)unsyncedRecordCount, (unsigned)heldRecordCount);
+    compactRecordLog();
+}
+
+// Folds the oldest segment into the summary and erases its sector. The
+// sector is erased even if the summary can't be written: new attendance
+// matters more than counts of records that are already synced.
+static void retireOldestSegment()
+{
+    uint16_t count;
+    const LogRecord *records = segmentRecords(recordLog.firstSegment, count);
+    LogSummary summary;
+    bool summarised = beginSummary(summary, recordLog.firstSegment);
+    if (summarised)
+    {
+        LogEntry entry;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            if (recordValid(records[i]))
+            {
+                recordEntry(records[i], entry);
+                tallySummary(summary, entry.date);
+            }
+        }
+        summarised = endSummary(summary);
+    }
+    if (!summarised)
+    {
+        printBoth("Failed to write the log summary");
+    }
+
+    eraseSector(sectorOf(recordLog.firstSegment));
+    recordLog.firstSegment++;
+    recordLog.compactedSegments++;
+}
+
+// Starts the next segment, reusing the oldest sector once the ring is full.
+// Fails rather than overwrite records that haven't been synced.
+static bool openNextSegment()
+{
+    uint32_t segment = recordLog.lastSegment + 1;
+    if (segment - recordLog.firstSegment >= sectorCount)
+    {
+        if (recordLog.firstSegment >= recordLog.syncSegment)
+        {
+            return false;
+        }
+        retireOldestSegment();
+    }
+
+    uint32_t sector = sectorOf(segment);
+    if (!sectorBlank(sector) && !eraseSector(sector))
+    {
+        return false;
+    }
+    recordLog.lastSegment = segment;
+    recordLog.activeRecords = 0;
+    return true;
+}
+
+// Records are written through, so each append is its own commit point
+bool commitRecordLog()
+{
+    return true;
+}
+
+void serviceRecordLog() {}
+
+bool appendRecord(uint32_t timestamp, bool trusted, uint16_t session, const char *studentId, uint16_t slot)
+{
+    if (mapped == nullptr)
+    {
+        return false;
+    }
+    if (recordLog.activeRecords >= LOG_SECTOR_RECORDS && !openNextSegment())
+    {
+        printBoth("Records partition full of unsynced records");
+        return false;
+    }
+
+    LogRecord record;
+    memset(&record, 0, offsetof(LogRecord, checksum));
+    record.sequence = (recordLog.lastSegment - 1) * LOG_SECTOR_RECORDS + recordLog.activeRecords + 1;
+    record.timestamp = timestamp;
+    record.session = session;
+    strlcpy(record.studentId, studentId, sizeof(record.studentId));
+    record.untrusted = trusted ? 0 : 1;
+    record.checksum = recordChecksum(record);
+    record.synced = 0xFF;
+    record.reserved = 0xFF;
+
+    size_t offset = (sectorOf(recordLog.lastSegment) * LOG_SECTOR_RECORDS + recordLog.activeRecords) * sizeof(LogRecord);
+    if (esp_partition_write(partition, offset, &record, sizeof(record)) != ESP_OK)
+    {
+        return false;
+    }
+    noteFlashWrite(sizeof(record));
+    recordLog.activeRecords++;
+    indexCommittedRecord(trusted ? timestamp : 0, slot);
+    return true;
+}
+
+// Clears the synced byte of the first recordCount unsynced records in place,
+// held ones skipped as in the batch; no segment rewrite
+bool markSegmentSynced(uint32_t segment, size_t recordCount)
+{
+    uint16_t count;
+    const LogRecord *records = segmentRecords(segment, count);
+    uint32_t remaining = 0;
+    size_t written = 0;
+    static const uint8_t synced = 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (!recordValid(records[i]) || records[i].synced == 0)
+        {
+            continue;
+        }
+        if (recordCount == 0 || recordHeld(records[i]))
+        {
+            remaining++;
+            continue;
+        }
+
+        size_t offset = (const uint8_t *)&records[i].synced - (const uint8_t *)mapped;
+        if (esp_partition_write(partition, offset, &synced, sizeof(synced)) != ESP_OK)
+        {
+            noteFlashWrite(written);
+            return false;
+        }
+        written += sizeof(synced);
+        recordCount--;
+    }
+    noteFlashWrite(written);
+
+    if (remaining == 0 && segment == recordLog.syncSegment && segment < recordLog.lastSegment)
+    {
+        recordLog.syncSegment++;
+    }
+    return true;
+}
+
+// Synced segments stay readable until the ring comes round to them. Once it
+// has, the sector the next segment will use is freed here, after a sync,
+// so appends during capture don't pay for the erase.
+void compactRecordLog()
+{
+    if (mapped != nullptr && recordLog.lastSegment + 1 - recordLog.firstSegment >= sectorCount &&
+        recordLog.firstSegment < recordLog.syncSegment)
+    {
+        retireOldestSegment();
+    }
+}
+
+bool clearRecordLog()
+{
+    if (mapped == nullptr)
+    {
+        return false;
+    }
+
+    bool erased = true;
+    uint32_t used = min(recordLog.lastSegment - recordLog.firstSegment + 1, sectorCount);
+    for (uint32_t i = 0; i < used; i++)
+    {
+        erased = eraseSector(sectorOf(recordLog.firstSegment + i)) && erased;
+    }
+    SPIFFS.remove(LOG_SUMMARY_FILE);
+
+    // Numbering carries on, so no old record can be mistaken for a new one
+    uint32_t segment = recordLog.lastSegment + 1;
+    if (!sectorBlank(sectorOf(segment)))
+    {
+        erased = eraseSector(sectorOf(segment)) && erased;
+    }
+    recordLog.firstSegment = segment;
+    recordLog.lastSegment = segment;
+    recordLog.syncSegment = segment;
+    recordLog.activeRecords = 0;
+    unsyncedRecordCount = 0;
+    heldRecordCount = 0;
+    return erased;
+}
+
+void forEachRecord(RecordVisitor visit)
+{
+    for (uint32_t segment = recordLog.firstSegment; segment <= recordLog.lastSegment && segment > 0; segment++)
+    {
+        uint16_t count;
+        const LogRecord *records = segmentRecords(segment, count);
+        LogEntry entry;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            if (recordValid(records[i]))
+            {
+                recordEntry(records[i], entry);
+                visit(entry);
+            }
+        }
+    }
+}
+
+#endif // LOG_BACKEND_PARTITION
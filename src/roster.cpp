@@ -0,0 +1,322 @@
+#include "roster.h"
+#include "ble_manager.h"
+#include "commands.h"
+#include "journal.h"
+#include "telemetry.h"
+#include <SPIFFS.h>
+
+#define ROSTER_MAGIC 0x52535431 // "RST1"
+#define ROSTER_GROW_SLOTS 64    // Table growth step during a bulk load
+
+// The whole table lives in RAM (PSRAM when fitted), so a scan's lookup is
+// one array index; the file is only read at boot
+static RosterEntry *table = nullptr;
+static uint16_t tableSlots = 0;
+
+// Bulk load in progress, swapped in on "end"
+static RosterEntry *staged = nullptr;
+static uint16_t stagedSlots = 0;
+static uint16_t stagedLines = 0;
+static uint16_t rejectedLines = 0;
+
+static RosterEntry *allocateEntries(uint16_t slots)
+{
+    size_t bytes = (size_t)slots * sizeof(RosterEntry);
+    RosterEntry *entries = psramFound() ? (RosterEntry *)ps_malloc(bytes) : nullptr;
+    if (entries == nullptr)
+    {
+        entries = (RosterEntry *)malloc(bytes);
+    }
+    if (entries != nullptr)
+    {
+        memset(entries, 0, bytes);
+    }
+    return entries;
+}
+
+static uint16_t countAssigned(const RosterEntry *entries, uint16_t slots)
+{
+    uint16_t assigned = 0;
+    for (uint16_t i = 0; i < slots; i++)
+    {
+        if (entries[i].studentId[0] != '\0')
+        {
+            assigned++;
+        }
+    }
+    return assigned;
+}
+
+static void replaceTable(RosterEntry *entries, uint16_t slots)
+{
+    free(table);
+    table = entries;
+    tableSlots = slots;
+}
+
+void loadRoster()
+{
+    File file = SPIFFS.open(ROSTER_FILE, FILE_READ);
+    if (!file)
+    {
+        return;
+    }
+
+    RosterHeader header;
+    bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+                 header.magic == ROSTER_MAGIC && header.entrySize == sizeof(RosterEntry) &&
+                 header.slots <= ROSTER_MAX_SLOTS;
+
+    RosterEntry *entries = valid ? allocateEntries(header.slots) : nullptr;
+    size_t bytes = (size_t)header.slots * sizeof(RosterEntry);
+    if (entries != nullptr && file.read((uint8_t *)entries, bytes) != bytes)
+    {
+        free(entries);
+        entries = nullptr;
+    }
+    file.close();
+
+    if (entries == nullptr)
+    {
+        printBoth(valid ? "Not enough memory for the roster" : "Roster file invalid, ignoring it");
+        return;
+    }
+
+    replaceTable(entries, header.slots);
+    printfBoth("Roster: %u students", countAssigned(table, tableSlots));
+}
+
+const RosterEntry *rosterLookup(uint16_t slot)
+{
+    if (slot >= tableSlots || table[slot].studentId[0] == '\0')
+    {
+        return nullptr;
+    }
+    return &table[slot];
+}
+
+// Slot holding a student number, -1 if it isn't on the roster
+int rosterSlotOf(const char *studentId)
+{
+    for (uint16_t slot = 0; slot < tableSlots; slot++)
+    {
+        if (table[slot].studentId[0] != '\0' && strcmp(table[slot].studentId, studentId) == 0)
+        {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Replaced through the journal, so a power cut keeps the old roster
+static bool saveRoster(const RosterEntry *entries, uint16_t slots)
+{
+    File file = beginReplace(ROSTER_FILE);
+    if (!file)
+    {
+        return false;
+    }
+
+    RosterHeader header = {ROSTER_MAGIC, slots, sizeof(RosterEntry)};
+    size_t bytes = (size_t)slots * sizeof(RosterEntry);
+    size_t written = file.write((const uint8_t *)&header, sizeof(header));
+    written += file.write((const uint8_t *)entries, bytes);
+    noteFlashWrite(written);
+
+    if (written != sizeof(header) + bytes)
+    {
+        abortReplace(file, ROSTER_FILE);
+        return false;
+    }
+    return commitReplace(file, ROSTER_FILE);
+}
+
+// Makes room for slot in the staged table
+static bool growStaged(uint16_t slot)
+{
+    if (slot < stagedSlots)
+    {
+        return true;
+    }
+
+    uint16_t slots = min((uint16_t)((slot / ROSTER_GROW_SLOTS + 1) * ROSTER_GROW_SLOTS), (uint16_t)ROSTER_MAX_SLOTS);
+    RosterEntry *entries = allocateEntries(slots);
+    if (entries == nullptr)
+    {
+        return false;
+    }
+    if (staged != nullptr)
+    {
+        memcpy(entries, staged, (size_t)stagedSlots * sizeof(RosterEntry));
+        free(staged);
+    }
+    staged = entries;
+    stagedSlots = slots;
+    return true;
+}
+
+// "slot,student_id[,name]"; IDs and names end up in CSV records and JSON,
+// so quotes, backslashes and commas in the ID are refused
+static bool parseRosterLine(const char *line, uint16_t &slot, RosterEntry &entry)
+{
+    const char *id = strchr(line, ',');
+    if (id == nullptr)
+    {
+        return false;
+    }
+    id++;
+
+    const char *name = strchr(id, ',');
+    size_t idLength = name != nullptr ? (size_t)(name - id) : strlen(id);
+    name = name != nullptr ? name + 1 : "";
+
+    int value = atoi(line);
+    if (value < 1 || value >= ROSTER_MAX_SLOTS || idLength == 0 || idLength >= ROSTER_ID_MAX ||
+        strlen(name) >= ROSTER_NAME_MAX || strpbrk(name, "\"\\") != nullptr)
+    {
+        return false;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.studentId, id, idLength);
+    strlcpy(entry.name, name, sizeof(entry.name));
+    if (strpbrk(entry.studentId, "\"\\") != nullptr)
+    {
+        return false;
+    }
+
+    slot = value;
+    return true;
+}
+
+static void discardStaged()
+{
+    free(staged);
+    staged = nullptr;
+    stagedSlots = 0;
+}
+
+static void finishRosterLoad()
+{
+    if (staged == nullptr)
+    {
+        printBoth("No roster lines received, roster unchanged");
+        return;
+    }
+
+    if (!saveRoster(staged, stagedSlots))
+    {
+        printBoth("Failed to save roster, keeping the old one");
+        discardStaged();
+        return;
+    }
+
+    replaceTable(staged, stagedSlots);
+    staged = nullptr;
+    stagedSlots = 0;
+    printfBoth("Roster saved: %u lines, %u rejected, %u students", stagedLines, rejectedLines,
+               countAssigned(table, tableSlots));
+}
+
+static SessionStatus rosterLoadInput(const char *line)
+{
+    if (strcasecmp(line, "end") == 0)
+    {
+        finishRosterLoad();
+        return SESSION_DONE;
+    }
+    if (strcasecmp(line, "cancel") == 0)
+    {
+        discardStaged();
+        printBoth("Roster load cancelled");
+        return SESSION_DONE;
+    }
+
+    uint16_t slot;
+    RosterEntry entry;
+    if (!parseRosterLine(line, slot, entry) || !growStaged(slot))
+    {
+        rejectedLines++;
+        printfBoth("Rejected: %s", line);
+        return SESSION_CONTINUE;
+    }
+
+    staged[slot] = entry;
+    stagedLines++;
+    return SESSION_CONTINUE;
+}
+
+// Replaces the roster, or with merge starts from a copy of it
+static void startRosterLoad(bool merge)
+{
+    discardStaged();
+    stagedLines = 0;
+    rejectedLines = 0;
+
+    if (merge && tableSlots > 0)
+    {
+        if (!growStaged(tableSlots - 1))
+        {
+            printBoth("Not enough memory for the roster");
+            return;
+        }
+        memcpy(staged, table, (size_t)tableSlots * sizeof(RosterEntry));
+    }
+
+    printBoth("Send one line per student: slot,student_id,name");
+    printBoth("'end' saves the roster, 'cancel' discards it");
+    beginSession(rosterLoadInput);
+}
+
+static void printEntry(uint16_t slot)
+{
+    const RosterEntry *entry = rosterLookup(slot);
+    if (entry == nullptr)
+    {
+        printfBoth("%u: not assigned", slot);
+        return;
+    }
+    printfBoth("%u: %s %s", slot, entry->studentId, entry->name);
+}
+
+static void showRoster()
+{
+    printBoth("=== Roster ===");
+    printfBoth("%u students in %u slots", countAssigned(table, tableSlots), tableSlots);
+    for (uint16_t slot = 0; slot < tableSlots; slot++)
+    {
+        if (table[slot].studentId[0] != '\0')
+        {
+            printEntry(slot);
+        }
+    }
+    printBoth("==============");
+}
+
+// "roster" lists it, "roster 12" shows one slot, "roster load [merge]" takes
+// slot,student_id,name lines until "end", "roster clear" deletes it
+void rosterCommand(const char *args)
+{
+    if (args[0] == '\0')
+    {
+        showRoster();
+    }
+    else if (strncasecmp(args, "load", 4) == 0)
+    {
+        startRosterLoad(strcasecmp(args, "load merge") == 0);
+    }
+    else if (strcasecmp(args, "clear") == 0)
+    {
+        SPIFFS.remove(ROSTER_FILE);
+        replaceTable(nullptr, 0);
+        printBoth("Roster cleared; records will use sensor slot numbers");
+    }
+    else if (atoi(args) > 0)
+    {
+        printEntry(atoi(args));
+    }
+    else
+    {
+        printBoth("Usage: roster [slot|load [merge]|clear]");
+    }
+}
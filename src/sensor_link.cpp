@@ -0,0 +1,547 @@
+#include "sensor_link.h"
+#include "ble_manager.h"
+#include "journal.h"
+#include "telemetry.h"
+#include <SPIFFS.h>
+
+#define SENSOR_LINK_MAGIC 0x534C4B31  // "SLK1"
+#define SENSOR_PACKET_MAX 256
+#define SENSOR_READ_INDEX 0x1F  // ReadIndexTable, not wrapped by the library
+
+// Rates tried by 'link tune', fastest first. The R30x/AS608 family takes
+// multiples of 9600 up to 115200.
+static const uint32_t baudCandidates[] = {115200, 105600, 96000, 86400,
+                                          76800,  67200,  57600};
+static const uint16_t packetCandidates[] = {256, 128, 64, 32};
+
+static const size_t baudCandidateCount =
+    sizeof(baudCandidates) / sizeof(baudCandidates[0]);
+static const size_t packetCandidateCount =
+    sizeof(packetCandidates) / sizeof(packetCandidates[0]);
+
+// Average time per command in microseconds, 0 if the command failed
+struct LinkTiming {
+  uint32_t handshakeUs;
+  uint32_t paramsUs;
+  uint32_t imageUs;
+  uint32_t templateUs;
+};
+
+static SensorLinkCache linkCache = {};
+
+void loadSensorLinks() {
+  linkCache.magic = 0;
+
+  File file = SPIFFS.open(SENSOR_LINK_FILE, FILE_READ);
+  if (!file) {
+    return;
+  }
+
+  if (file.read((uint8_t *)&linkCache, sizeof(linkCache)) !=
+          sizeof(linkCache) ||
+      linkCache.magic != SENSOR_LINK_MAGIC) {
+    linkCache.magic = 0;
+  }
+  file.close();
+}
+
+static void saveSensorLinks() {
+  SensorLinkCache fresh = {};
+  fresh.magic = SENSOR_LINK_MAGIC;
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    fresh.baud[i] = sensors[i].baud;
+    fresh.packetLen[i] = sensors[i].packetLen;
+  }
+
+  // Nothing changed: skip the flash write
+  if (memcmp(&fresh, &linkCache, sizeof(fresh)) == 0) {
+    return;
+  }
+
+  if (replaceFile(SENSOR_LINK_FILE, &fresh, sizeof(fresh))) {
+    linkCache = fresh;
+  }
+}
+
+static uint32_t storedBaud(uint8_t index) {
+  if (linkCache.magic != SENSOR_LINK_MAGIC || linkCache.baud[index] == 0) {
+    return SENSOR_DEFAULT_BAUD;
+  }
+  return linkCache.baud[index];
+}
+
+// Password handshake with a short timeout. verifyPassword() waits a full
+// second per try, too long to poll a sensor that is still powering up.
+bool probeSensor(Adafruit_Fingerprint &reader, uint16_t timeoutMs) {
+  uint8_t data[] = {FINGERPRINT_VERIFYPASSWORD, 0, 0, 0, 0};
+  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data),
+                                     data);
+  reader.writeStructuredPacket(packet);
+  if (reader.getStructuredPacket(&packet, timeoutMs) != FINGERPRINT_OK) {
+    return false;
+  }
+  return packet.type == FINGERPRINT_ACKPACKET &&
+         packet.data[0] == FINGERPRINT_OK;
+}
+
+static void setHostBaud(FingerprintSensor &sensor, uint32_t baud) {
+  sensor.serial->updateBaudRate(baud);
+  // Anything still buffered was framed at the old rate
+  while (sensor.serial->available()) {
+    sensor.serial->read();
+  }
+  sensor.baud = baud;
+}
+
+// Reads the sensor's system parameters into the link state
+static void readLinkParameters(FingerprintSensor &sensor) {
+  if (sensor.finger->getParameters() == FINGERPRINT_OK) {
+    sensor.packetLen = sensor.finger->packet_len;
+    sensor.securityLevel = sensor.finger->security_level;
+  }
+}
+
+// Probes every known rate once, starting with `first`. Leaves the host UART
+// at the rate that answered.
+static bool findSensorBaud(FingerprintSensor &sensor, uint32_t first) {
+  setHostBaud(sensor, first);
+  if (probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS)) {
+    return true;
+  }
+
+  for (size_t i = 0; i < baudCandidateCount; i++) {
+    if (baudCandidates[i] == first) {
+      continue;
+    }
+    setHostBaud(sensor, baudCandidates[i]);
+    if (probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS)) {
+      return true;
+    }
+  }
+
+  setHostBaud(sensor, SENSOR_DEFAULT_BAUD);
+  return false;
+}
+
+// Opens the UART at the stored rate and waits for the sensor to power up.
+// If it stays silent the stored rate may be stale (file lost, sensor
+// swapped), so every rate is probed once before giving up. Called with the
+// sensor's lock held.
+bool openSensorLink(uint8_t index) {
+  FingerprintSensor &sensor = sensors[index];
+  const SensorPins &pins = sensorPins(index);
+  uint32_t baud = storedBaud(index);
+
+  sensor.serial->begin(baud, SERIAL_8N1, pins.rx, pins.tx);
+  sensor.finger->begin(baud);
+  sensor.baud = baud;
+  sensor.packetLen = 0;
+
+  unsigned long start = millis();
+  bool ready = probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS);
+  while (!ready && millis() - start < SENSOR_INIT_TIMEOUT_MS) {
+    ready = probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS);
+  }
+
+  if (!ready && findSensorBaud(sensor, SENSOR_DEFAULT_BAUD)) {
+    printfBoth("Sensor %u answered at %lu baud instead of %lu", index + 1,
+               (unsigned long)sensor.baud, (unsigned long)baud);
+    ready = true;
+  }
+
+  if (ready) {
+    readLinkParameters(sensor);
+    if (sensor.baud != baud) {
+      saveSensorLinks();
+    }
+  }
+  return ready;
+}
+
+static bool readByteBy(HardwareSerial &serial, uint8_t &out,
+                       unsigned long deadline) {
+  while (!serial.available()) {
+    if ((long)(millis() - deadline) >= 0) {
+      return false;
+    }
+    delay(1);  // The UART FIFO holds the bytes meanwhile
+  }
+  out = serial.read();
+  return true;
+}
+
+// Reads the data packets that follow an upload ack straight off the UART,
+// checking each checksum. The library's packet buffer holds 64 bytes, too
+// small for 128- and 256-byte packets. The payload is copied to `out` when
+// given, or just counted. Returns the payload size, 0 on error or if it
+// doesn't fit.
+static size_t drainDataPackets(HardwareSerial &serial, uint16_t timeoutMs,
+                               uint8_t *out, size_t size) {
+  unsigned long deadline = millis() + timeoutMs;
+  size_t payload = 0;
+
+  for (;;) {
+    // Start code (2), address (4), type (1), length (2)
+    uint8_t header[9];
+    for (uint8_t i = 0; i < sizeof(header); i++) {
+      if (!readByteBy(serial, header[i], deadline)) {
+        return 0;
+      }
+    }
+    if (((header[0] << 8) | header[1]) != FINGERPRINT_STARTCODE) {
+      return 0;
+    }
+
+    uint8_t type = header[6];
+    uint16_t length = (header[7] << 8) | header[8];  // Includes the checksum
+    if (length < 2 || length > SENSOR_PACKET_MAX + 2) {
+      return 0;
+    }
+
+    if (out != nullptr && payload + length - 2 > size) {
+      return 0;
+    }
+
+    uint16_t sum = type + header[7] + header[8];
+    uint8_t byte;
+    for (uint16_t i = 0; i < length - 2; i++) {
+      if (!readByteBy(serial, byte, deadline)) {
+        return 0;
+      }
+      sum += byte;
+      if (out != nullptr) {
+        out[payload + i] = byte;
+      }
+    }
+
+    uint8_t high, low;
+    if (!readByteBy(serial, high, deadline) ||
+        !readByteBy(serial, low, deadline) || ((high << 8) | low) != sum) {
+      return 0;
+    }
+
+    payload += length - 2;
+    if (type == FINGERPRINT_ENDDATAPACKET) {
+      return payload;
+    }
+    if (type != FINGERPRINT_DATAPACKET) {
+      return 0;
+    }
+  }
+}
+
+// Uploads character buffer 1: the longest transfer the sensor does, and the
+// one the packet size applies to
+static size_t uploadTemplate(FingerprintSensor &sensor, uint8_t *out = nullptr,
+                             size_t size = 0) {
+  uint8_t data[] = {FINGERPRINT_UPLOAD, 0x01};
+  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data),
+                                     data);
+  sensor.finger->writeStructuredPacket(packet);
+  if (sensor.finger->getStructuredPacket(&packet, SENSOR_PROBE_TIMEOUT_MS) !=
+          FINGERPRINT_OK ||
+      packet.type != FINGERPRINT_ACKPACKET ||
+      packet.data[0] != FINGERPRINT_OK) {
+    return 0;
+  }
+  return drainDataPackets(*sensor.serial, SENSOR_UPLOAD_TIMEOUT_MS, out, size);
+}
+
+// One page of the sensor's index table: a bit per slot, slot 0 in bit 0 of
+// the first byte. Called with the sensor's lock held.
+bool readTemplateIndex(FingerprintSensor &sensor, uint8_t page,
+                       uint8_t *bitmap) {
+  uint8_t data[] = {SENSOR_READ_INDEX, page};
+  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data),
+                                     data);
+  sensor.finger->writeStructuredPacket(packet);
+  if (sensor.finger->getStructuredPacket(&packet, SENSOR_PROBE_TIMEOUT_MS) !=
+          FINGERPRINT_OK ||
+      packet.type != FINGERPRINT_ACKPACKET ||
+      packet.data[0] != FINGERPRINT_OK) {
+    return false;
+  }
+  memcpy(bitmap, &packet.data[1], SENSOR_INDEX_PAGE_SLOTS / 8);
+  return true;
+}
+
+// Loads a stored template into character buffer 1 and uploads it into
+// `out`. Returns its size, 0 if the slot is empty or the transfer failed.
+// Called with the sensor's lock held.
+size_t readTemplate(FingerprintSensor &sensor, uint16_t slot, uint8_t *out,
+                    size_t size) {
+  if (sensor.finger->loadModel(slot) != FINGERPRINT_OK) {
+    return 0;
+  }
+  return uploadTemplate(sensor, out, size);
+}
+
+static bool linkStable(FingerprintSensor &sensor, bool withUploads) {
+  for (uint8_t i = 0; i < SENSOR_LINK_TEST_ROUNDS; i++) {
+    if (!probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS)) {
+      return false;
+    }
+    // Long frames are where a marginal rate shows up first
+    if (withUploads && i % 4 == 0 && uploadTemplate(sensor) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint32_t averageUs(uint32_t totalUs, bool ok) {
+  return ok ? totalUs / SENSOR_LINK_TIMING_ROUNDS : 0;
+}
+
+static void measureLink(FingerprintSensor &sensor, LinkTiming &timing) {
+  Adafruit_Fingerprint &reader = *sensor.finger;
+  uint32_t handshake = 0, params = 0, image = 0, upload = 0;
+  bool handshakeOk = true, paramsOk = true, imageOk = true, uploadOk = true;
+
+  for (uint8_t i = 0; i < SENSOR_LINK_TIMING_ROUNDS; i++) {
+    uint32_t start = micros();
+    handshakeOk &= probeSensor(reader, SENSOR_PROBE_TIMEOUT_MS);
+    handshake += micros() - start;
+
+    start = micros();
+    paramsOk &= reader.getParameters() == FINGERPRINT_OK;
+    params += micros() - start;
+
+    // No finger present answers NOFINGER, which is still a full round trip
+    start = micros();
+    uint8_t p = reader.getImage();
+    imageOk &= p == FINGERPRINT_OK || p == FINGERPRINT_NOFINGER;
+    image += micros() - start;
+
+    start = micros();
+    uploadOk &= uploadTemplate(sensor) > 0;
+    upload += micros() - start;
+  }
+
+  timing.handshakeUs = averageUs(handshake, handshakeOk);
+  timing.paramsUs = averageUs(params, paramsOk);
+  timing.imageUs = averageUs(image, imageOk);
+  timing.templateUs = averageUs(upload, uploadOk);
+}
+
+// "12.3", or "-" when the command failed
+static void formatMs(char *out, size_t size, uint32_t us) {
+  if (us == 0) {
+    strlcpy(out, "-", size);
+  } else {
+    snprintf(out, size, "%.1f", us / 1000.0f);
+  }
+}
+
+static void printTimingRow(const char *name, uint32_t beforeUs,
+                           uint32_t afterUs) {
+  char before[12];
+  char after[12];
+  formatMs(before, sizeof(before), beforeUs);
+  formatMs(after, sizeof(after), afterUs);
+  printfBoth("  %-10s %8s %8s", name, before, after);
+}
+
+static void printTiming(const LinkTiming &before, const LinkTiming &after) {
+  printfBoth("  %-10s %8s %8s", "ms", "before", "after");
+  printTimingRow("handshake", before.handshakeUs, after.handshakeUs);
+  printTimingRow("params", before.paramsUs, after.paramsUs);
+  printTimingRow("get-image", before.imageUs, after.imageUs);
+  printTimingRow("template", before.templateUs, after.templateUs);
+}
+
+static uint8_t packetCode(uint16_t packetLen) {
+  switch (packetLen) {
+    case 32:
+      return FINGERPRINT_PACKET_SIZE_32;
+    case 64:
+      return FINGERPRINT_PACKET_SIZE_64;
+    case 256:
+      return FINGERPRINT_PACKET_SIZE_256;
+    default:
+      return FINGERPRINT_PACKET_SIZE_128;
+  }
+}
+
+// Moves the sensor and the host to `baud`. Some modules only apply a new
+// rate after a power cycle; those fail the probe here and get restored.
+static bool switchBaud(FingerprintSensor &sensor, uint32_t baud) {
+  if (sensor.finger->setBaudRate(baud / 9600) != FINGERPRINT_OK) {
+    return false;
+  }
+
+  setHostBaud(sensor, baud);
+  delay(20);  // Let the sensor re-time its UART
+  return probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS);
+}
+
+// Gets back to `previous` after a failed switch: finds whatever rate the
+// sensor answers at and tells it to return
+static bool restoreBaud(FingerprintSensor &sensor, uint32_t previous) {
+  if (!findSensorBaud(sensor, previous)) {
+    return false;
+  }
+  if (sensor.finger->setBaudRate(previous / 9600) != FINGERPRINT_OK) {
+    return false;
+  }
+  setHostBaud(sensor, previous);
+  delay(20);
+  return probeSensor(*sensor.finger, SENSOR_PROBE_TIMEOUT_MS);
+}
+
+static bool tuneBaud(uint8_t index, bool withUploads) {
+  FingerprintSensor &sensor = sensors[index];
+
+  for (size_t i = 0; i < baudCandidateCount; i++) {
+    uint32_t baud = baudCandidates[i];
+    uint32_t previous = sensor.baud;
+
+    if (baud == previous) {
+      if (linkStable(sensor, withUploads)) {
+        return true;
+      }
+      continue;
+    }
+
+    if (switchBaud(sensor, baud) &&
+        linkStable(sensor, withUploads)) {
+      return true;
+    }
+
+    printfBoth("Sensor %u: %lu baud not stable", index + 1,
+               (unsigned long)baud);
+    if (!restoreBaud(sensor, previous)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+static void tunePacketSize(uint8_t index) {
+  FingerprintSensor &sensor = sensors[index];
+
+  for (size_t i = 0; i < packetCandidateCount; i++) {
+    uint16_t packetLen = packetCandidates[i];
+    if (sensor.finger->setPacketSize(packetCode(packetLen)) != FINGERPRINT_OK) {
+      continue;
+    }
+
+    bool stable = true;
+    for (uint8_t round = 0; stable && round < SENSOR_LINK_TEST_ROUNDS / 4;
+         round++) {
+      stable = uploadTemplate(sensor) > 0;
+    }
+    if (stable) {
+      readLinkParameters(sensor);
+      return;
+    }
+  }
+
+  sensor.finger->setPacketSize(packetCode(SENSOR_DEFAULT_PACKET_LEN));
+  readLinkParameters(sensor);
+}
+
+// Negotiates the fastest stable rate, then the largest stable packet size
+static void tuneSensor(uint8_t index) {
+  FingerprintSensor &sensor = sensors[index];
+  uint32_t oldBaud = sensor.baud;
+  uint16_t oldPacketLen = sensor.packetLen;
+
+  LinkTiming before, after;
+  measureLink(sensor, before);
+
+  // Modules that refuse uploads are tuned on handshakes alone
+  bool withUploads = before.templateUs > 0;
+  printfBoth("Tuning sensor %u...", index + 1);
+
+  if (!tuneBaud(index, withUploads)) {
+    // Lost it mid-negotiation: fall back to the factory rate
+    if (!restoreBaud(sensor, SENSOR_DEFAULT_BAUD)) {
+      sensor.ready = false;
+      printfBoth("Sensor %u stopped answering; power-cycle it and use option "
+                 "17",
+                 index + 1);
+      return;
+    }
+  }
+
+  if (withUploads) {
+    tunePacketSize(index);
+  }
+
+  measureLink(sensor, after);
+  printfBoth("Sensor %u: %lu -> %lu baud, packet %u -> %u bytes", index + 1,
+             (unsigned long)oldBaud, (unsigned long)sensor.baud, oldPacketLen,
+             sensor.packetLen);
+  printTiming(before, after);
+}
+
+static void resetSensor(uint8_t index) {
+  FingerprintSensor &sensor = sensors[index];
+  sensor.finger->setPacketSize(packetCode(SENSOR_DEFAULT_PACKET_LEN));
+
+  if (sensor.baud != SENSOR_DEFAULT_BAUD &&
+      !restoreBaud(sensor, SENSOR_DEFAULT_BAUD)) {
+    sensor.ready = false;
+    printfBoth("Sensor %u stopped answering; power-cycle it and use option 17",
+               index + 1);
+    return;
+  }
+  readLinkParameters(sensor);
+  printfBoth("Sensor %u back at %lu baud, packet %u bytes", index + 1,
+             (unsigned long)sensor.baud, sensor.packetLen);
+}
+
+static void showSensorLink(uint8_t index) {
+  FingerprintSensor &sensor = sensors[index];
+  LinkTiming timing;
+  measureLink(sensor, timing);
+
+  char handshake[12], params[12], image[12], upload[12];
+  formatMs(handshake, sizeof(handshake), timing.handshakeUs);
+  formatMs(params, sizeof(params), timing.paramsUs);
+  formatMs(image, sizeof(image), timing.imageUs);
+  formatMs(upload, sizeof(upload), timing.templateUs);
+
+  printfBoth("Sensor %u: %lu baud, packet %u bytes", index + 1,
+             (unsigned long)sensor.baud, sensor.packetLen);
+  printfBoth("  ms: handshake %s, params %s, get-image %s, template %s",
+             handshake, params, image, upload);
+}
+
+// "link" shows rates and per-command timing, "link tune" negotiates the
+// fastest stable settings and stores them, "link reset" returns to 57600
+void sensorLinkCommand(const char *args) {
+  if (!requireSensor())
+    return;
+
+  bool tune = strcasecmp(args, "tune") == 0;
+  bool reset = strcasecmp(args, "reset") == 0;
+  if (!tune && !reset && args[0] != '\0') {
+    printBoth("Usage: link [tune|reset]");
+    return;
+  }
+
+  printBoth("=== Sensor Link ===");
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    FingerprintSensor &sensor = sensors[i];
+    if (!sensor.ready || !lockSensor(sensor)) {
+      printfBoth("Sensor %u: not available", i + 1);
+      continue;
+    }
+
+    if (tune) {
+      tuneSensor(i);
+    } else if (reset) {
+      resetSensor(i);
+    } else {
+      showSensorLink(i);
+    }
+    unlockSensor(sensor);
+  }
+
+  if (tune || reset) {
+    saveSensorLinks();
+  }
+  printBoth("===================");
+}
@@ -1,10 +1,20 @@
 #include "storage.h"
+#include "arena.h"
+#include "attendance_index.h"
+#include "telemetry.h"
 #include "ble_manager.h"
 #include "indicators.h"
+#include "journal.h"
+#include "commands.h"
 #include "config.h"
+#include "record_log.h"
+#include "roster.h"
+#include "time_source.h"
 
 // Globals
-String currentDate = "19/5"; // Default date (today's date)
+char currentDate[DATE_MAX] = "19/5"; // Today's date once the clock is set, see time_source.h
+uint32_t unsyncedRecordCount = 0;
+uint32_t heldRecordCount = 0;
 
 void initSPIFFS()
 {
@@ -14,156 +24,314 @@ void initSPIFFS()
         return;
     }
 
-    // Check if attendance file exists, if not create it with headers
-    if (!SPIFFS.exists(ATTENDANCE_FILE_PATH))
-    {
-        File file = SPIFFS.open(ATTENDANCE_FILE_PATH, FILE_WRITE);
-        if (!file)
-        {
-            printBoth("Failed to create file");
-            return;
-        }
-        // Write CSV headers
-        file.println("date,student_id,status,synced");
-        file.close();
-        printBoth("Created attendance file with headers");
-    }
-    else
+    // Finish or roll back a file replacement cut short by a reset
+    recoverJournal();
+
+    // Wall clock from the RTC or the last saved time; before the log, so
+    // boot-time compaction already dates records in local time
+    initTimeSource();
+
+    // Segmented attendance log; also rebuilds the backlog counter
+    initRecordLog();
+}
+
+// Reads one line into a fixed buffer without the trailing CR/LF; 0 at end of file
+size_t readRecordLine(File &file, char *line, size_t size)
+{
+    size_t length = file.readBytesUntil('\n', line, size - 1);
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' '))
     {
-        printBoth("Attendance file exists");
+        length--;
     }
+    line[length] = '\0';
+    return length;
 }
 
 // Implementation Note:
 // Move the following functions from main.cpp to storage.cpp:
-void saveAttendanceToFile(String studentId)
+bool saveAttendanceToFile(uint32_t timestamp, bool trusted, const char *studentId, uint16_t slot)
 {
-    File file = SPIFFS.open(ATTENDANCE_FILE_PATH, FILE_APPEND);
-    if (!file)
+    if (!appendRecord(timestamp, trusted, attendanceSession, studentId, slot))
     {
         printBoth("Failed to open file for appending");
-        return;
+        return false;
+    }
+    if (trusted)
+    {
+        unsyncedRecordCount++;
+    }
+    else
+    {
+        heldRecordCount++;
     }
 
-    // Format: date,student_id,status,synced
-    String record = currentDate + "," + studentId + ",present,0";
-    file.println(record);
-    file.close();
+    printfBoth("Saved attendance record to file: %s%lu,%u,%s", trusted ? "" : "~", (unsigned long)timestamp,
+               attendanceSession, studentId);
+    return true;
+}
 
-    printBoth("Saved attendance record to file: " + record);
+#if LOG_BACKEND_PARTITION
+// Formats each record straight from the flash mapping
+static void printSegment(uint32_t segment)
+{
+    uint16_t count;
+    const LogRecord *records = segmentRecords(segment, count);
+    printfBoth("-- segment %u --", (unsigned)segment);
+    printBoth("date,time,session,student_id,synced");
+    LogEntry entry;
+    char timeOfDay[12];
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (recordValid(records[i]))
+        {
+            recordEntry(records[i], entry);
+            formatTime(entry.timestamp, timeOfDay, sizeof(timeOfDay));
+            printfBoth("%s,%s,%u,%s,%c", entry.date, timeOfDay, entry.session, entry.studentId, entry.synced ? '1' : '0');
+        }
+    }
 }
+#endif
 
-void viewStoredRecords()
+// Prints one file in big sequential reads from the arena instead of
+// byte-wise readBytesUntil(); line by line still works if the arena is busy
+static void printRecordFile(const char *path)
 {
-    File file = SPIFFS.open(ATTENDANCE_FILE_PATH, FILE_READ);
+    File file = SPIFFS.open(path, FILE_READ);
     if (!file)
     {
         printBoth("Failed to open attendance file");
         return;
     }
 
-    printBoth("\n--- Stored Attendance Records ---");
+    bool claimed = arenaBegin(opArena, "export");
+    char *block = claimed ? (char *)arenaAlloc(opArena, EXPORT_BLOCK_SIZE + 1) : nullptr;
 
-    // Read and print all lines
-    while (file.available())
+    if (block != nullptr)
     {
-        String line = file.readStringUntil('\n');
-        printBoth(line);
-    }
-
-    file.close();
-    printBoth("--- End of Records ---\n");
-}
-
-// Function to clear attendance data
-void clearAttendanceData()
-{
-    printBoth("Are you sure you want to clear all attendance records? (Y/N)");
-
-    String confirmation = readInput();
-    if (confirmation == "Y" || confirmation == "y")
-    {
-        // Double confirmation for safety
-        printBoth("ALL ATTENDANCE RECORDS WILL BE PERMANENTLY DELETED!");
-        printBoth("Type 'CONFIRM' to proceed:");
-
-        String finalConfirmation = readInput();
-        if (finalConfirmation == "CONFIRM")
+        size_t pending = 0; // Partial line carried over from the previous block
+        while (true)
         {
-            // Delete the old file
-            if (SPIFFS.remove(ATTENDANCE_FILE_PATH))
+            size_t got = file.read((uint8_t *)block + pending, EXPORT_BLOCK_SIZE - pending);
+            size_t filled = pending + got;
+            if (filled == 0)
             {
-                // Create a new file with only the header
-                File file = SPIFFS.open(ATTENDANCE_FILE_PATH, FILE_WRITE);
-                if (file)
-                {
-                    // Write CSV headers
-                    file.println("date,student_id,status,synced");
-                    file.close();
+                break;
+            }
+            block[filled] = '\0';
 
-                    printBoth("All attendance records have been cleared successfully!");
-                    indicateSuccess(); // Visual confirmation
-                }
-                else
+            char *start = block;
+            char *newline;
+            while ((newline = strchr(start, '\n')) != nullptr)
+            {
+                *newline = '\0';
+                if (newline > start && newline[-1] == '\r')
                 {
-                    printBoth("Error: Failed to create a new attendance file");
-                    indicateFailure();
+                    newline[-1] = '\0';
                 }
+                printBoth(start);
+                start = newline + 1;
             }
-            else
+
+            pending = filled - (start - block);
+            if (got == 0 || pending == EXPORT_BLOCK_SIZE)
             {
-                printBoth("Error: Failed to remove the old attendance file");
-                indicateFailure();
+                // End of file without a newline, or a line longer than a block
+                if (pending > 0)
+                {
+                    printBoth(start);
+                }
+                pending = 0;
+                if (got == 0)
+                {
+                    break;
+                }
+                continue;
             }
+            memmove(block, start, pending);
         }
-        else
+    }
+    else
+    {
+        // Read and print all lines
+        char line[RECORD_LINE_MAX];
+        while (file.available())
         {
-            printBoth("Operation canceled: Confirmation text didn't match");
+            readRecordLine(file, line, sizeof(line));
+            printBoth(line);
         }
     }
-    else
+    if (claimed)
+    {
+        arenaEnd(opArena);
+    }
+
+    file.close();
+}
+
+// "records" prints the newest two segments, "records all" every segment
+// still on flash, "records summary" the per-date counts of compacted ones
+void viewStoredRecords(const char *args)
+{
+    if (strcasecmp(args, "summary") == 0)
+    {
+        printBoth("\n--- Compacted Records (date,records,segment) ---");
+        if (SPIFFS.exists(LOG_SUMMARY_FILE))
+        {
+            printRecordFile(LOG_SUMMARY_FILE);
+        }
+        printBoth("--- End of Summary ---\n");
+        return;
+    }
+
+    commitRecordLog();
+    bool all = strcasecmp(args, "all") == 0;
+    uint32_t first = recordLog.firstSegment;
+    if (!all && recordLog.lastSegment > first)
     {
-        printBoth("Operation canceled");
+        first = recordLog.lastSegment - 1;
     }
 
-    delay(2000);
+    printBoth("\n--- Stored Attendance Records ---");
+    printfBoth("Segments %u-%u on flash, %u records in the active one, sync from %u", (unsigned)recordLog.firstSegment,
+               (unsigned)recordLog.lastSegment, recordLog.activeRecords, (unsigned)recordLog.syncSegment);
+    for (uint32_t segment = first; segment <= recordLog.lastSegment && segment > 0; segment++)
+    {
+#if LOG_BACKEND_PARTITION
+        printSegment(segment);
+#else
+        char path[LOG_PATH_MAX];
+        segmentPath(segment, path, sizeof(path));
+        printfBoth("-- %s --", path);
+        printRecordFile(path);
+#endif
+    }
+    printBoth("--- End of Records ---\n");
 }
 
-void setCurrentDate()
+static void eraseAttendanceData()
 {
-    printBoth("Enter today's date in DD/MM format (e.g., 19/5):");
+    // Delete every segment and the summary, then start over with one empty segment
+    clearAttendanceIndex();
+    if (clearRecordLog())
+    {
+        printBoth("All attendance records have been cleared successfully!");
+        indicateSuccess(); // Visual confirmation
+    }
+    else
+    {
+        printBoth("Error: Failed to create a new attendance file");
+        indicateFailure();
+    }
+}
 
-    // Wait for user to input a date
-    String dateInput = readInput(); // Will wait for input by default
+static bool clearConfirmed = false; // First (Y/N) step of the clear dialog passed
 
-    // Check if we got a valid input (non-empty after timeout)
-    if (dateInput.length() > 0)
+static SessionStatus clearAttendanceInput(const char *line)
+{
+    if (!clearConfirmed)
     {
-        // Optional: add a way to cancel and keep current date
-        if (dateInput == "x" || dateInput == "X")
+        if (strcasecmp(line, "Y") != 0)
         {
-            printBoth("Date change canceled. Keeping current date: " + currentDate);
-            return;
+            printBoth("Operation canceled");
+            return SESSION_DONE;
         }
 
-        currentDate = dateInput;
-        printBoth("Date set to: " + currentDate);
+        // Double confirmation for safety
+        clearConfirmed = true;
+        printBoth("ALL ATTENDANCE RECORDS WILL BE PERMANENTLY DELETED!");
+        printBoth("Type 'CONFIRM' to proceed:");
+        return SESSION_CONTINUE;
+    }
+
+    if (strcmp(line, "CONFIRM") == 0)
+    {
+        eraseAttendanceData();
     }
     else
     {
-        printBoth("No date entered. Keeping current date: " + currentDate);
+        printBoth("Operation canceled: Confirmation text didn't match");
     }
+    return SESSION_DONE;
+}
+
+// Function to clear attendance data ("clear-records CONFIRM" skips the dialog)
+void clearAttendanceData(const char *args)
+{
+    if (strcmp(args, "CONFIRM") == 0)
+    {
+        eraseAttendanceData();
+        return;
+    }
+
+    printBoth("Are you sure you want to clear all attendance records? (Y/N)");
+    clearConfirmed = false;
+    beginSession(clearAttendanceInput);
+}
+
+// Sets the clock from "DD/MM[/YYYY] [HH:MM[:SS]]"; false keeps it as it was
+bool applyCurrentDate(const char *dateInput)
+{
+    // Check if we got a valid input
+    if (dateInput[0] == '\0')
+    {
+        printfBoth("No date entered. Keeping current date: %s", currentDate);
+        return false;
+    }
+
+    // Optional: add a way to cancel and keep current date
+    if (strcasecmp(dateInput, "x") == 0)
+    {
+        printfBoth("Date change canceled. Keeping current date: %s", currentDate);
+        return false;
+    }
+
+    return setClock(dateInput);
+}
+
+static SessionStatus dateInput(const char *line)
+{
+    applyCurrentDate(line);
+    return SESSION_DONE;
+}
+
+void promptCurrentDate()
+{
+    printBoth("Enter today's date and time as DD/MM[/YYYY] HH:MM (e.g., 19/5 08:30):");
+}
+
+// "date 19/5 08:30" sets the clock directly, bare "date" shows it and asks
+void setCurrentDate(const char *args)
+{
+    if (args[0] != '\0')
+    {
+        applyCurrentDate(args);
+        return;
+    }
+
+    showClock();
+    promptCurrentDate();
+    beginSession(dateInput);
 }
 
 // Function to add attendance
 void addAttendance(int fingerprintID)
 {
-    String studentId;
+    char studentId[ROSTER_ID_MAX];
 
     if (fingerprintID)
     {
-        printBoth("Welcome " + String(fingerprintID));
-        studentId = String(fingerprintID);
+        // Record the real student number; bare slot numbers for students not on the roster
+        const RosterEntry *student = rosterLookup(fingerprintID);
+        if (student != nullptr)
+        {
+            printfBoth("Welcome %s (%s)", student->name, student->studentId);
+            strlcpy(studentId, student->studentId, sizeof(studentId));
+        }
+        else
+        {
+            printfBoth("Welcome %d", fingerprintID);
+            snprintf(studentId, sizeof(studentId), "%d", fingerprintID);
+        }
     }
     else
     {
@@ -171,8 +339,12 @@ void addAttendance(int fingerprintID)
         return;
     }
 
-    // Save attendance to local file (passing only studentId)
-    saveAttendanceToFile(studentId);
+    // Save attendance to the log; the slot is marked present in the roll
+    // call once the record is committed, or for a record stamped by an
+    // untrusted clock once the clock is set and its date known
+    bool trusted;
+    uint32_t timestamp = recordStamp(trusted);
+    saveAttendanceToFile(timestamp, trusted, studentId, fingerprintID);
 
     // LED success indication
     indicateSuccess();
@@ -1,189 +1,415 @@
 #include "sync.h"
+#include "arena.h"
 #include "wifi_manager.h"
 #include "ble_manager.h"
+#include "commands.h"
 #include "config.h"
+#include "journal.h"
+#include "record_log.h"
+#include "storage.h"
+#include "sync_backend.h"
+#include "telemetry.h"
+#include "time_source.h"
+#include "trace.h"
 #include <SPIFFS.h>
 
-void syncToGoogle()
+#if FEATURE_SYNC
+
+// Globals
+char syncUrl[SYNC_URL_MAX] = DEFAULT_SYNC_URL;
+
+// Request buffer, carved from opArena for the duration of a sync
+static char *syncPayload = nullptr;
+static size_t syncPayloadSize = 0;
+
+void loadSyncSettings()
 {
-    // Connect to WiFi before syncing
-    connectToWiFi();
+    if (SPIFFS.exists(SYNC_CONFIG_FILE))
+    {
+        File file = SPIFFS.open(SYNC_CONFIG_FILE, FILE_READ);
+        if (file)
+        {
+            char urlFromFile[SYNC_URL_MAX];
+            readRecordLine(file, urlFromFile, sizeof(urlFromFile));
 
-    if (WiFi.status() != WL_CONNECTED)
+            // Only update if not empty
+            if (urlFromFile[0] != '\0')
+            {
+                strlcpy(syncUrl, urlFromFile, sizeof(syncUrl));
+            }
+
+            file.close();
+        }
+    }
+    printfBoth("Sync endpoint: %s", syncUrl);
+}
+
+void saveSyncSettings(const char *newUrl)
+{
+    char contents[SYNC_URL_MAX + 2];
+    int length = snprintf(contents, sizeof(contents), "%s\r\n", newUrl);
+    if (replaceFile(SYNC_CONFIG_FILE, contents, length))
     {
-        printBoth("WiFi not connected. Cannot sync to Google Sheets.");
+        printBoth("Sync endpoint saved successfully");
+    }
+    else
+    {
+        printBoth("Failed to save sync endpoint");
+    }
+}
+
+static bool startsWith(const char *text, const char *prefix)
+{
+    return strncmp(text, prefix, strlen(prefix)) == 0;
+}
+
+static void applySyncUrl(const char *newUrl)
+{
+    if (newUrl[0] == '\0')
+    {
+        printBoth("Sync endpoint unchanged");
         return;
     }
 
-    File file = SPIFFS.open(ATTENDANCE_FILE_PATH, FILE_READ);
-    if (!file)
+    if (strcmp(newUrl, "default") == 0)
     {
-        printBoth("Failed to open file for reading");
-        disconnectWiFi();
+        newUrl = DEFAULT_SYNC_URL;
+    }
+    else if (backendForUrl(newUrl) == nullptr)
+    {
+        printBoth("Endpoint must start with http://, https://, mqtt:// or mqtts://");
+        return;
+    }
+    else if (strlen(newUrl) >= sizeof(syncUrl))
+    {
+        printfBoth("Endpoint too long (max %u characters)", (unsigned)sizeof(syncUrl) - 1);
         return;
     }
 
-    // Read the header line and discard
-    String header = file.readStringUntil('\n');
+    strlcpy(syncUrl, newUrl, sizeof(syncUrl));
+    saveSyncSettings(syncUrl);
+    printfBoth("Sync endpoint updated: %s", syncUrl);
+}
 
-    // Temporary file to store synced records
-    File tempFile = SPIFFS.open("/temp.csv", FILE_WRITE);
-    if (!tempFile)
+static SessionStatus syncUrlInput(const char *line)
+{
+    applySyncUrl(line);
+    return SESSION_DONE;
+}
+
+// "endpoint <url>" applies directly, bare "endpoint" asks for it
+void updateSyncSettings(const char *args)
+{
+    if (args[0] != '\0')
     {
-        printBoth("Failed to create temp file");
-        file.close();
-        disconnectWiFi();
+        applySyncUrl(args);
         return;
     }
 
-    // Write the header to temp file
-    tempFile.println(header);
+    printfBoth("Current sync endpoint: %s", syncUrl);
+    printBoth("Enter new endpoint URL, e.g. http://192.168.1.10:8080/exec");
+    printBoth("or mqtt://192.168.1.10:1883/attendance for an MQTT broker");
+    printBoth("('default' restores Google Sheets, empty keeps current):");
+    beginSession(syncUrlInput);
+}
 
-    WiFiClientSecure client;
-    client.setInsecure(); // Ignore SSL certificate validation
+static const size_t batchSuffixLength = 2; // "]}"
 
-    // Increase timeout values for client
-    client.setTimeout(20000); // 20 seconds timeout
+// Writes everything before the first record into syncPayload
+static size_t beginBatch()
+{
+    static const char prefix[] = "{\"command\": \"batch_attendance\", \"sheet_name\": \"" SYNC_SHEET_NAME "\", ";
+
+    size_t length = strlcpy(syncPayload, prefix, syncPayloadSize);
+#if SYNC_SEND_HEALTH
+    // The reader's own health rides along so the server sees degradation early
+    length += snprintf(syncPayload + length, syncPayloadSize - length, "\"health\": ");
+    int healthLength = formatHealthJson(syncPayload + length, syncPayloadSize - length);
+    if (healthLength > 0 && length + healthLength < syncPayloadSize)
+    {
+        length += healthLength;
+        length += snprintf(syncPayload + length, syncPayloadSize - length, ", ");
+    }
+    else
+    {
+        length -= strlen("\"health\": ");
+    }
+#endif
+    length += snprintf(syncPayload + length, syncPayloadSize - length, "\"records\": [");
+    return length;
+}
 
-    HTTPClient http;
-    // Increase timeout values for HTTP client
-    http.setTimeout(20000);
+// Appends one record; false once the batch is full. "date" and "status"
+// stay for the Apps Script; records with a timestamp add the epoch and the
+// session, from which the server gets arrival times. A record whose clock
+// lost power before it was set goes as "unverified", which the sheet shows
+// in place of "present", under its estimated date or "undated".
+static bool addBatchRecord(size_t &length, size_t &recordCount, const LogEntry &record)
+{
+    bool unverified = record.stamp == STAMP_UNVERIFIED;
+    const char *status = unverified ? "unverified" : "present";
+    char entry[RECORD_LINE_MAX + 64];
+    int entryLength;
+    if (record.timestamp != 0)
+    {
+        entryLength = snprintf(entry, sizeof(entry),
+                               "%s{\"date\":\"%s\",\"ts\":%lu,\"session\":%u,\"student_id\":\"%s\",\"status\":\"%s\"}",
+                               recordCount > 0 ? "," : "", record.date, (unsigned long)record.timestamp,
+                               record.session, record.studentId, status);
+    }
+    else
+    {
+        entryLength = snprintf(entry, sizeof(entry), "%s{\"date\":\"%s\",\"student_id\":\"%s\",\"status\":\"%s\"}",
+                               recordCount > 0 ? "," : "", unverified ? "undated" : record.date, record.studentId,
+                               status);
+    }
+    if (entryLength < 0 || length + entryLength + batchSuffixLength >= syncPayloadSize)
+    {
+        return false; // Batch full; the rest goes in the next request
+    }
 
-    String url = String("/macros/s/") + GSCRIPT_ID + "/exec";
-    String fullUrl = "https://" + String(HOST) + url;
+    memcpy(syncPayload + length, entry, entryLength);
+    length += entryLength;
+    recordCount++;
+    return true;
+}
+
+static size_t endBatch(size_t length)
+{
+    memcpy(syncPayload + length, "]}", batchSuffixLength + 1);
+    return length + batchSuffixLength;
+}
 
-    // Build JSON array of records to sync
-    String jsonPayload = "{\"command\": \"batch_attendance\", \"sheet_name\": \"Attendance\", \"records\": [";
+// Fills syncPayload with the oldest unsynced records of one segment that
+// fit. Returns the payload length, 0 if the segment can't be read (a
+// missing one gives an empty batch); recordCount is the number of records
+// in the batch, held the number of records skipped until the clock is set.
+#if LOG_BACKEND_PARTITION
+static size_t buildBatch(uint32_t segment, size_t &recordCount, size_t &held)
+{
+    size_t length = beginBatch();
+    recordCount = 0;
+    held = 0;
+
+    // Encoded straight from the flash mapping, no line buffer
+    uint16_t count;
+    const LogRecord *records = segmentRecords(segment, count);
+    LogEntry entry;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (!recordValid(records[i]) || records[i].synced == 0)
+        {
+            continue; // Only include records that haven't been synced yet
+        }
+        recordEntry(records[i], entry);
+        if (entry.stamp == STAMP_HELD)
+        {
+            held++;
+            continue;
+        }
+        if (!addBatchRecord(length, recordCount, entry))
+        {
+            break;
+        }
+    }
+    return endBatch(length);
+}
+#else
+static size_t buildBatch(uint32_t segment, size_t &recordCount, size_t &held)
+{
+    size_t length = beginBatch();
+    recordCount = 0;
+    held = 0;
 
-    int recordCount = 0;
-    bool hasUnsyncedRecords = false;
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        if (!SPIFFS.exists(path))
+        {
+            return endBatch(length); // Lost segment: nothing to send, sync moves past it
+        }
+        printBoth("Failed to open file for reading");
+        return 0;
+    }
 
-    // First pass: count unsynchronized records and build JSON array
+    char line[RECORD_LINE_MAX];
+    readRecordLine(file, line, sizeof(line));
+    bool legacy = legacySegment(line);
+    LogEntry entry;
     while (file.available())
     {
-        String line = file.readStringUntil('\n');
-        if (line.length() <= 1)
+        if (readRecordLine(file, line, sizeof(line)) == 0)
+        {
             continue; // Skip empty lines
+        }
 
-        // Parse the CSV line
-        int commaPos1 = line.indexOf(',');
-        int commaPos2 = line.indexOf(',', commaPos1 + 1);
-        int commaPos3 = line.indexOf(',', commaPos2 + 1);
+        if (!parseRecordLine(line, legacy, entry) || entry.synced)
+        {
+            continue; // Only include records that haven't been synced yet
+        }
+        if (entry.stamp == STAMP_HELD)
+        {
+            held++;
+            continue;
+        }
+        if (!addBatchRecord(length, recordCount, entry))
+        {
+            break;
+        }
+    }
+    file.close();
+    return endBatch(length);
+}
+#endif
+
+// Each batch is bounded by the payload buffer; keep going until the backlog is empty
+static SyncResult uploadBacklog(const SyncBackend &backend)
+{
+    size_t totalSynced = 0;
+    bool heldBehind = false; // Held records in a segment already passed
+    uint32_t segment = recordLog.syncSegment;
+    while (true)
+    {
+        // Batches come from one segment at a time, oldest unsynced first
+        size_t recordCount = 0;
+        size_t held = 0;
+        size_t payloadLength = buildBatch(segment, recordCount, held);
+        if (payloadLength == 0)
+        {
+            return SYNC_FAILED;
+        }
 
-        String date = line.substring(0, commaPos1);
-        String studentId = line.substring(commaPos1 + 1, commaPos2);
-        String status = line.substring(commaPos2 + 1, commaPos3);
-        String synced = line.substring(commaPos3 + 1);
+        if (recordCount == 0 && segment < recordLog.lastSegment)
+        {
+            // Nothing left to send here. Held records keep syncSegment on
+            // their segment, so they're found again once the clock is set.
+            heldBehind |= held > 0;
+            if (!heldBehind)
+            {
+                recordLog.syncSegment = segment + 1;
+            }
+            segment++;
+            continue;
+        }
 
-        // Only include records that haven't been synced yet
-        if (synced.toInt() == 0)
+        // If no records to sync, just report and exit
+        if (recordCount == 0)
         {
-            // Add comma if not the first record
-            if (hasUnsyncedRecords)
+            if (totalSynced == 0)
             {
-                jsonPayload += ",";
+                printBoth("No unsynced records found. Nothing to upload.");
             }
+            unsyncedRecordCount = 0;
+            break;
+        }
 
-            // Add this record to the JSON array
-            jsonPayload += "{\"date\":\"" + date + "\",\"student_id\":\"" + studentId + "\",\"status\":\"" + status + "\"}";
+        printfBoth("Publishing %u attendance records to %s", (unsigned)recordCount, syncUrl);
+        printfBoth("Payload size: %u bytes", (unsigned)payloadLength);
+        trace(TRACE_SYNC_POST, 0, (uint16_t)recordCount);
 
-            hasUnsyncedRecords = true;
-            recordCount++;
+        if (!backend.send(syncPayload, payloadLength) || !markSegmentSynced(segment, recordCount))
+        {
+            printBoth("Sync failed. Will try again later.");
+            return SYNC_FAILED;
         }
+
+        totalSynced += recordCount;
+        unsyncedRecordCount = unsyncedRecordCount > recordCount ? unsyncedRecordCount - recordCount : 0;
     }
 
-    // Close the JSON array and object
-    jsonPayload += "]}";
+    printfBoth("Sync completed successfully. %u records synced.", (unsigned)totalSynced);
 
-    // Reset file position to beginning (after header)
-    file.seek(0);
-    file.readStringUntil('\n'); // Skip header
+    // Synced segments past the retention window are summarised and deleted
+    compactRecordLog();
+    return SYNC_OK;
+}
 
-    // If no records to sync, just report and exit
-    if (!hasUnsyncedRecords)
+const SyncBackend *backendForUrl(const char *url)
+{
+    if (startsWith(url, "mqtt://") || startsWith(url, "mqtts://"))
     {
-        printBoth("No unsynced records found. Nothing to upload.");
-        file.close();
-        tempFile.close();
-        disconnectWiFi();
-        return;
+        return &mqttBackend;
     }
+    if (startsWith(url, "http://") || startsWith(url, "https://"))
+    {
+        return &httpBackend;
+    }
+    return nullptr;
+}
 
-    printBoth("Publishing " + String(recordCount) + " attendance records to Google Sheets...");
-    printBoth("Payload size: " + String(jsonPayload.length()) + " bytes");
+// Backend whose session was left open by the last sync, if any
+static const SyncBackend *openBackend = nullptr;
 
-    // Send the batch request
-    http.begin(client, fullUrl);
-    http.addHeader("Content-Type", "application/json");
-    int httpResponseCode = http.POST(jsonPayload);
+void closeSyncSession()
+{
+    if (openBackend != nullptr)
+    {
+        openBackend->close(false);
+        openBackend = nullptr;
+    }
+}
 
-    bool syncSuccessful = false;
+SyncResult syncRecords()
+{
+    // Connect to WiFi before syncing
+    connectToWiFi();
 
-    // Handle response
-    if (httpResponseCode > 0)
+    if (!wifiConnected())
     {
-        String response = http.getString();
-        printBoth("HTTP Response code: " + String(httpResponseCode));
-        printBoth("Response: " + response);
-        syncSuccessful = true;
+        printBoth("WiFi not connected. Cannot sync attendance records.");
+        return SYNC_NO_UPLINK;
     }
-    // Check for specific negative error codes that might still indicate success
-    else if (httpResponseCode == -11)
+
+    const SyncBackend *backend = backendForUrl(syncUrl);
+    if (backend == nullptr)
     {
-        printBoth("Response timeout but data likely sent. HTTP Response code: " + String(httpResponseCode));
-        // Optimistically assume data was sent
-        syncSuccessful = true;
+        printfBoth("No sync backend for endpoint %s", syncUrl);
+        return SYNC_FAILED;
     }
-    else
+    if (openBackend != nullptr && openBackend != backend)
     {
-        printBoth("Error publishing data. HTTP Response code: " + String(httpResponseCode));
-        syncSuccessful = false;
+        closeSyncSession(); // Endpoint changed since the last sync
     }
 
-    http.end();
-
-    // Now update the local records based on sync result
-    while (file.available())
+    // Backend buffers first, the payload gets whatever the arena has left
+    if (!arenaBegin(opArena, "sync"))
     {
-        String line = file.readStringUntil('\n');
-        if (line.length() <= 1)
-        {
-            continue; // Skip empty lines
-        }
-
-        // Parse the CSV line to check sync status
-        int lastCommaPos = line.lastIndexOf(',');
-        String syncStatus = line.substring(lastCommaPos + 1);
-
-        if (syncStatus.toInt() == 0 && syncSuccessful)
-        {
-            // Mark as synced by replacing the last 0 with 1
-            String updatedLine = line.substring(0, lastCommaPos + 1) + "1";
-            tempFile.println(updatedLine);
-        }
-        else
-        {
-            // Keep line as is
-            tempFile.println(line);
-        }
+        printBoth("Sync buffers busy or unavailable");
+        return SYNC_FAILED;
     }
-
-    file.close();
-    tempFile.close();
-
-    // Replace the original file with the temp file
-    SPIFFS.remove(ATTENDANCE_FILE_PATH);
-    SPIFFS.rename("/temp.csv", ATTENDANCE_FILE_PATH);
-
-    if (syncSuccessful)
+    if (!backend->open(syncUrl))
     {
-        printBoth("Sync completed successfully. " + String(recordCount) + " records synced.");
+        arenaEnd(opArena);
+        backend->close(false);
+        openBackend = nullptr;
+        printfBoth("Failed to open %s sync session", backend->name);
+        return SYNC_FAILED;
     }
-    else
+    syncPayloadSize = min(arenaAvailable(opArena), (size_t)SYNC_PAYLOAD_MAX);
+    syncPayload = (char *)arenaAlloc(opArena, syncPayloadSize);
+    if (syncPayload == nullptr)
     {
-        printBoth("Sync failed. Will try again later.");
+        arenaEnd(opArena);
+        backend->close(false);
+        openBackend = nullptr;
+        printBoth("Not enough arena space for sync buffers");
+        return SYNC_FAILED;
     }
 
-    // Disconnect from WiFi after syncing
-    disconnectWiFi();
+    // Buffered records go out in this sync too
+    commitRecordLog();
+    SyncResult result = uploadBacklog(*backend);
+
+    // A healthy session stays up while WiFi lingers, see closeSyncSession()
+    backend->close(result == SYNC_OK);
+    openBackend = result == SYNC_OK ? backend : nullptr;
+
+    // Releases the payload and backend buffers in one go
+    arenaEnd(opArena);
+    syncPayload = nullptr;
+    return result;
 }
+
+#endif // FEATURE_SYNC
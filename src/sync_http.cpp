@@ -0,0 +1,152 @@
+#include "sync_backend.h"
+#include "arena.h"
+#include "ble_manager.h"
+#include "trace.h"
+
+#if FEATURE_SYNC
+#include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+
+// One POST per batch to Google Apps Script (or tools/sync_server.py)
+
+static const char *url = nullptr;
+static WiFiClientSecure secureClient;
+static WiFiClient plainClient;
+static WiFiClient *client = nullptr;
+
+// Response body kept for the log, carved from opArena for the sync
+static char *response = nullptr;
+static size_t responseSize = 0;
+
+static bool httpOpen(const char *endpoint)
+{
+    response = (char *)arenaAlloc(opArena, SYNC_RESPONSE_MAX);
+    if (response == nullptr)
+    {
+        return false;
+    }
+    responseSize = SYNC_RESPONSE_MAX;
+    url = endpoint;
+
+    // Plain HTTP is only used for local sync servers, production goes over TLS
+    if (strncmp(url, "https://", 8) == 0)
+    {
+        secureClient.setInsecure(); // Ignore SSL certificate validation
+        client = &secureClient;
+    }
+    else
+    {
+        client = &plainClient;
+    }
+
+    // Increase timeout values for client
+    client->setTimeout(SYNC_HTTP_TIMEOUT_MS);
+    return true;
+}
+
+// Keeps the first responseSize-1 bytes of the body and drains the rest
+// so the connection closes cleanly, without HTTPClient::getString()
+static size_t readResponse(HTTPClient &http)
+{
+    WiFiClient *stream = http.getStreamPtr();
+    int remaining = http.getSize(); // -1 when the server didn't send Content-Length
+    size_t length = 0;
+    unsigned long start = millis();
+
+    while (stream != nullptr && remaining != 0 && millis() - start < SYNC_HTTP_TIMEOUT_MS)
+    {
+        int available = stream->available();
+        if (available <= 0)
+        {
+            if (!stream->connected())
+            {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+
+        uint8_t scratch[64];
+        uint8_t *target = scratch;
+        size_t room = sizeof(scratch);
+        if (length < responseSize - 1)
+        {
+            target = (uint8_t *)response + length;
+            room = responseSize - 1 - length;
+        }
+        size_t want = min((size_t)available, room);
+        if (remaining > 0)
+        {
+            want = min(want, (size_t)remaining);
+        }
+
+        int got = stream->read(target, want);
+        if (got <= 0)
+        {
+            break;
+        }
+        if (target != scratch)
+        {
+            length += got;
+        }
+        if (remaining > 0)
+        {
+            remaining -= got;
+        }
+    }
+
+    response[length] = '\0';
+    return length;
+}
+
+static bool httpSend(const char *payload, size_t payloadLength)
+{
+    HTTPClient http;
+    // Increase timeout values for HTTP client
+    http.setTimeout(SYNC_HTTP_TIMEOUT_MS);
+
+    // Apps Script answers a POST with a 302 to the script's output; the
+    // 2xx that matters comes from following it (as a GET)
+    http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+
+    // Send the batch request
+    http.begin(*client, url);
+    http.addHeader("Content-Type", "application/json");
+    int httpResponseCode = http.POST((uint8_t *)payload, payloadLength);
+    trace(TRACE_SYNC_RESPONSE, 0, (uint16_t)(int16_t)httpResponseCode);
+
+    bool syncSuccessful = false;
+
+    // Handle response. Only a 2xx marks the batch synced; anything else,
+    // a read timeout included, leaves it for the next sync to send again.
+    if (httpResponseCode > 0)
+    {
+        readResponse(http);
+        printfBoth("HTTP Response code: %d", httpResponseCode);
+        printBoth("Response:");
+        printBoth(response);
+        syncSuccessful = httpResponseCode >= 200 && httpResponseCode < 300;
+    }
+    else
+    {
+        printfBoth("Error publishing data. HTTP Response code: %d", httpResponseCode);
+    }
+
+    http.end();
+    return syncSuccessful;
+}
+
+// Every POST is its own request, there is no session worth keeping
+static void httpClose(bool keepSession)
+{
+    if (client != nullptr)
+    {
+        client->stop();
+    }
+    client = nullptr;
+    response = nullptr;
+}
+
+const SyncBackend httpBackend = {"http", httpOpen, httpSend, httpClose};
+
+#endif // FEATURE_SYNC
@@ -0,0 +1,331 @@
+#include "sync_backend.h"
+#include "ble_manager.h"
+
+#if FEATURE_SYNC
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+// Just enough MQTT 3.1.1 for uploads: CONNECT without clean session, so the
+// broker keeps our session across reconnects; one QoS 1 PUBLISH per batch,
+// confirmed by its PUBACK; DISCONNECT. The connection outlives a sync while
+// WiFi lingers, so a follow-up sync skips TCP/TLS setup and CONNECT.
+//
+// A batch whose PUBACK never arrived stays unsynced in the log and goes out
+// again, under a new packet ID, in the next sync. The broker may therefore
+// deliver it twice; batch_attendance consumers already treat a repeated
+// record as the same mark.
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH_QOS1 0x32
+#define MQTT_PUBACK 0x40
+#define MQTT_DISCONNECT 0xE0
+#define MQTT_PACKET_TYPE(header) ((header) & 0xF0)
+
+struct MqttEndpoint
+{
+    char host[64];
+    uint16_t port;
+    char user[32];
+    char password[64];
+    char topic[MQTT_TOPIC_MAX];
+    bool tls;
+};
+
+static MqttEndpoint endpoint;
+static char sessionUrl[SYNC_URL_MAX] = ""; // Endpoint of the open connection
+static char clientId[MQTT_CLIENT_ID_MAX] = "";
+static WiFiClientSecure secureClient;
+static WiFiClient plainClient;
+static WiFiClient *client = nullptr;
+static uint16_t nextPacketId = 1;
+
+static bool copyField(char *out, size_t size, const char *start, const char *end)
+{
+    size_t length = end - start;
+    if (length >= size)
+    {
+        return false;
+    }
+    memcpy(out, start, length);
+    out[length] = '\0';
+    return true;
+}
+
+// mqtt[s]://[user[:password]@]host[:port][/topic]
+static bool parseEndpoint(const char *url, MqttEndpoint &out)
+{
+    memset(&out, 0, sizeof(out));
+    out.tls = strncmp(url, "mqtts://", 8) == 0;
+
+    const char *cursor = strstr(url, "://") + 3;
+    const char *slash = strchr(cursor, '/');
+    const char *end = slash != nullptr ? slash : cursor + strlen(cursor);
+
+    const char *at = (const char *)memchr(cursor, '@', end - cursor);
+    if (at != nullptr)
+    {
+        const char *colon = (const char *)memchr(cursor, ':', at - cursor);
+        if (!copyField(out.user, sizeof(out.user), cursor, colon != nullptr ? colon : at) ||
+            (colon != nullptr && !copyField(out.password, sizeof(out.password), colon + 1, at)))
+        {
+            return false;
+        }
+        cursor = at + 1;
+    }
+
+    const char *colon = (const char *)memchr(cursor, ':', end - cursor);
+    if (!copyField(out.host, sizeof(out.host), cursor, colon != nullptr ? colon : end) || out.host[0] == '\0')
+    {
+        return false;
+    }
+    out.port = colon != nullptr ? atoi(colon + 1) : (out.tls ? 8883 : 1883);
+
+    const char *topic = slash != nullptr && slash[1] != '\0' ? slash + 1 : MQTT_DEFAULT_TOPIC;
+    return out.port != 0 && strlcpy(out.topic, topic, sizeof(out.topic)) < sizeof(out.topic);
+}
+
+// MQTT "remaining length": 7 bits per byte, high bit set while more follow
+static size_t encodeLength(uint8_t *out, size_t length)
+{
+    size_t used = 0;
+    do
+    {
+        uint8_t digit = length & 0x7F;
+        length >>= 7;
+        out[used++] = length > 0 ? digit | 0x80 : digit;
+    } while (length > 0);
+    return used;
+}
+
+// Length-prefixed UTF-8 string
+static size_t putString(uint8_t *out, const char *text)
+{
+    size_t length = strlen(text);
+    out[0] = length >> 8;
+    out[1] = length & 0xFF;
+    memcpy(out + 2, text, length);
+    return length + 2;
+}
+
+static bool writeAll(const uint8_t *data, size_t length)
+{
+    return client->write(data, length) == length;
+}
+
+static bool readByte(uint8_t &value, unsigned long deadline)
+{
+    while (client->available() <= 0)
+    {
+        if (!client->connected() || (long)(millis() - deadline) >= 0)
+        {
+            return false;
+        }
+        delay(1);
+    }
+    value = client->read();
+    return true;
+}
+
+// Reads one packet, keeping up to size bytes of its body and skipping the rest
+static bool readPacket(uint8_t &header, uint8_t *body, size_t size, size_t &length, unsigned long deadline)
+{
+    if (!readByte(header, deadline))
+    {
+        return false;
+    }
+
+    size_t remaining = 0;
+    uint8_t shift = 0;
+    uint8_t digit;
+    do
+    {
+        if (shift > 21 || !readByte(digit, deadline))
+        {
+            return false;
+        }
+        remaining |= (size_t)(digit & 0x7F) << shift;
+        shift += 7;
+    } while (digit & 0x80);
+
+    length = 0;
+    for (size_t i = 0; i < remaining; i++)
+    {
+        uint8_t value;
+        if (!readByte(value, deadline))
+        {
+            return false;
+        }
+        if (length < size)
+        {
+            body[length++] = value;
+        }
+    }
+    return true;
+}
+
+static bool mqttConnect()
+{
+    if (endpoint.tls)
+    {
+        secureClient.setInsecure(); // Same policy as the HTTPS backend
+        client = &secureClient;
+    }
+    else
+    {
+        client = &plainClient;
+    }
+
+    unsigned long start = millis();
+    if (!client->connect(endpoint.host, endpoint.port))
+    {
+        printfBoth("MQTT broker %s:%u unreachable", endpoint.host, endpoint.port);
+        return false;
+    }
+
+    // Variable header: protocol name, level 4, flags, keepalive
+    uint8_t flags = 0; // Clean session off: the broker keeps our session
+    if (endpoint.user[0] != '\0')
+    {
+        flags |= 0x80;
+    }
+    if (endpoint.user[0] != '\0' && endpoint.password[0] != '\0')
+    {
+        flags |= 0x40; // Only allowed together with a user name
+    }
+    uint8_t body[10 + 2 + MQTT_CLIENT_ID_MAX + 2 + sizeof(endpoint.user) + 2 + sizeof(endpoint.password)];
+    size_t bodyLength = putString(body, "MQTT");
+    body[bodyLength++] = 4;
+    body[bodyLength++] = flags;
+    body[bodyLength++] = MQTT_KEEPALIVE_S >> 8;
+    body[bodyLength++] = MQTT_KEEPALIVE_S & 0xFF;
+    bodyLength += putString(body + bodyLength, clientId);
+    if (flags & 0x80)
+    {
+        bodyLength += putString(body + bodyLength, endpoint.user);
+    }
+    if (flags & 0x40)
+    {
+        bodyLength += putString(body + bodyLength, endpoint.password);
+    }
+
+    uint8_t header[5] = {MQTT_CONNECT};
+    size_t headerLength = 1 + encodeLength(header + 1, bodyLength);
+    if (!writeAll(header, headerLength) || !writeAll(body, bodyLength))
+    {
+        printBoth("MQTT connect failed");
+        return false;
+    }
+
+    uint8_t reply;
+    uint8_t ack[2];
+    size_t ackLength;
+    if (!readPacket(reply, ack, sizeof(ack), ackLength, millis() + MQTT_ACK_TIMEOUT_MS) ||
+        MQTT_PACKET_TYPE(reply) != MQTT_CONNACK || ackLength < 2)
+    {
+        printBoth("No CONNACK from MQTT broker");
+        return false;
+    }
+    if (ack[1] != 0)
+    {
+        printfBoth("MQTT broker refused the connection (code %u)", ack[1]);
+        return false;
+    }
+
+    printfBoth("MQTT connected to %s:%u as %s in %lu ms (%s session)", endpoint.host, endpoint.port, clientId,
+               millis() - start, (ack[0] & 0x01) ? "resumed" : "new");
+    return true;
+}
+
+static void mqttClose(bool keepSession)
+{
+    if (keepSession || client == nullptr)
+    {
+        return;
+    }
+    if (client->connected())
+    {
+        static const uint8_t disconnect[] = {MQTT_DISCONNECT, 0};
+        writeAll(disconnect, sizeof(disconnect));
+    }
+    client->stop();
+    client = nullptr;
+    sessionUrl[0] = '\0';
+}
+
+static bool mqttOpen(const char *url)
+{
+    if (client != nullptr && client->connected() && strcmp(url, sessionUrl) == 0)
+    {
+        printBoth("MQTT session still open, reusing it");
+        return true;
+    }
+    mqttClose(false);
+
+    if (!parseEndpoint(url, endpoint))
+    {
+        printBoth("Bad MQTT endpoint, expected mqtt://[user:pass@]host[:port][/topic]");
+        return false;
+    }
+    if (clientId[0] == '\0')
+    {
+        // Stable per device, which is what ties the broker's session to us
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf(clientId, sizeof(clientId), "attendance-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    }
+
+    if (!mqttConnect())
+    {
+        mqttClose(false);
+        return false;
+    }
+    strlcpy(sessionUrl, url, sizeof(sessionUrl));
+    return true;
+}
+
+static bool mqttSend(const char *payload, size_t length)
+{
+    uint16_t packetId = nextPacketId;
+    nextPacketId = nextPacketId == UINT16_MAX ? 1 : nextPacketId + 1;
+
+    uint8_t header[5 + 2 + MQTT_TOPIC_MAX + 2];
+    size_t used = 0;
+    header[used++] = MQTT_PUBLISH_QOS1;
+    used += encodeLength(header + used, 2 + strlen(endpoint.topic) + 2 + length);
+    used += putString(header + used, endpoint.topic);
+    header[used++] = packetId >> 8;
+    header[used++] = packetId & 0xFF;
+
+    unsigned long start = millis();
+    if (!writeAll(header, used) || !writeAll((const uint8_t *)payload, length))
+    {
+        printBoth("MQTT publish failed, connection lost");
+        return false;
+    }
+
+    // Anything else the broker sends meanwhile is skipped
+    unsigned long deadline = millis() + MQTT_ACK_TIMEOUT_MS;
+    while (true)
+    {
+        uint8_t reply;
+        uint8_t ack[2];
+        size_t ackLength;
+        if (!readPacket(reply, ack, sizeof(ack), ackLength, deadline))
+        {
+            printBoth("No PUBACK from MQTT broker");
+            return false;
+        }
+        if (MQTT_PACKET_TYPE(reply) == MQTT_PUBACK && ackLength == 2 && ((ack[0] << 8) | ack[1]) == packetId)
+        {
+            break;
+        }
+    }
+
+    printfBoth("Published to %s, PUBACK after %lu ms", endpoint.topic, millis() - start);
+    return true;
+}
+
+const SyncBackend mqttBackend = {"mqtt", mqttOpen, mqttSend, mqttClose};
+
+#endif // FEATURE_SYNC
@@ -0,0 +1,284 @@
+#include "sync_scheduler.h"
+#include "ble_manager.h"
+#include "config.h"
+#include "fingerprint.h"
+#include "storage.h"
+#include "sync_backend.h"
+#include "time_source.h"
+#include "trace.h"
+#include "wifi_manager.h"
+
+#if FEATURE_SYNC
+
+// Globals
+SyncSchedulerState syncScheduler = {};
+
+// Signed distance so comparisons survive millis() rollover
+static long msUntil(unsigned long deadline, unsigned long now)
+{
+    return (long)(deadline - now);
+}
+
+// Exponential backoff with jitter: a random delay in [d/2, d] where d doubles per failure
+static unsigned long backoffDelay(uint32_t failures)
+{
+    uint32_t exponent = failures > 0 ? failures - 1 : 0;
+    if (exponent > 16)
+    {
+        exponent = 16;
+    }
+
+    unsigned long delayMs = SYNC_BACKOFF_BASE_MS << exponent;
+    if (delayMs > SYNC_BACKOFF_MAX_MS)
+    {
+        delayMs = SYNC_BACKOFF_MAX_MS;
+    }
+
+    return random(delayMs / 2, delayMs + 1);
+}
+
+static const char *breakerName(BreakerState state)
+{
+    switch (state)
+    {
+    case BREAKER_OPEN:
+        return "open";
+    case BREAKER_HALF_OPEN:
+        return "half-open";
+    default:
+        return "closed";
+    }
+}
+
+void initSyncScheduler()
+{
+    unsigned long now = millis();
+    syncScheduler.lastActivity = now;
+    syncScheduler.lastSuccess = now;
+    syncScheduler.nextAttempt = now;
+    syncScheduler.lastClockSync = now - TIME_SYNC_RETRY_MS;
+    syncScheduler.breaker = BREAKER_CLOSED;
+    syncScheduler.enabled = true;
+}
+
+void noteSyncActivity()
+{
+    syncScheduler.lastActivity = millis();
+}
+
+uint32_t syncBacklogSize()
+{
+    return unsyncedRecordCount;
+}
+
+SyncResult runSync()
+{
+    syncScheduler.attempts++;
+    trace(TRACE_SYNC_START, 0, (uint16_t)min(unsyncedRecordCount, (uint32_t)UINT16_MAX));
+    SyncResult result = syncRecords();
+    trace(TRACE_SYNC_END, (uint8_t)result);
+    unsigned long now = millis();
+
+    if (result == SYNC_OK)
+    {
+        syncScheduler.successes++;
+        syncScheduler.consecutiveFailures = 0;
+        syncScheduler.uplinkFailures = 0;
+        syncScheduler.breaker = BREAKER_CLOSED;
+        syncScheduler.lastSuccess = now;
+        syncScheduler.nextAttempt = now;
+
+        // Leave WiFi up for a while so a follow-up sync skips the reconnect
+        syncScheduler.wifiIdleSince = now;
+        return result;
+    }
+
+    syncScheduler.consecutiveFailures++;
+    if (result == SYNC_NO_UPLINK)
+    {
+        syncScheduler.uplinkFailures++;
+    }
+    else
+    {
+        syncScheduler.uplinkFailures = 0;
+    }
+
+    bool tripBreaker = result == SYNC_NO_UPLINK &&
+                       (syncScheduler.breaker == BREAKER_HALF_OPEN ||
+                        syncScheduler.uplinkFailures >= SYNC_BREAKER_THRESHOLD);
+    if (tripBreaker)
+    {
+        syncScheduler.breaker = BREAKER_OPEN;
+        syncScheduler.nextAttempt = now + SYNC_BREAKER_COOLDOWN_MS;
+        printfBoth("Uplink down, automatic sync paused for %lu min", SYNC_BREAKER_COOLDOWN_MS / 60000);
+    }
+    else
+    {
+        if (syncScheduler.breaker == BREAKER_HALF_OPEN)
+        {
+            // Reached the server, so the uplink itself is back
+            syncScheduler.breaker = BREAKER_CLOSED;
+        }
+        syncScheduler.nextAttempt = now + backoffDelay(syncScheduler.consecutiveFailures);
+    }
+
+    closeSyncSession();
+    disconnectWiFi();
+    syncScheduler.wifiIdleSince = 0;
+    return result;
+}
+
+// Nothing to upload, but a clock that was never set or only restored after
+// a power loss is worth a short connection for SNTP while the reader idles.
+// WiFi then lingers like after a sync, long enough for the reply.
+static void serviceClockSync(unsigned long now)
+{
+    if (timeTrusted() || syncScheduler.breaker == BREAKER_OPEN || syncScheduler.wifiIdleSince != 0 ||
+        now - syncScheduler.lastActivity < SYNC_IDLE_MS || now - syncScheduler.lastClockSync < TIME_SYNC_RETRY_MS)
+    {
+        return;
+    }
+
+    syncScheduler.lastClockSync = now;
+    printBoth("Auto-sync: connecting to set the clock");
+    connectToWiFi();
+    if (wifiConnected())
+    {
+        syncScheduler.wifiIdleSince = millis();
+    }
+    else
+    {
+        disconnectWiFi();
+    }
+}
+
+// Before a headless reader scans on an untrusted clock: one connection,
+// waiting up to TIME_SYNC_WAIT_MS for SNTP. WiFi then lingers as after a
+// sync. Records taken if it fails are held until the clock is set.
+bool fetchClock()
+{
+    if (timeTrusted())
+    {
+        return true;
+    }
+
+    syncScheduler.lastClockSync = millis();
+    printBoth("Clock not trusted, connecting to set it before scanning");
+    connectToWiFi();
+    if (!wifiConnected())
+    {
+        disconnectWiFi();
+        return false;
+    }
+
+    unsigned long start = millis();
+    while (!timeTrusted() && millis() - start < TIME_SYNC_WAIT_MS)
+    {
+        delay(100);
+        serviceTimeSource();
+    }
+    syncScheduler.wifiIdleSince = millis();
+    return timeTrusted();
+}
+
+void serviceSyncScheduler()
+{
+    unsigned long now = millis();
+
+    if (syncScheduler.wifiIdleSince != 0 && now - syncScheduler.wifiIdleSince >= SYNC_WIFI_LINGER_MS)
+    {
+        closeSyncSession();
+        disconnectWiFi();
+        syncScheduler.wifiIdleSince = 0;
+    }
+
+    if (!syncScheduler.enabled || msUntil(syncScheduler.nextAttempt, now) > 0)
+    {
+        return;
+    }
+
+    if (unsyncedRecordCount == 0)
+    {
+        serviceClockSync(now);
+        return;
+    }
+
+    // A sync blocks the main loop for seconds, so during attendance mode
+    // only a lull in scanning may start one; the backlog and timer triggers
+    // wait until the session ends
+    bool capturing = captureActive();
+    bool backlogFull = !capturing && unsyncedRecordCount >= SYNC_BACKLOG_THRESHOLD;
+    bool idle = now - syncScheduler.lastActivity >= SYNC_IDLE_MS;
+    bool overdue = !capturing && now - syncScheduler.lastSuccess >= SYNC_INTERVAL_MS;
+    if (!backlogFull && !idle && !overdue)
+    {
+        return;
+    }
+
+    if (syncScheduler.breaker == BREAKER_OPEN)
+    {
+        syncScheduler.breaker = BREAKER_HALF_OPEN;
+    }
+
+    printfBoth("Auto-sync: %u records pending (%s)", (unsigned)unsyncedRecordCount,
+               backlogFull ? "backlog" : idle ? "idle" : "timer");
+    runSync();
+}
+
+long msUntilNextSync()
+{
+    if (!syncScheduler.enabled || unsyncedRecordCount == 0)
+    {
+        return -1;
+    }
+
+    unsigned long now = millis();
+    long due = 0;
+    long idleDue = msUntil(syncScheduler.lastActivity + SYNC_IDLE_MS, now);
+    if (captureActive())
+    {
+        // Attendance mode only syncs in a lull
+        due = idleDue;
+    }
+    else if (unsyncedRecordCount < SYNC_BACKLOG_THRESHOLD)
+    {
+        // Whichever of the idle and interval triggers fires first
+        long timerDue = msUntil(syncScheduler.lastSuccess + SYNC_INTERVAL_MS, now);
+        due = min(idleDue, timerDue);
+    }
+
+    long gate = msUntil(syncScheduler.nextAttempt, now);
+    return max(max(due, gate), 0L);
+}
+
+void showSyncStatus()
+{
+    printBoth("=== Sync Status ===");
+    const SyncBackend *backend = backendForUrl(syncUrl);
+    printfBoth("Endpoint: %s (%s)", syncUrl, backend != nullptr ? backend->name : "unsupported");
+    printfBoth("Backlog: %u records (threshold %d)", (unsigned)syncBacklogSize(), SYNC_BACKLOG_THRESHOLD);
+    if (heldRecordCount > 0)
+    {
+        printfBoth("Held until the clock is set: %u records", (unsigned)heldRecordCount);
+    }
+    printfBoth("Auto-sync: %s, breaker %s", syncScheduler.enabled ? "on" : "off", breakerName(syncScheduler.breaker));
+    printfBoth("Attempts: %u, succeeded: %u, consecutive failures: %u", (unsigned)syncScheduler.attempts,
+               (unsigned)syncScheduler.successes, (unsigned)syncScheduler.consecutiveFailures);
+    if (syncScheduler.successes > 0)
+    {
+        printfBoth("Last success: %lu s ago", (millis() - syncScheduler.lastSuccess) / 1000);
+    }
+
+    long next = msUntilNextSync();
+    if (next < 0)
+    {
+        printBoth("Next attempt: nothing to sync");
+    }
+    else
+    {
+        printfBoth("Next attempt in: %ld s", next / 1000);
+    }
+    printBoth("===================");
+}
+
+#endif // FEATURE_SYNC
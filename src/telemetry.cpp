@@ -0,0 +1,148 @@
+#include "telemetry.h"
+#include "ble_manager.h"
+#include "config.h"
+#include "heap_monitor.h"
+#include "trace.h"
+#include "wifi_manager.h"
+#include <SPIFFS.h>
+#include <esp_freertos_hooks.h>
+#include <esp_system.h>
+
+// Globals
+TelemetryCounters telemetry = {};
+
+// The stock core is built without FreeRTOS run-time stats, so CPU share is
+// sampled instead: every tick, each core charges the task it interrupted.
+// Tasks that block within a tick are undercounted; light sleep isn't
+// sampled at all, so shares are of awake time.
+struct CpuSamples
+{
+    TaskHandle_t task;
+    uint32_t ticks;
+};
+
+static CpuSamples cpuSamples[TELEMETRY_MAX_TASKS];
+static uint32_t cpuSampleTotal = 0;
+static portMUX_TYPE cpuSampleLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR sampleCpu()
+{
+    TaskHandle_t current = xTaskGetCurrentTaskHandleForCPU(xPortGetCoreID());
+    portENTER_CRITICAL_ISR(&cpuSampleLock);
+    cpuSampleTotal++;
+    for (int i = 0; i < TELEMETRY_MAX_TASKS; i++)
+    {
+        // Tasks beyond the table still count toward the total
+        if (cpuSamples[i].task == current || cpuSamples[i].task == nullptr)
+        {
+            cpuSamples[i].task = current;
+            cpuSamples[i].ticks++;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_ISR(&cpuSampleLock);
+}
+
+void initTelemetry()
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        esp_register_freertos_tick_hook_for_cpu(sampleCpu, core);
+    }
+}
+
+// Percent of all sampled ticks (both cores) spent in one task
+static unsigned cpuShare(TaskHandle_t task)
+{
+    unsigned share = 0;
+    portENTER_CRITICAL(&cpuSampleLock);
+    for (int i = 0; i < TELEMETRY_MAX_TASKS && cpuSamples[i].task != nullptr; i++)
+    {
+        if (cpuSamples[i].task == task && cpuSampleTotal > 0)
+        {
+            share = (unsigned)((uint64_t)cpuSamples[i].ticks * 100 / cpuSampleTotal);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&cpuSampleLock);
+    return share;
+}
+
+void noteFlashWrite(size_t bytes)
+{
+    telemetry.flashWrites++;
+    telemetry.flashBytesWritten += bytes;
+    trace(TRACE_FILE_WRITE, 0, (uint16_t)min(bytes, (size_t)UINT16_MAX));
+}
+
+// Smallest stack headroom of any task, the first thing to run out
+static uint32_t minStackFree(const char *&taskName)
+{
+#if configUSE_TRACE_FACILITY == 1
+    static TaskStatus_t tasks[TELEMETRY_MAX_TASKS];
+    UBaseType_t count = uxTaskGetSystemState(tasks, TELEMETRY_MAX_TASKS, nullptr);
+    uint32_t lowest = UINT32_MAX;
+    taskName = "";
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        if (tasks[i].usStackHighWaterMark < lowest)
+        {
+            lowest = tasks[i].usStackHighWaterMark;
+            taskName = tasks[i].pcTaskName;
+        }
+    }
+    return lowest;
+#else
+    // Without the trace facility only the calling (loop) task is visible
+    taskName = pcTaskGetName(nullptr);
+    return uxTaskGetStackHighWaterMark(nullptr);
+#endif
+}
+
+// Compact JSON object for the sync payload; returns the length like snprintf
+int formatHealthJson(char *buffer, size_t size)
+{
+    sampleHeap();
+    const char *stackTask;
+    uint32_t stackFree = minStackFree(stackTask);
+
+    return snprintf(buffer, size,
+                    "{\"up\":%lu,\"heap\":%u,\"heap_min\":%u,\"frag\":%u,\"stack_min\":%u,\"stack_task\":\"%s\","
+                    "\"fs_used\":%u,\"fs_total\":%u,\"fs_writes\":%u,\"fs_bytes\":%u,"
+                    "\"ble_conn\":%u,\"wifi_conn\":%u,\"wifi_drop\":%u}",
+                    millis() / 1000, (unsigned)esp_get_free_heap_size(), (unsigned)esp_get_minimum_free_heap_size(),
+                    heapStats.fragmentation, (unsigned)stackFree, stackTask,
+                    (unsigned)SPIFFS.usedBytes(), (unsigned)SPIFFS.totalBytes(),
+                    (unsigned)telemetry.flashWrites, (unsigned)telemetry.flashBytesWritten,
+                    (unsigned)bleConnections, (unsigned)wifiStats.successes, (unsigned)wifiStats.disconnects);
+}
+
+// Per-task stack headroom and sampled CPU share since boot
+static void showTasks()
+{
+#if configUSE_TRACE_FACILITY == 1
+    static TaskStatus_t tasks[TELEMETRY_MAX_TASKS];
+    UBaseType_t count = uxTaskGetSystemState(tasks, TELEMETRY_MAX_TASKS, nullptr);
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        const TaskStatus_t &task = tasks[i];
+        printfBoth("task %s stack=%u cpu=%u%%", task.pcTaskName, (unsigned)task.usStackHighWaterMark,
+                   cpuShare(task.xHandle));
+    }
+#else
+    printfBoth("task %s stack=%u cpu=%u%%", pcTaskGetName(nullptr), (unsigned)uxTaskGetStackHighWaterMark(nullptr),
+               cpuShare(xTaskGetCurrentTaskHandle()));
+#endif
+}
+
+// Compact enough to read on a phone over BLE: one summary line, one line per task
+void showHealth()
+{
+    sampleHeap();
+    printfBoth("health up=%lus heap=%u/%umin frag=%u%% fs=%u/%uKB writes=%u/%uKB ble=%u wifi=%u/%udrop",
+               millis() / 1000, (unsigned)esp_get_free_heap_size(), (unsigned)esp_get_minimum_free_heap_size(),
+               heapStats.fragmentation, (unsigned)(SPIFFS.usedBytes() / 1024), (unsigned)(SPIFFS.totalBytes() / 1024),
+               (unsigned)telemetry.flashWrites, (unsigned)(telemetry.flashBytesWritten / 1024),
+               (unsigned)bleConnections, (unsigned)wifiStats.successes, (unsigned)wifiStats.disconnects);
+    showTasks();
+}
@@ -0,0 +1,350 @@
+#include "template_search.h"
+#include "ble_manager.h"
+#include "commands.h"
+#include "fingerprint.h"
+#include "journal.h"
+#include "storage.h"
+#include "telemetry.h"
+#include <SPIFFS.h>
+
+// Globals
+SearchStats searchStats[SEARCH_STRATEGIES] = {};
+
+static HotSetMode hotMode = HOTSET_AUTO;
+static uint16_t rosterFirst = 0;
+static uint16_t rosterLast = 0;
+static uint32_t fallbacks = 0;  // Full searches after a hot miss
+
+// Recently matched IDs, fed by every sensor's capture task
+static uint16_t recentIds[SEARCH_HOT_RECENT];
+static uint8_t recentCount = 0;
+static uint8_t recentHead = 0;
+static portMUX_TYPE searchLock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *strategyNames[SEARCH_STRATEGIES] = {"hot", "full"};
+
+// The slot range to try first, false when there is none worth searching
+static bool hotRange(uint16_t &first, uint16_t &count) {
+  if (hotMode == HOTSET_ROSTER) {
+    first = rosterFirst;
+    count = rosterLast - rosterFirst + 1;
+    return true;
+  }
+  if (hotMode == HOTSET_OFF) {
+    return false;
+  }
+
+  portENTER_CRITICAL(&searchLock);
+  if (recentCount < SEARCH_HOT_MIN_MATCHES) {
+    portEXIT_CRITICAL(&searchLock);
+    return false;
+  }
+  uint16_t low = recentIds[0];
+  uint16_t high = recentIds[0];
+  for (uint8_t i = 1; i < recentCount; i++) {
+    low = min(low, recentIds[i]);
+    high = max(high, recentIds[i]);
+  }
+  portEXIT_CRITICAL(&searchLock);
+
+  low = low > SEARCH_HOT_PAD ? low - SEARCH_HOT_PAD : 0;
+  high += SEARCH_HOT_PAD;
+  if (high - low + 1 > SEARCH_HOT_MAX_SPAN) {
+    return false;
+  }
+  first = low;
+  count = high - low + 1;
+  return true;
+}
+
+static void rememberMatch(uint16_t id) {
+  portENTER_CRITICAL(&searchLock);
+  recentIds[recentHead] = id;
+  recentHead = (recentHead + 1) % SEARCH_HOT_RECENT;
+  if (recentCount < SEARCH_HOT_RECENT) {
+    recentCount++;
+  }
+  portEXIT_CRITICAL(&searchLock);
+}
+
+static void recordSearch(SearchStrategy strategy, bool hit, uint32_t us) {
+  portENTER_CRITICAL(&searchLock);
+  SearchStats &stats = searchStats[strategy];
+  stats.searches++;
+  stats.hits += hit ? 1 : 0;
+  stats.totalUs += us;
+  if (us > stats.maxUs) {
+    stats.maxUs = us;
+  }
+  portEXIT_CRITICAL(&searchLock);
+}
+
+// High-speed search of character buffer 1 over [first, first + count). The
+// library's search calls always cover the whole library.
+static uint8_t searchRange(Adafruit_Fingerprint &reader, uint16_t first,
+                           uint16_t count, uint16_t &id,
+                           uint16_t &confidence) {
+  uint8_t data[] = {FINGERPRINT_HISPEEDSEARCH, 0x01,
+                    (uint8_t)(first >> 8),     (uint8_t)(first & 0xFF),
+                    (uint8_t)(count >> 8),     (uint8_t)(count & 0xFF)};
+  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data),
+                                     data);
+  reader.writeStructuredPacket(packet);
+  if (reader.getStructuredPacket(&packet) != FINGERPRINT_OK ||
+      packet.type != FINGERPRINT_ACKPACKET) {
+    return FINGERPRINT_PACKETRECIEVEERR;
+  }
+
+  if (packet.data[0] == FINGERPRINT_OK) {
+    id = (packet.data[1] << 8) | packet.data[2];
+    confidence = (packet.data[3] << 8) | packet.data[4];
+  }
+  return packet.data[0];
+}
+
+// Searches the hot range first and the whole library on a miss. Called by
+// the capture tasks with the sensor's lock held, after image2Tz().
+uint8_t searchTemplates(Adafruit_Fingerprint &reader, uint16_t &id,
+                        uint16_t &confidence) {
+  uint16_t first, count;
+  bool triedHot = hotRange(first, count);
+  if (triedHot && reader.capacity > 0) {
+    // The sensor rejects ranges that run past the end of its library
+    triedHot = first < reader.capacity;
+    count = min(count, (uint16_t)(reader.capacity - first));
+  }
+  if (triedHot) {
+    uint32_t start = micros();
+    uint8_t p = searchRange(reader, first, count, id, confidence);
+    recordSearch(SEARCH_HOT, p == FINGERPRINT_OK, micros() - start);
+    if (p == FINGERPRINT_OK) {
+      rememberMatch(id);
+      return p;
+    }
+  }
+
+  uint32_t start = micros();
+  uint8_t p = reader.fingerFastSearch();
+  recordSearch(SEARCH_FULL, p == FINGERPRINT_OK, micros() - start);
+  if (triedHot) {
+    portENTER_CRITICAL(&searchLock);
+    fallbacks++;
+    portEXIT_CRITICAL(&searchLock);
+  }
+
+  if (p == FINGERPRINT_OK) {
+    id = reader.fingerID;
+    confidence = reader.confidence;
+    rememberMatch(id);
+  }
+  return p;
+}
+
+// "first-last", "auto" or "off"; false if the text is none of these
+static bool parseHotSet(const char *text) {
+  if (strcasecmp(text, "auto") == 0) {
+    hotMode = HOTSET_AUTO;
+    return true;
+  }
+  if (strcasecmp(text, "off") == 0) {
+    hotMode = HOTSET_OFF;
+    return true;
+  }
+
+  const char *dash = strchr(text, '-');
+  int first = atoi(text);
+  int last = dash != nullptr ? atoi(dash + 1) : 0;
+  if (dash == nullptr || first < 1 || last < first || last > UINT16_MAX) {
+    return false;
+  }
+  hotMode = HOTSET_ROSTER;
+  rosterFirst = first;
+  rosterLast = last;
+  return true;
+}
+
+static void describeHotSet(char *out, size_t size) {
+  switch (hotMode) {
+    case HOTSET_OFF:
+      strlcpy(out, "off", size);
+      break;
+    case HOTSET_ROSTER:
+      snprintf(out, size, "%u-%u", rosterFirst, rosterLast);
+      break;
+    default:
+      strlcpy(out, "auto", size);
+      break;
+  }
+}
+
+void loadSearchSettings() {
+  File file = SPIFFS.open(SEARCH_CONFIG_FILE, FILE_READ);
+  if (file) {
+    char line[RECORD_LINE_MAX];
+    readRecordLine(file, line, sizeof(line));
+    if (line[0] != '\0') {
+      parseHotSet(line);
+    }
+    file.close();
+  }
+}
+
+static void saveSearchSettings() {
+  char line[RECORD_LINE_MAX];
+  describeHotSet(line, sizeof(line));
+  strlcat(line, "\r\n", sizeof(line));
+  if (!replaceFile(SEARCH_CONFIG_FILE, line, strlen(line))) {
+    printBoth("Failed to save search settings");
+  }
+}
+
+static void showSearchStats() {
+  char mode[RECORD_LINE_MAX];
+  describeHotSet(mode, sizeof(mode));
+
+  printBoth("=== Template Search ===");
+  uint16_t first, count;
+  if (hotRange(first, count)) {
+    printfBoth("Hot set: %s (searching slots %u-%u)", mode, first,
+               first + count - 1);
+  } else {
+    printfBoth("Hot set: %s (not in use yet)", mode);
+  }
+
+  for (uint8_t i = 0; i < SEARCH_STRATEGIES; i++) {
+    const SearchStats &stats = searchStats[i];
+    if (stats.searches == 0) {
+      printfBoth("%s: no searches", strategyNames[i]);
+      continue;
+    }
+    printfBoth("%s: %u searches, %u hits (%u%%), avg %.1f ms, max %.1f ms",
+               strategyNames[i], (unsigned)stats.searches,
+               (unsigned)stats.hits,
+               (unsigned)(stats.hits * 100 / stats.searches),
+               stats.totalUs / 1000.0f / stats.searches,
+               stats.maxUs / 1000.0f);
+  }
+  printfBoth("Fallbacks to full search: %u", (unsigned)fallbacks);
+  printBoth("=======================");
+}
+
+struct BenchTiming {
+  uint32_t totalUs;
+  uint32_t maxUs;
+  uint16_t failures;
+};
+
+static void timeSearch(Adafruit_Fingerprint &reader, uint16_t first,
+                       uint16_t count, uint16_t slot, BenchTiming &timing) {
+  uint16_t id = 0;
+  uint16_t confidence = 0;
+  uint32_t start = micros();
+  uint8_t p = searchRange(reader, first, count, id, confidence);
+  uint32_t us = micros() - start;
+  timing.totalUs += us;
+  timing.maxUs = max(timing.maxUs, us);
+  timing.failures += p == FINGERPRINT_OK && id == slot ? 0 : 1;
+}
+
+// Loads the template in slot into the search buffer and times searches of
+// the whole library against one of just the slot's neighbourhood. The
+// search stops at the first match, so benchmark the highest enrolled slot
+// for the full-capacity worst case. The per-100 cost is what day_sim.py
+// takes as --search-ms-per-100.
+static void benchSearch(uint16_t slot, uint16_t runs) {
+  if (!requireSensor())
+    return;
+
+  printBoth("=== Search Benchmark ===");
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+    FingerprintSensor &sensor = sensors[i];
+    if (!sensor.ready || !lockSensor(sensor)) {
+      printfBoth("Sensor %u: not available", i + 1);
+      continue;
+    }
+
+    Adafruit_Fingerprint &reader = *sensor.finger;
+    uint16_t capacity = reader.capacity;
+    if (slot >= capacity || reader.loadModel(slot) != FINGERPRINT_OK) {
+      unlockSensor(sensor);
+      printfBoth("Sensor %u: no template in slot %u", i + 1, slot);
+      continue;
+    }
+
+    uint16_t first = slot > SEARCH_HOT_PAD ? slot - SEARCH_HOT_PAD : 0;
+    uint16_t count = min((uint16_t)(SEARCH_HOT_PAD * 2 + 1),
+                         (uint16_t)(capacity - first));
+    BenchTiming full = {};
+    BenchTiming hot = {};
+    for (uint16_t run = 0; run < runs; run++) {
+      timeSearch(reader, 0, capacity, slot, full);
+      timeSearch(reader, first, count, slot, hot);
+    }
+    reader.getTemplateCount();
+    uint16_t templates = reader.templateCount;
+    unlockSensor(sensor);
+
+    float fullMs = full.totalUs / 1000.0f / runs;
+    float hotMs = hot.totalUs / 1000.0f / runs;
+    printfBoth("Sensor %u: slot %u, %u of %u slots enrolled, %u runs", i + 1,
+               slot, templates, capacity, runs);
+    printfBoth("  full %u slots: avg %.1f ms, max %.1f ms", capacity, fullMs,
+               full.maxUs / 1000.0f);
+    printfBoth("  hot %u slots: avg %.1f ms, max %.1f ms", count, hotMs,
+               hot.maxUs / 1000.0f);
+    // Both stop at the slot; the full search passes `first` more slots
+    if (first > 0) {
+      printfBoth("  %.2f ms per 100 slots searched",
+                 (fullMs - hotMs) * 100.0f / first);
+    }
+    if (full.failures + hot.failures > 0) {
+      printfBoth("  %u searches didn't find the slot",
+                 full.failures + hot.failures);
+    }
+  }
+  printBoth("========================");
+}
+
+// "hotset" shows the hit rates, "hotset 10-45" pins a roster range,
+// "hotset auto" follows recent matches, "hotset off" always searches
+// everything, "hotset reset" clears the counters, "hotset bench 950"
+// times searches for the template in slot 950
+void hotSetCommand(const char *args) {
+  if (args[0] == '\0') {
+    showSearchStats();
+    return;
+  }
+
+  if (strncasecmp(args, "bench", 5) == 0) {
+    char buffer[INPUT_LINE_MAX];
+    strlcpy(buffer, args + 5, sizeof(buffer));
+    char *cursor = buffer;
+    long slot = atol(nextArg(cursor));
+    long runs = atol(nextArg(cursor));
+    if (slot < 1 || slot > UINT16_MAX) {
+      printBoth("Usage: hotset bench <slot> [runs]");
+      return;
+    }
+    benchSearch(slot, runs > 0 ? min(runs, 1000L) : SEARCH_BENCH_RUNS);
+    return;
+  }
+
+  if (strcasecmp(args, "reset") == 0) {
+    portENTER_CRITICAL(&searchLock);
+    memset(searchStats, 0, sizeof(searchStats));
+    fallbacks = 0;
+    portEXIT_CRITICAL(&searchLock);
+    printBoth("Search statistics cleared");
+    return;
+  }
+
+  if (!parseHotSet(args)) {
+    printBoth("Usage: hotset [first-last|auto|off|reset|bench <slot> [runs]]");
+    return;
+  }
+  saveSearchSettings();
+
+  char mode[RECORD_LINE_MAX];
+  describeHotSet(mode, sizeof(mode));
+  printfBoth("Hot set: %s", mode);
+}
@@ -0,0 +1,468 @@
+#include "time_source.h"
+#include "ble_manager.h"
+#include "commands.h"
+#include "journal.h"
+#include "record_log.h"
+#include "storage.h"
+#include "telemetry.h"
+#include <SPIFFS.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#if FEATURE_SYNC
+#include <esp_sntp.h>
+#endif
+
+#define TIME_STATE_MAGIC 0x314B4C43 // "CLK1"
+#define TIME_RTC_MAGIC 0x43545231   // "RTC1"
+
+// Correction for the flagged records of one run of an untrusted clock
+struct ClockFix
+{
+    uint16_t firstSession; // Sessions begun during the run
+    uint16_t lastSession;
+    int32_t offset;        // Seconds the clock jumped by when it was set
+    uint8_t verified;      // 0 if a power loss ended the run first; offset is 0 then
+    uint8_t reserved[3];
+};
+
+// Saved in TIME_STATE_FILE: restores an approximate clock after a power
+// loss, keeps session numbers unique across reboots and carries the stamp
+// corrections. Files from before the corrections end after nextSession
+// with heldFrom 0.
+struct TimeState
+{
+    uint32_t magic;
+    uint32_t epoch;
+    uint16_t nextSession;
+    uint16_t heldFrom; // First session of the untrusted run still going, 0 if the clock is trusted
+    uint8_t fixCount;
+    uint8_t reserved[3];
+    ClockFix fixes[TIME_FIXES_MAX]; // Oldest first; the oldest is dropped when full
+};
+
+// The system time itself survives soft resets and deep sleep in the RTC;
+// this remembers where it came from
+struct RtcClock
+{
+    uint32_t magic;
+    TimeSourceKind source;
+};
+
+// Globals
+uint16_t attendanceSession = 0;
+
+static RTC_NOINIT_ATTR RtcClock rtcClock;
+static TimeState timeState = {};
+static TimeSourceKind source = TIME_UNSET;
+static uint32_t lastSavedEpoch = 0;
+static uint32_t lastMinute = 0;
+static uint32_t runBase = 0; // System time minus uptime while the untrusted run's clock was untouched
+static volatile bool sntpSynced = false; // Set from the SNTP task, handled in serviceTimeSource()
+
+static const char *sourceName(TimeSourceKind kind)
+{
+    switch (kind)
+    {
+    case TIME_RESTORED:
+        return "restored after power loss, not trusted";
+    case TIME_MANUAL:
+        return "set by hand";
+    case TIME_SNTP:
+        return "SNTP";
+    default:
+        return "not set";
+    }
+}
+
+static void saveTimeState()
+{
+    timeState.magic = TIME_STATE_MAGIC;
+    timeState.epoch = timeNow();
+    if (replaceFile(TIME_STATE_FILE, &timeState, sizeof(timeState)))
+    {
+        lastSavedEpoch = timeState.epoch;
+    }
+}
+
+static void loadTimeState()
+{
+    File file = SPIFFS.open(TIME_STATE_FILE, FILE_READ);
+    if (file)
+    {
+        size_t got = file.read((uint8_t *)&timeState, sizeof(timeState));
+        if (got < offsetof(TimeState, fixCount) || timeState.magic != TIME_STATE_MAGIC)
+        {
+            got = 0;
+        }
+        memset((uint8_t *)&timeState + got, 0, sizeof(timeState) - got);
+        timeState.fixCount = min(timeState.fixCount, (uint8_t)TIME_FIXES_MAX);
+        file.close();
+    }
+    if (timeState.nextSession == 0)
+    {
+        timeState.nextSession = 1;
+    }
+}
+
+// Setting the clock never touches the uptime, so it measures how far the
+// clock jumped
+static uint32_t uptimeSeconds()
+{
+    return (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+// Ends the untrusted run: its sessions get their correction and new
+// records are trusted. The caller saves the time state.
+static void endClockRun(int32_t offset, bool verified)
+{
+    uint16_t first = timeState.heldFrom;
+    uint16_t last = timeState.nextSession - 1;
+    timeState.heldFrom = 0;
+    if (first == 0 || last < first)
+    {
+        return; // No session began during the run
+    }
+
+    if (timeState.fixCount == TIME_FIXES_MAX)
+    {
+        memmove(&timeState.fixes[0], &timeState.fixes[1], sizeof(ClockFix) * (TIME_FIXES_MAX - 1));
+        timeState.fixCount--;
+    }
+    ClockFix &fix = timeState.fixes[timeState.fixCount++];
+    memset(&fix, 0, sizeof(fix));
+    fix.firstSession = first;
+    fix.lastSession = last;
+    fix.offset = offset;
+    fix.verified = verified;
+}
+
+// Called once the clock has just been set by SNTP or by hand
+static void correctClockRun()
+{
+    if (timeState.heldFrom == 0)
+    {
+        saveTimeState();
+        return;
+    }
+
+    int32_t offset = (int32_t)((uint32_t)time(nullptr) - uptimeSeconds() - runBase);
+    endClockRun(offset, true);
+    saveTimeState();
+    printfBoth("Clock set: records taken before it moved by %ld s", (long)offset);
+    releaseHeldRecords();
+}
+
+static void setSource(TimeSourceKind kind)
+{
+    source = kind;
+    rtcClock.magic = TIME_RTC_MAGIC;
+    rtcClock.source = kind;
+}
+
+// Keeps currentDate, the date roll calls and prompts show, on the clock's day
+static void refreshDate(bool announce)
+{
+    if (source == TIME_UNSET)
+    {
+        return;
+    }
+
+    char date[DATE_MAX];
+    formatDate(timeNow(), date, sizeof(date));
+    if (strcmp(date, currentDate) != 0)
+    {
+        strlcpy(currentDate, date, sizeof(currentDate));
+        if (announce)
+        {
+            printfBoth("Date is now %s", currentDate);
+        }
+    }
+}
+
+void initTimeSource()
+{
+    setenv("TZ", TIME_ZONE, 1);
+    tzset();
+    loadTimeState();
+
+    // Power-on and brownout reset the RTC, and with it the system time
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool rtcKept = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT && rtcClock.magic == TIME_RTC_MAGIC &&
+                   (uint32_t)time(nullptr) >= TIME_VALID_AFTER;
+    if (rtcKept)
+    {
+        source = rtcClock.source;
+    }
+    else if (timeState.epoch >= TIME_VALID_AFTER)
+    {
+        struct timeval restored = {(time_t)timeState.epoch, 0};
+        settimeofday(&restored, nullptr);
+        setSource(TIME_RESTORED);
+    }
+    else
+    {
+        setSource(TIME_UNSET);
+    }
+
+    // The last run's clock went with the power: its records can't be
+    // corrected any more. A new run starts with the next session.
+    bool stateChanged = false;
+    if (timeState.heldFrom != 0 && (!rtcKept || timeTrusted()))
+    {
+        endClockRun(0, false);
+        stateChanged = true;
+    }
+    if (!timeTrusted() && timeState.heldFrom == 0)
+    {
+        timeState.heldFrom = timeState.nextSession;
+        stateChanged = true;
+    }
+    if (stateChanged)
+    {
+        saveTimeState();
+    }
+    runBase = (uint32_t)time(nullptr) - uptimeSeconds();
+
+    refreshDate(false);
+    lastMinute = timeNow() / 60;
+    showClock();
+}
+
+#if FEATURE_SYNC
+static void onSntpSync(struct timeval *tv)
+{
+    sntpSynced = true;
+}
+
+// Restarts SNTP on every connection; the first reply sets the clock
+void startTimeSync()
+{
+    static bool callbackSet = false;
+    if (!callbackSet)
+    {
+        sntp_set_time_sync_notification_cb(onSntpSync);
+        callbackSet = true;
+    }
+    configTzTime(TIME_ZONE, NTP_SERVER_1, NTP_SERVER_2);
+}
+#else
+void startTimeSync() {}
+#endif
+
+void serviceTimeSource()
+{
+    if (sntpSynced)
+    {
+        sntpSynced = false;
+        bool first = source != TIME_SNTP;
+        setSource(TIME_SNTP);
+        correctClockRun();
+        if (first)
+        {
+            showClock();
+        }
+    }
+
+    uint32_t now = timeNow();
+    if (now / 60 != lastMinute)
+    {
+        lastMinute = now / 60;
+        refreshDate(true);
+
+        // A power loss then costs at most this much clock drift
+        if (source != TIME_UNSET && now - lastSavedEpoch >= TIME_SAVE_INTERVAL_S)
+        {
+            saveTimeState();
+        }
+    }
+}
+
+bool timeTrusted()
+{
+    return source == TIME_MANUAL || source == TIME_SNTP;
+}
+
+TimeSourceKind timeSource()
+{
+    return source;
+}
+
+uint32_t timeNow()
+{
+    return source == TIME_UNSET ? 0 : (uint32_t)time(nullptr);
+}
+
+// Untrusted stamps are kept even while the clock was never set, so the
+// run's offset can still turn them into real times
+uint32_t recordStamp(bool &trusted)
+{
+    trusted = timeTrusted();
+    return (uint32_t)time(nullptr);
+}
+
+// Fixes are searched newest first; a run whose fix was dropped from the
+// table reads as unverified
+StampState correctStamp(uint16_t session, uint32_t &timestamp)
+{
+    StampState state = STAMP_UNVERIFIED;
+    if (timeState.heldFrom != 0 && session >= timeState.heldFrom)
+    {
+        state = STAMP_HELD;
+    }
+    else
+    {
+        for (int i = timeState.fixCount - 1; i >= 0; i--)
+        {
+            const ClockFix &fix = timeState.fixes[i];
+            if (session >= fix.firstSession && session <= fix.lastSession)
+            {
+                timestamp += fix.offset;
+                state = fix.verified ? STAMP_CORRECTED : STAMP_UNVERIFIED;
+                break;
+            }
+        }
+    }
+
+    if (state != STAMP_CORRECTED && timestamp < TIME_VALID_AFTER)
+    {
+        timestamp = 0; // Taken before the clock was ever set
+    }
+    return state;
+}
+
+void formatDate(uint32_t timestamp, char *out, size_t size)
+{
+    if (timestamp == 0)
+    {
+        strlcpy(out, "-", size);
+        return;
+    }
+
+    // Day/month without padding, the format dates were typed in before
+    time_t seconds = timestamp;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    snprintf(out, size, "%d/%d", local.tm_mday, local.tm_mon + 1);
+}
+
+void formatTime(uint32_t timestamp, char *out, size_t size)
+{
+    if (timestamp == 0)
+    {
+        strlcpy(out, "-", size);
+        return;
+    }
+
+    time_t seconds = timestamp;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    snprintf(out, size, "%02d:%02d:%02d", local.tm_hour, local.tm_min, local.tm_sec);
+}
+
+// "19/5", "19/5/2026", "19/5 08:30" or "08:30:15". A missing year or time
+// of day is taken from the running clock; the year falls back to the
+// firmware's build year, the time of day to midnight.
+bool setClock(const char *args)
+{
+    char buffer[INPUT_LINE_MAX];
+    strlcpy(buffer, args, sizeof(buffer));
+
+    time_t now = timeNow();
+    struct tm local = {};
+    if (source != TIME_UNSET)
+    {
+        localtime_r(&now, &local);
+    }
+    else
+    {
+        local.tm_year = atoi(__DATE__ + 7) - 1900;
+    }
+
+    bool haveDate = false;
+    char *cursor = buffer;
+    for (char *word = nextArg(cursor); word[0] != '\0'; word = nextArg(cursor))
+    {
+        unsigned a = 0, b = 0, c = 0;
+        int fields;
+        if (strchr(word, '/') != nullptr && (fields = sscanf(word, "%u/%u/%u", &a, &b, &c)) >= 2 && a >= 1 &&
+            a <= 31 && b >= 1 && b <= 12 && (fields == 2 || (c >= 2000 && c <= 2099)))
+        {
+            local.tm_mday = a;
+            local.tm_mon = b - 1;
+            if (fields == 3)
+            {
+                local.tm_year = c - 1900;
+            }
+            haveDate = true;
+        }
+        else if (strchr(word, ':') != nullptr && (fields = sscanf(word, "%u:%u:%u", &a, &b, &c)) >= 2 &&
+                 a < 24 && b < 60 && c < 60)
+        {
+            local.tm_hour = a;
+            local.tm_min = b;
+            local.tm_sec = fields == 3 ? c : 0;
+        }
+        else
+        {
+            printfBoth("Not a date or time: %s (use DD/MM[/YYYY] [HH:MM[:SS]])", word);
+            return false;
+        }
+    }
+
+    if (!haveDate && source == TIME_UNSET)
+    {
+        printBoth("The clock isn't set yet, give the date too, e.g. 19/5 08:30");
+        return false;
+    }
+
+    int day = local.tm_mday;
+    local.tm_isdst = -1;
+    time_t epoch = mktime(&local);
+    if (epoch < (time_t)TIME_VALID_AFTER || local.tm_mday != day)
+    {
+        printBoth("Invalid date");
+        return false;
+    }
+
+    struct timeval set = {epoch, 0};
+    settimeofday(&set, nullptr);
+    setSource(TIME_MANUAL);
+    correctClockRun();
+    refreshDate(false);
+    lastMinute = (uint32_t)epoch / 60;
+    showClock();
+    return true;
+}
+
+// Every attendance mode run is a session; records carry its number so the
+// sheet can tell morning and afternoon roll calls on the same date apart
+uint16_t beginAttendanceSession()
+{
+    attendanceSession = timeState.nextSession++;
+    if (timeState.nextSession == 0)
+    {
+        timeState.nextSession = 1;
+    }
+    saveTimeState();
+    return attendanceSession;
+}
+
+void showClock()
+{
+    uint32_t now = timeNow();
+    if (now == 0)
+    {
+        printfBoth("Clock: not set, date %s (set it with 'date' or connect WiFi)", currentDate);
+        return;
+    }
+
+    char date[DATE_MAX];
+    char clock[12];
+    formatDate(now, date, sizeof(date));
+    formatTime(now, clock, sizeof(clock));
+    time_t seconds = now;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    printfBoth("Clock: %s/%d %s (%s)", date, local.tm_year + 1900, clock, sourceName(source));
+}
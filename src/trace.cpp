@@ -0,0 +1,103 @@
+#include "trace.h"
+#include "ble_manager.h"
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#define TRACE_MAGIC 0x54524331 // "TRC1"
+#define TRACE_DUMP_PER_LINE 8
+
+// RTC slow memory is left alone by soft resets, panics and watchdog resets,
+// so the ring still holds the events leading up to the reboot
+static RTC_NOINIT_ATTR TraceRing traceRing;
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void resetTraceRing()
+{
+    memset(&traceRing, 0, sizeof(traceRing));
+    traceRing.magic = TRACE_MAGIC;
+}
+
+// Must run before anything traces; keeps the previous boots' entries
+void initTrace()
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    // Power-on and brownout leave RTC memory with garbage
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT || traceRing.magic != TRACE_MAGIC ||
+        traceRing.head >= TRACE_CAPACITY || traceRing.count > TRACE_CAPACITY)
+    {
+        resetTraceRing();
+    }
+
+    traceRing.boots++;
+    trace(TRACE_BOOT, (uint8_t)reason, (uint16_t)traceRing.boots);
+}
+
+// Safe from any task; cheap enough for the scan and sync paths
+void trace(TraceEvent event, uint8_t arg8, uint16_t arg16)
+{
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    portENTER_CRITICAL(&traceLock);
+    TraceEntry &entry = traceRing.entries[traceRing.head];
+    entry.us = now;
+    entry.event = event;
+    entry.arg8 = arg8;
+    entry.arg16 = arg16;
+    traceRing.head = (traceRing.head + 1) % TRACE_CAPACITY;
+    if (traceRing.count < TRACE_CAPACITY)
+    {
+        traceRing.count++;
+    }
+    portEXIT_CRITICAL(&traceLock);
+}
+
+// Hex dump, oldest entry first; decode with tools/trace_decode.py.
+// "trace clear" empties the ring.
+void dumpTrace(const char *args)
+{
+    if (strcmp(args, "clear") == 0)
+    {
+        portENTER_CRITICAL(&traceLock);
+        uint32_t boots = traceRing.boots;
+        resetTraceRing();
+        traceRing.boots = boots;
+        portEXIT_CRITICAL(&traceLock);
+        printBoth("Trace cleared");
+        return;
+    }
+
+    // Snapshot so the dump is consistent while other tasks keep tracing
+    static TraceRing snapshot;
+    portENTER_CRITICAL(&traceLock);
+    memcpy(&snapshot, &traceRing, sizeof(snapshot));
+    portEXIT_CRITICAL(&traceLock);
+
+    printfBoth("TRACE v1 boots=%u count=%u now=%08x", (unsigned)snapshot.boots, (unsigned)snapshot.count,
+               (unsigned)(uint32_t)esp_timer_get_time());
+
+    uint32_t start = (snapshot.head + TRACE_CAPACITY - snapshot.count) % TRACE_CAPACITY;
+    char line[3 + TRACE_DUMP_PER_LINE * 2 * sizeof(TraceEntry) + 1];
+    size_t length = 0;
+    for (uint32_t i = 0; i < snapshot.count; i++)
+    {
+        if (length == 0)
+        {
+            length = strlcpy(line, "T ", sizeof(line));
+        }
+
+        const uint8_t *raw = (const uint8_t *)&snapshot.entries[(start + i) % TRACE_CAPACITY];
+        for (size_t b = 0; b < sizeof(TraceEntry); b++)
+        {
+            length += snprintf(line + length, sizeof(line) - length, "%02x", raw[b]);
+        }
+
+        if ((i + 1) % TRACE_DUMP_PER_LINE == 0 || i + 1 == snapshot.count)
+        {
+            printBoth(line);
+            length = 0;
+        }
+    }
+    printBoth("TRACE END");
+}
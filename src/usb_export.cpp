@@ -0,0 +1,452 @@
+#include "usb_export.h"
+#include "arena.h"
+#include "ble_manager.h"
+#include "commands.h"
+#include "fingerprint.h"
+#include "power_manager.h"
+#include "record_log.h"
+#include "sensor_link.h"
+#include "storage.h"
+#include "time_source.h"
+
+#if FEATURE_USB_EXPORT
+
+// USBSerial is the USB Serial/JTAG port only while Serial stays on UART0
+#if ARDUINO_USB_CDC_ON_BOOT
+#error "FEATURE_USB_EXPORT needs the console on UART0 (ARDUINO_USB_CDC_ON_BOOT=0)"
+#endif
+
+#include <HWCDC.h>
+#include <SPIFFS.h>
+#include <esp_rom_crc.h>
+
+#define EXPORT_PART_RECORDS 0x01
+#define EXPORT_PART_ROSTER 0x02
+#define EXPORT_PART_TEMPLATES 0x04
+#define EXPORT_PART_ALL (EXPORT_PART_RECORDS | EXPORT_PART_ROSTER | EXPORT_PART_TEMPLATES)
+
+// Globals
+UsbExportStats usbExportStats = {};
+
+// One export in progress
+struct ExportState
+{
+    uint8_t *block;        // EXPORT_BLOCK_SIZE, one DATA frame
+    uint8_t *templateData; // USB_EXPORT_TEMPLATE_MAX, one uploaded template
+    ExportItemKind kind;
+    uint16_t item;
+    uint32_t itemBytes;
+    uint32_t itemCrc;
+    uint32_t items;
+    uint32_t bytes;
+    uint32_t unreadableTemplates;
+    bool failed;
+};
+
+static ExportState exportState;
+static char requestLine[INPUT_LINE_MAX];
+static size_t requestLength = 0;
+
+void initUsbExport()
+{
+    // A whole DATA frame fits the TX buffer, so a frame is one USB burst
+    USBSerial.setTxBufferSize(EXPORT_BLOCK_SIZE + sizeof(ExportFrameHeader) + sizeof(uint32_t));
+    USBSerial.setTxTimeoutMs(USB_EXPORT_TX_TIMEOUT_MS);
+    USBSerial.begin();
+}
+
+// True while a host has the port open; the port drops in light sleep
+bool usbHostAttached()
+{
+    return (bool)USBSerial;
+}
+
+static bool writeAll(const void *data, size_t length)
+{
+    return length == 0 || USBSerial.write((const uint8_t *)data, length) == length;
+}
+
+// A host that stopped reading fails the export on the first short write
+static bool sendFrame(uint8_t type, const void *payload, uint32_t length)
+{
+    if (exportState.failed)
+    {
+        return false;
+    }
+
+    ExportFrameHeader header = {USB_EXPORT_MAGIC, type, exportState.kind, exportState.item, length};
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&header, sizeof(header));
+    crc = esp_rom_crc32_le(crc, (const uint8_t *)payload, length);
+
+    if (!writeAll(&header, sizeof(header)) || !writeAll(payload, length) || !writeAll(&crc, sizeof(crc)))
+    {
+        exportState.failed = true;
+        return false;
+    }
+    notePowerActivity();
+    return true;
+}
+
+static void failExport(const char *message)
+{
+    exportState.kind = EXPORT_ITEM_NONE;
+    exportState.item = 0;
+    sendFrame(EXPORT_ERROR, message, strlen(message));
+    exportState.failed = true;
+    printfBoth("USB export failed: %s", message);
+}
+
+static bool beginItem(ExportItemKind kind, const char *name)
+{
+    exportState.items++;
+    exportState.kind = kind;
+    exportState.item = exportState.items;
+    exportState.itemBytes = 0;
+    exportState.itemCrc = 0;
+    return sendFrame(EXPORT_BEGIN, name, strlen(name));
+}
+
+static bool sendData(const uint8_t *data, size_t length)
+{
+    exportState.itemCrc = esp_rom_crc32_le(exportState.itemCrc, data, length);
+    exportState.itemBytes += length;
+    exportState.bytes += length;
+    return sendFrame(EXPORT_DATA, data, length);
+}
+
+static bool endItem()
+{
+    uint32_t end[2] = {exportState.itemBytes, exportState.itemCrc};
+    bool sent = sendFrame(EXPORT_END, end, sizeof(end));
+    exportState.kind = EXPORT_ITEM_NONE;
+    exportState.item = 0;
+    return sent;
+}
+
+// Streams a SPIFFS file as one item; a missing file is skipped
+static bool sendFile(ExportItemKind kind, const char *path, const char *name)
+{
+    if (!SPIFFS.exists(path))
+    {
+        return true;
+    }
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file)
+    {
+        failExport("file unreadable");
+        return false;
+    }
+
+    bool sent = beginItem(kind, name);
+    while (sent)
+    {
+        size_t got = file.read(exportState.block, EXPORT_BLOCK_SIZE);
+        if (got == 0)
+        {
+            break;
+        }
+        sent = sendData(exportState.block, got);
+    }
+    file.close();
+    return sent && endItem();
+}
+
+static void sendInfo(uint8_t parts)
+{
+    uint64_t mac = ESP.getEfuseMac();
+    uint8_t sensorsReady = 0;
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        sensorsReady += sensors[i].ready ? 1 : 0;
+    }
+
+    char info[256];
+    int length = snprintf(info, sizeof(info),
+                          "device=attendance-%02x%02x%02x\n"
+                          "date=%s\n"
+                          "time=%lu\n"
+                          "time_trusted=%u\n"
+                          "log_backend=%s\n"
+                          "segments=%u-%u\n"
+                          "unsynced=%u\n"
+                          "sensors=%u/%u\n"
+                          "parts=%s%s%s\n",
+                          (unsigned)((mac >> 24) & 0xFF), (unsigned)((mac >> 32) & 0xFF),
+                          (unsigned)((mac >> 40) & 0xFF), currentDate,
+                          (unsigned long)timeNow(), timeTrusted() ? 1u : 0u,
+                          LOG_BACKEND_PARTITION ? "partition" : "spiffs", (unsigned)recordLog.firstSegment,
+                          (unsigned)recordLog.lastSegment, (unsigned)unsyncedRecordCount, sensorsReady,
+                          SENSOR_COUNT, (parts & EXPORT_PART_RECORDS) ? "records " : "",
+                          (parts & EXPORT_PART_ROSTER) ? "roster " : "",
+                          (parts & EXPORT_PART_TEMPLATES) ? "templates" : "");
+    sendFrame(EXPORT_INFO, info, min(length, (int)sizeof(info) - 1));
+}
+
+#if LOG_BACKEND_PARTITION
+// Formats the segment's records straight from the flash mapping, in the
+// same CSV format as the SPIFFS backend's segments
+static bool sendSegment(uint32_t segment)
+{
+    uint16_t count;
+    const LogRecord *records = segmentRecords(segment, count);
+    if (records == nullptr)
+    {
+        return true;
+    }
+
+    char name[LOG_PATH_MAX];
+    snprintf(name, sizeof(name), "att_%05u.csv", (unsigned)segment);
+    if (!beginItem(EXPORT_ITEM_SEGMENT, name))
+    {
+        return false;
+    }
+
+    char *block = (char *)exportState.block;
+    size_t used = snprintf(block, EXPORT_BLOCK_SIZE, "timestamp,session,student_id,synced\n");
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (!recordValid(records[i]))
+        {
+            continue;
+        }
+        if (EXPORT_BLOCK_SIZE - used < RECORD_LINE_MAX)
+        {
+            if (!sendData(exportState.block, used))
+            {
+                return false;
+            }
+            used = 0;
+        }
+        used += snprintf(block + used, EXPORT_BLOCK_SIZE - used, "%lu,%u,%s,%c\n",
+                         (unsigned long)records[i].timestamp, records[i].session, records[i].studentId,
+                         records[i].synced == 0 ? '1' : '0');
+    }
+    return sendData(exportState.block, used) && endItem();
+}
+#else
+static bool sendSegment(uint32_t segment)
+{
+    char path[LOG_PATH_MAX];
+    segmentPath(segment, path, sizeof(path));
+    return sendFile(EXPORT_ITEM_SEGMENT, path, path + 1);
+}
+#endif
+
+static void exportRecords()
+{
+    commitRecordLog();
+    for (uint32_t segment = recordLog.firstSegment; segment <= recordLog.lastSegment && segment > 0; segment++)
+    {
+        if (!sendSegment(segment))
+        {
+            return;
+        }
+    }
+    sendFile(EXPORT_ITEM_SUMMARY, LOG_SUMMARY_FILE, LOG_SUMMARY_FILE + 1);
+}
+
+// Walks each sensor's index table and uploads every stored template. The
+// sensor lock is taken per slot, so scans on a running attendance mode
+// only wait for one transfer.
+static void exportTemplates()
+{
+    for (uint8_t i = 0; i < SENSOR_COUNT && !exportState.failed; i++)
+    {
+        FingerprintSensor &sensor = sensors[i];
+        if (!sensor.ready)
+        {
+            continue;
+        }
+
+        uint16_t capacity = sensor.finger->capacity;
+        for (uint16_t first = 0; first < capacity && !exportState.failed; first += SENSOR_INDEX_PAGE_SLOTS)
+        {
+            uint8_t bitmap[SENSOR_INDEX_PAGE_SLOTS / 8];
+            lockSensor(sensor);
+            bool indexed = readTemplateIndex(sensor, first / SENSOR_INDEX_PAGE_SLOTS, bitmap);
+            unlockSensor(sensor);
+            if (!indexed)
+            {
+                printfBoth("Sensor %u: index table unreadable, templates skipped", i + 1);
+                break;
+            }
+
+            for (uint16_t offset = 0; offset < SENSOR_INDEX_PAGE_SLOTS && first + offset < capacity; offset++)
+            {
+                if (!(bitmap[offset / 8] & (1 << (offset % 8))))
+                {
+                    continue;
+                }
+
+                uint16_t slot = first + offset;
+                lockSensor(sensor);
+                size_t size = readTemplate(sensor, slot, exportState.templateData, USB_EXPORT_TEMPLATE_MAX);
+                unlockSensor(sensor);
+                if (size == 0)
+                {
+                    exportState.unreadableTemplates++;
+                    continue;
+                }
+
+                char name[32];
+                snprintf(name, sizeof(name), "templates/s%u_%04u.tpl", i + 1, slot);
+                if (!beginItem(EXPORT_ITEM_TEMPLATE, name) || !sendData(exportState.templateData, size) || !endItem())
+                {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Streams the requested parts with buffers from the arena; false if the
+// export was cut short
+static bool exportParts(uint8_t parts)
+{
+    if (!arenaBegin(opArena, "usb-export"))
+    {
+        failExport("busy, try again after the running sync");
+        return false;
+    }
+    exportState.block = (uint8_t *)arenaAlloc(opArena, EXPORT_BLOCK_SIZE);
+    if (parts & EXPORT_PART_TEMPLATES)
+    {
+        exportState.templateData = (uint8_t *)arenaAlloc(opArena, USB_EXPORT_TEMPLATE_MAX);
+    }
+    if (exportState.block == nullptr || ((parts & EXPORT_PART_TEMPLATES) && exportState.templateData == nullptr))
+    {
+        arenaEnd(opArena);
+        failExport("out of memory");
+        return false;
+    }
+
+    unsigned long start = millis();
+    sendInfo(parts);
+    if (parts & EXPORT_PART_RECORDS)
+    {
+        exportRecords();
+    }
+    if ((parts & EXPORT_PART_ROSTER) && !exportState.failed)
+    {
+        sendFile(EXPORT_ITEM_ROSTER, ROSTER_FILE, ROSTER_FILE + 1);
+    }
+    if ((parts & EXPORT_PART_TEMPLATES) && !exportState.failed)
+    {
+        exportTemplates();
+    }
+    arenaEnd(opArena);
+
+    uint32_t done[3] = {exportState.items, exportState.bytes, (uint32_t)(millis() - start)};
+    if (!sendFrame(EXPORT_DONE, done, sizeof(done)))
+    {
+        return false;
+    }
+    usbExportStats.lastItems = done[0];
+    usbExportStats.lastBytes = done[1];
+    usbExportStats.lastMs = done[2];
+    return true;
+}
+
+static void runExport(uint8_t parts)
+{
+    printBoth("USB export started");
+
+    if (!exportParts(parts))
+    {
+        usbExportStats.failures++;
+        printBoth("USB export aborted");
+        return;
+    }
+
+    usbExportStats.exports++;
+    printfBoth("USB export: %u items, %u KB in %u ms", (unsigned)usbExportStats.lastItems,
+               (unsigned)(usbExportStats.lastBytes / 1024), (unsigned)usbExportStats.lastMs);
+    if (exportState.unreadableTemplates > 0)
+    {
+        printfBoth("%u templates could not be read from the sensor", (unsigned)exportState.unreadableTemplates);
+    }
+}
+
+// "EXPORT [records] [roster] [templates]"
+static void handleRequest(char *line)
+{
+    // Fresh state before anything can fail: a failed earlier export would
+    // otherwise swallow this request's error frame
+    memset(&exportState, 0, sizeof(exportState));
+
+    char *cursor = line;
+    if (strcasecmp(nextArg(cursor), "EXPORT") != 0)
+    {
+        failExport("unknown request, expected EXPORT");
+        return;
+    }
+
+    uint8_t parts = 0;
+    for (char *part = nextArg(cursor); *part != '\0'; part = nextArg(cursor))
+    {
+        if (strcasecmp(part, "records") == 0)
+        {
+            parts |= EXPORT_PART_RECORDS;
+        }
+        else if (strcasecmp(part, "roster") == 0)
+        {
+            parts |= EXPORT_PART_ROSTER;
+        }
+        else if (strcasecmp(part, "templates") == 0)
+        {
+            parts |= EXPORT_PART_TEMPLATES;
+        }
+        else
+        {
+            failExport("unknown part, expected records, roster or templates");
+            return;
+        }
+    }
+    runExport(parts != 0 ? parts : EXPORT_PART_ALL);
+}
+
+// Collects a request line from the USB port; the export itself blocks the
+// loop like a sync does, with scans queueing meanwhile
+void serviceUsbExport()
+{
+    while (USBSerial.available() > 0)
+    {
+        char c = USBSerial.read();
+        if (c == '\r')
+        {
+            continue;
+        }
+        if (c != '\n')
+        {
+            if (requestLength < sizeof(requestLine) - 1)
+            {
+                requestLine[requestLength++] = c;
+            }
+            continue;
+        }
+
+        requestLine[requestLength] = '\0';
+        requestLength = 0;
+        if (requestLine[0] != '\0')
+        {
+            handleRequest(requestLine);
+        }
+    }
+}
+
+void usbExportCommand(const char *args)
+{
+    printBoth("=== USB Export ===");
+    printfBoth("Host: %s", usbHostAttached() ? "attached" : "not attached");
+    printfBoth("Exports: %u, failed: %u", (unsigned)usbExportStats.exports, (unsigned)usbExportStats.failures);
+    if (usbExportStats.exports > 0)
+    {
+        printfBoth("Last: %u items, %u KB in %u ms (%u KB/s)", (unsigned)usbExportStats.lastItems,
+                   (unsigned)(usbExportStats.lastBytes / 1024), (unsigned)usbExportStats.lastMs,
+                   (unsigned)(usbExportStats.lastMs > 0 ? usbExportStats.lastBytes / usbExportStats.lastMs * 1000 / 1024 : 0));
+    }
+    printBoth("Run tools/usb_export.py on the native USB port to export");
+    printBoth("==================");
+}
+
+#endif // FEATURE_USB_EXPORT
@@ -1,11 +1,253 @@
 #include "wifi_manager.h"
 #include "ble_manager.h"
+#include "commands.h"
 #include "config.h"
+#include "journal.h"
+#include "storage.h"
+#include "telemetry.h"
+#include "time_source.h"
+#include "trace.h"
 #include <SPIFFS.h>
+#include <freertos/event_groups.h>
+
+#if FEATURE_SYNC
+#include <esp_netif.h>
+#include <lwip/dhcp.h>
+
+#define WIFI_CACHE_MAGIC 0x57434332 // "WCC2"
+#define WIFI_LEASE_MARGIN_S 60      // Reused leases stop this long before T1
+
+#define WIFI_GOT_IP_BIT BIT0
+#define WIFI_FAIL_BIT BIT1
 
 // Globals
-String storedSSID = "";
-String storedPassword = "";
+char storedSSID[WIFI_SSID_MAX] = "";
+char storedPassword[WIFI_PASSWORD_MAX] = "";
+char storedStaticIP[WIFI_STATIC_IP_MAX] = ""; // "ip,gateway,subnet,dns" or empty for DHCP
+WiFiConnectStats wifiStats = {};
+
+static bool credentialsLoaded = false;
+static EventGroupHandle_t wifiEvents = nullptr;
+static WiFiCache wifiCache = {};
+
+static void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+    switch (event)
+    {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+        xEventGroupSetBits(wifiEvents, WIFI_GOT_IP_BIT);
+        break;
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+        wifiStats.disconnects++;
+        xEventGroupSetBits(wifiEvents, WIFI_FAIL_BIT);
+        break;
+    default:
+        break;
+    }
+}
+
+static void initWiFiEvents()
+{
+    if (wifiEvents != nullptr)
+    {
+        return;
+    }
+
+    wifiEvents = xEventGroupCreate();
+    WiFi.onEvent(onWiFiEvent);
+
+    // Credentials live in SPIFFS; keep them out of NVS so every connect is explicit
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+}
+
+static void loadWiFiCache()
+{
+    wifiCache.magic = 0;
+
+    File file = SPIFFS.open(WIFI_CACHE_FILE, FILE_READ);
+    if (!file)
+    {
+        return;
+    }
+
+    if (file.read((uint8_t *)&wifiCache, sizeof(wifiCache)) != sizeof(wifiCache))
+    {
+        wifiCache.magic = 0;
+    }
+    file.close();
+}
+
+// Seconds from now until the DHCP client would renew the lease it holds
+// (T1, half the lease if the server sent none), 0 without a lease
+static uint32_t leaseRenewSeconds()
+{
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    struct netif *lwip = netif != nullptr ? (struct netif *)esp_netif_get_netif_impl(netif) : nullptr;
+    struct dhcp *dhcp = lwip != nullptr ? netif_dhcp_data(lwip) : nullptr;
+    if (dhcp == nullptr)
+    {
+        return 0;
+    }
+    return dhcp->offered_t1_renew != 0 ? dhcp->offered_t1_renew : dhcp->offered_t0_lease / 2;
+}
+
+// The cached address may only be claimed without DHCP until the lease's
+// renewal time. That needs a trusted clock: a restored one runs late.
+static bool leaseValid()
+{
+    return wifiCache.leaseRenewAt != 0 && timeTrusted() && timeNow() + WIFI_LEASE_MARGIN_S < wifiCache.leaseRenewAt;
+}
+
+// freshLease: DHCP ran on this connection, so the lease timing is new
+static void saveWiFiCache(bool freshLease)
+{
+    WiFiCache fresh = {};
+    fresh.magic = WIFI_CACHE_MAGIC;
+    memcpy(fresh.bssid, WiFi.BSSID(), sizeof(fresh.bssid));
+    fresh.channel = WiFi.channel();
+    fresh.ip = WiFi.localIP();
+    fresh.gateway = WiFi.gatewayIP();
+    fresh.subnet = WiFi.subnetMask();
+    fresh.dns = WiFi.dnsIP();
+    fresh.leaseRenewAt = wifiCache.magic == WIFI_CACHE_MAGIC ? wifiCache.leaseRenewAt : 0;
+    if (freshLease)
+    {
+        uint32_t renewIn = leaseRenewSeconds();
+        fresh.leaseRenewAt = renewIn != 0 && timeTrusted() ? timeNow() + renewIn : 0;
+    }
+
+    // Same AP and lease as last time: skip the flash write
+    if (memcmp(&fresh, &wifiCache, sizeof(fresh)) == 0)
+    {
+        return;
+    }
+
+    if (replaceFile(WIFI_CACHE_FILE, &fresh, sizeof(fresh)))
+    {
+        wifiCache = fresh;
+    }
+}
+
+static void invalidateWiFiCache()
+{
+    wifiCache.magic = 0;
+    SPIFFS.remove(WIFI_CACHE_FILE);
+}
+
+// Parses "ip,gateway,subnet,dns" into WiFi.config() arguments
+static bool parseStaticIP(const char *config, IPAddress &ip, IPAddress &gateway, IPAddress &subnet, IPAddress &dns)
+{
+    // Split a copy in place; fromString() wants terminated fields
+    char fields[WIFI_STATIC_IP_MAX];
+    strlcpy(fields, config, sizeof(fields));
+
+    char *parts[4];
+    char *cursor = fields;
+    for (int i = 0; i < 4; i++)
+    {
+        parts[i] = cursor;
+        cursor = strchr(cursor, ',');
+        if (cursor == nullptr)
+        {
+            if (i < 3)
+            {
+                return false;
+            }
+            break;
+        }
+        *cursor++ = '\0';
+    }
+
+    return ip.fromString(parts[0]) &&
+           gateway.fromString(parts[1]) &&
+           subnet.fromString(parts[2]) &&
+           dns.fromString(parts[3]);
+}
+
+static void recordAttempt(uint32_t durationMs, bool fastPath, bool success)
+{
+    trace(success ? TRACE_WIFI_UP : TRACE_WIFI_FAIL, fastPath, (uint16_t)min(durationMs, (uint32_t)UINT16_MAX));
+    wifiStats.attempts++;
+    if (fastPath)
+    {
+        wifiStats.fastAttempts++;
+    }
+
+    if (success)
+    {
+        wifiStats.successes++;
+        if (fastPath)
+        {
+            wifiStats.fastSuccesses++;
+        }
+        wifiStats.totalConnectMs += durationMs;
+        if (wifiStats.minConnectMs == 0 || durationMs < wifiStats.minConnectMs)
+        {
+            wifiStats.minConnectMs = durationMs;
+        }
+        if (durationMs > wifiStats.maxConnectMs)
+        {
+            wifiStats.maxConnectMs = durationMs;
+        }
+    }
+
+    WiFiAttempt &entry = wifiStats.history[wifiStats.historyHead];
+    entry.durationMs = durationMs;
+    entry.fastPath = fastPath;
+    entry.success = success;
+    wifiStats.historyHead = (wifiStats.historyHead + 1) % WIFI_ATTEMPT_HISTORY;
+}
+
+// One association attempt. The fast path pins the cached BSSID/channel and,
+// with reuseLease, the cached address; otherwise DHCP runs. The slow path
+// scans.
+static bool attemptConnection(bool fastPath, bool reuseLease)
+{
+    unsigned long start = millis();
+    xEventGroupClearBits(wifiEvents, WIFI_GOT_IP_BIT | WIFI_FAIL_BIT);
+
+    IPAddress ip, gateway, subnet, dns;
+    if (storedStaticIP[0] != '\0' && parseStaticIP(storedStaticIP, ip, gateway, subnet, dns))
+    {
+        WiFi.config(ip, gateway, subnet, dns);
+    }
+    else if (fastPath && reuseLease)
+    {
+        WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway),
+                    IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+    }
+    else
+    {
+        // All-zero config switches the interface back to DHCP
+        WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+    }
+
+    EventBits_t waitBits = WIFI_GOT_IP_BIT;
+    uint32_t timeoutMs = WIFI_CONNECT_TIMEOUT_MS;
+    if (fastPath)
+    {
+        WiFi.begin(storedSSID, storedPassword, wifiCache.channel, wifiCache.bssid);
+        // A stale BSSID/channel fails fast; don't sit out the full timeout
+        waitBits |= WIFI_FAIL_BIT;
+        timeoutMs = WIFI_FAST_CONNECT_TIMEOUT_MS;
+    }
+    else
+    {
+        WiFi.begin(storedSSID, storedPassword);
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(wifiEvents, waitBits, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeoutMs));
+    bool connected = (bits & WIFI_GOT_IP_BIT) && WiFi.status() == WL_CONNECTED;
+
+    if (!connected)
+    {
+        WiFi.disconnect();
+    }
+
+    recordAttempt(millis() - start, fastPath, connected);
+    return connected;
+}
 
 void loadWiFiCredentials()
 {
@@ -14,74 +256,136 @@ void loadWiFiCredentials()
         File file = SPIFFS.open(WIFI_CONFIG_FILE, FILE_READ);
         if (file)
         {
-            String ssidFromFile = file.readStringUntil('\n');
-            String passwordFromFile = file.readStringUntil('\n');
+            char ssidFromFile[WIFI_SSID_MAX];
+            char passwordFromFile[WIFI_PASSWORD_MAX];
 
-            // Trim any newlines or whitespace
-            ssidFromFile.trim();
-            passwordFromFile.trim();
+            // readRecordLine() drops the trailing newline and whitespace
+            readRecordLine(file, ssidFromFile, sizeof(ssidFromFile));
+            readRecordLine(file, passwordFromFile, sizeof(passwordFromFile));
+            readRecordLine(file, storedStaticIP, sizeof(storedStaticIP));
 
             // Only update if not empty
-            if (ssidFromFile.length() > 0)
+            if (ssidFromFile[0] != '\0')
             {
-                storedSSID = ssidFromFile;
+                strlcpy(storedSSID, ssidFromFile, sizeof(storedSSID));
             }
-            if (passwordFromFile.length() > 0)
+            if (passwordFromFile[0] != '\0')
             {
-                storedPassword = passwordFromFile;
+                strlcpy(storedPassword, passwordFromFile, sizeof(storedPassword));
             }
 
             file.close();
-            printBoth("WiFi credentials loaded: " + storedSSID);
+            printfBoth("WiFi credentials loaded: %s", storedSSID);
         }
     }
     else
     {
         printBoth("No saved WiFi credentials found");
     }
+
+    loadWiFiCache();
+    credentialsLoaded = true;
 }
 
 // New function to save WiFi credentials to SPIFFS
-void saveWiFiCredentials(const String &newSSID, const String &newPassword)
+void saveWiFiCredentials(const char *newSSID, const char *newPassword)
 {
-    File file = SPIFFS.open(WIFI_CONFIG_FILE, FILE_WRITE);
-    if (file)
+    // One line each for SSID, password and static IP
+    char contents[WIFI_SSID_MAX + WIFI_PASSWORD_MAX + WIFI_STATIC_IP_MAX + 8];
+    int length = snprintf(contents, sizeof(contents), "%s\r\n%s\r\n%s\r\n", newSSID, newPassword, storedStaticIP);
+    if (replaceFile(WIFI_CONFIG_FILE, contents, length))
     {
-        file.println(newSSID);
-        file.println(newPassword);
-        file.close();
         printBoth("WiFi credentials saved successfully");
     }
     else
     {
         printBoth("Failed to save WiFi credentials");
     }
+
+    // Cached AP and lease belong to the old network
+    invalidateWiFiCache();
 }
 
-// New function to update WiFi settings
-void updateWiFiSettings()
+static void applyWiFiSettings(const char *newSSID, const char *newPassword, const char *newStaticIP)
 {
-    printBoth("Current SSID: " + storedSSID);
-    printBoth("Enter new SSID (or leave empty to keep current):");
+    IPAddress ip, gateway, subnet, dns;
+    if (parseStaticIP(newStaticIP, ip, gateway, subnet, dns))
+    {
+        strlcpy(storedStaticIP, newStaticIP, sizeof(storedStaticIP));
+    }
+    else
+    {
+        storedStaticIP[0] = '\0';
+        printBoth("Using DHCP");
+    }
 
-    String newSSID = readInput();
-    if (newSSID.length() > 0)
+    // Update stored variables
+    strlcpy(storedSSID, newSSID, sizeof(storedSSID));
+    strlcpy(storedPassword, newPassword, sizeof(storedPassword));
+
+    // Save to file
+    saveWiFiCredentials(storedSSID, storedPassword);
+    printBoth("WiFi settings updated");
+}
+
+// Dialog state: which field the next line fills in
+enum WiFiDialogStep
+{
+    WIFI_STEP_SSID,
+    WIFI_STEP_PASSWORD,
+    WIFI_STEP_STATIC_IP
+};
+
+static WiFiDialogStep wifiStep = WIFI_STEP_SSID;
+static char pendingSSID[WIFI_SSID_MAX] = "";
+static char pendingPassword[WIFI_PASSWORD_MAX] = "";
+
+static SessionStatus wifiSettingsInput(const char *line)
+{
+    switch (wifiStep)
     {
-        printBoth("Enter password for " + newSSID + ":");
-        String newPassword = readInput();
+    case WIFI_STEP_SSID:
+        if (line[0] == '\0')
+        {
+            printBoth("SSID unchanged");
+            return SESSION_DONE;
+        }
+        strlcpy(pendingSSID, line, sizeof(pendingSSID));
+        wifiStep = WIFI_STEP_PASSWORD;
+        printfBoth("Enter password for %s:", pendingSSID);
+        return SESSION_CONTINUE;
 
-        // Update stored variables
-        storedSSID = newSSID;
-        storedPassword = newPassword;
+    case WIFI_STEP_PASSWORD:
+        strlcpy(pendingPassword, line, sizeof(pendingPassword));
+        wifiStep = WIFI_STEP_STATIC_IP;
+        printBoth("Static IP as ip,gateway,subnet,dns (or 'dhcp'):");
+        return SESSION_CONTINUE;
 
-        // Save to file
-        saveWiFiCredentials(storedSSID, storedPassword);
-        printBoth("WiFi settings updated");
+    default:
+        applyWiFiSettings(pendingSSID, pendingPassword, line);
+        memset(pendingPassword, 0, sizeof(pendingPassword));
+        return SESSION_DONE;
     }
-    else
+}
+
+// "wifi <ssid> <password> [ip,gw,mask,dns]" applies directly, bare "wifi" asks step by step
+void updateWiFiSettings(const char *args)
+{
+    if (args[0] != '\0')
     {
-        printBoth("SSID unchanged");
+        char rest[INPUT_LINE_MAX];
+        strlcpy(rest, args, sizeof(rest));
+        char *cursor = rest;
+        const char *newSSID = nextArg(cursor);
+        const char *newPassword = nextArg(cursor);
+        applyWiFiSettings(newSSID, newPassword, cursor);
+        return;
     }
+
+    printfBoth("Current SSID: %s", storedSSID);
+    printBoth("Enter new SSID (or leave empty to keep current):");
+    wifiStep = WIFI_STEP_SSID;
+    beginSession(wifiSettingsInput);
 }
 
 void connectToWiFi()
@@ -92,61 +396,56 @@ void connectToWiFi()
         return;
     }
 
-    // Load saved credentials only when needed
-    loadWiFiCredentials();
+    // Credentials and the AP cache are read from SPIFFS once per boot
+    if (!credentialsLoaded)
+    {
+        loadWiFiCredentials();
+    }
 
-    // If no credentials are available, prompt user
-    if (storedSSID.length() == 0)
+    // Setting credentials is a dialog of its own; never block the caller on it
+    if (storedSSID[0] == '\0')
     {
-        printBoth("No WiFi credentials found. Please set them now:");
-        updateWiFiSettings();
+        printBoth("No WiFi credentials found. Set them with 'wifi' (option 8)");
+        return;
     }
 
-    printBoth("Connecting to " + storedSSID + " ...");
+    initWiFiEvents();
 
-    WiFi.begin(storedSSID.c_str(), storedPassword.c_str());
+    printfBoth("Connecting to %s ...", storedSSID);
 
-    int wifiCounter = 0;
-    while (WiFi.status() != WL_CONNECTED && wifiCounter < 20) // Timeout after 20 seconds
+    bool connected = false;
+    bool reuseLease = false;
+    if (wifiCache.magic == WIFI_CACHE_MAGIC)
     {
-        delay(1000);
-        printBoth(".");
-        wifiCounter++;
+        reuseLease = leaseValid();
+        connected = attemptConnection(true, reuseLease);
+        if (!connected)
+        {
+            printBoth("Cached access point unavailable, scanning...");
+            invalidateWiFiCache();
+        }
+    }
+    if (!connected)
+    {
+        reuseLease = false;
+        connected = attemptConnection(false, false);
     }
 
-    if (WiFi.status() == WL_CONNECTED)
+    if (!connected)
     {
-        printBoth("\nConnection established!");
-        printBoth("IP address: " + WiFi.localIP().toString());
+        printBoth("WiFi connection failed! Check settings with 'wifi' (option 8)");
     }
-    else
+
+    if (connected)
     {
-        printBoth("\nWiFi connection failed! Do you want to update WiFi settings? (Y/N)");
-        String response = readInput();
-        if (response == "Y" || response == "y")
-        {
-            updateWiFiSettings();
-            // Try connecting once more with new settings
-            printBoth("Trying again with new settings...");
-            WiFi.begin(storedSSID.c_str(), storedPassword.c_str());
-            wifiCounter = 0;
-            while (WiFi.status() != WL_CONNECTED && wifiCounter < 20)
-            {
-                delay(1000);
-                printBoth(".");
-                wifiCounter++;
-            }
+        const WiFiAttempt &last = wifiStats.history[(wifiStats.historyHead + WIFI_ATTEMPT_HISTORY - 1) % WIFI_ATTEMPT_HISTORY];
+        printfBoth("\nConnection established in %u ms%s", (unsigned)last.durationMs, last.fastPath ? " (cached AP)" : "");
+        IPAddress ip = WiFi.localIP();
+        printfBoth("IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+        saveWiFiCache(!reuseLease && storedStaticIP[0] == '\0');
 
-            if (WiFi.status() == WL_CONNECTED)
-            {
-                printBoth("\nConnection established!");
-                printBoth("IP address: " + WiFi.localIP().toString());
-            }
-            else
-            {
-                printBoth("\nWiFi connection still failed. Cannot sync to Google Sheets.");
-            }
-        }
+        // Every connection corrects the clock; the reply arrives in the background
+        startTimeSync();
     }
 }
 
@@ -158,4 +457,31 @@ void disconnectWiFi()
         WiFi.disconnect();
         printBoth("WiFi disconnected");
     }
-}
\ No newline at end of file
+}
+
+void showWiFiStats()
+{
+    printBoth("=== WiFi Connect Statistics ===");
+    printfBoth("Attempts: %u, connected: %u", (unsigned)wifiStats.attempts, (unsigned)wifiStats.successes);
+    printfBoth("Cached AP: %u/%u succeeded", (unsigned)wifiStats.fastSuccesses, (unsigned)wifiStats.fastAttempts);
+
+    if (wifiStats.successes > 0)
+    {
+        printfBoth("Connect time ms: min %u, avg %u, max %u", (unsigned)wifiStats.minConnectMs,
+                   (unsigned)(wifiStats.totalConnectMs / wifiStats.successes), (unsigned)wifiStats.maxConnectMs);
+    }
+
+    // Oldest first
+    for (int i = 0; i < WIFI_ATTEMPT_HISTORY; i++)
+    {
+        const WiFiAttempt &entry = wifiStats.history[(wifiStats.historyHead + i) % WIFI_ATTEMPT_HISTORY];
+        if (entry.durationMs == 0)
+        {
+            continue;
+        }
+        printfBoth("%u ms %s%s", (unsigned)entry.durationMs, entry.fastPath ? "cached " : "scan ", entry.success ? "ok" : "failed");
+    }
+    printBoth("===============================");
+}
+
+#endif // FEATURE_SYNC
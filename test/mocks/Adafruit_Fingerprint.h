@@ -0,0 +1,149 @@
+#pragma once
+
+// Simulated fingerprint sensor behind the Adafruit_Fingerprint API: a
+// library of enrolled slots and the finger currently on the glass. Searches
+// (the library's full search and the raw high-speed search packet) match
+// the finger only if its slot lies in the searched range, and count the
+// slots they compare so tests can check what a search covered.
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <set>
+
+#define FINGERPRINT_OK 0x00
+#define FINGERPRINT_PACKETRECIEVEERR 0x01
+#define FINGERPRINT_NOFINGER 0x02
+#define FINGERPRINT_IMAGEFAIL 0x03
+#define FINGERPRINT_IMAGEMESS 0x06
+#define FINGERPRINT_FEATUREFAIL 0x07
+#define FINGERPRINT_NOMATCH 0x08
+#define FINGERPRINT_NOTFOUND 0x09
+#define FINGERPRINT_ENROLLMISMATCH 0x0A
+#define FINGERPRINT_BADLOCATION 0x0B
+#define FINGERPRINT_INVALIDIMAGE 0x15
+#define FINGERPRINT_FLASHERR 0x18
+#define FINGERPRINT_TIMEOUT 0xFF
+#define FINGERPRINT_BADPACKET 0xFE
+
+#define FINGERPRINT_COMMANDPACKET 0x1
+#define FINGERPRINT_DATAPACKET 0x2
+#define FINGERPRINT_ACKPACKET 0x7
+#define FINGERPRINT_ENDDATAPACKET 0x8
+#define FINGERPRINT_HISPEEDSEARCH 0x1B
+
+#define FINGERPRINT_LED_ON 0x03
+#define FINGERPRINT_LED_OFF 0x04
+#define FINGERPRINT_LED_RED 0x01
+#define FINGERPRINT_LED_BLUE 0x02
+#define FINGERPRINT_LED_PURPLE 0x03
+
+struct Adafruit_Fingerprint_Packet
+{
+    Adafruit_Fingerprint_Packet(uint8_t type, uint16_t length, uint8_t *data) : type(type), length(length)
+    {
+        memcpy(this->data, data, length < sizeof(this->data) ? length : sizeof(this->data));
+    }
+    uint16_t start_code = 0xEF01;
+    uint8_t address[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t type;
+    uint16_t length;
+    uint8_t data[64] = {};
+};
+
+class Adafruit_Fingerprint
+{
+public:
+    explicit Adafruit_Fingerprint(HardwareSerial *serial, uint32_t password = 0) {}
+
+    // Simulation state
+    std::set<uint16_t> enrolled;
+    uint16_t fingerOn = 0;        // Slot of the finger on the glass, 0 for none
+    uint32_t searchedSlots = 0;   // Slots compared by all searches so far
+    uint16_t lastSearchFirst = 0; // Range of the last high-speed search packet
+    uint16_t lastSearchCount = 0;
+
+    uint8_t getImage() { return fingerOn != 0 ? FINGERPRINT_OK : FINGERPRINT_NOFINGER; }
+    uint8_t image2Tz(uint8_t slot = 1) { return FINGERPRINT_OK; }
+    uint8_t getTemplateCount()
+    {
+        templateCount = enrolled.size();
+        return FINGERPRINT_OK;
+    }
+    uint8_t setSecurityLevel(uint8_t level)
+    {
+        security_level = level;
+        return FINGERPRINT_OK;
+    }
+    uint8_t LEDcontrol(uint8_t control, uint8_t speed, uint8_t colour, uint8_t count = 0) { return FINGERPRINT_OK; }
+    uint8_t createModel() { return FINGERPRINT_OK; }
+    uint8_t storeModel(uint16_t id)
+    {
+        enrolled.insert(id);
+        return FINGERPRINT_OK;
+    }
+    uint8_t loadModel(uint16_t id) { return enrolled.count(id) ? FINGERPRINT_OK : FINGERPRINT_BADLOCATION; }
+    uint8_t emptyDatabase()
+    {
+        enrolled.clear();
+        return FINGERPRINT_OK;
+    }
+
+    uint8_t fingerFastSearch()
+    {
+        return search(0, capacity, fingerID, confidence);
+    }
+
+    // Only the high-speed search command is simulated; its reply is
+    // returned by the next getStructuredPacket()
+    void writeStructuredPacket(const Adafruit_Fingerprint_Packet &packet)
+    {
+        reply[0] = FINGERPRINT_PACKETRECIEVEERR;
+        if (packet.data[0] != FINGERPRINT_HISPEEDSEARCH)
+        {
+            return;
+        }
+        lastSearchFirst = (packet.data[2] << 8) | packet.data[3];
+        lastSearchCount = (packet.data[4] << 8) | packet.data[5];
+        if (lastSearchFirst + lastSearchCount > capacity)
+        {
+            reply[0] = FINGERPRINT_BADLOCATION;
+            return;
+        }
+        uint16_t id = 0, score = 0;
+        reply[0] = search(lastSearchFirst, lastSearchCount, id, score);
+        reply[1] = id >> 8;
+        reply[2] = id & 0xFF;
+        reply[3] = score >> 8;
+        reply[4] = score & 0xFF;
+    }
+
+    uint8_t getStructuredPacket(Adafruit_Fingerprint_Packet *packet, uint16_t timeout = 1000)
+    {
+        packet->type = FINGERPRINT_ACKPACKET;
+        memcpy(packet->data, reply, sizeof(reply));
+        return FINGERPRINT_OK;
+    }
+
+    uint16_t fingerID = 0;
+    uint16_t confidence = 0;
+    uint16_t templateCount = 0;
+    uint16_t capacity = 1000;
+    uint16_t security_level = 3;
+    uint16_t packet_len = 128;
+
+private:
+    uint8_t reply[5] = {};
+
+    // Compares slot by slot from first and stops at the finger's slot
+    uint8_t search(uint16_t first, uint16_t count, uint16_t &id, uint16_t &score)
+    {
+        bool inRange = fingerOn >= first && fingerOn < first + count && enrolled.count(fingerOn);
+        searchedSlots += inRange ? fingerOn - first + 1 : count;
+        if (!inRange)
+        {
+            return FINGERPRINT_NOTFOUND;
+        }
+        id = fingerOn;
+        score = 120;
+        return FINGERPRINT_OK;
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core the modules under test
+// use. Time only moves when a test advances mockMillis.
+#include <algorithm>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <time.h>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+inline unsigned long mockMillis = 0;
+
+// Set by a host program that runs other work while the firmware waits
+inline void (*mockDelayHook)(unsigned long ms) = nullptr;
+
+inline unsigned long millis() { return mockMillis; }
+inline unsigned long micros() { return mockMillis * 1000; }
+inline void delay(unsigned long ms)
+{
+    if (mockDelayHook != nullptr)
+    {
+        mockDelayHook(ms);
+        return;
+    }
+    mockMillis += ms;
+}
+
+// Seeded with srand() by the host program
+inline long random(long high) { return high > 0 ? rand() % high : 0; }
+inline long random(long low, long high) { return high > low ? low + random(high - low) : low; }
+
+// The core's SNTP setup; only the time zone matters on the host
+inline void configTzTime(const char *tz, const char *server1, const char *server2 = nullptr,
+                         const char *server3 = nullptr)
+{
+    setenv("TZ", tz, 1);
+    tzset();
+}
+
+// No PSRAM on the host
+inline bool psramFound() { return false; }
+inline void *ps_malloc(size_t size) { return malloc(size); }
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size > 0)
+    {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, copied);
+        dst[copied] = '\0';
+    }
+    return length;
+}
+
+inline size_t strlcat(char *dst, const char *src, size_t size)
+{
+    size_t used = strnlen(dst, size);
+    return used == size ? size + strlen(src) : used + strlcpy(dst + used, src, size - used);
+}
+#endif
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+    virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+    size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t println(const char *text) { return print(text) + println(); }
+    size_t println() { return print("\r\n"); }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+
+    size_t readBytesUntil(char terminator, char *buffer, size_t length)
+    {
+        size_t count = 0;
+        while (count < length && available() > 0)
+        {
+            int c = read();
+            if (c == terminator)
+            {
+                break;
+            }
+            buffer[count++] = (char)c;
+        }
+        return count;
+    }
+};
+
+// The core pulls the FreeRTOS task API in with Arduino.h
+#include <freertos/task.h>
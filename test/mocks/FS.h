@@ -0,0 +1,230 @@
+#pragma once
+
+// Host stand-in for the Arduino FS API over an in-memory file system with
+// SPIFFS semantics: flat names, no rename over an existing file, writes
+// visible as soon as they are made. Writes go at the file position, so
+// "r+" and seek() overwrite in place.
+//
+// Tests can cut the power: with powerCutIn = n, the n-th mutating step from
+// now (open for write, write, remove, rename) throws PowerCut instead of
+// completing, a write keeping only the first half of its bytes. Whatever is
+// in files at that moment is what the next boot finds.
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+struct PowerCut
+{
+};
+
+struct MockFs
+{
+    std::map<std::string, std::vector<uint8_t>> files;
+    std::set<std::string> failRemove; // remove() of these paths fails
+    long powerCutIn = -1;             // Mutating steps until the cut, -1 for none
+    long steps = 0;                   // Mutating steps taken so far
+
+    // True when this step is the one the power goes on
+    bool cutting() const { return powerCutIn == 0; }
+
+    void step()
+    {
+        steps++;
+        if (powerCutIn == 0)
+        {
+            powerCutIn = -1;
+            throw PowerCut();
+        }
+        if (powerCutIn > 0)
+        {
+            powerCutIn--;
+        }
+    }
+
+    void reset()
+    {
+        files.clear();
+        failRemove.clear();
+        powerCutIn = -1;
+        steps = 0;
+    }
+
+    std::string text(const std::string &path) const
+    {
+        auto file = files.find(path);
+        return file == files.end() ? std::string() : std::string(file->second.begin(), file->second.end());
+    }
+};
+
+inline MockFs mockFs;
+
+namespace fs
+{
+class File : public Stream
+{
+public:
+    File() {}
+    File(const std::string &path, bool writable, size_t offset = 0)
+        : open(true), writable(writable), path_(path), offset(offset)
+    {
+    }
+
+    // A directory listing
+    explicit File(const std::vector<std::string> &names) : open(true), directory(true), listing(names) {}
+
+    operator bool() const { return open; }
+    void close() { open = false; }
+    size_t size() const { return open && !directory ? data().size() : 0; }
+    size_t position() const { return offset; }
+    const char *path() const { return path_.c_str(); }
+    const char *name() const { return path_.c_str() + (path_.empty() ? 0 : 1); } // SPIFFS names drop the '/'
+    bool isDirectory() const { return directory; }
+
+    File openNextFile()
+    {
+        if (!directory || next >= listing.size())
+        {
+            return File();
+        }
+        return File(listing[next++], false);
+    }
+
+    bool seek(size_t position)
+    {
+        if (!open || directory || position > data().size())
+        {
+            return false;
+        }
+        offset = position;
+        return true;
+    }
+
+    int available() override { return open && !directory ? (int)(data().size() - offset) : 0; }
+
+    int read() override
+    {
+        if (available() <= 0)
+        {
+            return -1;
+        }
+        return data()[offset++];
+    }
+
+    size_t read(uint8_t *buffer, size_t size)
+    {
+        size_t count = min(size, (size_t)max(available(), 0));
+        memcpy(buffer, data().data() + offset, count);
+        offset += count;
+        return count;
+    }
+
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (!open || !writable)
+        {
+            return 0;
+        }
+        std::vector<uint8_t> &contents = mockFs.files[path_];
+        size_t count = mockFs.cutting() ? size / 2 : size;
+        if (contents.size() < offset + count)
+        {
+            contents.resize(offset + count);
+        }
+        memcpy(contents.data() + offset, buffer, count);
+        mockFs.step();
+        offset += size;
+        return size;
+    }
+
+private:
+    const std::vector<uint8_t> &data() const
+    {
+        static const std::vector<uint8_t> none;
+        auto file = mockFs.files.find(path_);
+        return file == mockFs.files.end() ? none : file->second;
+    }
+
+    bool open = false;
+    bool writable = false;
+    bool directory = false;
+    std::string path_;
+    size_t offset = 0;
+    std::vector<std::string> listing;
+    size_t next = 0;
+};
+
+enum SeekMode
+{
+    SeekSet,
+    SeekCur,
+    SeekEnd
+};
+
+class FS
+{
+public:
+    File open(const char *path, const char *mode = FILE_READ)
+    {
+        std::string name(path);
+        if (name == "/")
+        {
+            std::vector<std::string> names;
+            for (const auto &file : mockFs.files)
+            {
+                names.push_back(file.first);
+            }
+            return File(names);
+        }
+        if (strcmp(mode, FILE_READ) == 0)
+        {
+            return exists(path) ? File(name, false) : File();
+        }
+        if (strcmp(mode, "r+") == 0)
+        {
+            return exists(path) ? File(name, true) : File();
+        }
+        mockFs.step();
+        if (strcmp(mode, FILE_WRITE) == 0)
+        {
+            mockFs.files[name].clear();
+        }
+        return File(name, true, mockFs.files[name].size());
+    }
+
+    bool exists(const char *path) { return mockFs.files.count(path) != 0; }
+
+    bool remove(const char *path)
+    {
+        if (!exists(path) || mockFs.failRemove.count(path) != 0)
+        {
+            return false;
+        }
+        mockFs.step();
+        mockFs.files.erase(path);
+        return true;
+    }
+
+    bool rename(const char *from, const char *to)
+    {
+        if (!exists(from) || exists(to))
+        {
+            return false;
+        }
+        mockFs.step();
+        mockFs.files[to] = mockFs.files[from];
+        mockFs.files.erase(from);
+        return true;
+    }
+};
+} // namespace fs
+
+using fs::File;
+using fs::FS;
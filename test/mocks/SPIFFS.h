@@ -0,0 +1,21 @@
+#pragma once
+
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS
+{
+public:
+    bool begin(bool formatOnFail = false) { return true; }
+    size_t totalBytes() { return 1024 * 1024; }
+    size_t usedBytes()
+    {
+        size_t used = 0;
+        for (const auto &file : mockFs.files)
+        {
+            used += file.second.size();
+        }
+        return used;
+    }
+};
+
+inline SPIFFSFS SPIFFS;
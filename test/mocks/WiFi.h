@@ -0,0 +1,28 @@
+#pragma once
+
+// Host stand-in for the WiFi station: only its link status, which the host
+// program sets when its scripted network connects or drops
+#include <Arduino.h>
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class WiFiClass
+{
+public:
+    wl_status_t status() { return mockStatus; }
+    bool disconnect()
+    {
+        mockStatus = WL_DISCONNECTED;
+        return true;
+    }
+
+    wl_status_t mockStatus = WL_DISCONNECTED;
+};
+
+inline WiFiClass WiFi;
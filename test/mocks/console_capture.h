@@ -0,0 +1,31 @@
+#pragma once
+
+// Console and telemetry hooks for host tests: console output is collected
+// in consoleOutput instead of going to Serial or BLE. Include it from the
+// one test file of a test binary.
+#include <Arduino.h>
+#include <string>
+
+std::string consoleOutput;
+size_t flashBytesWritten = 0;
+
+void printBoth(const char *message)
+{
+    consoleOutput += message;
+    consoleOutput += '\n';
+}
+
+void printfBoth(const char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    printBoth(buffer);
+}
+
+void noteFlashWrite(size_t bytes)
+{
+    flashBytesWritten += bytes;
+}
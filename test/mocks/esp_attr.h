@@ -0,0 +1,5 @@
+#pragma once
+
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
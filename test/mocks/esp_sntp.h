@@ -0,0 +1,11 @@
+#pragma once
+
+// Host stand-in for SNTP: the notification callback is kept so the host
+// program can deliver a reply when its scripted network allows one
+#include <sys/time.h>
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+inline sntp_sync_time_cb_t mockSntpCallback = nullptr;
+
+inline void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) { mockSntpCallback = callback; }
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Uptime follows mockMillis like the rest of the host clock
+inline int64_t esp_timer_get_time() { return (int64_t)mockMillis * 1000; }
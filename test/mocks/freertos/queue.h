@@ -0,0 +1,49 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include <deque>
+#include <string.h>
+#include <vector>
+
+struct MockQueue
+{
+    size_t length;
+    size_t itemSize;
+    std::deque<std::vector<uint8_t>> items;
+};
+typedef MockQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    return new MockQueue{length, itemSize, {}};
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t)
+{
+    if (queue->items.size() >= queue->length)
+    {
+        return pdFALSE;
+    }
+    const uint8_t *bytes = (const uint8_t *)item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t)
+{
+    if (queue->items.empty())
+    {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+inline BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    queue->items.clear();
+    return pdPASS;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->items.size(); }
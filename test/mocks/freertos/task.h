@@ -0,0 +1,23 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include <Arduino.h>
+
+// Tasks never run on the host; the test calls their bodies' steps itself
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t,
+                                          TaskHandle_t *handle, BaseType_t)
+{
+    if (handle != nullptr)
+    {
+        *handle = nullptr;
+    }
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *param,
+                              UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stack, param, priority, handle, tskNO_AFFINITY);
+}
+
+inline void vTaskDelay(TickType_t ticks) { mockMillis += ticks; }
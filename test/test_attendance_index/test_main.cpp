@@ -0,0 +1,205 @@
+// Attendance index: roll calls and days present kept from committed
+// records, across reboots, date reuse and a rebuild from the log.
+#include <unity.h>
+#include <map>
+#include "console_capture.h"
+#include "../../src/journal.cpp"
+#include "../../src/record_log.cpp"
+#include "../../src/time_source.cpp"
+#include "../../src/attendance_index.cpp"
+
+// Link seams: the parts of other modules the index and the log call
+char currentDate[DATE_MAX] = "19/5";
+uint32_t unsyncedRecordCount = 0;
+uint32_t heldRecordCount = 0;
+static std::map<uint16_t, RosterEntry> roster;
+
+const RosterEntry *rosterLookup(uint16_t slot)
+{
+    auto entry = roster.find(slot);
+    return entry == roster.end() ? nullptr : &entry->second;
+}
+
+int rosterSlotOf(const char *studentId)
+{
+    for (const auto &entry : roster)
+    {
+        if (strcmp(entry.second.studentId, studentId) == 0)
+        {
+            return entry.first;
+        }
+    }
+    return -1;
+}
+
+// As in commands.cpp
+char *nextArg(char *&cursor)
+{
+    while (*cursor == ' ')
+    {
+        cursor++;
+    }
+
+    char *token = cursor;
+    while (*cursor != '\0' && *cursor != ' ')
+    {
+        cursor++;
+    }
+
+    if (*cursor == ' ')
+    {
+        *cursor++ = '\0';
+        while (*cursor == ' ')
+        {
+            cursor++;
+        }
+    }
+    return token;
+}
+
+// As in storage.cpp
+size_t readRecordLine(File &file, char *line, size_t size)
+{
+    size_t length = file.readBytesUntil('\n', line, size - 1);
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' '))
+    {
+        length--;
+    }
+    line[length] = '\0';
+    return length;
+}
+
+static const uint32_t MAY_19 = 1747643465; // 19/5/2025 08:31:05 UTC
+static const uint32_t DAY = 86400;
+
+// RAM state lost, flash kept
+static void reboot()
+{
+    consoleOutput.clear();
+    free(bitmaps);
+    bitmaps = nullptr;
+    memset(dates, 0, sizeof(dates));
+    recordLog = {};
+    pendingLength = 0;
+    pendingRecords = 0;
+    recoverJournal();
+    initRecordLog();
+    initAttendanceIndex();
+}
+
+static int16_t entryOf(const char *date)
+{
+    int16_t entry = findDate(date);
+    TEST_ASSERT_TRUE_MESSAGE(entry >= 0, date);
+    return entry;
+}
+
+void setUp()
+{
+    mockFs.reset();
+    roster.clear();
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    reboot();
+}
+
+void tearDown() {}
+
+static void test_scans_counted_once_per_date()
+{
+    indexAttendance("19/5", 12);
+    indexAttendance("19/5", 12);
+    indexAttendance("19/5", 7);
+    indexAttendance("20/5", 12);
+
+    TEST_ASSERT_EQUAL(2, presentCount[entryOf("19/5")]);
+    TEST_ASSERT_EQUAL(1, presentCount[entryOf("20/5")]);
+    TEST_ASSERT_EQUAL(2, daysPresent[12]);
+    TEST_ASSERT_EQUAL(1, daysPresent[7]);
+}
+
+static void test_index_survives_reboot()
+{
+    indexAttendance("19/5", 12);
+    indexAttendance("20/5", 12);
+    indexAttendance("20/5", ROSTER_MAX_SLOTS - 1);
+    reboot();
+
+    TEST_ASSERT_TRUE(consoleOutput.find("Building") == std::string::npos);
+    TEST_ASSERT_EQUAL(2, usedDates);
+    TEST_ASSERT_EQUAL(2, daysPresent[12]);
+    TEST_ASSERT_EQUAL(1, daysPresent[ROSTER_MAX_SLOTS - 1]);
+    TEST_ASSERT_EQUAL(2, presentCount[entryOf("20/5")]);
+}
+
+static void test_oldest_date_reused_when_full()
+{
+    char date[DATE_MAX];
+    for (int i = 0; i <= INDEX_MAX_DATES; i++)
+    {
+        snprintf(date, sizeof(date), "d%d", i);
+        indexAttendance(date, 3);
+    }
+    TEST_ASSERT_EQUAL(INDEX_MAX_DATES, usedDates);
+    TEST_ASSERT_EQUAL(-1, findDate("d0"));
+    TEST_ASSERT_EQUAL(INDEX_MAX_DATES, daysPresent[3]);
+
+    // The reused entry was cleared on flash too
+    reboot();
+    TEST_ASSERT_EQUAL(-1, findDate("d0"));
+    TEST_ASSERT_EQUAL(INDEX_MAX_DATES, daysPresent[3]);
+    TEST_ASSERT_EQUAL(1, presentCount[entryOf(date)]);
+}
+
+static void test_rebuilt_from_log_without_index_file()
+{
+    strlcpy(roster[5].studentId, "S1234", sizeof(roster[5].studentId));
+    strlcpy(roster[5].name, "Ada", sizeof(roster[5].name));
+
+    // Roster students by number, others by slot; records from a clock that
+    // was never set are skipped
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "S1234", 5));
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "9", 9));
+    TEST_ASSERT_TRUE(appendRecord(MAY_19 + DAY, true, 2, "S1234", 5));
+    TEST_ASSERT_TRUE(appendRecord(600, false, 1, "11", 11));
+    TEST_ASSERT_TRUE(commitRecordLog());
+
+    SPIFFS.remove(INDEX_FILE);
+    reboot();
+    TEST_ASSERT_TRUE(consoleOutput.find("Building") != std::string::npos);
+    TEST_ASSERT_EQUAL(2, usedDates);
+    TEST_ASSERT_EQUAL(2, daysPresent[5]);
+    TEST_ASSERT_EQUAL(1, daysPresent[9]);
+    TEST_ASSERT_EQUAL(0, daysPresent[11]);
+
+    consoleOutput.clear();
+    rollCallCommand("19/5 absent");
+    TEST_ASSERT_TRUE(consoleOutput.find("0 roster students absent") != std::string::npos);
+    consoleOutput.clear();
+    rollCallCommand("21/5 absent");
+    TEST_ASSERT_TRUE(consoleOutput.find("5: S1234 Ada") != std::string::npos);
+}
+
+static void test_index_of_other_layout_rebuilt()
+{
+    indexAttendance("19/5", 12);
+    IndexHeader header = {INDEX_MAGIC, ROSTER_MAX_SLOTS, INDEX_MAX_DATES + 1};
+    File file = SPIFFS.open(INDEX_FILE, "r+");
+    file.write((const uint8_t *)&header, sizeof(header));
+    file.close();
+
+    reboot();
+    TEST_ASSERT_TRUE(consoleOutput.find("Building") != std::string::npos);
+    TEST_ASSERT_EQUAL(0, usedDates);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_scans_counted_once_per_date);
+    RUN_TEST(test_index_survives_reboot);
+    RUN_TEST(test_oldest_date_reused_when_full);
+    RUN_TEST(test_rebuilt_from_log_without_index_file);
+    RUN_TEST(test_index_of_other_layout_rebuilt);
+    return UNITY_END();
+}
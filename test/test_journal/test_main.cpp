@@ -0,0 +1,178 @@
+// Journal state machine against the in-memory file system: a power cut at
+// every step of a replacement, and of the recovery after it, must leave
+// each file wholly old or wholly new.
+#include <unity.h>
+#include "console_capture.h"
+#include "../../src/journal.cpp"
+
+static const char *const TARGET = "/data.bin";
+static const char OLD_DATA[] = "old contents of the file";
+static const char NEW_DATA[] = "the new, somewhat longer, contents of the file";
+
+static void writeFile(const char *path, const char *text)
+{
+    mockFs.files[path].assign(text, text + strlen(text));
+}
+
+static bool leftovers()
+{
+    for (const auto &file : mockFs.files)
+    {
+        if (file.first.back() == '~' || file.first == JOURNAL_FILE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Steps a clean replacement takes, the range the power-cut sweeps cover
+static long replacementSteps()
+{
+    mockFs.reset();
+    writeFile(TARGET, OLD_DATA);
+    replaceFile(TARGET, NEW_DATA, strlen(NEW_DATA));
+    return mockFs.steps;
+}
+
+void setUp()
+{
+    mockFs.reset();
+    consoleOutput.clear();
+}
+
+void tearDown() {}
+
+static void test_replace_installs_new_contents()
+{
+    writeFile(TARGET, OLD_DATA);
+    TEST_ASSERT_TRUE(replaceFile(TARGET, NEW_DATA, strlen(NEW_DATA)));
+    TEST_ASSERT_EQUAL_STRING(NEW_DATA, mockFs.text(TARGET).c_str());
+    TEST_ASSERT_FALSE(leftovers());
+}
+
+static void test_power_cut_at_every_step()
+{
+    long total = replacementSteps();
+    for (long cut = 0; cut <= total; cut++)
+    {
+        mockFs.reset();
+        writeFile(TARGET, OLD_DATA);
+        mockFs.powerCutIn = cut;
+        bool returned = false;
+        try
+        {
+            returned = replaceFile(TARGET, NEW_DATA, strlen(NEW_DATA));
+        }
+        catch (const PowerCut &)
+        {
+        }
+        mockFs.powerCutIn = -1;
+
+        recoverJournal();
+        std::string text = mockFs.text(TARGET);
+        TEST_ASSERT_TRUE_MESSAGE(text == OLD_DATA || text == NEW_DATA, "file torn by a power cut");
+        TEST_ASSERT_TRUE_MESSAGE(!returned || text == NEW_DATA, "acknowledged replacement lost");
+        TEST_ASSERT_FALSE_MESSAGE(leftovers(), "copy or journal left after recovery");
+    }
+}
+
+static void test_power_cut_during_recovery()
+{
+    long total = replacementSteps();
+    for (long cut = 0; cut <= total; cut++)
+    {
+        for (long recoveryCut = 0; recoveryCut < 6; recoveryCut++)
+        {
+            mockFs.reset();
+            writeFile(TARGET, OLD_DATA);
+            mockFs.powerCutIn = cut;
+            try
+            {
+                replaceFile(TARGET, NEW_DATA, strlen(NEW_DATA));
+            }
+            catch (const PowerCut &)
+            {
+            }
+
+            mockFs.powerCutIn = recoveryCut;
+            try
+            {
+                recoverJournal();
+            }
+            catch (const PowerCut &)
+            {
+            }
+            mockFs.powerCutIn = -1;
+
+            recoverJournal();
+            std::string text = mockFs.text(TARGET);
+            TEST_ASSERT_TRUE_MESSAGE(text == OLD_DATA || text == NEW_DATA, "file torn by a cut during recovery");
+            TEST_ASSERT_FALSE(leftovers());
+        }
+    }
+}
+
+static void test_new_file_is_absent_or_complete()
+{
+    long total = replacementSteps();
+    for (long cut = 0; cut <= total; cut++)
+    {
+        mockFs.reset();
+        mockFs.powerCutIn = cut;
+        try
+        {
+            replaceFile(TARGET, NEW_DATA, strlen(NEW_DATA));
+        }
+        catch (const PowerCut &)
+        {
+        }
+        mockFs.powerCutIn = -1;
+
+        recoverJournal();
+        TEST_ASSERT_TRUE(!SPIFFS.exists(TARGET) || mockFs.text(TARGET) == NEW_DATA);
+    }
+}
+
+static void test_failed_install_stays_pending()
+{
+    writeFile(TARGET, OLD_DATA);
+    mockFs.failRemove.insert(TARGET);
+    TEST_ASSERT_FALSE(replaceFile(TARGET, NEW_DATA, strlen(NEW_DATA)));
+    TEST_ASSERT_TRUE(SPIFFS.exists(JOURNAL_FILE));
+
+    // Neither a reboot nor another replacement may drop the committed copy
+    recoverJournal();
+    TEST_ASSERT_TRUE(SPIFFS.exists(JOURNAL_FILE));
+    TEST_ASSERT_TRUE(SPIFFS.exists("/data.bin~"));
+    TEST_ASSERT_FALSE(replaceFile("/other.bin", OLD_DATA, strlen(OLD_DATA)));
+    TEST_ASSERT_FALSE(SPIFFS.exists("/other.bin"));
+
+    mockFs.failRemove.clear();
+    TEST_ASSERT_TRUE(replaceFile("/other.bin", OLD_DATA, strlen(OLD_DATA)));
+    TEST_ASSERT_EQUAL_STRING(NEW_DATA, mockFs.text(TARGET).c_str());
+    TEST_ASSERT_EQUAL_STRING(OLD_DATA, mockFs.text("/other.bin").c_str());
+    TEST_ASSERT_FALSE(leftovers());
+}
+
+static void test_uncommitted_copies_removed()
+{
+    writeFile(TARGET, OLD_DATA);
+    writeFile("/data.bin~", "half of the new");
+    writeFile("/roster.bin~", "stale");
+    recoverJournal();
+    TEST_ASSERT_EQUAL_STRING(OLD_DATA, mockFs.text(TARGET).c_str());
+    TEST_ASSERT_FALSE(leftovers());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_replace_installs_new_contents);
+    RUN_TEST(test_power_cut_at_every_step);
+    RUN_TEST(test_power_cut_during_recovery);
+    RUN_TEST(test_new_file_is_absent_or_complete);
+    RUN_TEST(test_failed_install_stays_pending);
+    RUN_TEST(test_uncommitted_copies_removed);
+    return UNITY_END();
+}
@@ -0,0 +1,328 @@
+// SPIFFS record log: line parsing, commit points, and compaction that a
+// power cut at any step neither loses nor double-counts in the summary.
+#include <unity.h>
+#include <map>
+#include "console_capture.h"
+#include "../../src/journal.cpp"
+#include "../../src/record_log.cpp"
+#include "../../src/time_source.cpp"
+
+// Link seams: the parts of other modules the record log calls
+char currentDate[DATE_MAX] = "";
+uint32_t unsyncedRecordCount = 0;
+uint32_t heldRecordCount = 0;
+static std::vector<std::pair<std::string, uint16_t>> indexed;
+
+void indexAttendance(const char *date, uint16_t slot)
+{
+    indexed.push_back({date, slot});
+}
+
+// As in attendance_index.cpp, with the student number as the slot
+void indexLogEntry(const LogEntry &record)
+{
+    if (record.stamp == STAMP_TRUSTED || record.stamp == STAMP_CORRECTED)
+    {
+        indexAttendance(record.date, atoi(record.studentId + 1));
+    }
+}
+
+char *nextArg(char *&cursor)
+{
+    return cursor;
+}
+
+// As in storage.cpp
+size_t readRecordLine(File &file, char *line, size_t size)
+{
+    size_t length = file.readBytesUntil('\n', line, size - 1);
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' '))
+    {
+        length--;
+    }
+    line[length] = '\0';
+    return length;
+}
+
+static const uint32_t MAY_19 = 1747643465; // 19/5/2025 08:31:05 UTC
+static const uint32_t DAY = 86400;
+
+static void resetLog()
+{
+    recordLog = {};
+    pendingLength = 0;
+    pendingRecords = 0;
+    unsyncedRecordCount = 0;
+    heldRecordCount = 0;
+    timeState = {};
+}
+
+// Segments 1..count, each with three synced records over two dates
+static void writeSyncedSegments(uint32_t count)
+{
+    for (uint32_t segment = 1; segment <= count; segment++)
+    {
+        char path[LOG_PATH_MAX];
+        segmentPath(segment, path, sizeof(path));
+        std::string text = "timestamp,session,student_id,synced\r\n";
+        char line[RECORD_LINE_MAX];
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            snprintf(line, sizeof(line), "%u,1,%u,1\r\n", (unsigned)(MAY_19 + segment * DAY + (i == 2 ? DAY : 0)),
+                     (unsigned)(i + 1));
+            text += line;
+        }
+        mockFs.files[path].assign(text.begin(), text.end());
+    }
+}
+
+// Records per segment in the summary file
+static std::map<uint32_t, uint32_t> summaryTotals()
+{
+    std::map<uint32_t, uint32_t> totals;
+    std::string text = mockFs.text(LOG_SUMMARY_FILE);
+    size_t start = text.find('\n') + 1; // Past the header
+    while (start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        std::string line = text.substr(start, end - start);
+        unsigned records = 0, segment = 0;
+        TEST_ASSERT_EQUAL(2, sscanf(strchr(line.c_str(), ',') + 1, "%u,%u", &records, &segment));
+        totals[segment] += records;
+        start = end + 1;
+    }
+    return totals;
+}
+
+void setUp()
+{
+    mockFs.reset();
+    consoleOutput.clear();
+    indexed.clear();
+    resetLog();
+    setenv("TZ", "UTC0", 1);
+    tzset();
+}
+
+void tearDown() {}
+
+static void test_parse_current_line()
+{
+    char line[] = "1747643465,3,S1234,0";
+    LogEntry entry;
+    TEST_ASSERT_TRUE(parseRecordLine(line, false, entry));
+    TEST_ASSERT_EQUAL_UINT32(MAY_19, entry.timestamp);
+    TEST_ASSERT_EQUAL(3, entry.session);
+    TEST_ASSERT_EQUAL_STRING("S1234", entry.studentId);
+    TEST_ASSERT_EQUAL_STRING("19/5", entry.date);
+    TEST_ASSERT_FALSE(entry.synced);
+}
+
+static void test_parse_legacy_line()
+{
+    char line[] = "19/5,12,present,1";
+    LogEntry entry;
+    TEST_ASSERT_TRUE(legacySegment("date,student_id,status,synced"));
+    TEST_ASSERT_FALSE(legacySegment("timestamp,session,student_id,synced"));
+    TEST_ASSERT_TRUE(parseRecordLine(line, true, entry));
+    TEST_ASSERT_EQUAL_UINT32(0, entry.timestamp);
+    TEST_ASSERT_EQUAL_STRING("19/5", entry.date);
+    TEST_ASSERT_EQUAL_STRING("12", entry.studentId);
+    TEST_ASSERT_TRUE(entry.synced);
+}
+
+static void test_parse_rejects_malformed_lines()
+{
+    char empty[] = "";
+    char short1[] = "1747643465";
+    char short3[] = "1747643465,3,S1234";
+    char noFlag[] = "1747643465,3,S1234,";
+    // A torn line joined by the next append: the rest lands in the synced field
+    char joined[] = "1747643465,12,S11747643499,12,34,0";
+    LogEntry entry;
+    TEST_ASSERT_FALSE(parseRecordLine(empty, false, entry));
+    TEST_ASSERT_FALSE(parseRecordLine(short1, false, entry));
+    TEST_ASSERT_FALSE(parseRecordLine(short3, false, entry));
+    TEST_ASSERT_FALSE(parseRecordLine(noFlag, false, entry));
+    TEST_ASSERT_FALSE(parseRecordLine(joined, false, entry));
+}
+
+static void test_records_indexed_only_once_committed()
+{
+    initRecordLog();
+    for (int i = 1; i < LOG_COMMIT_RECORDS; i++)
+    {
+        TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "S1", i));
+    }
+    TEST_ASSERT_TRUE(indexed.empty());
+    TEST_ASSERT_EQUAL_STRING("timestamp,session,student_id,synced\r\n", mockFs.text("/att_00001.csv").c_str());
+
+    // The batch's last record commits it; the untrusted one isn't indexed
+    TEST_ASSERT_TRUE(appendRecord(600, false, 1, "S2", 7));
+    TEST_ASSERT_EQUAL(0, pendingRecords);
+    TEST_ASSERT_EQUAL(LOG_COMMIT_RECORDS - 1, indexed.size());
+    TEST_ASSERT_EQUAL_STRING("19/5", indexed[0].first.c_str());
+
+    // A buffered record is not indexed before its commit
+    indexed.clear();
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "S3", 9));
+    TEST_ASSERT_TRUE(indexed.empty());
+    mockMillis += LOG_COMMIT_MS;
+    serviceRecordLog();
+    TEST_ASSERT_EQUAL(1, indexed.size());
+    TEST_ASSERT_EQUAL(9, indexed[0].second);
+}
+
+static void test_malformed_lines_never_counted_or_marked()
+{
+    // A torn line ending ",0" sits between two unsynced records
+    std::string text = "timestamp,session,student_id,synced\r\n1747643465,1,S1,0\r\nS2,0\r\n1747643466,1,S3,0\r\n";
+    mockFs.files["/att_00001.csv"].assign(text.begin(), text.end());
+
+    uint32_t records, unsynced, held;
+    scanSegment(1, records, unsynced, held);
+    TEST_ASSERT_EQUAL(2, records);
+    TEST_ASSERT_EQUAL(2, unsynced);
+
+    // A batch holds the two valid records; marking it reaches both of them
+    TEST_ASSERT_TRUE(markSegmentSynced(1, 2));
+    TEST_ASSERT_EQUAL_STRING("timestamp,session,student_id,synced\r\n1747643465,1,S1,1\r\nS2,0\r\n1747643466,1,S3,1\r\n",
+                             mockFs.text("/att_00001.csv").c_str());
+    scanSegment(1, records, unsynced, held);
+    TEST_ASSERT_EQUAL(0, unsynced);
+}
+
+static void test_torn_commit_closed_at_boot()
+{
+    initRecordLog();
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "S1", 1));
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "S22", 22));
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 1, "S333", 333));
+
+    // The power goes halfway through the commit's write, inside the second line
+    mockFs.powerCutIn = 1;
+    try
+    {
+        commitRecordLog();
+    }
+    catch (const PowerCut &)
+    {
+    }
+    std::string torn = mockFs.text("/att_00001.csv");
+    TEST_ASSERT_TRUE(torn.back() != '\n');
+
+    // The next boot ends the fragment, so the next record gets a line of its own
+    resetLog();
+    initRecordLog();
+    TEST_ASSERT_EQUAL(1, unsyncedRecordCount);
+    TEST_ASSERT_TRUE(appendRecord(MAY_19, true, 2, "S4", 4));
+    TEST_ASSERT_TRUE(commitRecordLog());
+    TEST_ASSERT_EQUAL_STRING((torn + "\r\n1747643465,2,S4,0\r\n").c_str(), mockFs.text("/att_00001.csv").c_str());
+
+    uint32_t records, unsynced, held;
+    scanSegment(1, records, unsynced, held);
+    TEST_ASSERT_EQUAL(2, records);
+    TEST_ASSERT_EQUAL(2, unsynced);
+}
+
+static void test_untrusted_records_held_until_clock_set()
+{
+    // Session 1 ran on a clock a power loss ended before it was set, session
+    // 2 runs on the current untrusted clock, which was never set either
+    timeState.fixes[0] = {1, 1, 0, 0, {}};
+    timeState.fixCount = 1;
+    timeState.heldFrom = 2;
+    timeState.nextSession = 3;
+    std::string text = "timestamp,session,student_id,synced\r\n1747643465,1,S1,0\r\n~1747640000,1,S2,0\r\n"
+                       "~600,2,S3,0\r\n~700,2,S4,0\r\n";
+    mockFs.files["/att_00001.csv"].assign(text.begin(), text.end());
+    initRecordLog();
+    TEST_ASSERT_EQUAL(2, unsyncedRecordCount);
+    TEST_ASSERT_EQUAL(2, heldRecordCount);
+
+    char line[] = "~1747640000,1,S2,0";
+    LogEntry entry;
+    TEST_ASSERT_TRUE(parseRecordLine(line, false, entry));
+    TEST_ASSERT_EQUAL(STAMP_UNVERIFIED, entry.stamp);
+    TEST_ASSERT_EQUAL_UINT32(1747640000, entry.timestamp);
+
+    // A sync sends the two that aren't held, and marking leaves the rest
+    TEST_ASSERT_TRUE(markSegmentSynced(1, 2));
+    unsyncedRecordCount = 0;
+    TEST_ASSERT_EQUAL_STRING("timestamp,session,student_id,synced\r\n1747643465,1,S1,1\r\n~1747640000,1,S2,1\r\n"
+                             "~600,2,S3,0\r\n~700,2,S4,0\r\n",
+                             mockFs.text("/att_00001.csv").c_str());
+    TEST_ASSERT_EQUAL(1, recordLog.syncSegment);
+
+    // The clock is set a day after May 19, 600 s into the run. The offset
+    // outlives a reboot, and the held records join the backlog and the
+    // roll call under the corrected date.
+    endClockRun(MAY_19 + DAY - 600, true);
+    saveTimeState();
+    timeState = {};
+    loadTimeState();
+    releaseHeldRecords();
+    TEST_ASSERT_EQUAL(2, unsyncedRecordCount);
+    TEST_ASSERT_EQUAL(0, heldRecordCount);
+    TEST_ASSERT_EQUAL(2, indexed.size());
+    TEST_ASSERT_EQUAL_STRING("20/5", indexed[0].first.c_str());
+    TEST_ASSERT_EQUAL(4, indexed[1].second);
+
+    char held[] = "~700,2,S4,0";
+    TEST_ASSERT_TRUE(parseRecordLine(held, false, entry));
+    TEST_ASSERT_EQUAL(STAMP_CORRECTED, entry.stamp);
+    TEST_ASSERT_EQUAL_UINT32(MAY_19 + DAY + 100, entry.timestamp);
+    TEST_ASSERT_TRUE(markSegmentSynced(1, 2));
+    TEST_ASSERT_EQUAL(std::string::npos, mockFs.text("/att_00001.csv").find(",0\r\n"));
+}
+
+static void test_compaction_counts_each_segment_once()
+{
+    // Steps of a clean boot-time compaction: the range the cuts sweep
+    writeSyncedSegments(7);
+    initRecordLog();
+    long total = mockFs.steps;
+    TEST_ASSERT_EQUAL(2, recordLog.compactedSegments);
+
+    for (long cut = 0; cut <= total; cut++)
+    {
+        mockFs.reset();
+        resetLog();
+        writeSyncedSegments(7);
+        mockFs.powerCutIn = cut;
+        try
+        {
+            initRecordLog();
+        }
+        catch (const PowerCut &)
+        {
+        }
+        mockFs.powerCutIn = -1;
+
+        // Next boot
+        resetLog();
+        recoverJournal();
+        initRecordLog();
+
+        std::map<uint32_t, uint32_t> totals = summaryTotals();
+        TEST_ASSERT_EQUAL(2, totals.size());
+        TEST_ASSERT_EQUAL_MESSAGE(3, totals[1], "segment 1 counted wrongly");
+        TEST_ASSERT_EQUAL_MESSAGE(3, totals[2], "segment 2 counted wrongly");
+        TEST_ASSERT_FALSE(SPIFFS.exists("/att_00002.csv"));
+        TEST_ASSERT_TRUE(SPIFFS.exists("/att_00003.csv"));
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_current_line);
+    RUN_TEST(test_parse_legacy_line);
+    RUN_TEST(test_parse_rejects_malformed_lines);
+    RUN_TEST(test_records_indexed_only_once_committed);
+    RUN_TEST(test_malformed_lines_never_counted_or_marked);
+    RUN_TEST(test_torn_commit_closed_at_boot);
+    RUN_TEST(test_untrusted_records_held_until_clock_set);
+    RUN_TEST(test_compaction_counts_each_segment_once);
+    return UNITY_END();
+}
@@ -0,0 +1,246 @@
+// Scan path against two simulated sensors: the range the hot-set search
+// sends to the sensor, and the duplicate window shared by both sensors in
+// attendance mode.
+#define SENSOR_COUNT 2
+#include <unity.h>
+#include <vector>
+#include "console_capture.h"
+#include "../../src/journal.cpp"
+#include "../../src/template_search.cpp"
+#include "../../src/fingerprint.cpp"
+
+// Link seams: the parts of other modules the scan path calls
+char currentDate[DATE_MAX] = "19/5";
+static std::vector<int> recorded;
+static SessionTickHandler attendTick = nullptr;
+
+void addAttendance(int fingerprintID)
+{
+    recorded.push_back(fingerprintID);
+}
+
+bool applyCurrentDate(const char *dateInput)
+{
+    return true;
+}
+
+void promptCurrentDate() {}
+void showClock() {}
+bool timeTrusted() { return true; }
+uint16_t beginAttendanceSession() { return 1; }
+bool commitRecordLog() { return true; }
+void noteFingerImaged() {}
+void notePowerActivity() {}
+void trace(TraceEvent event, uint8_t arg8, uint16_t arg16) {}
+void loadSensorLinks() {}
+
+// As the real link does once the sensor answers
+bool openSensorLink(uint8_t index)
+{
+    sensors[index].securityLevel = sensors[index].finger->security_level;
+    return true;
+}
+
+void beginSession(SessionInputHandler onInput, SessionTickHandler onTick)
+{
+    attendTick = onTick;
+}
+
+char *nextArg(char *&cursor)
+{
+    return cursor;
+}
+
+size_t readRecordLine(File &file, char *line, size_t size)
+{
+    line[0] = '\0';
+    return 0;
+}
+
+static Adafruit_Fingerprint &reader(uint8_t index)
+{
+    return *sensors[index].finger;
+}
+
+// One finger down and lifted on one sensor: a step of its capture task
+static void touch(uint8_t index, uint16_t slot)
+{
+    reader(index).fingerOn = slot;
+    ScanEvent event;
+    if (captureOnce(index, event))
+    {
+        xQueueSend(scanQueue, &event, 0);
+    }
+    reader(index).fingerOn = 0;
+}
+
+// Both sensors with slots 1-999 enrolled, the automatic hot set, and no
+// scan remembered
+static void resetScanPath()
+{
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensors[i].finger == nullptr)
+        {
+            initFingerprint();
+        }
+        Adafruit_Fingerprint &sensor = reader(i);
+        sensor.capacity = 1000;
+        sensor.enrolled.clear();
+        for (uint16_t slot = 1; slot < 1000; slot++)
+        {
+            sensor.enrolled.insert(slot);
+        }
+        sensor.searchedSlots = 0;
+        sensor.lastSearchCount = 0;
+        sensors[i].stats = {};
+    }
+    hotMode = HOTSET_AUTO;
+    recentCount = 0;
+    recentHead = 0;
+    fallbacks = 0;
+    memset(searchStats, 0, sizeof(searchStats));
+    memset(lastRecordedAt, 0, sizeof(lastRecordedAt));
+    xQueueReset(scanQueue);
+}
+
+static uint16_t search(uint8_t index, uint16_t slot)
+{
+    reader(index).fingerOn = slot;
+    uint16_t id = 0, confidence = 0;
+    TEST_ASSERT_EQUAL(FINGERPRINT_OK, searchTemplates(reader(index), id, confidence));
+    reader(index).fingerOn = 0;
+    return id;
+}
+
+void setUp()
+{
+    mockFs.reset();
+    consoleOutput.clear();
+    recorded.clear();
+    mockMillis = 1000000;
+    resetScanPath();
+}
+
+void tearDown() {}
+
+static void test_hot_range_spans_recent_matches()
+{
+    // Full searches until enough matches have been seen
+    for (uint16_t slot = 500; slot < 500 + SEARCH_HOT_MIN_MATCHES; slot++)
+    {
+        TEST_ASSERT_EQUAL(slot, search(slot % 2, slot));
+    }
+    TEST_ASSERT_EQUAL(0, searchStats[SEARCH_HOT].searches);
+    TEST_ASSERT_EQUAL(SEARCH_HOT_MIN_MATCHES, searchStats[SEARCH_FULL].searches);
+
+    // Matches from both sensors feed one range, padded on each side
+    TEST_ASSERT_EQUAL(502, search(0, 502));
+    TEST_ASSERT_EQUAL(500 - SEARCH_HOT_PAD, reader(0).lastSearchFirst);
+    TEST_ASSERT_EQUAL(SEARCH_HOT_MIN_MATCHES + SEARCH_HOT_PAD * 2, reader(0).lastSearchCount);
+    TEST_ASSERT_EQUAL(1, searchStats[SEARCH_HOT].hits);
+    TEST_ASSERT_EQUAL(SEARCH_HOT_MIN_MATCHES, searchStats[SEARCH_FULL].searches);
+}
+
+static void test_hot_miss_falls_back_to_full_search()
+{
+    for (uint16_t slot = 500; slot < 500 + SEARCH_HOT_MIN_MATCHES; slot++)
+    {
+        search(0, slot);
+    }
+    TEST_ASSERT_EQUAL(20, search(0, 20));
+    TEST_ASSERT_EQUAL(1, searchStats[SEARCH_HOT].searches);
+    TEST_ASSERT_EQUAL(0, searchStats[SEARCH_HOT].hits);
+    TEST_ASSERT_EQUAL(1, fallbacks);
+}
+
+static void test_wide_recent_span_skips_hot_search()
+{
+    for (uint8_t i = 0; i < SEARCH_HOT_MIN_MATCHES; i++)
+    {
+        search(0, 10 + i * SEARCH_HOT_MAX_SPAN);
+    }
+    search(0, 10);
+    TEST_ASSERT_EQUAL(0, searchStats[SEARCH_HOT].searches);
+    TEST_ASSERT_EQUAL(0, fallbacks);
+}
+
+static void test_hot_range_clipped_to_library()
+{
+    // A 200-slot sensor with a roster range running past its end
+    reader(0).capacity = 200;
+    TEST_ASSERT_TRUE(parseHotSet("150-300"));
+    TEST_ASSERT_EQUAL(180, search(0, 180));
+    TEST_ASSERT_EQUAL(150, reader(0).lastSearchFirst);
+    TEST_ASSERT_EQUAL(50, reader(0).lastSearchCount);
+    TEST_ASSERT_EQUAL(1, searchStats[SEARCH_HOT].hits);
+
+    // Entirely past the end: straight to the full search, not a fallback
+    reader(0).lastSearchCount = 0;
+    TEST_ASSERT_TRUE(parseHotSet("250-300"));
+    TEST_ASSERT_EQUAL(120, search(0, 120));
+    TEST_ASSERT_EQUAL(0, reader(0).lastSearchCount);
+    TEST_ASSERT_EQUAL(1, searchStats[SEARCH_HOT].searches);
+    TEST_ASSERT_EQUAL(0, fallbacks);
+}
+
+static void test_hot_set_settings_parse()
+{
+    TEST_ASSERT_TRUE(parseHotSet("off"));
+    TEST_ASSERT_EQUAL(HOTSET_OFF, hotMode);
+    TEST_ASSERT_FALSE(parseHotSet("45-10"));
+    TEST_ASSERT_FALSE(parseHotSet("0-10"));
+    TEST_ASSERT_FALSE(parseHotSet("12"));
+    TEST_ASSERT_TRUE(parseHotSet("10-45"));
+    char mode[16];
+    describeHotSet(mode, sizeof(mode));
+    TEST_ASSERT_EQUAL_STRING("10-45", mode);
+}
+
+static void test_duplicate_window_spans_sensors_and_check_ins()
+{
+    attendanceMode("");
+    TEST_ASSERT_NOT_NULL(attendTick);
+
+    // More students than the scan queue holds, alternating sensors
+    const uint16_t students = SCAN_QUEUE_LENGTH + 4;
+    for (uint16_t slot = 1; slot <= students; slot++)
+    {
+        touch(slot % 2, slot);
+        attendTick();
+        mockMillis += ATTEND_HOLD_MS;
+    }
+    TEST_ASSERT_EQUAL(students, recorded.size());
+
+    // The first student again, on the other sensor, still inside the window
+    touch(0, 1);
+    attendTick();
+    TEST_ASSERT_EQUAL(students, recorded.size());
+    TEST_ASSERT_EQUAL(1, sensors[0].stats.duplicates);
+
+    // Both sensors in the same tick: recorded once
+    touch(0, 300);
+    touch(1, 300);
+    attendTick();
+    TEST_ASSERT_EQUAL(students + 1, recorded.size());
+    TEST_ASSERT_EQUAL(1, sensors[1].stats.duplicates);
+
+    // Once the window has passed the student is recorded again
+    mockMillis += SCAN_DUPLICATE_WINDOW_MS;
+    touch(1, 1);
+    attendTick();
+    TEST_ASSERT_EQUAL(students + 2, recorded.size());
+    TEST_ASSERT_EQUAL(1, recorded.back());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hot_range_spans_recent_matches);
+    RUN_TEST(test_hot_miss_falls_back_to_full_search);
+    RUN_TEST(test_wide_recent_span_skips_hot_search);
+    RUN_TEST(test_hot_range_clipped_to_library);
+    RUN_TEST(test_hot_set_settings_parse);
+    RUN_TEST(test_duplicate_window_spans_sensors_and_check_ins);
+    return UNITY_END();
+}
@@ -0,0 +1,725 @@
+// An attendance day on one reader, in virtual time, run through the
+// firmware's own code: the capture step and attendance tick of
+// fingerprint.cpp, the template search, the record log and attendance
+// index, and the sync path with its scheduler, built for the host against
+// the stand-ins in test/mocks. Around that code it scripts what only the
+// device has: students arriving at the sensors, how long a finger takes and
+// whether it matches, flash write times, WiFi, SNTP and the server. Only
+// those are assumed values, given as options.
+//
+// The firmware runs single-threaded. The main loop is called as loop()
+// does in a headless build; whenever it waits (a delay, a flash write, a
+// connection, a batch upload) virtual time moves on and the capture tasks
+// and the students act in the meantime, as they would on the other core.
+//
+// Prints one line per student, scan, sync and backlog sample;
+// tools/day_sim.py builds this, runs it and turns the lines into a report.
+// Built by hand (SENSOR_COUNT 1 or 2):
+//
+//   c++ -std=gnu++17 -O2 -Itest/mocks -Iinclude -DFEATURE_BLE_CONSOLE=0 -DFEATURE_LEDS=0
+//       -DFEATURE_SERIAL_UI=0 -DFEATURE_USB_EXPORT=0 -DSENSOR_COUNT=2 tools/day_sim.cpp -o day_sim
+//   ./day_sim --students 400 --window-min 15 --outage 5:25
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_sntp.h>
+#include <deque>
+#include <functional>
+#include <math.h>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/arena.cpp"
+#include "../src/journal.cpp"
+#include "../src/record_log.cpp"
+#include "../src/time_source.cpp"
+#include "../src/attendance_index.cpp"
+#include "../src/storage.cpp"
+#include "../src/template_search.cpp"
+#include "../src/fingerprint.cpp"
+#include "../src/sync.cpp"
+#include "../src/sync_scheduler.cpp"
+
+#define MISSED_FINGER 0xFFFF // A placement the sensor won't match: never enrolled
+#define LOOP_DELAY_MS 10     // loop() without light sleep
+
+// Options, all times in seconds or milliseconds as named
+struct DayOptions
+{
+    double students = 400;
+    double windowMin = 15;     // Arrival window
+    double horizonMin = 180;   // Stop simulating after this
+    double seed = 1;
+    double placeS = 1.5;       // Median time to place a finger
+    double pressS = 0.8;       // How long a finger stays on the glass
+    double imageMs = 250;      // getImage
+    double tzMs = 120;         // image2Tz
+    double searchBaseMs = 20;  // Per search command
+    double searchMsPer100 = 25; // Per 100 templates compared
+    double library = 127;      // Templates enrolled on each sensor
+    double missRate = 0.05;    // Placements that don't match
+    double retries = 3;        // Attempts before a student gives up
+    double retryS = 1.0;       // After a red LED
+    double patienceS = 5.0;    // Without any feedback before trying again
+    double flashOpMs = 5;      // Per open for write, write, rename or remove
+    double flashKbMs = 10;     // Per KB written
+    double wifiFastS = 1.2;    // Connect through the cached AP
+    double wifiScanS = 4.5;    // Connect with a full scan
+    double sntpMs = 300;       // SNTP reply after connecting
+    double postS = 2.5;        // Server latency per batch
+    double uplinkKbps = 2000;
+    double postFailRate = 0;
+    double sampleMin = 5;      // Backlog timeline interval
+    std::string pattern = "rush"; // uniform, poisson, or rush: peaks a third into the window
+    std::vector<std::pair<unsigned long, unsigned long>> outages; // Uplink down, ms
+};
+
+struct Student
+{
+    uint16_t number;
+    uint16_t slot;
+    unsigned long arrival;
+    long atSensor = -1; // Stepped up to a sensor
+    long imaged = -1;   // Image of the touch that was recorded
+    long recorded = -1; // Main loop handled the match
+    uint8_t attempts = 0;
+    bool feedback = false; // Result shown for the current attempt
+    bool gaveUp = false;
+};
+
+// A sensor with its line of students
+struct Station
+{
+    std::deque<Student *> line;
+    Student *current = nullptr;
+};
+
+// A result in the scan queue, in the same order as the firmware's queue
+struct InFlight
+{
+    Student *student;
+    uint8_t attempt;
+    unsigned long imaged;
+    bool matched;
+};
+
+struct Event
+{
+    unsigned long at;
+    uint64_t order;
+    std::function<void()> action;
+    bool operator<(const Event &other) const
+    {
+        return at != other.at ? at > other.at : order > other.order;
+    }
+};
+
+static DayOptions options;
+static std::mt19937 rng;
+static std::priority_queue<Event> events;
+static uint64_t eventOrder = 0;
+static std::vector<Student> students;
+static Station stations[SENSOR_COUNT];
+static std::deque<InFlight> inFlight;
+static SessionTickHandler attendTick = nullptr;
+static bool verbose = false;
+static unsigned long dayStart = 0; // After boot; the times printed count from here
+
+// Network script state
+static bool apCached = false;
+static unsigned long syncStartedAt = 0;
+static uint32_t syncRecordsSent = 0;
+static uint16_t batchRecords = 0;
+static long flashStepsCharged = 0;
+
+static unsigned long msOf(double seconds)
+{
+    return (unsigned long)llround(seconds * 1000.0);
+}
+
+static double uniform(double low, double high)
+{
+    return std::uniform_real_distribution<double>(low, high)(rng);
+}
+
+static void schedule(unsigned long at, std::function<void()> action)
+{
+    events.push({max(at, mockMillis), eventOrder++, std::move(action)});
+}
+
+// Runs the events due up to `until`, each with millis() at its own time
+static void advanceTo(unsigned long until)
+{
+    while (!events.empty() && events.top().at <= until)
+    {
+        Event event = events.top();
+        events.pop();
+        mockMillis = max(mockMillis, event.at);
+        event.action();
+    }
+    mockMillis = max(mockMillis, until);
+}
+
+// The firmware is busy for ms; everything else carries on
+static void spend(unsigned long ms)
+{
+    advanceTo(mockMillis + ms);
+}
+
+static unsigned long dayTime()
+{
+    return millis() - dayStart;
+}
+
+static bool inOutage(unsigned long at)
+{
+    for (const auto &outage : options.outages)
+    {
+        if (at >= outage.first && at < outage.second)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Link seams: console, flash accounting and the modules left out
+
+void printBoth(const char *message)
+{
+    if (verbose)
+    {
+        fprintf(stderr, "%8.3f %s\n", mockMillis / 1000.0, message);
+    }
+}
+
+void printfBoth(const char *format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    printBoth(buffer);
+}
+
+// Charges the flash steps taken since the last charge, plus the bytes
+static void chargeFlash(size_t bytes)
+{
+    long steps = mockFs.steps - flashStepsCharged;
+    flashStepsCharged = mockFs.steps;
+    spend((unsigned long)llround(steps * options.flashOpMs + bytes * options.flashKbMs / 1024.0));
+}
+
+void noteFlashWrite(size_t bytes)
+{
+    chargeFlash(bytes);
+}
+
+int formatHealthJson(char *buffer, size_t size)
+{
+    return snprintf(buffer, size, "{\"uptime_s\":%lu,\"heap_free\":180000,\"spiffs_used\":%u}", millis() / 1000,
+                    (unsigned)SPIFFS.usedBytes());
+}
+
+const RosterEntry *rosterLookup(uint16_t slot)
+{
+    return nullptr; // No roster: slot numbers are the student IDs
+}
+
+int rosterSlotOf(const char *studentId)
+{
+    return -1;
+}
+
+// As in commands.cpp
+char *nextArg(char *&cursor)
+{
+    while (*cursor == ' ')
+    {
+        cursor++;
+    }
+    char *token = cursor;
+    while (*cursor != '\0' && *cursor != ' ')
+    {
+        cursor++;
+    }
+    if (*cursor == ' ')
+    {
+        *cursor++ = '\0';
+    }
+    return token;
+}
+
+void beginSession(SessionInputHandler onInput, SessionTickHandler onTick)
+{
+    attendTick = onTick;
+}
+
+void notePowerActivity() {}
+void loadSensorLinks() {}
+
+// As the real link does once the sensor answers
+bool openSensorLink(uint8_t index)
+{
+    sensors[index].securityLevel = sensors[index].finger->security_level;
+    return true;
+}
+
+// Sync start and end, and the size of each batch sent
+void trace(TraceEvent event, uint8_t arg8, uint16_t arg16)
+{
+    if (event == TRACE_SYNC_START)
+    {
+        syncStartedAt = dayTime();
+        syncRecordsSent = 0;
+    }
+    else if (event == TRACE_SYNC_POST)
+    {
+        batchRecords = arg16;
+    }
+    else if (event == TRACE_SYNC_END)
+    {
+        static const char *results[] = {"ok", "no-uplink", "failed"};
+        printf("sync %lu %lu %s %u\n", syncStartedAt, dayTime() - syncStartedAt, results[arg8],
+               (unsigned)syncRecordsSent);
+    }
+}
+
+// Scripted network: WiFi comes up unless the uplink is out, then SNTP
+// answers; the server takes its latency plus the transfer time per batch
+
+void connectToWiFi()
+{
+    if (WiFi.status() == WL_CONNECTED)
+    {
+        return;
+    }
+    if (inOutage(dayTime()))
+    {
+        spend((apCached ? WIFI_FAST_CONNECT_TIMEOUT_MS : 0) + WIFI_CONNECT_TIMEOUT_MS);
+        return;
+    }
+
+    spend(msOf(apCached ? options.wifiFastS : options.wifiScanS));
+    apCached = true;
+    WiFi.mockStatus = WL_CONNECTED;
+    startTimeSync();
+    schedule(millis() + (unsigned long)options.sntpMs, [] {
+        if (WiFi.status() == WL_CONNECTED && mockSntpCallback != nullptr)
+        {
+            mockSntpCallback(nullptr);
+        }
+    });
+}
+
+void disconnectWiFi()
+{
+    WiFi.disconnect();
+}
+
+static bool openSession(const char *url)
+{
+    return true;
+}
+
+static bool sendBatch(const char *payload, size_t length)
+{
+    if (inOutage(dayTime()) || uniform(0, 1) < options.postFailRate)
+    {
+        spend(SYNC_HTTP_TIMEOUT_MS);
+        return false;
+    }
+    spend(msOf(options.postS + length * 8 / (options.uplinkKbps * 1000.0)));
+    syncRecordsSent += batchRecords;
+    return true;
+}
+
+static void closeSession(bool keepSession) {}
+
+const SyncBackend httpBackend = {"http", openSession, sendBatch, closeSession};
+const SyncBackend mqttBackend = {"mqtt", openSession, sendBatch, closeSession};
+
+// Students
+
+static void nextStudent(uint8_t index);
+static void place(uint8_t index, Student *student);
+
+// Leaves the sensor to the next in line
+static void leave(uint8_t index)
+{
+    Station &station = stations[index];
+    station.current = nullptr;
+    sensors[index].finger->fingerOn = 0;
+    nextStudent(index);
+}
+
+static void nextStudent(uint8_t index)
+{
+    Station &station = stations[index];
+    if (station.current != nullptr || station.line.empty())
+    {
+        return;
+    }
+    Student *student = station.line.front();
+    station.line.pop_front();
+    station.current = student;
+    student->atSensor = dayTime();
+    double placeS = std::lognormal_distribution<double>(log(options.placeS), 0.35)(rng);
+    schedule(millis() + msOf(placeS), [index, student] { place(index, student); });
+}
+
+// No result for this attempt yet: out of patience, or gives up
+static void tryAgain(uint8_t index, Student *student, unsigned long waitMs)
+{
+    if (student->attempts >= options.retries)
+    {
+        student->gaveUp = true;
+        leave(index);
+        return;
+    }
+    schedule(millis() + waitMs, [index, student] { place(index, student); });
+}
+
+// A finger goes down for pressS, matching unless this placement misses
+static void place(uint8_t index, Student *student)
+{
+    if (stations[index].current != student || student->recorded >= 0)
+    {
+        return;
+    }
+    uint8_t attempt = ++student->attempts;
+    student->feedback = false;
+    Adafruit_Fingerprint &reader = *sensors[index].finger;
+    reader.fingerOn = uniform(0, 1) < options.missRate ? MISSED_FINGER : student->slot;
+    schedule(millis() + msOf(options.pressS), [index, student, attempt] {
+        if (stations[index].current == student && student->attempts == attempt)
+        {
+            sensors[index].finger->fingerOn = 0;
+        }
+    });
+    schedule(millis() + msOf(options.patienceS), [index, student, attempt] {
+        if (stations[index].current == student && student->attempts == attempt && !student->feedback)
+        {
+            tryAgain(index, student, 0);
+        }
+    });
+}
+
+static void arrive(Student *student)
+{
+    uint8_t shortest = 0;
+    for (uint8_t i = 1; i < SENSOR_COUNT; i++)
+    {
+        size_t length = stations[i].line.size() + (stations[i].current != nullptr);
+        if (length < stations[shortest].line.size() + (stations[shortest].current != nullptr))
+        {
+            shortest = i;
+        }
+    }
+    stations[shortest].line.push_back(student);
+    nextStudent(shortest);
+}
+
+// handleScan() calls this first for every result it takes from the queue;
+// the results arrive in the order they were queued
+void noteFingerImaged()
+{
+    InFlight result = inFlight.front();
+    inFlight.pop_front();
+    Student *student = result.student;
+    if (student == nullptr)
+    {
+        return;
+    }
+    int index = -1;
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        index = stations[i].current == student ? i : index;
+    }
+
+    if (result.matched)
+    {
+        // A late match of an earlier attempt still records the student;
+        // any later one is the firmware's duplicate
+        if (student->recorded < 0)
+        {
+            student->recorded = dayTime();
+            student->imaged = result.imaged;
+            student->gaveUp = false;
+            if (index >= 0)
+            {
+                leave(index);
+            }
+        }
+        return;
+    }
+
+    // Red LED: lift and try again, unless this is an older attempt's result
+    if (index >= 0 && result.attempt == student->attempts && !student->feedback)
+    {
+        student->feedback = true;
+        sensors[index].finger->fingerOn = 0;
+        tryAgain(index, student, msOf(options.retryS));
+    }
+}
+
+// Capture tasks: one pass of captureTask() per sensor. The sensor stays
+// busy for the image, conversion and search, so the result is queued that
+// much after the finger was imaged.
+static uint32_t searchCount()
+{
+    return searchStats[SEARCH_HOT].searches + searchStats[SEARCH_FULL].searches;
+}
+
+static void captureStep(uint8_t index)
+{
+    FingerprintSensor &sensor = sensors[index];
+    if (!sensor.ready || !captureActive())
+    {
+        schedule(millis() + ATTEND_POLL_MS, [index] { captureStep(index); });
+        return;
+    }
+
+    Student *student = stations[index].current;
+    uint32_t searchesBefore = searchCount();
+    uint32_t slotsBefore = sensor.finger->searchedSlots;
+    ScanEvent event;
+    if (!captureOnce(index, event))
+    {
+        schedule(millis() + ATTEND_POLL_MS, [index] { captureStep(index); });
+        return;
+    }
+
+    uint32_t searches = searchCount() - searchesBefore;
+    uint32_t slots = sensor.finger->searchedSlots - slotsBefore;
+    unsigned long busy = (unsigned long)llround(options.imageMs + options.tzMs + searches * options.searchBaseMs +
+                                                slots * options.searchMsPer100 / 100.0);
+    unsigned long imaged = dayTime();
+    uint8_t attempt = student != nullptr ? student->attempts : 0;
+    printf("scan %lu %u %lu %u %u\n", imaged, index, busy, (unsigned)slots, event.matched);
+
+    schedule(millis() + busy, [index, event, student, attempt, imaged] {
+        if (xQueueSend(scanQueue, &event, 0) != pdTRUE)
+        {
+            sensors[index].stats.dropped++; // The student only sees nothing happen
+        }
+        else
+        {
+            inFlight.push_back({student, attempt, imaged, event.matched});
+        }
+        schedule(millis() + (event.matched ? ATTEND_HOLD_MS : ATTEND_POLL_MS), [index] { captureStep(index); });
+    });
+}
+
+static void scheduleArrivals()
+{
+    double window = options.windowMin * 60.0;
+    size_t count = (size_t)options.students;
+    std::vector<uint16_t> slots;
+    for (size_t i = 1; i <= count; i++)
+    {
+        slots.push_back((uint16_t)i);
+    }
+    std::shuffle(slots.begin(), slots.end(), rng);
+
+    std::vector<double> times;
+    double t = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (options.pattern == "uniform")
+        {
+            times.push_back(uniform(0, window));
+        }
+        else if (options.pattern == "poisson")
+        {
+            t += std::exponential_distribution<double>(count / window)(rng);
+            times.push_back(t);
+        }
+        else
+        {
+            // Triangular, peaking a third of the way in
+            double u = uniform(0, 1);
+            double mode = 1.0 / 3.0;
+            times.push_back(window * (u < mode ? sqrt(u * mode) : 1 - sqrt((1 - u) * (1 - mode))));
+        }
+    }
+    std::sort(times.begin(), times.end());
+
+    students.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Student student;
+        student.number = (uint16_t)i;
+        student.slot = slots[i];
+        student.arrival = msOf(times[i]);
+        students.push_back(student);
+    }
+    for (Student &student : students)
+    {
+        Student *arriving = &student;
+        schedule(dayStart + student.arrival, [arriving] { arrive(arriving); });
+    }
+}
+
+static bool settled()
+{
+    for (const Student &student : students)
+    {
+        if (student.recorded < 0 && !student.gaveUp)
+        {
+            return false;
+        }
+    }
+    return unsyncedRecordCount == 0 && heldRecordCount == 0 && uxQueueMessagesWaiting(scanQueue) == 0;
+}
+
+static void sample(unsigned long interval)
+{
+    printf("sample %lu %u %u %u\n", dayTime(), (unsigned)unsyncedRecordCount, (unsigned)heldRecordCount,
+           (unsigned)uxQueueMessagesWaiting(scanQueue));
+    schedule(millis() + interval, [interval] { sample(interval); });
+}
+
+static bool parseOptions(int argc, char **argv)
+{
+    struct Option
+    {
+        const char *name;
+        double *value;
+    };
+    const Option table[] = {
+        {"--students", &options.students},       {"--window-min", &options.windowMin},
+        {"--horizon-min", &options.horizonMin},  {"--seed", &options.seed},
+        {"--place-s", &options.placeS},          {"--press-s", &options.pressS},
+        {"--image-ms", &options.imageMs},        {"--tz-ms", &options.tzMs},
+        {"--search-base-ms", &options.searchBaseMs}, {"--search-ms-per-100", &options.searchMsPer100},
+        {"--library", &options.library},         {"--miss-rate", &options.missRate},
+        {"--retries", &options.retries},         {"--retry-s", &options.retryS},
+        {"--patience-s", &options.patienceS},    {"--flash-op-ms", &options.flashOpMs},
+        {"--flash-kb-ms", &options.flashKbMs},   {"--wifi-fast-s", &options.wifiFastS},
+        {"--wifi-scan-s", &options.wifiScanS},   {"--sntp-ms", &options.sntpMs},
+        {"--post-s", &options.postS},            {"--uplink-kbps", &options.uplinkKbps},
+        {"--post-fail-rate", &options.postFailRate}, {"--sample-min", &options.sampleMin},
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *name = argv[i];
+        if (strcmp(name, "--verbose") == 0)
+        {
+            verbose = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            fprintf(stderr, "%s needs a value\n", name);
+            return false;
+        }
+        const char *value = argv[++i];
+
+        bool known = false;
+        for (const Option &option : table)
+        {
+            if (strcmp(name, option.name) == 0)
+            {
+                *option.value = atof(value);
+                known = true;
+            }
+        }
+        if (strcmp(name, "--pattern") == 0)
+        {
+            options.pattern = value;
+            known = options.pattern == "uniform" || options.pattern == "poisson" || options.pattern == "rush";
+        }
+        else if (strcmp(name, "--outage") == 0)
+        {
+            // START:END in minutes
+            double start, end;
+            known = sscanf(value, "%lf:%lf", &start, &end) == 2 && end > start;
+            options.outages.push_back({msOf(start * 60), msOf(end * 60)});
+        }
+        if (!known)
+        {
+            fprintf(stderr, "Unknown option or value: %s %s\n", name, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+// setup() of a headless build, trimmed to the modules built here
+static void boot()
+{
+    initArena(opArena, ARENA_PSRAM_BYTES, ARENA_INTERNAL_BYTES);
+    initSPIFFS();
+    loadSyncSettings();
+    loadSearchSettings();
+    initAttendanceIndex();
+    initSyncScheduler();
+    initFingerprint();
+
+    uint16_t library = (uint16_t)max(options.library, options.students);
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        Adafruit_Fingerprint &reader = *sensors[i].finger;
+        reader.capacity = library + 1;
+        for (uint16_t slot = 1; slot <= library; slot++)
+        {
+            reader.enrolled.insert(slot);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (!parseOptions(argc, argv))
+    {
+        return 2;
+    }
+    rng.seed((uint32_t)options.seed);
+    srand((unsigned)options.seed);
+    mockDelayHook = spend;
+
+    printf("day students=%u sensors=%u window_ms=%lu pattern=%s\n", (unsigned)options.students, SENSOR_COUNT,
+           msOf(options.windowMin * 60), options.pattern.c_str());
+    boot();
+
+    // Headless, the reader goes straight into attendance mode
+    dayStart = millis();
+    scheduleArrivals();
+    schedule(dayStart, [] { sample(msOf(options.sampleMin * 60)); });
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        schedule(dayStart, [i] { captureStep(i); });
+    }
+    attendanceMode("");
+
+    // loop(): the session tick runs the attendance tick, which runs the
+    // sync scheduler between scans
+    unsigned long horizon = msOf(options.horizonMin * 60);
+    while (dayTime() < horizon && !settled())
+    {
+        serviceTimeSource();
+        serviceRecordLog();
+        attendTick();
+        chargeFlash(0);
+        delay(LOOP_DELAY_MS);
+    }
+
+    for (const Student &student : students)
+    {
+        printf("student %u %u %lu %ld %ld %ld %u %u\n", student.number, student.slot, student.arrival,
+               student.atSensor, student.imaged, student.recorded, student.attempts, student.gaveUp);
+    }
+    uint32_t dropped = 0;
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++)
+    {
+        dropped += sensors[i].stats.dropped;
+    }
+    printf("search %u %u %u %u\n", (unsigned)searchStats[SEARCH_HOT].searches, (unsigned)searchStats[SEARCH_HOT].hits,
+           (unsigned)fallbacks, (unsigned)searchStats[SEARCH_FULL].searches);
+    printf("end %lu %u %u %u %u\n", dayTime(), (unsigned)unsyncedRecordCount, (unsigned)heldRecordCount,
+           (unsigned)(recordLog.lastSegment - recordLog.firstSegment + 1), (unsigned)dropped);
+    return 0;
+}
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Capacity report for one reader over an attendance day.
+
+Front end for tools/day_sim.cpp, which runs the firmware's own scan, store
+and sync code on the host against test/mocks, in virtual time, with scripted
+students, sensors, flash timings and network. This script builds that
+program (once per sensor count, again whenever a source changes), runs it
+with the options given and turns its event lines into a report: queueing
+delay, scan-to-record latency, syncs and the backlog over time.
+
+Sensor, flash and network timings are assumed values given on the command
+line, so the timings are only as good as those; the firmware's behaviour
+(queueing, duplicate window, hot-set search, commit batching, sync triggers,
+backoff, held records) is the real code's.
+
+    python3 tools/day_sim.py --students 400 --window-min 15
+    python3 tools/day_sim.py --sensors 2 --pattern rush --outage 5:25
+    python3 tools/day_sim.py --miss-rate 0.15 --post-fail-rate 0.2 --seed 7
+"""
+
+import argparse
+import collections
+import glob
+import os
+import subprocess
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+SOURCE = os.path.join(ROOT, "tools", "day_sim.cpp")
+# A headless reader with sync, as deployed; the native test env otherwise
+FLAGS = ["-std=gnu++17", "-O2", "-Itest/mocks", "-Iinclude", "-DFEATURE_BLE_CONSOLE=0", "-DFEATURE_LEDS=0",
+         "-DFEATURE_SERIAL_UI=0", "-DFEATURE_USB_EXPORT=0"]
+
+
+def build(sensors):
+    """Path of the simulator binary, rebuilt if any source is newer."""
+    binary = os.path.join(ROOT, ".pio", "build", "day_sim", "day_sim_%d" % sensors)
+    sources = [SOURCE] + glob.glob(os.path.join(ROOT, "src", "*.cpp")) + \
+        glob.glob(os.path.join(ROOT, "include", "*.h")) + \
+        glob.glob(os.path.join(ROOT, "test", "mocks", "**", "*.h"), recursive=True)
+    if os.path.exists(binary) and os.path.getmtime(binary) >= max(os.path.getmtime(s) for s in sources):
+        return binary
+
+    os.makedirs(os.path.dirname(binary), exist_ok=True)
+    compiler = os.environ.get("CXX", "c++")
+    command = [compiler] + FLAGS + ["-DSENSOR_COUNT=%d" % sensors, "tools/day_sim.cpp", "-o", binary]
+    print("building: %s" % " ".join(command), file=sys.stderr)
+    subprocess.run(command, cwd=ROOT, check=True)
+    return binary
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def summary(values, scale=1.0, unit="s"):
+    if not values:
+        return "n/a"
+    return "p50=%.2f%s p90=%.2f%s p99=%.2f%s max=%.2f%s" % (
+        percentile(values, 50) * scale, unit, percentile(values, 90) * scale, unit,
+        percentile(values, 99) * scale, unit, max(values) * scale, unit)
+
+
+def clock(ms):
+    seconds = int(ms // 1000)
+    return "%02d:%02d" % (seconds // 60, seconds % 60)
+
+
+Student = collections.namedtuple("Student", "number slot arrival at_sensor imaged recorded attempts gave_up")
+Sync = collections.namedtuple("Sync", "start duration result records")
+
+
+def parse(lines):
+    """The simulator's event lines, times in ms from the start of the day."""
+    day = {"info": {}, "students": [], "scans": [], "syncs": [], "samples": []}
+    for line in lines:
+        kind, *fields = line.split()
+        if kind == "day":
+            day["info"].update(field.split("=", 1) for field in fields)
+        elif kind == "student":
+            day["students"].append(Student(*(int(f) for f in fields)))
+        elif kind == "scan":
+            day["scans"].append(tuple(int(f) for f in fields))  # at, sensor, busy ms, slots, matched
+        elif kind == "sync":
+            day["syncs"].append(Sync(int(fields[0]), int(fields[1]), fields[2], int(fields[3])))
+        elif kind == "sample":
+            day["samples"].append(tuple(int(f) for f in fields))  # at, unsynced, held, queued
+        elif kind == "search":
+            day["search"] = tuple(int(f) for f in fields)  # hot searches, hot hits, fallbacks, full searches
+        elif kind == "end":
+            day["end"] = tuple(int(f) for f in fields)  # at, unsynced, held, segments, dropped
+    return day
+
+
+def report(args, day):
+    students = day["students"]
+    recorded = [s for s in students if s.recorded >= 0]
+    queueing = [(s.at_sensor - s.arrival) / 1000.0 for s in students if s.at_sensor >= 0]
+    scan_to_record = [(s.recorded - s.imaged) / 1000.0 for s in recorded]
+    end_to_end = [(s.recorded - s.arrival) / 1000.0 for s in recorded]
+    gave_up = sum(1 for s in students if s.gave_up)
+    waiting = len(students) - len(recorded) - gave_up
+    end, unsynced, held, segments, dropped = day["end"]
+
+    info = day["info"]
+    print("=== %s students, %s arrivals over %.0f min, %s sensor(s) ===" % (
+        info["students"], info["pattern"], args.window_min, info["sensors"]))
+    print("recorded %d, gave up %d, still waiting %d, results lost to a full queue %d" % (
+        len(recorded), gave_up, waiting, dropped))
+    if recorded:
+        print("last record at %s" % clock(max(s.recorded for s in recorded)))
+    print("queueing delay (arrival -> at sensor): %s" % summary(queueing))
+    print("scan-to-record latency:               %s" % summary(scan_to_record, 1000.0, "ms"))
+    print("arrival-to-record:                    %s" % summary(end_to_end))
+
+    hot, hits, fallbacks, full = day["search"]
+    print("sensor time per scan: %s; searches: hot hits %d/%d, fallbacks %d, full %d" % (
+        summary([scan[2] for scan in day["scans"]], 1.0, "ms"), hits, hot, fallbacks, full))
+
+    syncs = day["syncs"]
+    results = collections.Counter(s.result for s in syncs)
+    print("syncs: %d (ok %d, no uplink %d, failed %d), duration %s" % (
+        len(syncs), results["ok"], results["no-uplink"], results["failed"],
+        summary([s.duration / 1000.0 for s in syncs])))
+    for sync in syncs:
+        print("  %s  %6.1f s  %-9s %4d records" % (clock(sync.start), sync.duration / 1000.0, sync.result,
+                                                    sync.records))
+
+    samples = day["samples"]
+    peak = max(samples + [(end, unsynced, held, 0)], key=lambda s: s[1] + s[2])
+    print("backlog: peak %d at %s, %d at the end (%s), %d held for the clock, %d segment(s)" % (
+        peak[1] + peak[2], clock(peak[0]), unsynced, clock(end), held, segments))
+    print("backlog timeline (time, unsynced, held, queued):")
+    for at, backlog, held_then, queued in samples:
+        print("  %s  %5d  %5d  %3d" % (clock(at), backlog, held_then, queued))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    group = parser.add_argument_group("day")
+    group.add_argument("--students", type=int, default=400)
+    group.add_argument("--window-min", type=float, default=15.0, help="arrival window")
+    group.add_argument("--pattern", choices=("uniform", "poisson", "rush"), default="rush",
+                       help="rush peaks a third of the way into the window")
+    group.add_argument("--sensors", type=int, choices=(1, 2), default=1, help="SENSOR_COUNT of the build")
+    group.add_argument("--horizon-min", type=float, default=180.0, help="stop simulating after this")
+    group.add_argument("--seed", type=int, default=1)
+
+    group = parser.add_argument_group("sensor")
+    group.add_argument("--place-s", type=float, default=1.5, help="median time to place a finger")
+    group.add_argument("--press-s", type=float, default=0.8, help="how long a finger stays on the glass")
+    group.add_argument("--image-ms", type=float, default=250.0)
+    group.add_argument("--tz-ms", type=float, default=120.0, help="image2Tz")
+    group.add_argument("--search-base-ms", type=float, default=20.0)
+    group.add_argument("--search-ms-per-100", type=float, default=25.0, help="per 100 templates compared")
+    group.add_argument("--library", type=int, default=127, help="templates on the sensor")
+    group.add_argument("--miss-rate", type=float, default=0.05, help="placements that fail to match")
+    group.add_argument("--retries", type=int, default=3, help="attempts before a student gives up")
+    group.add_argument("--retry-s", type=float, default=1.0, help="after a red LED")
+    group.add_argument("--patience-s", type=float, default=5.0, help="wait for a result before trying again")
+
+    group = parser.add_argument_group("flash and network")
+    group.add_argument("--flash-op-ms", type=float, default=5.0, help="per file open, write, rename or remove")
+    group.add_argument("--flash-kb-ms", type=float, default=10.0, help="per KB written")
+    group.add_argument("--wifi-fast-s", type=float, default=1.2, help="connect via cached AP")
+    group.add_argument("--wifi-scan-s", type=float, default=4.5, help="connect with a full scan")
+    group.add_argument("--sntp-ms", type=float, default=300.0, help="SNTP reply after connecting")
+    group.add_argument("--post-s", type=float, default=2.5, help="server latency per batch")
+    group.add_argument("--uplink-kbps", type=float, default=2000.0)
+    group.add_argument("--post-fail-rate", type=float, default=0.0)
+    group.add_argument("--outage", dest="outages", action="append", default=[],
+                       metavar="START:END", help="uplink down between these minutes (repeatable)")
+    group.add_argument("--sample-min", type=float, default=5.0, help="backlog timeline interval")
+    group.add_argument("--verbose", action="store_true", help="firmware console output on stderr")
+    args = parser.parse_args()
+
+    command = [build(args.sensors)]
+    for name, value in vars(args).items():
+        if name in ("sensors", "outages", "verbose"):
+            continue
+        command += ["--" + name.replace("_", "-"), str(value)]
+    for outage in args.outages:
+        command += ["--outage", outage]
+    if args.verbose:
+        command.append("--verbose")
+
+    result = subprocess.run(command, stdout=subprocess.PIPE, universal_newlines=True, check=True)
+    report(args, parse(result.stdout.splitlines()))
+
+
+if __name__ == "__main__":
+    main()
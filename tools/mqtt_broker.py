@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+"""Local stand-in MQTT broker for the MQTT sync backend.
+
+Speaks the subset of MQTT 3.1.1 the firmware uses (CONNECT/CONNACK with
+persistent sessions, QoS 0/1 PUBLISH/PUBACK, PINGREQ, DISCONNECT) and feeds
+every batch_attendance payload into the same in-memory sheet as
+tools/sync_server.py. Point a reader at it with
+`endpoint mqtt://<this machine>:1883/attendance`.
+
+    python3 tools/mqtt_broker.py --port 1883
+    python3 tools/mqtt_broker.py --drop-ack 0.2 --kick-after 3
+
+--drop-ack withholds a share of PUBACKs and --kick-after closes the
+connection after N publishes. Both exercise the firmware's retry path
+(records stay unsynced and go out again) and session resumption.
+"""
+
+import argparse
+import json
+import random
+import socketserver
+import struct
+import threading
+import time
+
+from sync_server import Sheet
+
+CONNECT, CONNACK, PUBLISH, PUBACK = 1, 2, 3, 4
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+
+class Broker:
+    """Sessions by client ID plus counters; the sheet holds the records."""
+
+    def __init__(self, args):
+        self.args = args
+        self.sheet = Sheet()
+        self.lock = threading.Lock()
+        self.sessions = {}
+        self.connects = 0
+        self.resumed = 0
+        self.publishes = 0
+        self.duplicates = 0
+        self.dropped_acks = 0
+        self.seen = set()
+
+    def connect(self, client_id, clean):
+        with self.lock:
+            self.connects += 1
+            present = not clean and client_id in self.sessions
+            if clean:
+                self.sessions.pop(client_id, None)
+            else:
+                self.sessions.setdefault(client_id, {"messages": 0})
+            self.resumed += 1 if present else 0
+            return present
+
+    def publish(self, client_id, topic, payload):
+        with self.lock:
+            self.publishes += 1
+            if client_id in self.sessions:
+                self.sessions[client_id]["messages"] += 1
+            digest = hash(payload)
+            if digest in self.seen:
+                self.duplicates += 1
+            self.seen.add(digest)
+
+        try:
+            data = json.loads(payload or b"{}")
+        except ValueError:
+            data = {}
+        records = data.get("records") if isinstance(data, dict) else None
+        if data.get("command") != "batch_attendance" or not isinstance(records, list):
+            with self.sheet.lock:
+                self.sheet.errors += 1
+            return 0
+        if isinstance(data.get("health"), dict):
+            with self.sheet.lock:
+                self.sheet.last_health = data["health"]
+        self.sheet.process_batch(data.get("sheet_name", "Attendance"), records)
+        return len(records)
+
+    def stats(self):
+        stats = self.sheet.stats()
+        with self.lock:
+            stats.update({
+                "connects": self.connects,
+                "resumed_sessions": self.resumed,
+                "publishes": self.publishes,
+                "duplicate_batches": self.duplicates,
+                "dropped_acks": self.dropped_acks,
+            })
+        return stats
+
+
+def read_exact(stream, count):
+    data = b""
+    while len(data) < count:
+        chunk = stream.read(count - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def read_packet(stream):
+    header = read_exact(stream, 1)[0]
+    length, shift = 0, 0
+    while True:
+        digit = read_exact(stream, 1)[0]
+        length |= (digit & 0x7F) << shift
+        shift += 7
+        if not digit & 0x80:
+            break
+        if shift > 21:
+            raise ValueError("malformed remaining length")
+    return header >> 4, header & 0x0F, read_exact(stream, length)
+
+
+def read_string(body, offset):
+    (length,) = struct.unpack_from(">H", body, offset)
+    start = offset + 2
+    return body[start:start + length].decode("utf-8", "replace"), start + length
+
+
+def packet(kind, flags, body=b""):
+    length, encoded = len(body), bytearray()
+    while True:
+        digit = length & 0x7F
+        length >>= 7
+        encoded.append(digit | 0x80 if length else digit)
+        if not length:
+            break
+    return bytes([kind << 4 | flags]) + bytes(encoded) + body
+
+
+class ClientHandler(socketserver.StreamRequestHandler):
+    broker = None
+
+    def log(self, message):
+        if not self.broker.args.quiet:
+            print("%s %s" % (self.client_address[0], message), flush=True)
+
+    def handle(self):
+        client_id = None
+        published = 0
+        args = self.broker.args
+        try:
+            while True:
+                kind, flags, body = read_packet(self.rfile)
+                if kind == CONNECT:
+                    _, offset = read_string(body, 0)
+                    level, connect_flags, keepalive = struct.unpack_from(">BBH", body, offset)
+                    client_id, _ = read_string(body, offset + 4)
+                    clean = bool(connect_flags & 0x02)
+                    present = self.broker.connect(client_id, clean)
+                    if keepalive:
+                        self.connection.settimeout(keepalive * 1.5)
+                    self.wfile.write(packet(CONNACK, 0, bytes([1 if present else 0, 0])))
+                    self.log("CONNECT %s level=%d clean=%d keepalive=%ds session=%s"
+                             % (client_id, level, clean, keepalive,
+                                "resumed" if present else "new"))
+                elif kind == PUBLISH:
+                    qos = (flags >> 1) & 0x03
+                    topic, offset = read_string(body, 0)
+                    packet_id = None
+                    if qos > 0:
+                        (packet_id,) = struct.unpack_from(">H", body, offset)
+                        offset += 2
+                    records = self.broker.publish(client_id, topic, body[offset:])
+                    published += 1
+                    self.log("PUBLISH %s qos=%d id=%s %d bytes, %d records"
+                             % (topic, qos, packet_id, len(body) - offset, records))
+                    if args.ack_delay_ms:
+                        time.sleep(args.ack_delay_ms / 1000.0)
+                    if qos == 1:
+                        if random.random() < args.drop_ack:
+                            with self.broker.lock:
+                                self.broker.dropped_acks += 1
+                            self.log("  PUBACK %d withheld" % packet_id)
+                        else:
+                            self.wfile.write(packet(PUBACK, 0, struct.pack(">H", packet_id)))
+                    if args.kick_after and published >= args.kick_after:
+                        self.log("closing connection after %d publishes" % published)
+                        return
+                elif kind == PINGREQ:
+                    self.wfile.write(packet(PINGRESP, 0))
+                elif kind == DISCONNECT:
+                    self.log("DISCONNECT %s" % client_id)
+                    return
+                else:
+                    self.log("ignoring packet type %d" % kind)
+        except (EOFError, ConnectionError, OSError, ValueError, struct.error):
+            self.log("connection closed")
+
+
+class BrokerServer(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+    request_queue_size = 128
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--ack-delay-ms", type=float, default=0.0,
+                        help="artificial delay before each PUBACK")
+    parser.add_argument("--drop-ack", type=float, default=0.0,
+                        help="share of QoS 1 publishes left unacknowledged")
+    parser.add_argument("--kick-after", type=int, default=0,
+                        help="close a connection after this many publishes (0 = never)")
+    parser.add_argument("--seed", type=int, help="random seed for --drop-ack")
+    parser.add_argument("--quiet", action="store_true",
+                        help="do not log each packet")
+    args = parser.parse_args()
+    random.seed(args.seed)
+
+    ClientHandler.broker = Broker(args)
+    server = BrokerServer((args.bind, args.port), ClientHandler)
+    print("MQTT broker stand-in listening on mqtt://%s:%d" % (args.bind, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        print(json.dumps(ClientHandler.broker.stats()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Firmware size per build profile.
+
+Builds every firmware env in platformio.ini (or the ones named; the
+native test env has no image) and reports flash and static RAM use next
+to the first env, taken from the RAM/Flash lines PlatformIO prints after
+linking, plus the size of firmware.bin. RAM here is .data + .bss; heap
+taken at run time (BLE, WiFi) shows up in the firmware's 'heap' and
+'health' commands instead.
+
+    python3 tools/size_report.py
+    python3 tools/size_report.py esp32-s3-devkitc-1 wired --markdown
+"""
+
+import argparse
+import configparser
+import os
+import re
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+USAGE_LINE = re.compile(r"^(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)")
+
+
+def project_envs():
+    config = configparser.ConfigParser(strict=False, interpolation=None)
+    config.read(os.path.join(ROOT, "platformio.ini"))
+    return [section[4:] for section in config.sections()
+            if section.startswith("env:")
+            and config.get(section, "platform", fallback="") != "native"]
+
+
+def build(env, verbose):
+    """Returns {"RAM": (used, total), "Flash": (used, total)} or None."""
+    process = subprocess.run(["pio", "run", "-e", env], cwd=ROOT,
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                             universal_newlines=True)
+    if verbose or process.returncode != 0:
+        sys.stdout.write(process.stdout)
+    if process.returncode != 0:
+        return None
+
+    usage = {}
+    for line in process.stdout.splitlines():
+        match = USAGE_LINE.match(line.strip())
+        if match:
+            usage[match.group(1)] = (int(match.group(2)), int(match.group(3)))
+    return usage
+
+
+def image_size(env):
+    path = os.path.join(ROOT, ".pio", "build", env, "firmware.bin")
+    return os.path.getsize(path) if os.path.exists(path) else 0
+
+
+def delta(value, reference):
+    if reference is None or value == reference:
+        return ""
+    return "%+d" % (value - reference)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("envs", nargs="*",
+                        help="envs to build (default: all, in file order)")
+    parser.add_argument("--markdown", action="store_true",
+                        help="print a Markdown table")
+    parser.add_argument("--verbose", action="store_true",
+                        help="show the build output")
+    args = parser.parse_args()
+
+    envs = args.envs or project_envs()
+    if not envs:
+        print("No envs found in platformio.ini")
+        return 1
+
+    rows = []
+    for env in envs:
+        print("Building %s..." % env, file=sys.stderr)
+        usage = build(env, args.verbose)
+        if usage is None or "RAM" not in usage or "Flash" not in usage:
+            print("Build of %s failed or printed no size summary" % env)
+            return 1
+        rows.append((env, usage["Flash"][0], usage["RAM"][0], image_size(env)))
+
+    reference = rows[0]
+    header = ("env", "flash", "vs " + reference[0], "ram", "vs " + reference[0], "image")
+    lines = []
+    for env, flash, ram, image in rows:
+        lines.append((env, str(flash), delta(flash, reference[1]), str(ram),
+                      delta(ram, reference[2]), str(image)))
+
+    if args.markdown:
+        print("| " + " | ".join(header) + " |")
+        print("|" + "|".join("---" for _ in header) + "|")
+        for line in lines:
+            print("| " + " | ".join(line) + " |")
+    else:
+        widths = [max(len(row[i]) for row in [header] + lines) for i in range(len(header))]
+        for row in [header] + lines:
+            print("  ".join(cell.ljust(width) for cell, width in zip(row, widths)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
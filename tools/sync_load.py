@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Multi-reader sync load test.
+
+Simulates many readers uploading their unsynced backlog at the same time,
+using the same `batch_attendance` payload the firmware builds in
+syncRecords(). Reports per-request latency percentiles and throughput.
+
+    python3 tools/sync_load.py --url http://127.0.0.1:8080/exec \\
+        --readers 40 --backlog 500 --rounds 3
+"""
+
+import argparse
+import json
+import ssl
+import statistics
+import threading
+import time
+import urllib.request
+
+
+def build_payload(reader, backlog, round_no, sheet_name):
+    records = []
+    for i in range(backlog):
+        records.append({
+            "date": "%d/%d" % (1 + (round_no + i // 127) % 28, 1 + reader % 12),
+            "student_id": str(1 + (reader * backlog + i) % 1000),
+            "status": "present",
+        })
+    return json.dumps({
+        "command": "batch_attendance",
+        "sheet_name": sheet_name,
+        "records": records,
+    }).encode()
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+def run_reader(args, reader, results, lock, start_barrier):
+    context = ssl._create_unverified_context() if args.insecure else None
+    start_barrier.wait()
+    for round_no in range(args.rounds):
+        payload = build_payload(reader, args.backlog, round_no, args.sheet)
+        request = urllib.request.Request(
+            args.url, data=payload,
+            headers={"Content-Type": "application/json"})
+        started = time.perf_counter()
+        ok = False
+        try:
+            with urllib.request.urlopen(request, timeout=args.timeout,
+                                        context=context) as response:
+                body = json.loads(response.read() or b"{}")
+                ok = body.get("result") == "success"
+        except Exception:  # noqa: BLE001 - any failure counts as an error
+            ok = False
+        elapsed = time.perf_counter() - started
+        with lock:
+            results.append((elapsed, ok, len(payload)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--url", default="http://127.0.0.1:8080/exec")
+    parser.add_argument("--readers", type=int, default=24)
+    parser.add_argument("--backlog", type=int, default=300,
+                        help="unsynced records per reader per sync")
+    parser.add_argument("--rounds", type=int, default=1,
+                        help="sync attempts per reader")
+    parser.add_argument("--sheet", default="Attendance")
+    parser.add_argument("--timeout", type=float, default=20.0,
+                        help="per-request timeout, matches SYNC_HTTP_TIMEOUT_MS")
+    parser.add_argument("--insecure", action="store_true",
+                        help="skip TLS certificate checks, like setInsecure()")
+    args = parser.parse_args()
+
+    results = []
+    lock = threading.Lock()
+    barrier = threading.Barrier(args.readers + 1)
+    threads = [threading.Thread(target=run_reader,
+                                args=(args, r, results, lock, barrier))
+               for r in range(args.readers)]
+    for thread in threads:
+        thread.start()
+
+    barrier.wait()
+    started = time.perf_counter()
+    for thread in threads:
+        thread.join()
+    wall = time.perf_counter() - started
+
+    latencies = [r[0] * 1000.0 for r in results]
+    succeeded = sum(1 for r in results if r[1])
+    payload_bytes = sum(r[2] for r in results)
+    records = succeeded * args.backlog
+
+    print("readers=%d backlog=%d rounds=%d requests=%d ok=%d failed=%d"
+          % (args.readers, args.backlog, args.rounds, len(results),
+             succeeded, len(results) - succeeded))
+    print("latency ms: min=%.1f p50=%.1f p95=%.1f p99=%.1f max=%.1f mean=%.1f"
+          % (min(latencies), percentile(latencies, 50),
+             percentile(latencies, 95), percentile(latencies, 99),
+             max(latencies), statistics.mean(latencies)))
+    print("throughput: %.1f req/s, %.1f records/s, %.1f KiB/s over %.2f s"
+          % (len(results) / wall, records / wall,
+             payload_bytes / 1024.0 / wall, wall))
+
+
+if __name__ == "__main__":
+    main()
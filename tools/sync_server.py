@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Google Apps Script sync endpoint.
+
+Implements the same `batch_attendance` protocol as appscript.js so readers
+can be pointed at a machine on the LAN (menu option 11) for load testing and
+CI. Records are kept in memory in the same shape as the attendance sheet:
+one row per student, one column per date.
+
+    python3 tools/sync_server.py --port 8080
+    python3 tools/sync_server.py --port 8443 --cert cert.pem --key key.pem
+
+GET /stats returns request/record counters and the health object from the
+last batch, GET /sheet returns the sheet.
+"""
+
+import argparse
+import json
+import ssl
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Sheet:
+    """In-memory equivalent of one attendance sheet."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.dates = []
+        self.students = {}
+        self.requests = 0
+        self.records = 0
+        self.errors = 0
+        self.started = time.time()
+        self.last_health = None
+
+    def process_batch(self, sheet_name, records):
+        results = []
+        with self.lock:
+            self.requests += 1
+            for record in records:
+                student_id = str(record.get("student_id", ""))
+                if not student_id:
+                    results.append({"student_id": student_id, "success": False,
+                                    "error": "missing student_id"})
+                    continue
+                date = record.get("date") or time.strftime("%m/%d/%Y")
+                status = record.get("status") or "present"
+                if date not in self.dates:
+                    self.dates.append(date)
+                self.students.setdefault(student_id, {})[date] = status
+                results.append({"student_id": student_id, "date": date,
+                                "success": True})
+            self.records += len(records)
+        return results
+
+    def stats(self):
+        with self.lock:
+            return {
+                "requests": self.requests,
+                "records": self.records,
+                "errors": self.errors,
+                "students": len(self.students),
+                "dates": len(self.dates),
+                "uptime_s": round(time.time() - self.started, 1),
+                "last_health": self.last_health,
+            }
+
+    def snapshot(self):
+        with self.lock:
+            rows = []
+            for student_id in sorted(self.students, key=_student_sort_key):
+                attended = self.students[student_id]
+                rows.append({
+                    "student_id": student_id,
+                    "attended_days": len(attended),
+                    "dates": dict(attended),
+                })
+            return {"dates": list(self.dates), "rows": rows}
+
+
+class SyncServer(ThreadingHTTPServer):
+    # Many readers connect at once under load; the default backlog of 5 drops them
+    request_queue_size = 128
+    daemon_threads = True
+
+
+def _student_sort_key(student_id):
+    return (0, int(student_id)) if student_id.isdigit() else (1, student_id)
+
+
+class SyncHandler(BaseHTTPRequestHandler):
+    sheet = None
+    delay_s = 0.0
+    quiet = False
+
+    def _send_json(self, code, body):
+        payload = json.dumps(body).encode()
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(payload)))
+        self.end_headers()
+        self.wfile.write(payload)
+
+    def do_GET(self):
+        if self.path == "/stats":
+            self._send_json(200, self.sheet.stats())
+        elif self.path == "/sheet":
+            self._send_json(200, self.sheet.snapshot())
+        else:
+            self._send_json(404, {"result": "error", "message": "Not found"})
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        try:
+            data = json.loads(self.rfile.read(length) or b"{}")
+        except ValueError as error:
+            self._error(str(error))
+            return
+
+        if data.get("command") != "batch_attendance":
+            self._error("Invalid command")
+            return
+
+        records = data.get("records")
+        if not isinstance(records, list) or not records:
+            self._error("No valid records provided")
+            return
+
+        if self.delay_s:
+            time.sleep(self.delay_s)
+
+        health = data.get("health")
+        if isinstance(health, dict):
+            with self.sheet.lock:
+                self.sheet.last_health = health
+
+        results = self.sheet.process_batch(data.get("sheet_name", "Attendance"),
+                                           records)
+        self._send_json(200, {
+            "result": "success",
+            "message": "Successfully processed %d attendance records" % len(records),
+            "details": results,
+        })
+
+    def _error(self, message):
+        with self.sheet.lock:
+            self.sheet.errors += 1
+        # Apps Script answers errors with 200 and a JSON error body
+        self._send_json(200, {"result": "error", "message": message})
+
+    def log_message(self, fmt, *args):
+        if not self.quiet:
+            super().log_message(fmt, *args)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--cert", help="PEM certificate, enables HTTPS")
+    parser.add_argument("--key", help="PEM private key for --cert")
+    parser.add_argument("--delay-ms", type=float, default=0.0,
+                        help="artificial processing delay per batch")
+    parser.add_argument("--quiet", action="store_true",
+                        help="do not log each request")
+    args = parser.parse_args()
+
+    SyncHandler.sheet = Sheet()
+    SyncHandler.delay_s = args.delay_ms / 1000.0
+    SyncHandler.quiet = args.quiet
+
+    server = SyncServer((args.bind, args.port), SyncHandler)
+    scheme = "http"
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+        scheme = "https"
+
+    print("Sync server listening on %s://%s:%d/exec" % (scheme, args.bind, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
+        print(json.dumps(SyncHandler.sheet.stats()))
+
+
+if __name__ == "__main__":
+    main()
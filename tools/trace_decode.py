@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Decode the reader's event trace into a timeline.
+
+Feed it the output of the `trace` command (a serial log or BLE terminal
+capture is fine, other lines are ignored). Events are grouped per boot,
+timestamps are shown in ms since that boot, and slow scans, slow syncs and
+long silent gaps are flagged. The last events before each reset are what the
+reader was doing when it rebooted.
+
+    python3 tools/trace_decode.py capture.log
+    pio device monitor | python3 tools/trace_decode.py --scan-ms 800
+"""
+
+import argparse
+import struct
+import sys
+
+# Mirrors TraceEvent in include/trace.h
+EVENTS = {
+    1: "BOOT",
+    2: "SCAN_START",
+    3: "SCAN_MATCH",
+    4: "SCAN_MISS",
+    5: "FILE_WRITE",
+    6: "SYNC_START",
+    7: "SYNC_POST",
+    8: "SYNC_RESPONSE",
+    9: "SYNC_END",
+    10: "HEAP",
+    11: "WIFI_UP",
+    12: "WIFI_FAIL",
+    13: "WAKE",
+    14: "BLE_CONNECT",
+    15: "BLE_DISCONNECT",
+}
+
+# esp_reset_reason_t
+RESET_REASONS = {
+    0: "unknown", 1: "power-on", 2: "external", 3: "software", 4: "panic",
+    5: "interrupt watchdog", 6: "task watchdog", 7: "other watchdog",
+    8: "deep sleep", 9: "brownout", 10: "SDIO",
+}
+
+SYNC_RESULTS = {0: "ok", 1: "no uplink", 2: "failed"}
+WAKE_CAUSES = {7: "touch", 8: "serial"}
+
+ENTRY = struct.Struct("<IBBH")  # struct TraceEntry
+
+
+def parse_dump(lines):
+    entries = []
+    in_dump = False
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE v1"):
+            entries = []  # Keep only the last dump in the capture
+            in_dump = True
+        elif line == "TRACE END":
+            in_dump = False
+        elif in_dump and line.startswith("T "):
+            raw = bytes.fromhex(line[2:])
+            for offset in range(0, len(raw) - ENTRY.size + 1, ENTRY.size):
+                entries.append(ENTRY.unpack_from(raw, offset))
+    return entries
+
+
+def describe(event, arg8, arg16):
+    name = EVENTS.get(event, "EVENT_%d" % event)
+    if name == "BOOT":
+        return "BOOT #%d (%s reset)" % (arg16, RESET_REASONS.get(arg8, arg8))
+    if name == "SCAN_START":
+        return "SCAN_START sensor %d" % (arg8 + 1)
+    if name == "SCAN_MATCH":
+        return "SCAN_MATCH id=%d confidence=%d" % (arg16, arg8)
+    if name == "SCAN_MISS":
+        return "SCAN_MISS status=0x%02x" % arg8
+    if name == "FILE_WRITE":
+        return "FILE_WRITE %d bytes" % arg16
+    if name == "SYNC_START":
+        return "SYNC_START backlog=%d" % arg16
+    if name == "SYNC_POST":
+        return "SYNC_POST %d records" % arg16
+    if name == "SYNC_RESPONSE":
+        code = arg16 - 0x10000 if arg16 & 0x8000 else arg16
+        return "SYNC_RESPONSE http=%d" % code
+    if name == "SYNC_END":
+        return "SYNC_END %s" % SYNC_RESULTS.get(arg8, arg8)
+    if name == "HEAP":
+        return "HEAP free=%d KB fragmentation=%d%%" % (arg16, arg8)
+    if name in ("WIFI_UP", "WIFI_FAIL"):
+        return "%s after %d ms%s" % (name, arg16, " (cached AP)" if arg8 else "")
+    if name == "WAKE":
+        return "WAKE %s" % WAKE_CAUSES.get(arg8, "cause %d" % arg8)
+    return name
+
+
+def split_boots(entries):
+    """Per-boot lists of (us since boot, event, arg8, arg16), unwrapping the 32-bit clock."""
+    boots = []
+    current = []
+    wraps = 0
+    previous = None
+    for us, event, arg8, arg16 in entries:
+        if EVENTS.get(event) == "BOOT":
+            if current:
+                boots.append(current)
+            current = []
+            wraps = 0
+            previous = None
+        elif previous is not None and us < previous:
+            wraps += 1
+        previous = us
+        current.append((us + (wraps << 32), event, arg8, arg16))
+    if current:
+        boots.append(current)
+    return boots
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="log file (default: stdin)")
+    parser.add_argument("--scan-ms", type=float, default=500.0,
+                        help="flag image-to-result times above this")
+    parser.add_argument("--sync-ms", type=float, default=5000.0,
+                        help="flag POST-to-response times above this")
+    parser.add_argument("--gap-ms", type=float, default=0.0,
+                        help="flag silent gaps above this (0 = off)")
+    parser.add_argument("--tail", type=int, default=10,
+                        help="events shown before each reset in the summary")
+    args = parser.parse_args()
+
+    source = open(args.capture) if args.capture else sys.stdin
+    with source:
+        entries = parse_dump(source)
+    if not entries:
+        print("No trace dump found (run the 'trace' command and capture its output)")
+        return 1
+
+    boots = split_boots(entries)
+    spikes = []
+    for index, boot in enumerate(boots):
+        print("=== Boot segment %d ===" % (index + 1))
+        previous_ms = None
+        scan_start = None
+        post_at = None
+        for us, event, arg8, arg16 in boot:
+            ms = us / 1000.0
+            delta = "" if previous_ms is None else "+%.1f" % (ms - previous_ms)
+            note = ""
+            name = EVENTS.get(event)
+
+            if name == "SCAN_START":
+                scan_start = ms
+            elif name in ("SCAN_MATCH", "SCAN_MISS") and scan_start is not None:
+                took = ms - scan_start
+                note = "scan %.1f ms" % took
+                if took > args.scan_ms:
+                    note += "  <-- slow scan"
+                    spikes.append((index + 1, ms, note))
+                scan_start = None
+            elif name == "SYNC_POST":
+                post_at = ms
+            elif name == "SYNC_RESPONSE" and post_at is not None:
+                took = ms - post_at
+                note = "request %.1f ms" % took
+                if took > args.sync_ms:
+                    note += "  <-- slow sync"
+                    spikes.append((index + 1, ms, note))
+                post_at = None
+
+            if args.gap_ms and previous_ms is not None and ms - previous_ms > args.gap_ms:
+                spikes.append((index + 1, ms, "gap of %.1f ms" % (ms - previous_ms)))
+
+            print(("%12.1f %10s  %-44s %s" % (ms, delta, describe(event, arg8, arg16), note)).rstrip())
+            previous_ms = ms
+
+    print("\n=== Before each reset ===")
+    for index in range(1, len(boots)):
+        boot_event = boots[index][0]
+        reason = RESET_REASONS.get(boot_event[2], boot_event[2]) if EVENTS.get(boot_event[1]) == "BOOT" else "?"
+        print("Segment %d ended with a %s reset; last events:" % (index, reason))
+        for us, event, arg8, arg16 in boots[index - 1][-args.tail:]:
+            print("    %12.1f  %s" % (us / 1000.0, describe(event, arg8, arg16)))
+
+    if spikes:
+        print("\n=== Latency spikes ===")
+        for segment, ms, note in spikes:
+            print("segment %d at %.1f ms: %s" % (segment, ms, note))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+"""Pull the attendance log, roster and template backups over native USB.
+
+Talks to the reader's native USB port (the ESP32-S3's USB Serial/JTAG
+port, not the UART console the monitor uses), requests an export and
+writes every item into a directory, checking each frame's CRC-32 and each
+item's length and CRC-32 against its END frame:
+
+    python3 tools/usb_export.py /dev/ttyACM0 -o term1
+    python3 tools/usb_export.py /dev/ttyACM0 -o term1 --parts records roster
+    python3 tools/usb_export.py --decode capture.bin -o term1
+
+Log segments land as att_NNNNN.csv next to summary.csv, the roster as
+roster.bin plus a readable roster.csv, templates as
+templates/s<sensor>_<slot>.tpl in the sensor's upload format (load them
+back with the sensor's DownChar command). --save keeps the raw stream.
+Uses pyserial when installed, else the tty directly (Linux/macOS).
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = 0x31584541  # "AEX1"
+HEADER = struct.Struct("<IBBHI")
+INFO, BEGIN, DATA, END, DONE, ERROR = range(1, 7)
+KINDS = {1: "segment", 2: "summary", 3: "roster", 4: "template"}
+ROSTER_HEADER = struct.Struct("<IHH")
+ROSTER_ID_MAX, ROSTER_NAME_MAX = 16, 32
+MAX_PAYLOAD = 64 * 1024
+
+
+class ExportError(Exception):
+    pass
+
+
+class TtyPort:
+    """Minimal raw tty, for hosts without pyserial."""
+
+    def __init__(self, path, timeout):
+        import termios
+        import tty
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[6][termios.VMIN] = 0
+        attrs[6][termios.VTIME] = min(255, int(timeout * 10))
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+
+    def write(self, data):
+        os.write(self.fd, data)
+
+    def read(self, count):
+        return os.read(self.fd, count)
+
+    def close(self):
+        os.close(self.fd)
+
+
+def open_port(path, timeout):
+    try:
+        import serial
+    except ImportError:
+        return TtyPort(path, timeout)
+    port = serial.Serial(path, 115200, timeout=timeout)  # Rate is ignored on USB
+    port.reset_input_buffer()
+    return port
+
+
+class Reader:
+    """Buffered reads of exact sizes, optionally teeing to a capture file."""
+
+    def __init__(self, source, save=None):
+        self.source = source
+        self.save = save
+        self.buffer = b""
+        self.total = 0
+
+    def read(self, count):
+        while len(self.buffer) < count:
+            chunk = self.source.read(max(count - len(self.buffer), 16384))
+            if not chunk:
+                raise ExportError("stream ended or timed out after %d bytes" % self.total)
+            if self.save:
+                self.save.write(chunk)
+            self.total += len(chunk)
+            self.buffer += chunk
+        data, self.buffer = self.buffer[:count], self.buffer[count:]
+        return data
+
+
+def read_frame(reader):
+    header = reader.read(HEADER.size)
+    magic, kind, item_kind, item, length = HEADER.unpack(header)
+    if magic != MAGIC:
+        raise ExportError("lost frame sync (magic %08x)" % magic)
+    if length > MAX_PAYLOAD:
+        raise ExportError("frame of %d bytes is too large" % length)
+    payload = reader.read(length)
+    (crc,) = struct.unpack("<I", reader.read(4))
+    if zlib.crc32(header + payload) != crc:
+        raise ExportError("CRC mismatch in frame type %d, item %d" % (kind, item))
+    return kind, item_kind, item, payload
+
+
+def safe_path(out_dir, name):
+    path = os.path.normpath(os.path.join(out_dir, name))
+    if os.path.isabs(name) or not path.startswith(os.path.normpath(out_dir) + os.sep):
+        raise ExportError("refusing item name %r" % name)
+    return path
+
+
+def roster_csv(path):
+    """roster.bin -> roster.csv (slot,student_id,name) for assigned slots."""
+    with open(path, "rb") as source:
+        data = source.read()
+    if len(data) < ROSTER_HEADER.size:
+        return None
+    _, slots, entry_size = ROSTER_HEADER.unpack_from(data)
+    if entry_size < ROSTER_ID_MAX + ROSTER_NAME_MAX:
+        return None
+    target = os.path.splitext(path)[0] + ".csv"
+    with open(target, "w", newline="") as out:
+        writer = csv.writer(out)
+        writer.writerow(["slot", "student_id", "name"])
+        for slot in range(slots):
+            offset = ROSTER_HEADER.size + slot * entry_size
+            entry = data[offset:offset + entry_size]
+            if len(entry) < entry_size:
+                break
+            student = entry[:ROSTER_ID_MAX].split(b"\0")[0].decode("utf-8", "replace")
+            name = entry[ROSTER_ID_MAX:ROSTER_ID_MAX + ROSTER_NAME_MAX].split(b"\0")[0]
+            if student:
+                writer.writerow([slot, student, name.decode("utf-8", "replace")])
+    return target
+
+
+def receive(reader, out_dir, quiet):
+    """Reads one export into out_dir; returns (items, bytes, device ms)."""
+    counts = {}
+    current = None
+    while True:
+        kind, item_kind, item, payload = read_frame(reader)
+        if kind == INFO:
+            with open(os.path.join(out_dir, "info.txt"), "wb") as info:
+                info.write(payload)
+            if not quiet:
+                sys.stdout.write(payload.decode("utf-8", "replace"))
+        elif kind == BEGIN:
+            name = payload.decode("utf-8", "replace")
+            path = safe_path(out_dir, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            current = {"item": item, "name": name, "path": path, "crc": 0, "size": 0,
+                       "file": open(path, "wb")}
+            counts[KINDS.get(item_kind, "other")] = counts.get(KINDS.get(item_kind, "other"), 0) + 1
+        elif kind == DATA:
+            if current is None or current["item"] != item:
+                raise ExportError("data for item %d outside its BEGIN/END" % item)
+            current["file"].write(payload)
+            current["crc"] = zlib.crc32(payload, current["crc"])
+            current["size"] += len(payload)
+        elif kind == END:
+            if current is None or current["item"] != item:
+                raise ExportError("END for unknown item %d" % item)
+            current["file"].close()
+            size, crc = struct.unpack("<II", payload)
+            if size != current["size"] or crc != current["crc"]:
+                raise ExportError("%s: %d bytes crc %08x, device sent %d bytes crc %08x"
+                                  % (current["name"], current["size"], current["crc"], size, crc))
+            if item_kind == 3:
+                roster_csv(current["path"])
+            current = None
+        elif kind == DONE:
+            items, size, device_ms = struct.unpack("<III", payload)
+            if not quiet:
+                print(", ".join("%d %s" % (count, name) for name, count in sorted(counts.items()))
+                      or "nothing to export")
+            return items, size, device_ms
+        elif kind == ERROR:
+            raise ExportError("reader: " + payload.decode("utf-8", "replace"))
+        else:
+            raise ExportError("unknown frame type %d" % kind)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", nargs="?", help="native USB port, e.g. /dev/ttyACM0 or COM5")
+    parser.add_argument("-o", "--out", default="export",
+                        help="directory the items are written to (default: export)")
+    parser.add_argument("--parts", nargs="+", choices=["records", "roster", "templates"],
+                        help="what to export (default: everything)")
+    parser.add_argument("--timeout", type=float, default=5.0,
+                        help="seconds without data before giving up (template uploads are slow)")
+    parser.add_argument("--save", help="also write the raw frame stream to this file")
+    parser.add_argument("--decode", help="decode a stream saved with --save instead of a port")
+    parser.add_argument("--quiet", action="store_true")
+    args = parser.parse_args()
+    if not args.port and not args.decode:
+        parser.error("give a port or --decode")
+
+    os.makedirs(args.out, exist_ok=True)
+    save = open(args.save, "wb") if args.save else None
+    if args.decode:
+        source = open(args.decode, "rb")
+    else:
+        source = open_port(args.port, args.timeout)
+        source.write(("EXPORT %s\n" % " ".join(args.parts or [])).encode())
+
+    start = time.time()
+    try:
+        items, size, device_ms = receive(Reader(source, save), args.out, args.quiet)
+    except ExportError as error:
+        print("Export failed: %s" % error)
+        return 1
+    finally:
+        source.close()
+        if save:
+            save.close()
+
+    elapsed = time.time() - start
+    print("%d items, %d bytes in %.2f s (%.0f KB/s, %d ms on the reader) -> %s"
+          % (items, size, elapsed, size / 1024.0 / elapsed if elapsed > 0 else 0,
+             device_ms, args.out))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())